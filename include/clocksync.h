@@ -0,0 +1,108 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include "misc.h"
+
+namespace razor {
+	// Number of round trip samples kept by a clock sync estimator
+	inline constexpr auto CLOCK_SYNC_WINDOW = 32;
+	
+	// Number of samples needed before a drift is estimated
+	inline constexpr auto CLOCK_SYNC_MIN_SKEW_SAMPLES = 8;
+	
+	// Error assumed of even the lowest round trip sample, from clock resolution and scheduling
+	inline constexpr double CLOCK_SYNC_ERROR_FLOOR = 100'000;
+	
+	// Largest clock drift believed, as a fraction. Quartz clocks drift far less than this.
+	inline constexpr double CLOCK_SYNC_MAX_SKEW = 500e-6;
+	
+	// Number of command arrival margins the lead is steered from
+	inline constexpr auto LEAD_WINDOW = 128;
+	
+	// Fraction of commands the lead lets arrive later than the safety margin
+	inline constexpr auto LEAD_LATE_FRACTION = 0.02f;
+	
+	// Time before their tick that all but LEAD_LATE_FRACTION of commands should arrive by
+	inline constexpr nanotimediff LEAD_SAFETY_MARGIN = 2 * NANOS_PER_MILLI;
+	
+	// Number of margins needed before the controller takes over the lead
+	inline constexpr auto LEAD_MIN_SAMPLES = 16;
+	
+	// Fastest the lead changes, as a fraction of the time passed, so ticks never jump
+	inline constexpr double LEAD_SLEW_RATE = 0.02;
+	
+	// Ticks whose commands' lead is remembered until their margins are reported back
+	inline constexpr auto LEAD_HISTORY_TICKS = 1024;
+	
+	// NTP-style estimator of a remote clock's offset from the local clock. The samples with the
+	// lowest round trips spent the least time in queues, so their offsets are the most accurate.
+	// The offset and drift are fitted to all recent samples weighted by that accuracy, so delay
+	// spikes and asymmetric queueing have next to no effect.
+	class ClockSync {
+	public:
+		struct Sample {
+			nanotime local_time; // local time halfway through the round trip
+			nanotimediff offset; // remote minus local time
+			nanotime round_trip; // excluding the time the remote held the request
+		};
+		
+		std::deque<Sample> samples;
+		nanotimediff offset; // remote minus local time at reference_time
+		double skew; // change of the offset per nanosecond of local time
+		nanotime reference_time;
+		
+		ClockSync();
+		
+		void clear();
+		
+		// takes the local send, remote receive, remote send and local receive times of a request and its reply
+		void addSample(nanotime request_sent, nanotime request_received, nanotime reply_sent, nanotime reply_received);
+		
+		// estimated remote minus local time at a local time
+		nanotimediff offsetAt(nanotime local_time);
+		
+		nanotime minRoundTrip();
+		
+		// round trip that the given fraction of samples are at or under
+		nanotime roundTripPercentile(float fraction);
+		
+	private:
+		void estimate();
+	};
+	
+	// Steers how far ahead of the daemon a slave plays (its lead) from how early its commands
+	// arrive. The target lead puts the LEAD_LATE_FRACTION percentile of arrivals at the safety
+	// margin, and the lead slews toward it at LEAD_SLEW_RATE.
+	class LeadController {
+	public:
+		// arrival margins less the lead they were sent with, so old samples stay comparable
+		std::deque<nanotimediff> margins;
+		nanotimediff lead, target;
+		nanotime last_step;
+		// the lead commands for each tick were sent with, by tick modulo LEAD_HISTORY_TICKS
+		std::vector<std::pair<ticktype, nanotimediff>> sent_leads;
+		
+		LeadController();
+		
+		void clear();
+		
+		// remembers the current lead as the one commands for the tick are sent with
+		void recordLead(ticktype tick_number);
+		
+		// how long before its tick a command arrived, negative if it was late. Margins for ticks
+		// without a recorded lead are dropped.
+		void addMargin(ticktype tick_number, nanotimediff margin);
+		
+		// whether enough margins have arrived to steer the lead
+		bool ready();
+		
+		// slews the lead toward the target for the time since the last step and returns it
+		nanotimediff step(nanotime now);
+	};
+	
+	// Returns 0 on success. Otherwise returns the number of the test that failed.
+	int clockSyncUnitTest();
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <algorithm>
+#include <typeindex>
+#include <unordered_map>
+
+#include "misc.h"
+#include "syncable.h"
+
+namespace razor {
+	// Number of ticks a command buffer can hold, covering both the future ticks commands
+	// may be queued for and the finalized ticks kept for lookups.
+	inline constexpr auto COMMAND_BUFFER_TICKS = 2048;
+	
+	// A command scheduled for a specific tick
+	struct TickCommand {
+		ticktype tick_number;
+		std::string origin; // host and port of the issuing slave, or LOCAL
+		unsigned int seq; // sequence number assigned by the origin
+		std::string command;
+	};
+	
+	// Holds commands by the tick they're requested for until that tick executes. Once a tick
+	// is finalized its commands are in their authoritative order and can no longer change.
+	// Ticks are stored in a ring buffer, so each tick's commands are contiguous.
+	class CommandBuffer {
+	public:
+		CommandBuffer();
+		
+		// returns false if the command's tick was already finalized or has left the buffer
+		bool add(const TickCommand &command);
+		
+		// orders the tick's commands deterministically (by origin then seq) and locks them
+		std::span<const TickCommand> finalize(ticktype tick_number);
+		
+		// stores an already ordered, finalized command list (received from the daemon)
+		void assign(ticktype tick_number, std::vector<TickCommand> &&commands);
+		
+		bool isFinalized(ticktype tick_number);
+		
+		// empty if the tick holds no commands or has left the buffer
+		std::span<const TickCommand> commandsForTick(ticktype tick_number);
+		
+		void clear();
+		
+	private:
+		struct Slot {
+			ticktype tick_number;
+			bool finalized;
+			std::vector<TickCommand> commands;
+		};
+		std::vector<Slot> slots;
+		
+		// returns nullptr if the tick is older than the slot's current tick
+		Slot* slotFor(ticktype tick_number);
+	};
+	
+	// Encoded commands start with this byte, which no text command does, then a varint opcode
+	inline constexpr char COMMAND_OPCODE_MARKER = '\0';
+	
+	// Command types registered with their arguments as a syncable struct, so commands travel as
+	// the marker, a varint opcode and the packed fields rather than console text, and handlers
+	// get the fields decoded straight from the command's bytes. Opcodes are given in the order
+	// types are added, so the daemon and slaves must add the same types in the same order, which
+	// they check by comparing hash() when a slave joins. Text commands still pass through untouched.
+	class CommandRegistry {
+	public:
+		// Adds a command type, returning its opcode. handler may be nullptr for commands that are
+		// only decoded. Adding a type twice throws std::runtime_error.
+		template<Syncable T> unsigned int add(const std::string &name,
+				void (*handler)(const TickCommand&, const T&)=nullptr) {
+			if(this->opcodes.count(typeid(T)) != 0)
+				throw std::runtime_error("Command type already registered");
+			unsigned int opcode = this->entries.size();
+			this->opcodes[typeid(T)] = opcode;
+			this->entries.push_back({name, (void (*)())handler, &CommandRegistry::dispatchAs<T>,
+				&CommandRegistry::validateAs<T>});
+			return opcode;
+		}
+		
+		// Throws std::runtime_error if T wasn't added
+		template<Syncable T> unsigned int opcodeOf() {
+			auto it = this->opcodes.find(typeid(T));
+			if(it == this->opcodes.end())
+				throw std::runtime_error("Command type not registered");
+			return it->second;
+		}
+		
+		template<Syncable T> std::string encode(const T &args) {
+			std::string command;
+			BufferWriter<> out(&command);
+			out.write(COMMAND_OPCODE_MARKER);
+			out.writeVarint(this->opcodeOf<T>());
+			razor::encode(args, out);
+			out.finish();
+			return command;
+		}
+		
+		// Returns false if the command isn't a T or its arguments don't decode exactly
+		template<Syncable T> bool decode(std::string_view command, T* args) {
+			unsigned int opcode;
+			try {
+				BufferReader<> in(command);
+				if(!CommandRegistry::readOpcode(in, &opcode) || opcode != this->opcodeOf<T>())
+					return false;
+				razor::decode(args, in);
+				return in.remaining() == 0;
+			} catch(std::range_error &e) {
+				return false;
+			}
+		}
+		
+		static bool isEncoded(std::string_view command);
+		
+		// The opcode's name, or empty for opcodes that weren't added
+		const std::string& name(unsigned int opcode);
+		
+		// Calls an encoded command's handler with its decoded arguments. Returns false for text
+		// commands, unknown opcodes, malformed arguments and types without a handler.
+		bool dispatch(const TickCommand &command);
+		
+		// Whether the command is text, or has a known opcode and arguments that decode exactly, so
+		// daemons can drop malformed commands before they reach other slaves
+		bool validate(std::string_view command);
+		
+		void clear();
+		
+		// A hash of the added names in opcode order
+		unsigned long long hash();
+		
+	private:
+		struct Entry {
+			std::string name;
+			void (*handler)(); // a void (*)(const TickCommand&, const T&) for the entry's T
+			bool (*dispatch)(void (*handler)(), const TickCommand &command, BufferReader<> &in);
+			bool (*validate)(BufferReader<> &in);
+		};
+		std::vector<Entry> entries;
+		std::unordered_map<std::type_index, unsigned int> opcodes;
+		
+		static bool readOpcode(BufferReader<> &in, unsigned int* opcode);
+		
+		template<Syncable T> static bool dispatchAs(void (*handler)(), const TickCommand &command, BufferReader<> &in) {
+			T args = {};
+			razor::decode(&args, in);
+			if(in.remaining() != 0 || handler == nullptr)
+				return false;
+			((void (*)(const TickCommand&, const T&))handler)(command, args);
+			return true;
+		}
+		
+		template<Syncable T> static bool validateAs(BufferReader<> &in) {
+			T args = {};
+			razor::decode(&args, in);
+			return in.remaining() == 0;
+		}
+	};
+	
+	int commandsUnitTest();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "serialization.h"
+
+namespace razor {
+	// Fast LZ77 compression in the LZ4 block format: sequences of a token, literals, a 2 byte
+	// offset back into the data and a match length. Matches are found through a hash table of
+	// the last position each 4 byte sequence was seen at, with no entropy coding, so compressing
+	// runs at hundreds of MB/s and decompressing is little more than copying.
+	
+	// Shortest match, and the log2 of the hash table's entries
+	inline constexpr auto COMPRESSION_MIN_MATCH = 4;
+	inline constexpr auto COMPRESSION_HASH_LOG = 12;
+	
+	// Furthest back a match can be, which is also the most of a dictionary that is used
+	inline constexpr auto COMPRESSION_WINDOW = 65535;
+	
+	// As in LZ4, the last match starts at least 12 bytes before the end and the last 5 bytes are
+	// always literals, so decoders can copy in whole words near the end
+	inline constexpr auto COMPRESSION_MF_LIMIT = 12;
+	inline constexpr auto COMPRESSION_LAST_LITERALS = 5;
+	
+	// Most bytes compress writes for length bytes of input
+	size_t compressBound(size_t length);
+	
+	// Replaces output with the compressed input. A dictionary, such as a typical state, primes
+	// the window so even the start of the input can match it. Decompressing needs the same one.
+	void compress(std::string_view input, std::string* output, std::string_view dictionary={});
+	
+	// Replaces output with the decompressed input, which must decompress to exactly length bytes.
+	// Throws std::range_error if it doesn't or is malformed.
+	void decompress(std::string_view input, size_t length, std::string* output, std::string_view dictionary={});
+	
+	int compressionUnitTest();
+}
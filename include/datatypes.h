@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <span>
+
+#include "serialization.h"
+
+namespace razor {
+	// Plain value types shared by Razor's spatial modules and applications
+	struct Vector3 {
+		float x, y, z;
+	};
+	
+	struct Quaternion {
+		float x, y, z, w;
+	};
+	
+	// Row-major, transforming column vectors, so m[row * 4 + column] and the translation is
+	// m[3], m[7] and m[11]
+	struct Matrix44 {
+		float m[16];
+	};
+	
+	// Values quantized together on the stack by the batch encoders
+	inline constexpr auto ENCODE_BATCH = 256;
+	
+	// Bits per component of a smallest-three quaternion. With the 2 bit index, 9 bits packs a
+	// quaternion into 29 bits and 10 bits into 32.
+	inline constexpr auto QUATERNION_COMPONENT_BITS = 9;
+	
+	// Fixed-point quantization of floats from min to max into bits. Values outside the range are
+	// clamped to it, NaN to min, and the rest round to the nearest of its 2^bits evenly spaced steps.
+	struct Quantization {
+		float min, max;
+		unsigned int bits; // 1 to 32
+		
+		unsigned int quantize(float value) const;
+		float dequantize(unsigned int value) const;
+		
+		// the largest error after rounding, half a step
+		float precision() const;
+	};
+	
+	// The fewest bits that cover min to max at steps no coarser than twice precision, so every
+	// value decodes to within precision of itself
+	Quantization quantizationFor(float min, float max, float precision);
+	
+	void writeFloat(BitWriter &out, float value, const Quantization &quantization);
+	float readFloat(BitReader &in, const Quantization &quantization);
+	
+	void writeVector3(BitWriter &out, const Vector3 &value, const Quantization &quantization);
+	Vector3 readVector3(BitReader &in, const Quantization &quantization);
+	
+	// Writes a rotation as the index of its largest component and the other three, which lie
+	// within +-1/sqrt(2). The largest is rebuilt from them, the quaternion being unit length, and
+	// the sign is made positive since q and -q are the same rotation. Quaternions needn't be
+	// normalized beforehand.
+	void writeQuaternion(BitWriter &out, const Quaternion &value, unsigned int component_bits = QUATERNION_COMPONENT_BITS);
+	Quaternion readQuaternion(BitReader &in, unsigned int component_bits = QUATERNION_COMPONENT_BITS);
+	
+	// Batch forms of writeVector3 and readVector3 for arrays of entities, in the same format.
+	// Values are quantized with the widest SIMD kernels the CPU has, then packed together. The
+	// kernels work in float rather than double, so a value can land a step from where
+	// writeVector3 puts it, though every SIMD level gives the same bits.
+	void encodePositions(std::span<const Vector3> values, const Quantization &quantization, BitWriter &out);
+	void decodePositions(BitReader &in, const Quantization &quantization, std::span<Vector3> out);
+	
+	// Batch forms of writeQuaternion and readQuaternion, likewise
+	void encodeQuaternions(std::span<const Quaternion> values, BitWriter &out,
+		unsigned int component_bits = QUATERNION_COMPONENT_BITS);
+	void decodeQuaternions(BitReader &in, std::span<Quaternion> out,
+		unsigned int component_bits = QUATERNION_COMPONENT_BITS);
+	
+	// The matrix that scales points per axis, then rotates them, then translates them
+	Matrix44 composeTransform(const Vector3 &position, const Quaternion &rotation, const Vector3 &scale);
+	
+	// Splits an affine matrix back into its translation, rotation and scale. Shear and projection
+	// aren't representable, and mirrored matrices come out with a negative x scale.
+	void decomposeTransform(const Matrix44 &matrix, Vector3 *position, Quaternion *rotation, Vector3 *scale);
+	
+	// Writes an affine matrix as its quantized translation, smallest-three rotation and quantized
+	// scale, rather than 16 floats
+	void writeMatrix44(BitWriter &out, const Matrix44 &value, const Quantization &position,
+		const Quantization &scale, unsigned int rotation_bits = QUATERNION_COMPONENT_BITS);
+	Matrix44 readMatrix44(BitReader &in, const Quantization &position, const Quantization &scale,
+		unsigned int rotation_bits = QUATERNION_COMPONENT_BITS);
+	
+	int datatypesUnitTest();
+}
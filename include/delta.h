@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "serialization.h"
+#include "simd.h"
+
+namespace razor {
+	// Equal bytes that end a changed run. Shorter stretches cost more as a new run's header than
+	// as part of the run.
+	inline constexpr auto DELTA_MIN_MATCH = 8;
+	
+	// Byte-level deltas between two versions of an opaque state. The delta is the state's length
+	// as a varint, then runs of a varint gap of unchanged bytes, a varint length and that many
+	// bytes of the state XORed with the baseline. Matching stretches are skipped with the SIMD
+	// firstDifference and runs are XORed with xorBuffers, in both directions. Bytes past the end
+	// of the baseline are compared against zeroes.
+	
+	// Writes the delta that turns baseline into state
+	void diffState(std::string_view baseline, std::string_view state, std::string* delta);
+	
+	// Applies a delta to the baseline it was made against, into state, which must not be the
+	// baseline's storage. Throws std::range_error if the delta is malformed.
+	void patchState(std::string_view baseline, std::string_view delta, std::string* state);
+	
+	int deltaUnitTest();
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <bit>
+#include <vector>
+#include <cstring>
+#include <type_traits>
+
+#include "serialization.h"
+#include "simd.h"
+
+namespace razor {
+	// identifies a stored entity: its slot in the low 32 bits and the slot's generation in the
+	// upper 32, so handles to destroyed entities are rejected. 0 is never a valid handle.
+	typedef unsigned long long entityhandle;
+	
+	inline constexpr entityhandle NO_ENTITY = 0;
+	
+	// Most entities a store holds, which bounds what a change message from the network can create
+	inline constexpr auto ENTITY_STORE_MAX_ENTITIES = 1 << 20;
+	
+	// Slots allocated the first time an entity is created, doubled as the store fills
+	inline constexpr auto ENTITY_STORE_INITIAL_CAPACITY = 256;
+	
+	// Replicated entity state kept as a structure of arrays. Each field registered with addField
+	// is one contiguous array of fixed-size values indexed by slot, and has a dirty bitmask with
+	// a bit per slot that setters set when they change a value. A summary mask, with a bit per
+	// word of the dirty mask, lets a scan skip whole clean stretches, so walking the changes costs
+	// in proportion to how many there are rather than how many entities exist.
+	//
+	// The daemon writes the changes since the last clearDirty() with writeChanges, and a full copy
+	// with writeSnapshot, and slaves apply them to their own store registered with the same fields
+	// in the same order. Applying marks what changed dirty on the slave, so the application can
+	// walk the updates the same way before clearing them.
+	class EntityStore {
+	public:
+		struct Field {
+			unsigned int size;
+			std::vector<char> values; // size bytes per slot
+			std::vector<unsigned long long> dirty; // a bit per slot
+			std::vector<unsigned long long> summary; // a bit per word of dirty that isn't zero
+			unsigned int dirty_count;
+		};
+		
+		std::vector<Field> fields;
+		std::vector<unsigned int> generations; // of each slot's current or last entity
+		std::vector<unsigned long long> live; // a bit per slot with an entity
+		std::vector<unsigned int> free_slots;
+		unsigned int capacity, slots, count; // slots ever used, entities alive
+		// since the last clearDirty, for writeChanges
+		std::vector<entityhandle> created, destroyed;
+		
+		EntityStore();
+		
+		// Removes every entity and field
+		void clear();
+		
+		// Adds a field of size bytes, returning its index. Fields can only be added before the first
+		// entity is created, and throws std::runtime_error after.
+		unsigned int addField(unsigned int size);
+		
+		template<class T> unsigned int addField() {
+			static_assert(std::is_trivially_copyable_v<T>, "Entity fields are copied as their bytes");
+			return this->addField(sizeof(T));
+		}
+		
+		// A new entity, with every field zero and dirty. Throws std::runtime_error when full.
+		entityhandle create();
+		// Creates the entity with this exact handle, as a slave mirrors the daemon's entities,
+		// replacing whatever held the slot. Throws std::range_error for slots beyond the maximum.
+		void createAt(entityhandle handle);
+		// returns false if the entity was already destroyed
+		bool destroy(entityhandle handle);
+		bool alive(entityhandle handle);
+		unsigned int size();
+		
+		// The handle of the entity in a slot, or NO_ENTITY
+		entityhandle handleAt(unsigned int slot);
+		
+		// Calls f(handle) for each entity, in slot order
+		template<class F> void forEach(F f) {
+			this->forEachBit(this->live, [&](unsigned int slot) {
+				f(this->handleAt(slot));
+			});
+		}
+		
+		// The field's value. Throws std::range_error for dead handles or the wrong size of T.
+		template<class T> T get(entityhandle handle, unsigned int field) {
+			T value;
+			std::memcpy(&value, this->value(handle, field, sizeof(T)), sizeof(T));
+			return value;
+		}
+		
+		// Sets the field, marking it dirty if the value changed. Throws as get does.
+		template<class T> void set(entityhandle handle, unsigned int field, const T &value) {
+			static_assert(std::is_trivially_copyable_v<T>, "Entity fields are copied as their bytes");
+			this->setBytes(handle, field, &value, sizeof(T));
+		}
+		
+		void setBytes(entityhandle handle, unsigned int field, const void* value, unsigned int size);
+		
+		// A field's values for every slot, for processing a field in bulk, valid until the store
+		// grows. Slots without an entity hold zeroes. Writing through it bypasses the dirty masks,
+		// so call markDirty for changes.
+		template<class T> T* column(unsigned int field) {
+			if(field >= this->fields.size() || this->fields[field].size != sizeof(T))
+				throw std::range_error("EntityStore column of the wrong field size");
+			return (T*)this->fields[field].values.data();
+		}
+		
+		void markDirty(entityhandle handle, unsigned int field);
+		bool dirty(entityhandle handle, unsigned int field);
+		unsigned int dirtyCount(unsigned int field);
+		
+		// Calls f(handle) for each entity with the field dirty, in slot order
+		template<class F> void forEachDirty(unsigned int field, F f) {
+			this->forEachBit(this->fields.at(field).dirty, this->fields[field].summary, [&](unsigned int slot) {
+				f(this->handleAt(slot));
+			});
+		}
+		
+		// Clears the dirty masks and the created and destroyed lists, touching only dirty words
+		void clearDirty();
+		
+		// Whether anything was created, destroyed or changed since the last clearDirty
+		bool changed();
+		
+		// Writes the entities destroyed and created and the dirty fields since the last clearDirty:
+		// a varint count and the handles for each list, then for each field a varint count of
+		// dirty entities, each a varint slot gap and the value's bytes
+		void writeChanges(BufferWriter<> &out);
+		// Throws std::range_error if the data is malformed or for a store with other fields. Values
+		// for entities the store doesn't have, such as from before a lost creation, are skipped.
+		void readChanges(BufferReader<> &in);
+		
+		// Writes the field sizes, every entity's handle, then each field's values for all of them
+		void writeSnapshot(BufferWriter<> &out);
+		// Replaces the store's entities with the snapshot's. Throws as readChanges does.
+		void readSnapshot(BufferReader<> &in);
+	
+	private:
+		Field* find(entityhandle handle, unsigned int field);
+		char* value(entityhandle handle, unsigned int field, unsigned int size);
+		void grow(unsigned int slots);
+		void mark(Field &f, unsigned int slot);
+		void unmark(Field &f, unsigned int slot);
+		void place(unsigned int slot, unsigned int generation, bool record);
+		void remove(unsigned int slot, bool record);
+		void readFields(BufferReader<> &in);
+		
+		template<class F> static void forEachBit(const std::vector<unsigned long long> &bits, F f) {
+			for(size_t word=0; word<bits.size(); word++) {
+				for(auto w = bits[word]; w != 0; w &= w - 1)
+					f(word * 64 + std::countr_zero(w));
+			}
+		}
+		
+		// Finds the dirty words through the summary, skipping clear stretches with firstNonZero
+		template<class F> static void forEachBit(const std::vector<unsigned long long> &bits,
+				const std::vector<unsigned long long> &summary, F f) {
+			size_t count = summary.size();
+			for(size_t s = firstNonZero(summary.data(), count); s < count;
+					s += 1 + firstNonZero(summary.data() + s + 1, count - s - 1)) {
+				for(auto sw = summary[s]; sw != 0; sw &= sw - 1) {
+					size_t word = s * 64 + std::countr_zero(sw);
+					for(auto w = bits[word]; w != 0; w &= w - 1)
+						f(word * 64 + std::countr_zero(w));
+				}
+			}
+		}
+	};
+	
+	int entityStoreUnitTest();
+}
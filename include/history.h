@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <span>
+#include <cmath>
+#include <algorithm>
+
+#include "misc.h"
+#include "datatypes.h"
+
+namespace razor {
+	// Default number of ticks of transforms kept
+	inline constexpr auto HISTORY_TICKS = 64;
+	
+	// Default number of entity columns allocated up front
+	inline constexpr auto HISTORY_INITIAL_ENTITIES = 256;
+	
+	// A ring buffer of registered entities' transforms over the last ticks, for rewinding the
+	// world to what a client saw when validating its hits. Each component is stored as its own
+	// array with one row per tick and one column per entity, so a query at a tick reads two
+	// contiguous rows.
+	class TransformHistory {
+	public:
+		struct RaycastHit {
+			unsigned int id;
+			float distance;
+		};
+		
+		unsigned int ticks; // rows in the ring
+		unsigned int columns; // entity columns allocated per row
+		
+		std::unordered_map<unsigned int, unsigned int> entity_columns;
+		std::vector<unsigned int> column_ids;
+		std::vector<unsigned int> free_columns;
+		// per column bounding box half extents, used by raycasts and overlaps
+		std::vector<float> extent_x, extent_y, extent_z;
+		
+		// per row tick number, and per row and column components
+		std::vector<ticktype> row_ticks;
+		std::vector<bool> row_valid;
+		std::vector<float> position_x, position_y, position_z;
+		std::vector<float> rotation_x, rotation_y, rotation_z, rotation_w;
+		std::vector<unsigned char> recorded;
+		
+		TransformHistory(unsigned int ticks=HISTORY_TICKS);
+		
+		void add(unsigned int id, const Vector3 &half_extents);
+		void remove(unsigned int id);
+		bool contains(unsigned int id);
+		void clear();
+		
+		// Starts the row of a tick. Entities not recorded in it have no transform at that tick.
+		void beginTick(ticktype tick_number);
+		// records an entity's transform in the row of the last beginTick
+		void record(unsigned int id, const Vector3 &position, const Quaternion &rotation);
+		
+		// Transform fraction of the way from tick_number to the next tick. Returns false if the
+		// entity wasn't recorded at both ticks (at just tick_number when fraction is 0).
+		bool sample(ticktype tick_number, float fraction, unsigned int id, Vector3* position, Quaternion* rotation=nullptr);
+		
+		// Positions of several entities. Returns how many were found; the rest are left unchanged.
+		unsigned int samplePositions(ticktype tick_number, float fraction,
+				std::span<const unsigned int> ids, Vector3* positions, bool* found);
+		
+		// appends the entities whose boxes a ray hits within max_distance, nearest first
+		void raycast(ticktype tick_number, float fraction, const Vector3 &origin, const Vector3 &direction,
+				float max_distance, std::vector<RaycastHit>* hits);
+		
+		// appends the entities whose boxes overlap an axis aligned box
+		void overlapBox(ticktype tick_number, float fraction, const Vector3 &min, const Vector3 &max,
+				std::vector<unsigned int>* ids);
+		
+	private:
+		ticktype current_tick;
+		unsigned int current_row;
+		
+		bool rowFor(ticktype tick_number, unsigned int* row);
+		bool interpolationRows(ticktype tick_number, float fraction, unsigned int* row_a, unsigned int* row_b);
+		void growColumns();
+		template <typename F> void forEachInterpolated(unsigned int row_a, unsigned int row_b, float fraction, F f);
+	};
+	
+	int historyUnitTest();
+}
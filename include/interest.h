@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include <algorithm>
+
+namespace razor {
+	// Default edge length of a cell in the interest grid, in world units
+	inline constexpr float INTEREST_CELL_SIZE = 64.0f;
+	
+	// A registry of syncable objects indexed in a uniform spatial hash grid, so the objects
+	// near a point can be found without visiting the whole world. Global objects (game rules,
+	// scores, ...) have no position and are relevant to everyone.
+	class InterestGrid {
+	public:
+		struct Entry {
+			float x, y, z;
+			bool global;
+			long long cell; // key of the cell holding the object
+			unsigned int cell_index; // position within the cell's id list
+		};
+		
+		float cell_size;
+		std::unordered_map<unsigned int, Entry> objects;
+		std::unordered_map<long long, std::vector<unsigned int>> cells;
+		std::vector<unsigned int> global_objects;
+		
+		InterestGrid(float cell_size=INTEREST_CELL_SIZE);
+		
+		void add(unsigned int id, float x, float y, float z);
+		void addGlobal(unsigned int id);
+		void move(unsigned int id, float x, float y, float z);
+		void remove(unsigned int id);
+		bool contains(unsigned int id);
+		void clear();
+		
+		// appends the ids of positioned objects within radius of a point
+		void query(float x, float y, float z, float radius, std::vector<unsigned int>* out);
+		
+	private:
+		long long cellKey(int cx, int cy, int cz);
+		int cellCoordinate(float v);
+		void insertIntoCell(unsigned int id, Entry* entry);
+		void removeFromCell(Entry* entry);
+	};
+	
+	int interestUnitTest();
+}
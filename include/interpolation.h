@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <span>
+#include <cmath>
+#include <algorithm>
+
+#include "misc.h"
+#include "datatypes.h"
+
+namespace razor {
+	// Default number of received samples kept per entity
+	inline constexpr auto INTERPOLATION_SAMPLES = 8;
+	
+	// Default number of entity slots allocated up front
+	inline constexpr auto INTERPOLATION_INITIAL_ENTITIES = 256;
+	
+	// Default furthest a sample is extrapolated past the newest one
+	inline constexpr nanotime INTERPOLATION_MAX_EXTRAPOLATION = 100 * NANOS_PER_MILLI;
+	
+	// Entities sampled together on the stack by samplePositions
+	inline constexpr auto INTERPOLATION_BATCH = 64;
+	
+	enum InterpolationMode {
+		INTERPOLATE_LINEAR,
+		INTERPOLATE_HERMITE // cubic through the samples' velocities
+	};
+	
+	enum SampleResult {
+		SAMPLE_MISSING,
+		SAMPLE_INTERPOLATED, // includes render times before the oldest sample, which hold it
+		SAMPLE_EXTRAPOLATED
+	};
+	
+	// Short per-entity histories of transforms received from the daemon, for rendering remote
+	// entities smoothly a little in the past. Every entity slot has room for a fixed number of
+	// samples in flat per-component arrays, so pushing and sampling never allocate once the
+	// entities are added.
+	class InterpolationBuffer {
+	public:
+		unsigned int samples; // samples per entity slot
+		unsigned int slots; // entity slots allocated
+		InterpolationMode mode;
+		nanotime max_extrapolation;
+		
+		std::unordered_map<unsigned int, unsigned int> entity_slots;
+		std::vector<unsigned int> free_slots;
+		unsigned int used_slots;
+		
+		// per slot, the index of its newest sample and how many it holds
+		std::vector<unsigned int> newest;
+		std::vector<unsigned int> count;
+		// per slot and sample, at slot * samples + index
+		std::vector<nanotime> times;
+		std::vector<float> position_x, position_y, position_z;
+		std::vector<float> velocity_x, velocity_y, velocity_z;
+		std::vector<float> rotation_x, rotation_y, rotation_z, rotation_w;
+		
+		InterpolationBuffer(unsigned int samples=INTERPOLATION_SAMPLES, InterpolationMode mode=INTERPOLATE_LINEAR);
+		
+		void add(unsigned int id);
+		void remove(unsigned int id);
+		bool contains(unsigned int id);
+		void clear();
+		
+		// Adds a sample newer than the entity's others; older ones are ignored. Without a velocity
+		// it is estimated from the previous sample.
+		void push(unsigned int id, nanotime time, const Vector3 &position, const Quaternion &rotation,
+				const Vector3* velocity=nullptr);
+		
+		// Transform at render_time, interpolating between the samples around it with mode for
+		// positions and slerp for rotations, or extrapolating up to max_extrapolation past the newest
+		SampleResult sample(unsigned int id, nanotime render_time, Vector3* position, Quaternion* rotation=nullptr);
+		
+		// Positions of several entities at once. Returns how many were found; the rest are left unchanged.
+		unsigned int samplePositions(nanotime render_time, std::span<const unsigned int> ids,
+				Vector3* positions, bool* found);
+		
+	private:
+		void growSlots();
+		// Finds the samples to blend for render_time: how far from a to b it is, the seconds between
+		// them, and for extrapolation (where b == a) the seconds past a
+		SampleResult bracket(unsigned int slot, nanotime render_time, unsigned int* a, unsigned int* b,
+				float* t, float* span, float* extrapolation);
+	};
+	
+	Quaternion slerp(const Quaternion &a, const Quaternion &b, float t);
+	
+	int interpolationUnitTest();
+}
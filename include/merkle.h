@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "serialization.h"
+
+namespace razor {
+	// Number of bytes of state covered by each leaf of a Merkle tree
+	inline constexpr auto MERKLE_CHUNK_SIZE = 256;
+	
+	// Number of tree levels descended per repair request
+	inline constexpr auto MERKLE_DESCENT_LEVELS = 4;
+	
+	// A binary hash tree over fixed-size chunks of serialized state. Level 0 holds the
+	// leaf (chunk) hashes and the last level holds the root. Node (level, index) has the
+	// children (level-1, 2*index) and (level-1, 2*index+1).
+	class MerkleTree {
+	public:
+		std::vector<std::vector<unsigned long long>> levels;
+		unsigned int length; // bytes of data the tree was built from
+		
+		MerkleTree();
+		
+		void build(const void* data, unsigned int length);
+		void clear();
+		
+		unsigned long long root();
+		unsigned int depth();
+		unsigned int leafCount();
+		
+		// hash of a node, or 0 if it doesn't exist
+		unsigned long long node(unsigned int level, unsigned int index);
+		
+		// the range [first, last) of a node's descendants on a lower level
+		void descendants(unsigned int level, unsigned int index, unsigned int target_level,
+				unsigned int* first, unsigned int* last);
+	};
+	
+	int merkleUnitTest();
+}
@@ -9,6 +9,8 @@
 namespace razor {
 	typedef unsigned long long int nanotime;
 	typedef unsigned int millitime;
+	typedef unsigned long long int ticktype;
+	typedef long long int nanotimediff;
 	inline constexpr nanotime NANOS_PER_MILLI = 1'000'000ULL;
 	inline constexpr nanotime NANOS_PER_SECOND = 1'000'000'000ULL;
 	
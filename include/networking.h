@@ -6,6 +6,7 @@
 #include <deque>
 #include <unordered_map>
 #include <iostream>
+#include <algorithm>
 #include <SDL2/SDL_net.h>
 
 #include "serialization.h"
@@ -17,6 +18,30 @@ namespace razor {
 	inline constexpr auto PACKET_SEGMENT_MAX_SIZE = PACKET_MAX_SIZE-12;
 	inline constexpr auto ANY_ADDRESS = "ANY";
 	
+	// Send lanes in priority order. Queued datagrams of a higher lane are always sent first,
+	// so bulk transfers are interrupted between fragments by timing-sensitive messages.
+	enum SendLanes {
+		SEND_LANE_CONTROL,
+		SEND_LANE_COMMANDS,
+		SEND_LANE_EVENTS,
+		SEND_LANE_BULK,
+		SEND_LANE_COUNT
+	};
+	
+	// Pacing. Rates are in bytes per second.
+	inline constexpr double PACING_INITIAL_RATE = 64 * 1024;
+	inline constexpr double PACING_MIN_RATE = 8 * 1024;
+	inline constexpr double PACING_MAX_RATE = 16 * 1024 * 1024;
+	// bytes a remote may send in a burst after being idle
+	inline constexpr double PACING_BURST = 8 * PACKET_MAX_SIZE;
+	// bytes queued for a remote after which further sends are refused. A larger message is still
+	// accepted when nothing is queued, so it waits for the rate instead of never being sent.
+	inline constexpr auto PACING_MAX_QUEUED = 1024 * 1024;
+	// queueing delay the congestion controller aims for, as LEDBAT's target
+	inline constexpr nanotime PACING_TARGET_DELAY = 25 * NANOS_PER_MILLI;
+	// fraction of the rate changed per delay sample at the furthest from the target
+	inline constexpr double PACING_GAIN = 0.25;
+	
 	// Razor's packet
 	// Structure:
 	// - ID 4 bytes
@@ -38,6 +63,8 @@ namespace razor {
 		~Packet();
 		void freeSegments();
 		void assignID();
+		// reserves count consecutive ids and returns the first
+		static unsigned int reserveIDs(unsigned int count);
 		unsigned short length();
 		unsigned char num_segments();
 		void addSegment(const void* data, unsigned short length);
@@ -59,6 +86,7 @@ namespace razor {
 		struct DirectedMessage {
 			std::string host_and_port;
 			std::string message;
+			nanotime timestamp; // local time the message's last datagram was read from the socket
 		};
 		std::deque<DirectedMessage> received_messages;
 		
@@ -68,6 +96,29 @@ namespace razor {
 		// log file for recording packet data for analysis
 		std::FILE* log_file;
 		
+		// Pacing. When enabled, datagrams are queued per remote and released by token buckets. Each
+		// remote's rate follows its round trip delay and loss, bounded by a per-remote and global ceiling.
+		struct QueuedPacket {
+			int channel;
+			unsigned int id;
+			unsigned char multipart_total, multipart_index;
+			std::string message_part;
+		};
+		struct Pacer {
+			double rate, tokens;
+			nanotime last_refill;
+			// lowest round trip seen, taken as the delay without queueing
+			nanotime base_delay;
+			unsigned int queued_bytes;
+			std::deque<QueuedPacket> lanes[SEND_LANE_COUNT];
+		};
+		bool pacing;
+		// 0 is unlimited
+		unsigned int peer_rate_limit, global_rate_limit;
+		double global_tokens;
+		nanotime global_last_refill;
+		std::unordered_map<std::string, Pacer> pacers;
+		
 		Connection();
 		~Connection();
 		
@@ -84,16 +135,33 @@ namespace razor {
 		void unbindAll();
 		
 		// returns whether the message was sent
-		bool send(const std::string &host_and_port, const std::string &message);
-		bool sendAll(const std::string &message);
+		bool send(const std::string &host_and_port, const std::string &message, unsigned char lane=SEND_LANE_BULK);
+		bool sendAll(const std::string &message, unsigned char lane=SEND_LANE_BULK);
+		
+		void setPacing(bool is_pacing=true, unsigned int peer_rate_limit=0, unsigned int global_rate_limit=0);
+		// releases the queued datagrams the token buckets allow. Call regularly while pacing.
+		void flush();
+		// feeds a round trip and loss rate sample to a remote's congestion controller
+		void updateRate(const std::string &host_and_port, nanotime round_trip, float loss);
+		unsigned int queuedBytes(const std::string &host_and_port);
+		
+		// returns if anything was recieved. The timestamp is when the message was read from the socket.
+		bool receive(std::string* host_and_port, std::string* message, nanotime* timestamp=nullptr);
+		
+		// Reads every waiting datagram and queues the completed messages for receive, stamped with
+		// the current time. Calling this between ticks keeps receive timestamps close to arrival.
+		void poll();
 		
-		// returns if anything was recieved
-		bool receive(std::string* host_and_port, std::string* message);
+		// drops multipart messages still incomplete whose oldest part arrived before older_than
+		void expireMultiparts(nanotime older_than);
 		
 		void enableLogging();
 		
 	private:
-		bool sendPacket(int channel, unsigned char multipart_total, 
+		bool receiveFromSocket(std::string* host_and_port, std::string* message, nanotime* timestamp);
+		Pacer& pacerFor(const std::string &host_and_port);
+		double rateCeiling();
+		bool sendPacket(int channel, unsigned int id, unsigned char multipart_total, 
 				unsigned char multipart_index, const std::string &message_part);
 		static std::string getPacketUIDString(const std::string &hostAndPort, Packet* p);
 		static std::string getPacketUIDString(const std::string &hostAndPort, unsigned int id);
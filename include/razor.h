@@ -3,8 +3,22 @@
 #include <string>
 #include <iostream>
 #include <stdexcept>
+#include <set>
+#include <unordered_set>
 
 #include "networking.h"
+#include "commands.h"
+#include "merkle.h"
+#include "interest.h"
+#include "clocksync.h"
+#include "history.h"
+#include "interpolation.h"
+#include "timingwheel.h"
+#include "simd.h"
+#include "syncable.h"
+#include "entitystore.h"
+#include "delta.h"
+#include "compression.h"
 
 //extern std::string local_player_name;
 
@@ -19,7 +33,7 @@ Slave|Daemon - Packet type
 <- PONG *
 <- SYNC 
 -> COMMAND
-<- COMMAND (to other slaves)
+<- COMMAND_BATCH (to all slaves)
 <- SYNC
 -> DISCONNECT
 
@@ -32,7 +46,14 @@ Slaves operate a number of ticks ahead of the daemon determined by the PONG leng
 
 Slaves send commands to daemon that are queued into the future.
 
-Daemon rebroadcasts future commands to all slaves.
+Each slave command carries a sequence number. Slaves repeat every unacknowledged command
+from the last COMMAND_REDUNDANCY_TICKS ticks in each command message, and the daemon
+piggybacks the highest contiguous sequence number it has received on all traffic back
+to the slave. The daemon discards repeats it has already seen.
+
+Daemon holds commands in a buffer indexed by tick until their tick executes, then orders them
+deterministically and broadcasts the tick's finalized command list to all slaves as one batch.
+Each batch is repeated for COMMAND_BATCH_REDUNDANCY ticks.
 
 When a command is received by a slave, it is queued into its command list and ticks are
 replayed from the oldest command forward to regenerate the future simulation.
@@ -41,17 +62,83 @@ If the daemon receives a command that is older than the current tick, it is disg
 
 Occassionally the daemon broadcasts a sync of all changes past the last sync
 
+With Merkle sync enabled, periodic syncs send only a Merkle root (SYNC_ROOT) over fixed-size
+chunks of the serialized state. A slave whose own tree of its state at the root's tick has the
+same root is converged. Otherwise it sends MERKLE_REQUEST for the mismatching nodes, the daemon
+answers with MERKLE_NODES for their descendants a few levels down, and the slave keeps descending
+until it requests and receives only the mismatching chunks (MERKLE_CHUNKS). A MERKLE_REQUEST
+without nodes asks for a full SYNC, which slaves send when the state length differs.
+
+With interest management enabled the daemon instead sends each slave SYNC_OBJECTS holding only
+the registered objects relevant to it: global objects, objects within its area of interest, and
+any accepted by the relevance callback. Objects that stop being relevant are listed as departed.
+Given a sync budget, SYNC_OBJECTS is sent every tick but holds only as many object states as fit
+in the budget, chosen by a per-slave priority accumulator that grows each tick an object waits.
+
+With join streaming enabled, a REQUEST_FULL starts a join stream instead of a single SYNC. The
+daemon snapshots its state and sends it in JOIN_STREAM chunks, a budget of bytes per tick. A slave
+that stops receiving chunks sends JOIN_RESUME listing the chunks it is missing, and a JOIN_RESUME
+with none listed ends the stream. With interest management, the joining slave's object sync
+priorities are seeded so the nearest objects are sent first, and objects are applied as they arrive.
+
+With entity sync enabled, replicated state lives in the daemon's entity store. Each tick the
+daemon broadcasts ENTITY_CHANGES holding only the entities created and destroyed and the fields
+set since the last tick, found through the store's dirty masks. ENTITY_SYNC, a snapshot of the
+whole store, replaces SYNC on each slave's periodic schedule and recovers changes lost in transit.
+Slaves drop ENTITY_CHANGES for ticks at or before the last changes or snapshot they applied, and
+snapshots older than that.
+
+With delta sync enabled, periodic syncs are SYNC_DELTA, a byte-level delta of the serialized state
+against the last one sent to that slave, whenever it is smaller than the state. A slave that
+doesn't hold that baseline asks for a full SYNC with REQUEST_FULL.
+
+Slaves with compression enabled say so in their REQUEST_FULL, with a hash of their preset
+dictionary. Daemons with it enabled then compress message bodies of at least
+COMPRESSION_THRESHOLD bytes to that slave, setting MESSAGE_COMPRESSED in the type, when that makes
+them smaller. The dictionary is used only if both hashes match.
+
+Every REQUEST_FULL also carries a hash of the slave's command registry names in opcode order. A
+daemon whose own registry hashes differently refuses the slave with DISCONNECT, since their
+opcodes would mean different commands.
+
 If a slave detects packet loss, it will request a full sync
 
-If the daemon or a slave sends no packets for KEEPALIVE time, it will send a pong to keep the connection alive
+Daemons report how long before its tick each slave command arrived in COMMAND_TIMING, with the
+tick, so slaves compare it against the lead they sent that tick's commands with. Slaves
+steer their future time so only a small fraction of commands arrive within a safety margin of
+their tick, slewing it gradually so ticks never jump.
+
+Daemons sync each slave on its own schedule. New slaves get phases spread evenly over SYNC_DELAY
+ticks, and each slave's delay grows with the ping and loss rate it reports in its PINGs.
+
+If the daemon sends a slave nothing for KEEPALIVE time, it will send an ACK to keep the connection alive.
+Slaves' PINGs keep their connection alive.
+
+If the daemon or a slave detects no packets for TIMEOUT time, it will disconnect. A DISCONNECT
+disconnects immediately. Daemons forget a disconnected slave and unbind its channel. Slaves that
+time out request a full sync again, while a DISCONNECT from the daemon ends their session.
+
+Keepalives, timeouts, pings and multipart reassembly expiry are timers on one hierarchical
+timing wheel, so firing them costs the same however many slaves are connected.
+
+
+==Lockstep Mode==
+
+For deterministic simulations with large states. The daemon sends no periodic syncs. Instead it
+broadcasts a command batch for every tick (including empty ones), and slaves only simulate a
+tick once its batch has arrived (isTickReady). Slave commands are scheduled
+lockstep_command_delay ticks ahead so they reach the daemon in time.
 
-If the daemon or a slave detects no packets for TIMEOUT time, it will disconnect
+A batch is only repeated a few times, so a slave still missing a tick's batch after newer ones
+have arrived sends BATCH_REQUEST listing the missing ticks. The daemon sends it those batches
+again, or a full sync once they have left its command buffer.
+
+At the start of each tick, every peer hashes its state, which is the state after the previous
+tick. Slaves send their hash to the daemon, which compares it with its own hash of the same tick
+and sends a full sync only to slaves whose hashes diverge.
 */
 
 namespace razor {
-	typedef unsigned long long int ticktype;
-	typedef long long int nanotimediff;
-	
 	// Amount of time after connecting to wait before adding the player. This allows local time to be synchronized.
 	inline constexpr nanotime CREATE_PLAYER_DELAY = 500 * NANOS_PER_MILLI;
 
@@ -62,20 +149,36 @@ namespace razor {
 	inline constexpr nanotime PING_LOG_LENGTH = 10;
 
 	// The multiplier on top of ping. This gives a buffer of time for commands to be received at the server
-	inline constexpr auto FUTURE_TIME_PING_MULTIPLIER = 1.4f;
+	inline constexpr auto FUTURE_TIME_PING_MULTIPLIER = 1.2f;
 
 	// Fixed amount of future time to add on top of multiplier. This is to account for other player's pings when
 	// the server sends your command to them.
-	inline constexpr nanotime FUTURE_TIME_PING_FIXED = 30 * NANOS_PER_MILLI;
+	inline constexpr nanotime FUTURE_TIME_PING_FIXED = 20 * NANOS_PER_MILLI;
+
+	// Fraction of recent round trips the future time covers. Rarer spikes are absorbed by the multiplier.
+	inline constexpr auto FUTURE_TIME_PING_PERCENTILE = 0.9f;
+
+	// maximum command arrival margins reported in a single COMMAND_TIMING message
+	inline constexpr auto COMMAND_TIMING_MAX = 64;
 
 	// Maximum value of future time before triggering high-ping self-disconnect
 	inline constexpr nanotime MAX_FUTURE_TIME_HIGH_PING = 1000 * NANOS_PER_MILLI;
 
+	// Most bytes of a message before its body: type, timestamp, then varints of the tick number,
+	// ack and body length at their longest
+	inline constexpr auto MESSAGE_HEADER_SIZE = 1 + 8 + VARINT_MAX_BYTES + 5 + 5;
+
+	// Set in a message's type when its body is compressed
+	inline constexpr unsigned char MESSAGE_COMPRESSED = 0x80;
+
+	// bytes of body below which messages aren't worth compressing
+	inline constexpr auto COMPRESSION_THRESHOLD = 512;
+
 	// Size of the working memory for sends
 	inline constexpr auto SEND_BUFFER_SIZE = 1024*1024;
 
 	// Maximum commands per packet
-	inline constexpr auto MAX_COMMANDS_PER_PACKET = 5;
+	inline constexpr auto MAX_COMMANDS_PER_PACKET = 32;
 
 	// Maximum length of a command
 	inline constexpr auto MAX_COMMAND_LENGTH = 200;
@@ -86,15 +189,88 @@ namespace razor {
 	// number of nanoseconds to wait before sending another ping request
 	inline constexpr nanotime PING_DELAY = 1000 * NANOS_PER_MILLI;
 
+	// nanoseconds without sending to a slave before the daemon sends it an ACK
+	inline constexpr nanotime KEEPALIVE = 1000 * NANOS_PER_MILLI;
+
+	// nanoseconds without receiving from a peer before disconnecting it
+	inline constexpr nanotime TIMEOUT = 10 * NANOS_PER_SECOND;
+
+	// nanoseconds after which a multipart message still missing parts is dropped
+	inline constexpr nanotime REASSEMBLY_TIMEOUT = 5 * NANOS_PER_SECOND;
+
+	// peer id of the daemon in a slave's timers. Daemons number their slaves from 1.
+	inline constexpr unsigned int DAEMON_PEER_ID = 0;
+
 	// number of pings to average
 	inline constexpr auto PING_LOG_SIZE = 10;
 
 	// number of game ticks to wait before requesting a new sync
 	inline constexpr auto SYNC_DELAY = 250;
 
+	// slaves with a ping above this many milliseconds are synced proportionally less often
+	inline constexpr auto SYNC_REFERENCE_PING = 100;
+
+	// multiplier on a slave's ping loss rate added to its sync delay
+	inline constexpr auto SYNC_LOSS_BACKOFF = 2.0f;
+
+	// maximum number of game ticks between syncs of a single slave
+	inline constexpr auto SYNC_MAX_DELAY = 4 * SYNC_DELAY;
+
 	// number of game ticks to accumulate commands before sending
 	inline constexpr auto COMMAND_DELAY = 10;
 
+	// number of ticks an unacknowledged command is repeated in outgoing command messages
+	inline constexpr auto COMMAND_REDUNDANCY_TICKS = 30;
+
+	// default maximum bytes of commands packed into a single outgoing command message
+	inline constexpr auto COMMAND_REDUNDANCY_BUDGET = 1200;
+
+	// number of ticks the daemon repeats each finalized command batch
+	inline constexpr auto COMMAND_BATCH_REDUNDANCY = 3;
+	
+	// most missing ticks a lockstep slave lists in a single BATCH_REQUEST
+	inline constexpr auto BATCH_REQUEST_MAX_TICKS = 64;
+	
+	// number of ticks a lockstep slave waits before requesting missing batches again
+	inline constexpr auto BATCH_REQUEST_DELAY = 10;
+
+	// number of past ticks of state hashes the daemon keeps for lockstep comparisons
+	inline constexpr auto LOCKSTEP_HASH_HISTORY = 256;
+
+	// default number of ticks ahead a lockstep slave schedules its commands
+	inline constexpr ticktype LOCKSTEP_COMMAND_DELAY = 10;
+
+	// maximum state chunks sent in a single MERKLE_CHUNKS message
+	inline constexpr auto MERKLE_MAX_CHUNKS_PER_MESSAGE = 64;
+
+	// bytes of object states after which a SYNC_OBJECTS message is split
+	inline constexpr auto SYNC_OBJECTS_MESSAGE_SIZE = 8192;
+
+	// bytes of state in each chunk of a join stream
+	inline constexpr auto JOIN_STREAM_CHUNK_SIZE = 1024;
+	
+	// Largest state a join stream carries. Slaves refuse streams announcing more, so a forged
+	// chunk can't make them allocate an arbitrary buffer, and daemons refuse to send more.
+	inline constexpr auto JOIN_STREAM_MAX_STATE = 64 * 1024 * 1024;
+
+	// default bytes of a join stream sent to a slave per tick
+	inline constexpr auto JOIN_STREAM_BUDGET = 16 * 1024;
+
+	// bytes of chunks after which a JOIN_STREAM message is split
+	inline constexpr auto JOIN_STREAM_MESSAGE_SIZE = 8192;
+
+	// ticks a slave waits without receiving a chunk before asking for the missing ones
+	inline constexpr auto JOIN_STREAM_RESUME_TICKS = 30;
+
+	// ticks without a resume after which the daemon drops a finished join stream
+	inline constexpr auto JOIN_STREAM_TIMEOUT = 600;
+
+	// maximum missing chunks listed in a single JOIN_RESUME message
+	inline constexpr auto JOIN_RESUME_MAX_CHUNKS = 256;
+
+	// priority given to a joining slave's nearest object, falling off with distance
+	inline constexpr auto JOIN_OBJECT_PRIORITY = 1000.0f;
+
 	// Destination/Source special case host strings
 	inline constexpr auto LOCAL = "LOCAL";
 	inline constexpr auto BROADCAST = "BROADCAST";
@@ -108,7 +284,30 @@ namespace razor {
 		MESSAGE_PONG,
 		MESSAGE_REQUEST_FULL,
 		MESSAGE_DISCONNECT,
-		MESSAGE_PING
+		MESSAGE_PING,
+		MESSAGE_ACK,
+		MESSAGE_COMMAND_BATCH,
+		MESSAGE_STATE_HASH,
+		MESSAGE_SYNC_ROOT,
+		MESSAGE_MERKLE_REQUEST,
+		MESSAGE_MERKLE_NODES,
+		MESSAGE_MERKLE_CHUNKS,
+		MESSAGE_SYNC_OBJECTS,
+		MESSAGE_JOIN_STREAM,
+		MESSAGE_JOIN_RESUME,
+		MESSAGE_COMMAND_TIMING,
+		MESSAGE_ENTITY_CHANGES,
+		MESSAGE_ENTITY_SYNC,
+		MESSAGE_SYNC_DELTA,
+		MESSAGE_BATCH_REQUEST
+	};
+	
+	// Timers on the timing wheel, stored with the peer id they belong to
+	enum TimerTypes {
+		TIMER_KEEPALIVE,
+		TIMER_TIMEOUT,
+		TIMER_PING,
+		TIMER_REASSEMBLY
 	};
 	
 	class Razor {
@@ -119,32 +318,183 @@ namespace razor {
 			unsigned char type;
 			std::string origin_host_and_port;
 			std::string dest_host_and_port; // if == to BROADCAST, will be sent to all
-			nanotime timestamp; // timestamps are absolute to the epoch
+			nanotime timestamp; // timestamps are absolute to the epoch, stamped when the message is sent
+			nanotime received_timestamp; // local time the message was read from the socket
 			ticktype ticknumber; // ticknumbers are relative / dynamic
+			unsigned int ack; // highest contiguous command sequence received from the destination
 			std::string message;
 		};
 		
 		struct OutgoingCommand {
 			ticktype tick_number;
+			unsigned int seq;
 			std::string command;
 		};
 		
-		// queue for messages waiting to be sent
-		std::deque<NetworkMessage> send_queue;
+		// for daemons only, per-slave command acknowledgement state
+		struct PeerState {
+			// numbers the slave's timers, 0 until it has sent a message
+			unsigned int id;
+			timerhandle keepalive_timer, timeout_timer;
+			// highest sequence number below which every command has been received
+			unsigned int command_ack;
+			// sequence numbers received above command_ack (out of order arrivals)
+			std::set<unsigned int> received_command_seqs;
+			// true if command_ack changed and hasn't been sent back yet
+			bool ack_pending;
+			// lockstep hashes for ticks before this are ignored because a resync is in flight
+			ticktype lockstep_sync_tick;
+			// area of interest for object syncs. Without one every object is relevant.
+			bool has_interest;
+			float interest_x, interest_y, interest_z, interest_radius;
+			// the ticks of the slave's commands and how long before them they arrived, not yet
+			// reported to it
+			std::vector<std::pair<ticktype, nanotimediff>> command_margins;
+			// staggered sync schedule, and the ping (in milliseconds) and loss the slave reports
+			ticktype next_sync_tick;
+			nanotime ping;
+			float loss;
+			// objects included in the slave's last object sync
+			std::unordered_set<unsigned int> relevant_objects;
+			// accumulated priority of each relevant object since it was last sent
+			std::unordered_map<unsigned int, float> object_priorities;
+			// Join stream. Without interest management, chunks of join_state still to be sent are
+			// queued. With it, join_unsent holds the relevant objects not yet sent.
+			bool joining;
+			ticktype join_tick, join_last_activity;
+			std::string join_state;
+			std::deque<unsigned int> join_queue;
+			std::unordered_set<unsigned int> join_unsent;
+			// the last state sent to the slave, which delta syncs are made against
+			bool has_sync_baseline;
+			ticktype sync_baseline_tick;
+			std::string sync_baseline;
+			// whether the slave accepts compressed messages, and has the same dictionary
+			bool compression, compression_dictionary;
+		};
+		
+		struct StateHash {
+			ticktype tick_number;
+			unsigned long long hash;
+		};
 		
-		// for slaves only, the last PING_LOG_LENGTH of pings
-		std::deque<nanotime> ping_log;
+		// queues for messages waiting to be sent, one per send lane
+		std::deque<NetworkMessage> send_queues[SEND_LANE_COUNT];
 		
-		// for slaves only, the last PING_LOG_LENGTH of time_deltas
-		std::deque<nanotimediff> time_delta_log;
+		// for slaves only, the daemon clock's offset and the round trips estimated from pongs
+		ClockSync clock_sync;
+		
+		// for slaves only, steers future time from the arrival margins the daemon reports
+		LeadController lead_controller;
+		
+		// for daemons only, a moving average of the time between ticks, and when the last tick began
+		nanotime tick_period, last_tick_time;
+		ticktype last_tick_number;
 		
 		bool daemon, slaved;
 		std::string daemon_host_and_port;
 		
 		std::deque<OutgoingCommand> outgoing_commands;
 		
-		// ping in nanoseconds. Generated from a moving average of ping_log.
+		// for slaves only, commands sent to the daemon that haven't been acknowledged
+		std::deque<OutgoingCommand> unacked_commands;
+		unsigned int next_command_seq;
+		
+		// maximum bytes of commands in one outgoing command message
+		int command_budget;
+		
+		// for daemons only, keyed by slave host and port
+		std::unordered_map<std::string, PeerState> peers;
+		
+		// Daemons hold received commands here until their tick is finalized. Slaves store the
+		// finalized batches received from the daemon.
+		CommandBuffer command_buffer;
+		
+		// Command types the application adds, in the same order on the daemon and slaves. Its
+		// tick_commands_func passes each command to dispatch to have them decoded and handled.
+		// Daemons refuse slaves whose registry hashes differently.
+		CommandRegistry command_registry;
+		
+		// for daemons only, the next tick to finalize in command_buffer
+		ticktype next_finalize_tick;
+		
+		// for daemons only, recently finalized ticks with commands that are still being repeated
+		std::deque<ticktype> recent_batch_ticks;
+		
+		// for lockstep slaves, the newest tick with a batch received, the oldest tick that may
+		// still be missing its batch, and the tick missing batches were last requested
+		ticktype batch_receive_tick, next_batch_tick, batch_request_tick;
+		
+		// lockstep mode, see the protocol description above
+		bool lockstep;
+		ticktype lockstep_command_delay;
+		
+		// for daemons only, ring buffer of the daemon's own state hashes indexed by tick
+		std::vector<StateHash> state_hashes;
+		
+		// the last tick whose state was hashed
+		ticktype last_hashed_tick;
+		
+		// Merkle syncs. Daemons keep the state and tree of their last SYNC_ROOT. Slaves keep
+		// their own state for the daemon's tick while repairing it.
+		bool merkle_sync;
+		std::string merkle_state;
+		MerkleTree merkle_tree;
+		ticktype merkle_tick;
+		
+		// for slaves only, the daemon's root and the chunks still awaited during a repair
+		unsigned long long merkle_root;
+		std::set<unsigned int> merkle_pending_chunks;
+		
+		// Delta syncs. Slaves keep the last state loaded from the daemon as the baseline for the next.
+		bool delta_sync;
+		bool has_sync_baseline;
+		ticktype sync_baseline_tick;
+		std::string sync_baseline;
+		
+		// Interest management. Daemons register syncable objects and their positions in
+		// interest, and serialize each object at most once per tick for all slaves.
+		bool interest_management;
+		InterestGrid interest;
+		std::unordered_map<unsigned int, std::string> object_state_cache;
+		ticktype object_state_cache_tick;
+		// bytes of object states sent to each slave per tick. 0 sends every object each SYNC_DELAY.
+		unsigned int sync_budget;
+		
+		// For daemons, recent transforms of entities the application registers and records each
+		// tick, so commands can be checked against the world as their slave saw it
+		TransformHistory transform_history;
+		
+		// Entity sync. The application registers the same fields on the daemon and slaves. Daemons
+		// set values and send what changed each tick, and slaves' stores mirror the daemon's.
+		bool entity_sync;
+		EntityStore entities;
+		// For slaves, the daemon tick of the last changes or snapshot applied, so ones arriving late
+		// don't roll the store back
+		ticktype entity_tick;
+		
+		// For slaves, received transforms of remote entities, which the application pushes as
+		// states arrive and samples a little behind the daemon's time when rendering
+		InterpolationBuffer interpolation;
+		
+		// Join streaming. Daemons send joining slaves join_stream_budget bytes per tick. Slaves
+		// assemble the stream's chunks in join_buffer until every one has been received.
+		bool join_stream;
+		unsigned int join_stream_budget;
+		bool join_receiving;
+		ticktype join_receive_tick, join_last_progress;
+		std::string join_buffer;
+		std::vector<bool> join_received;
+		unsigned int join_remaining;
+		
+		// ping in milliseconds. The FUTURE_TIME_PING_PERCENTILE of recent round trips.
 		nanotime ping;
+		// for slaves only, a moving average of the fraction of pings that got no pong
+		float ping_loss;
+		bool awaiting_pong;
+		
+		// for daemons only, the number of slaves given a sync phase
+		unsigned int sync_phase_count;
 		
 		// zero time of the daemon
 		nanotime daemon_zero_time;
@@ -161,13 +511,29 @@ namespace razor {
 		
 		// used for working memory for building packets
 		char* send_buffer;
+		// each message is serialized here before it is sent, reusing its allocation
+		std::string transmit_buffer;
+		
+		// Compression of large message bodies, see the protocol description above. The message
+		// being transmitted is compressed at most once without and once with the dictionary.
+		bool compression;
+		std::string compression_dictionary;
+		unsigned long long compression_dictionary_hash;
+		std::string compressed_bodies[2];
+		bool compressed_ready[2];
 		char* packed_command_buffer;
 		
 		// Sync timer
 		ticktype next_sync_tick, last_sync_tick;
 		
-		// Ping timer
-		nanotime next_ping_time;
+		// Keepalive, timeout, ping and reassembly timers. Timer data is the peer id shifted
+		// above the timer type. Daemons map their slaves' ids back to hosts with peer_hosts.
+		TimingWheel timers;
+		std::vector<unsigned long long> expired_timers;
+		std::unordered_map<unsigned int, std::string> peer_hosts;
+		unsigned int next_peer_id;
+		nanotime keepalive, timeout;
+		timerhandle ping_timer, daemon_timeout_timer, reassembly_timer;
 		
 		// Command send delay timer
 		nanotime next_command_time;
@@ -182,6 +548,16 @@ namespace razor {
         
         // Callback functions
         void (*get_state_data_func)(std::string*); 
+		void (*set_state_data_func)(std::string*, ticktype, nanotimediff);
+		unsigned long long (*get_state_hash_func)();
+		void (*get_state_data_at_tick_func)(std::string*, ticktype);
+		void (*get_object_state_func)(unsigned int, std::string*);
+		void (*set_object_state_func)(unsigned int, std::string*, ticktype);
+		void (*object_left_interest_func)(unsigned int);
+		bool (*object_relevance_func)(const std::string&, unsigned int);
+		float (*object_priority_func)(const std::string&, unsigned int);
+		void (*tick_commands_func)(ticktype, std::span<const TickCommand>);
+		void (*peer_disconnected_func)(const std::string&);
 		
 		Razor();
 		
@@ -193,34 +569,78 @@ namespace razor {
 		
 		// Serialize/deserialize different message types
 		// returns number of bytes copied
-		int serializeMessage(void* data, NetworkMessage* in);
-		int deserializeMessage(NetworkMessage* out, void* data);
+		int serializeMessage(BufferWriter<false> &out, NetworkMessage* in);
+		int deserializeMessage(NetworkMessage* out, BufferReader<> &in);
 		
-		int serializePong(char* data, nanotime remote_timestamp, nanotime zero_time);
-		int deserializePong(char* data, nanotime *start_timestamp, nanotime *zero_time);
+		int serializePong(char* data, nanotime remote_timestamp, nanotime received_timestamp, nanotime zero_time);
+		int deserializePong(BufferReader<> &in, nanotime *start_timestamp, nanotime *received_timestamp, nanotime *zero_time);
 		
-		int serializeCommand(char* data, int pos, ticktype tick_number, std::string* command);
-		int deserializeCommand(char* data, int pos, ticktype *tick_number, std::string *command);
+		int serializeCommand(char* data, int pos, ticktype tick_number, unsigned int seq, std::string* command,
+				ticktype reference_tick, unsigned int reference_seq);
+		void deserializeCommand(BufferReader<> &in, ticktype *tick_number, unsigned int *seq, std::string *command,
+				ticktype reference_tick, unsigned int reference_seq);
 		
 		// Queuing of new messages, used by sends
-		void queueOutgoingNetworkMessage(const std::string &dest, unsigned char type, const std::string& message);
+		void queueOutgoingNetworkMessage(const std::string &dest, unsigned char type, std::string message);
 		void queueOutgoingCommands();
+		void queueCommandMessage(const std::string &dest, unsigned short command_counter, int length);
+		void queueRedundantCommands();
 		
 		// Send message types
 		void sendRequestFullSync();
-		void sendPong(std::string dest, nanotime remote_timestamp);
+		void sendPong(std::string dest, nanotime remote_timestamp, nanotime received_timestamp);
 		void sendPing(std::string dest);
 		void sendDisconnect(std::string dest);
 		void sendSync(std::string dest);
 		void sendCommand(const std::string& command);
+		void sendAck(std::string dest);
+		void sendCommandBatch(const std::string &dest, const std::deque<ticktype> &batch_ticks);
+		void sendBatchRequest();
+		void sendStateHash(ticktype tick_number, unsigned long long hash);
+		void sendSyncRoot(std::string dest);
+		void sendMerkleRequest(unsigned int level, const std::vector<unsigned int> &indices);
+		void sendMerkleNodes(std::string dest, unsigned int level, const std::vector<unsigned int> &indices);
+		void sendMerkleChunks(std::string dest, const std::vector<unsigned int> &indices);
+		void sendObjectSync(std::string dest, unsigned int budget=0);
+		void sendEntityChanges();
+		void sendEntitySync(std::string dest);
+		void startJoinStream(const std::string &dest);
+		void sendJoinStreams();
+		void sendJoinChunks(const std::string &dest, PeerState &peer);
+		void sendJoinResume();
+		void sendCommandTiming(const std::string &dest, PeerState &peer);
+		void queueObjectSyncMessage(const std::string &dest, unsigned int count, int length);
 		
 		// Receive message types
+		void receiveAck(NetworkMessage* nm);
+		bool acceptCommand(const std::string &origin, unsigned int first_seq, unsigned int seq);
 		void receivePong(NetworkMessage* nm);
+		void receivePing(NetworkMessage* nm);
 		void receiveCommands(NetworkMessage* nm);
+		void receiveCommandBatch(NetworkMessage* nm);
+		void receiveBatchRequest(NetworkMessage* nm);
+		void receiveStateHash(NetworkMessage* nm);
+		void receiveSyncRoot(NetworkMessage* nm);
+		void receiveMerkleRequest(NetworkMessage* nm);
+		void receiveMerkleNodes(NetworkMessage* nm);
+		void receiveMerkleChunks(NetworkMessage* nm);
+		void receiveObjectSync(NetworkMessage* nm);
+		void receiveJoinStream(NetworkMessage* nm);
+		void receiveJoinResume(NetworkMessage* nm);
+		void receiveCommandTiming(NetworkMessage* nm);
+		void receiveEntityChanges(NetworkMessage* nm);
+		void receiveEntitySync(NetworkMessage* nm);
+		void receiveSyncDelta(NetworkMessage* nm);
+		void loadSync(std::string* state, ticktype daemon_tick_number);
 		void receiveSync(NetworkMessage* nm);
 		
 		// Handle sending and receiving of messages
 		void sendMessages(ticktype tick_number);
+		void transmitSendQueue();
+		static unsigned char laneFor(unsigned char type);
+		bool transmitMessage(const std::string &dest, NetworkMessage* nm);
+		bool compressMessage(PeerState &peer, NetworkMessage* nm);
+		void decompressMessage(NetworkMessage* nm);
 		void receiveMessages();
 		
 		// Internal processes
@@ -228,6 +648,19 @@ namespace razor {
 		void clearSendQueue();
 		void clearOutgoingCommands();
 		void updateFutureTime();
+		void finalizeCommands();
+		unsigned long long stateHash();
+		void hashLockstepState();
+		void relevantObjects(const std::string &dest, std::vector<unsigned int>* out);
+		const std::string& objectState(unsigned int id);
+		float objectPriority(const std::string &dest, unsigned int id);
+		ticktype nextSyncPhase();
+		ticktype syncDelay(const PeerState &peer);
+		void sendPeriodicSyncs();
+		PeerState& touchPeer(const std::string &host_and_port, nanotime now);
+		void armTimer(timerhandle* timer, unsigned int peer_id, unsigned char type, nanotime when);
+		void runTimers();
+		void disconnectFromDaemon();
 		
 		// Daemon/slave tick functions
 		void daemonTick();
@@ -238,6 +671,23 @@ namespace razor {
 		void setDaemon(bool is_daemon=true);
 		void setDaemonAddress(const std::string &daemon_host_and_port);
 		void setLogNetworking();
+		void setCommandBudget(int bytes);
+		void setLockstep(bool is_lockstep=true, ticktype command_delay=LOCKSTEP_COMMAND_DELAY);
+		// Off by default. Slaves should register registerCallbackGetStateDataAtTick, since their
+		// current state is ahead of the daemon's root and would never match it.
+		void setMerkleSync(bool is_merkle_sync=true);
+		void setInterestManagement(bool is_interest_management=true, float cell_size=INTEREST_CELL_SIZE);
+		void setSyncBudget(unsigned int bytes_per_tick);
+		void setJoinStream(bool is_join_stream=true, unsigned int bytes_per_tick=JOIN_STREAM_BUDGET);
+		void setEntitySync(bool is_entity_sync=true);
+		void setDeltaSync(bool is_delta_sync=true);
+		// Both sides need the same dictionary for it to be used, such as a typical serialized state
+		void setCompression(bool is_compression=true, const std::string &dictionary="");
+		// rate limits are in bytes per second, 0 is unlimited
+		void setPacing(bool is_pacing=true, unsigned int peer_rate_limit=0, unsigned int global_rate_limit=0);
+		// returns false for slaves the daemon hasn't heard from
+		bool setAreaOfInterest(const std::string &slave_host_and_port, float x, float y, float z, float radius);
+		void setTimeouts(nanotime keepalive=KEEPALIVE, nanotime timeout=TIMEOUT);
 		
 		// Public callback registration functions
 		void registerCallbackSetStateData(
@@ -252,6 +702,56 @@ namespace razor {
 				std::string* // state
 			)
 		);
+		// Optional. Used by slaves comparing Merkle roots to get their state as of a past daemon
+		// tick. Without it the current state from get_state_data_func is compared.
+		void registerCallbackGetStateDataAtTick(
+			void (*get_state_data_at_tick_func)(
+				std::string*, // state
+				ticktype // daemon tick number
+			)
+		);
+		// Interest management callbacks. The daemon serializes a single registered object, and
+		// slaves load one or are told it is no longer relevant to them.
+		void registerCallbackGetObjectState(
+			void (*get_object_state_func)(
+				unsigned int, // object id
+				std::string* // object state
+			)
+		);
+		void registerCallbackSetObjectState(
+			void (*set_object_state_func)(
+				unsigned int, // object id
+				std::string*, // object state
+				ticktype // daemon tick number
+			)
+		);
+		void registerCallbackObjectLeftInterest(
+			void (*object_left_interest_func)(
+				unsigned int // object id
+			)
+		);
+		// Optional. Filters the objects found in a slave's area of interest.
+		void registerCallbackObjectRelevance(
+			// returns whether the object should be synced to the slave
+			bool (*object_relevance_func)(
+				const std::string&, // slave host and port
+				unsigned int // object id
+			)
+		);
+		// Optional. How quickly an object's sync priority grows for a slave, 1 by default.
+		void registerCallbackObjectPriority(
+			// returns the priority added each tick the object isn't sent
+			float (*object_priority_func)(
+				const std::string&, // slave host and port
+				unsigned int // object id
+			)
+		);
+		// Optional. Used in lockstep mode instead of hashing the state from get_state_data_func,
+		// for applications that can hash their state more cheaply than serializing it.
+		void registerCallbackGetStateHash(
+			// returns a hash of the current state
+			unsigned long long (*get_state_hash_func)()
+		);
 		void registerCallbackGetTickNumber(
 			// returns local tick number
 			ticktype (*get_tick_number_func)()
@@ -270,6 +770,21 @@ namespace razor {
 				nanotimediff // local time difference
 			)
 		);
+		// Called with the authoritative, ordered commands of each tick. On the daemon this happens
+		// for every tick as it executes. On slaves it happens when a tick's batch arrives from the
+		// daemon, which is after the slave has simulated that tick, so the slave should replay from it.
+		void registerCallbackTickCommands(
+			void (*tick_commands_func)(
+				ticktype, // tick number
+				std::span<const TickCommand> // commands in execution order
+			)
+		);
+		// Optional. Called when a daemon's slave or a slave's daemon disconnects or times out.
+		void registerCallbackPeerDisconnected(
+			void (*peer_disconnected_func)(
+				const std::string& // host and port
+			)
+		);
 		void registerCallbackRewindState(
 			void (*rewind_state_func)(
 				std::string*, // daemon state
@@ -280,7 +795,21 @@ namespace razor {
 		// Public live functions
 		// Note: tick must be called first each frame
 		void tick(ticktype tick_number, nanotime zero_time);
+		// Optional. Reads waiting packets between ticks so pings are timed closer to their arrival.
+		void pollNetwork();
 		void command(const std::string &command_data);
+		// Sends a command type added to command_registry, encoded as its opcode and fields
+		template<Syncable T> void command(const T &args) {
+			this->sendCommand(this->command_registry.encode(args));
+		}
+		// Daemons disconnect a slave, telling it unless it's already gone
+		void disconnectPeer(const std::string &host_and_port, bool notify=true);
+		// Slaves leave their daemon. Daemons disconnect every slave.
+		void disconnect();
+		
+		// In lockstep mode, whether the slave has the daemon's command batch for a tick
+		// and may simulate it. Always true for daemons and outside lockstep mode.
+		bool isTickReady(ticktype tick_number);
 	};
 	
 	int razorUnitTest();
@@ -6,6 +6,13 @@
 #include <cmath>
 #include <iostream>
 #include <cstddef>
+#include <span>
+#include <string_view>
+#include <stdexcept>
+#include <algorithm>
+#include <bit>
+#include <type_traits>
+#include <cstdint>
 
 namespace razor {
 	inline constexpr auto BOOL_VECTOR_MAX = 64;
@@ -31,7 +38,7 @@ namespace razor {
 	}
 	
 	unsigned int copyInCString(void *data, unsigned int position, const char* in);
-	unsigned int copyInString(void *data, unsigned int position, std::string* in);
+	unsigned int copyInString(void *data, unsigned int position, const std::string* in);
 	unsigned int copyInBV(void *data, unsigned int position, bool* in, unsigned char bool_num);
 	
 	template<class T> inline unsigned int copyOut(T* out_value, void *data, unsigned int position) {
@@ -52,5 +59,537 @@ namespace razor {
 	unsigned int copyOutString(std::string* out, void *data, unsigned int position);
 	unsigned int copyOutBV(bool* out, unsigned char* bool_num, void *data, unsigned int position);
 	
+	// Bits needed to write any value from 0 to range
+	inline unsigned int bitsRequired(unsigned long long range) {
+		return 64 - std::countl_zero(range);
+	}
+	
+	inline unsigned long long bitMask(unsigned int bits) {
+		return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+	}
+	
+	// Longest varint, a 64 bit value at 7 bits a byte
+	inline constexpr auto VARINT_MAX_BYTES = 10;
+	
+	// Maps signed values to unsigned so that small magnitudes of either sign stay small:
+	// 0, -1, 1, -2, 2 become 0, 1, 2, 3, 4
+	template<class T> inline std::make_unsigned_t<T> zigzagEncode(T value) {
+		using U = std::make_unsigned_t<T>;
+		return (U)(((U)value << 1) ^ (U)(value >> (sizeof(T) * 8 - 1)));
+	}
+	
+	template<class U> inline std::make_signed_t<U> zigzagDecode(U value) {
+		return (std::make_signed_t<U>)((value >> 1) ^ (U)(0 - (value & 1)));
+	}
+	
+	// The unsigned value a varint of T carries, zigzag encoded for signed types
+	template<class T> inline unsigned long long varintValue(T value) {
+		static_assert(std::is_integral_v<T>, "varints hold integers");
+		if constexpr(std::is_signed_v<T>)
+			return zigzagEncode(value);
+		else
+			return value;
+	}
+	
+	// The inverse of varintValue. Throws std::range_error if the value doesn't fit in T.
+	template<class T> inline T varintCast(unsigned long long value) {
+		using U = std::make_unsigned_t<T>;
+		if(value > (U)~(U)0)
+			throw std::range_error("Varint too large for its type");
+		if constexpr(std::is_signed_v<T>)
+			return zigzagDecode((U)value);
+		else
+			return (T)value;
+	}
+	
+	template<class T> inline unsigned int varintSize(T value) {
+		return 1 + (bitsRequired(varintValue(value) | 1) - 1) / 7;
+	}
+	
+	// Copy in an integer as a LEB128 varint: 7 bits a byte, low bits first, with the high bit set
+	// on every byte but the last. Values under 128 take 1 byte and under 16384 take 2. Signed types
+	// are zigzag encoded so small negative values stay short.
+	template<class T> inline unsigned int copyInVarint(void* data, unsigned int position, T in_value) {
+		auto value = varintValue(in_value);
+		auto address = (uint8_t*)data+position;
+		unsigned int length = 0;
+		while(value >= 0x80) {
+			address[length++] = (uint8_t)value | 0x80;
+			value >>= 7;
+		}
+		address[length++] = (uint8_t)value;
+		return length;
+	}
+	
+	// Decodes a varint from at most available bytes. Returns its length, or 0 if it doesn't end
+	// within them or within VARINT_MAX_BYTES.
+	inline unsigned int decodeVarint(const uint8_t* address, unsigned int available, unsigned long long* out) {
+		if(available >= 1 && address[0] < 0x80) {
+			*out = address[0];
+			return 1;
+		}
+		if(available >= 2 && address[1] < 0x80) {
+			*out = (address[0] & 0x7F) | ((unsigned long long)address[1] << 7);
+			return 2;
+		}
+		available = std::min<unsigned int>(available, VARINT_MAX_BYTES);
+		unsigned long long value = 0;
+		for(unsigned int i=0; i<available; i++) {
+			if(i == VARINT_MAX_BYTES - 1 && address[i] > 1)
+				return 0; // more than 64 bits
+			value |= (unsigned long long)(address[i] & 0x7F) << (7 * i);
+			if(address[i] < 0x80) {
+				*out = value;
+				return i + 1;
+			}
+		}
+		return 0;
+	}
+	
+	// Copy out a varint written by copyInVarint. Like copyOut it trusts the data, reading up to
+	// VARINT_MAX_BYTES bytes, so use BufferReader::readVarint for data from the network. Throws
+	// std::range_error for varints that don't end or don't fit in T.
+	template<class T> inline unsigned int copyOutVarint(T* out_value, void* data, unsigned int position) {
+		unsigned long long value;
+		auto length = decodeVarint((const uint8_t*)data+position, VARINT_MAX_BYTES, &value);
+		if(length == 0)
+			throw std::range_error("Malformed varint");
+		*out_value = varintCast<T>(value);
+		return length;
+	}
+	
+	// Copy in a value as its signed difference from a reference value the reader also knows, for
+	// fields that change little between sends such as tick numbers and sequence numbers
+	template<class T> inline unsigned int copyInVarintDelta(void* data, unsigned int position, 
+			T in_value, T reference) {
+		using U = std::make_unsigned_t<T>;
+		return copyInVarint(data, position, (std::make_signed_t<T>)((U)in_value - (U)reference));
+	}
+	
+	template<class T> inline unsigned int copyOutVarintDelta(T* out_value, void* data, 
+			unsigned int position, T reference) {
+		using U = std::make_unsigned_t<T>;
+		std::make_signed_t<T> delta;
+		auto length = copyOutVarint(&delta, data, position);
+		*out_value = (T)((U)reference + (U)delta);
+		return length;
+	}
+	
+	// a varint length then the bytes
+	inline unsigned int copyInVarintString(void *data, unsigned int position, std::string_view in) {
+		auto length = copyInVarint(data, position, (unsigned int)in.size());
+		if(in.size() != 0)
+			std::memcpy((uint8_t*)data+position+length, in.data(), in.size());
+		return length + in.size();
+	}
+	
+	// Writes values at a tracked position, in the same layout as copyIn and copyInString. A
+	// writer over a fixed span throws std::range_error rather than overrun it. A writer over a
+	// std::string appends to it, growing it as needed, and finish() trims it to what was written.
+	// Writers with checked false skip the per-write capacity checks, for buffers given enough room
+	// up front with a single reserve().
+	template<bool checked=true> class BufferWriter {
+	public:
+		char* data;
+		unsigned int position, capacity;
+		std::string* output;
+		
+		BufferWriter(std::span<char> buffer) {
+			this->data = buffer.data();
+			this->position = 0;
+			this->capacity = buffer.size();
+			this->output = nullptr;
+		}
+		
+		BufferWriter(std::string* output) {
+			this->output = output;
+			this->position = output->size();
+			this->data = output->data();
+			this->capacity = output->size();
+		}
+		
+		// Makes room for bytes more. Always checked, whatever the writer's checked setting.
+		void reserve(unsigned int bytes) {
+			if((unsigned long long)this->position + bytes <= this->capacity)
+				return;
+			if(this->output == nullptr)
+				throw std::range_error("BufferWriter capacity exceeded");
+			this->output->resize(std::max<size_t>((size_t)this->position + bytes, (size_t)this->capacity * 2));
+			this->data = this->output->data();
+			this->capacity = this->output->size();
+		}
+		
+		template<class T> void write(T value) {
+			this->require(sizeof(T));
+			this->position += copyIn(this->data, this->position, value);
+		}
+		
+		template<class T> void writeArray(const T* values, unsigned int length) {
+			this->require(length * sizeof(T));
+			this->position += copyInArray(this->data, this->position, values, length);
+		}
+		
+		// a 4 byte length then the bytes, as copyInString writes them
+		void writeString(std::string_view in) {
+			int length = in.size();
+			this->require(sizeof(length) + length);
+			this->position += copyIn(this->data, this->position, length);
+			if(length != 0)
+				this->position += copyInArray(this->data, this->position, in.data(), length);
+		}
+		
+		template<class T> void writeVarint(T value) {
+			this->require(varintSize(value));
+			this->position += copyInVarint(this->data, this->position, value);
+		}
+		
+		template<class T> void writeVarintDelta(T value, T reference) {
+			using U = std::make_unsigned_t<T>;
+			this->writeVarint((std::make_signed_t<T>)((U)value - (U)reference));
+		}
+		
+		// a varint length then the bytes, as copyInVarintString writes them
+		void writeVarintString(std::string_view in) {
+			unsigned int length = in.size();
+			this->require(varintSize(length) + length);
+			this->position += copyInVarintString(this->data, this->position, in);
+		}
+		
+		std::string_view view() {
+			return std::string_view(this->data, this->position);
+		}
+		
+		// Trims a string output to the bytes written. Must be called before the string is used.
+		void finish() {
+			if(this->output != nullptr) {
+				this->output->resize(this->position);
+				this->capacity = this->position;
+			}
+		}
+		
+	private:
+		void require(unsigned int bytes) {
+			if constexpr(checked)
+				this->reserve(bytes);
+		}
+	};
+	
+	// Reads values written by copyIn, copyInString or a BufferWriter, tracking the position.
+	// Reading past the end throws std::range_error, including string lengths from the wire that
+	// overrun it. Strings are returned as views into the buffer, which must outlive them.
+	// Readers with checked false skip the checks, for buffers the process wrote itself.
+	template<bool checked=true> class BufferReader {
+	public:
+		const char* data;
+		unsigned int position, length;
+		
+		BufferReader(std::string_view buffer) {
+			this->data = buffer.data();
+			this->position = 0;
+			this->length = buffer.size();
+		}
+		
+		// Throws unless bytes more can be read. Always checked, so one call can cover several
+		// reads of an unchecked reader.
+		void require(unsigned long long bytes) {
+			if(bytes > this->length - this->position)
+				throw std::range_error("BufferReader read past the end");
+		}
+		
+		template<class T> T read() {
+			T value;
+			this->read(&value);
+			return value;
+		}
+		
+		template<class T> void read(T* out) {
+			this->check(sizeof(T));
+			this->position += copyOut(out, (void*)this->data, this->position);
+		}
+		
+		template<class T> void readArray(T* out, unsigned int count) {
+			this->check((unsigned long long)count * sizeof(T));
+			this->position += copyOutArray(out, (void*)this->data, this->position, count);
+		}
+		
+		std::string_view readString() {
+			int string_length = this->read<int>();
+			if(string_length < 0)
+				throw std::range_error("BufferReader negative string length");
+			return this->readBytes(string_length);
+		}
+		
+		// Varints are decoded from the bytes remaining, so a truncated one throws rather than
+		// reading past the end. Values too large for T throw too.
+		template<class T> T readVarint() {
+			T value;
+			this->readVarint(&value);
+			return value;
+		}
+		
+		template<class T> void readVarint(T* out) {
+			unsigned int available = VARINT_MAX_BYTES;
+			if constexpr(checked)
+				available = this->remaining();
+			unsigned long long value;
+			auto length = decodeVarint((const uint8_t*)this->data + this->position, available, &value);
+			if(length == 0)
+				throw std::range_error("BufferReader malformed varint");
+			*out = varintCast<T>(value);
+			this->position += length;
+		}
+		
+		template<class T> T readVarintDelta(T reference) {
+			using U = std::make_unsigned_t<T>;
+			auto delta = this->readVarint<std::make_signed_t<T>>();
+			return (T)((U)reference + (U)delta);
+		}
+		
+		std::string_view readVarintString() {
+			return this->readBytes(this->readVarint<unsigned int>());
+		}
+		
+		std::string_view readBytes(unsigned int count) {
+			this->check(count);
+			std::string_view bytes(this->data + this->position, count);
+			this->position += count;
+			return bytes;
+		}
+		
+		void skip(unsigned int count) {
+			this->check(count);
+			this->position += count;
+		}
+		
+		unsigned int remaining() {
+			return this->length - this->position;
+		}
+		
+	private:
+		void check(unsigned long long bytes) {
+			if constexpr(checked)
+				this->require(bytes);
+		}
+	};
+	
+	// Packs values of any bit width into a std::string, least significant bit first, so bools
+	// come out in the same layout as copyInBV's packed bytes. Bits gather in a 64 bit scratch
+	// word that is stored to the output a whole word at a time. finish() stores the last partial
+	// word, trimmed to whole bytes, and must be called before the output is used.
+	class BitWriter {
+	public:
+		std::string* output;
+		char* buffer; // output's data, and its size
+		size_t capacity;
+		unsigned int position; // bytes of output filled
+		unsigned long long scratch;
+		unsigned int scratch_bits;
+		
+		BitWriter(std::string* output) {
+			this->output = output;
+			this->buffer = output->data();
+			this->capacity = output->size();
+			this->position = output->size();
+			this->scratch = 0;
+			this->scratch_bits = 0;
+		}
+		
+		// writes the low bits of value, 0 to 64 of them
+		void writeBits(unsigned long long value, unsigned int bits) {
+			value &= bitMask(bits);
+			this->scratch |= value << this->scratch_bits;
+			unsigned int total = this->scratch_bits + bits;
+			if(total < 64) {
+				this->scratch_bits = total;
+				return;
+			}
+			this->storeWord();
+			// the bits of value that didn't fit in the word just stored
+			this->scratch = this->scratch_bits == 0 ? 0 : value >> (64 - this->scratch_bits);
+			this->scratch_bits = total - 64;
+		}
+		
+		// Writes count values of the same width, up to 32 bits, keeping the scratch word in
+		// registers and checking the output's capacity once
+		void writeBitsArray(const unsigned int* values, size_t count, unsigned int bits) {
+			size_t end = this->position + ((unsigned long long)this->scratch_bits + (unsigned long long)count * bits) / 64 * 8;
+			if(end + 8 > this->capacity) {
+				this->output->resize(std::max<size_t>(end + 8, this->capacity * 2));
+				this->buffer = this->output->data();
+				this->capacity = this->output->size();
+			}
+			char* word = this->buffer + this->position;
+			unsigned long long scratch = this->scratch, mask = bitMask(bits);
+			unsigned int scratch_bits = this->scratch_bits;
+			// values go in pairs, joined into one field of up to 64 bits
+			for(size_t i=0; i<count; i+=2) {
+				unsigned long long value = values[i] & mask;
+				unsigned int value_bits = bits;
+				if(i + 1 < count) {
+					value |= (values[i + 1] & mask) << bits;
+					value_bits = 2 * bits;
+				}
+				scratch |= value << scratch_bits;
+				if(scratch_bits + value_bits >= 64) {
+					std::memcpy(word, &scratch, 8);
+					word += 8;
+					// the bits that didn't fit, shifting in two steps as they may be none
+					scratch = (value >> 1) >> (63 - scratch_bits);
+					scratch_bits += value_bits - 64;
+				} else {
+					scratch_bits += value_bits;
+				}
+			}
+			this->position = word - this->buffer;
+			this->scratch = scratch;
+			this->scratch_bits = scratch_bits;
+		}
+		
+		void writeBool(bool value) {
+			this->writeBits(value, 1);
+		}
+		
+		// any number of bools, gathered 64 to a word
+		void writeBools(const bool* values, unsigned int count) {
+			while(count > 0) {
+				unsigned int n = std::min(count, 64U);
+				unsigned long long word = 0;
+				for(unsigned int i=0; i<n; i++)
+					word |= (unsigned long long)values[i] << i;
+				this->writeBits(word, n);
+				values += n;
+				count -= n;
+			}
+		}
+		
+		// Writes value in the fewest bits that hold every value from min to max. Throws
+		// std::range_error for values outside it.
+		void writeRanged(long long value, long long min, long long max) {
+			if(value < min || value > max)
+				throw std::range_error("BitWriter value out of range");
+			this->writeBits((unsigned long long)value - min, bitsRequired((unsigned long long)max - min));
+		}
+		
+		// pads with zeros to the next byte boundary
+		void align() {
+			this->writeBits(0, (8 - this->scratch_bits % 8) % 8);
+		}
+		
+		unsigned long long bitsWritten() {
+			return (unsigned long long)this->position * 8 + this->scratch_bits;
+		}
+		
+		void finish() {
+			unsigned int bytes = (this->scratch_bits + 7) / 8;
+			this->storeWord();
+			this->position -= 8 - bytes;
+			this->output->resize(this->position);
+			this->buffer = this->output->data();
+			this->capacity = this->position;
+			this->scratch = 0;
+			this->scratch_bits = 0;
+		}
+		
+	private:
+		void storeWord() {
+			if(this->position + 8 > this->capacity) [[unlikely]] {
+				this->output->resize(std::max<size_t>(this->position + 8, this->capacity * 2));
+				this->buffer = this->output->data();
+				this->capacity = this->output->size();
+			}
+			std::memcpy(this->buffer + this->position, &this->scratch, 8);
+			this->position += 8;
+		}
+	};
+	
+	// Reads values written by a BitWriter. Whole words are loaded into the scratch word while at
+	// least 8 bytes remain. Reading past the end throws std::range_error, as do ranged values
+	// beyond their maximum.
+	class BitReader {
+	public:
+		const char* data;
+		unsigned int length, position; // in bytes, position is the next byte to load
+		unsigned long long scratch;
+		unsigned int scratch_bits;
+		
+		BitReader(std::string_view buffer) {
+			this->data = buffer.data();
+			this->length = buffer.size();
+			this->position = 0;
+			this->scratch = 0;
+			this->scratch_bits = 0;
+		}
+		
+		unsigned long long readBits(unsigned int bits) {
+			if(bits <= this->scratch_bits) {
+				unsigned long long value = this->scratch & bitMask(bits);
+				this->scratch = bits >= 64 ? 0 : this->scratch >> bits;
+				this->scratch_bits -= bits;
+				return value;
+			}
+			
+			// the scratch word's remaining bits are the low bits of the value
+			unsigned long long value = this->scratch;
+			unsigned int have = this->scratch_bits;
+			unsigned int loaded = this->loadWord();
+			unsigned int needed = bits - have;
+			if(loaded < needed)
+				throw std::range_error("BitReader read past the end");
+			value |= (this->scratch & bitMask(needed)) << have;
+			this->scratch = needed >= 64 ? 0 : this->scratch >> needed;
+			this->scratch_bits = loaded - needed;
+			return value;
+		}
+		
+		void readBitsArray(unsigned int* out, size_t count, unsigned int bits) {
+			for(size_t i=0; i<count; i++)
+				out[i] = this->readBits(bits);
+		}
+		
+		bool readBool() {
+			return this->readBits(1) != 0;
+		}
+		
+		void readBools(bool* values, unsigned int count) {
+			while(count > 0) {
+				unsigned int n = std::min(count, 64U);
+				unsigned long long word = this->readBits(n);
+				for(unsigned int i=0; i<n; i++)
+					values[i] = (word >> i) & 1;
+				values += n;
+				count -= n;
+			}
+		}
+		
+		long long readRanged(long long min, long long max) {
+			unsigned long long offset = this->readBits(bitsRequired((unsigned long long)max - min));
+			if(offset > (unsigned long long)max - min)
+				throw std::range_error("BitReader value out of range");
+			return min + (long long)offset;
+		}
+		
+		void align() {
+			this->readBits(this->scratch_bits % 8);
+		}
+		
+	private:
+		// loads the next word into scratch, returning how many bits it holds
+		unsigned int loadWord() {
+			unsigned int remaining = this->length - this->position;
+			if(remaining >= 8) {
+				std::memcpy(&this->scratch, this->data + this->position, 8);
+				this->position += 8;
+				return 64;
+			}
+			this->scratch = 0;
+			std::memcpy(&this->scratch, this->data + this->position, remaining);
+			this->position += remaining;
+			return remaining * 8;
+		}
+	};
+	
+	// Fast non-cryptographic 64-bit hash of a block of data (xxHash64)
+	unsigned long long hashData(const void* data, unsigned int length, unsigned long long seed=0);
+	
 	int serializationUnitTest();
 };
\ No newline at end of file
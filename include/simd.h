@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+#include "datatypes.h"
+
+namespace razor {
+	// Instruction sets the batch kernels can use. The library is built for the baseline target,
+	// so wider kernels are compiled per function and picked at runtime by the CPU's support.
+	enum SimdLevel {
+		SIMD_SCALAR,
+		SIMD_SSE4, // SSE4.1
+		SIMD_AVX2
+	};
+	
+	// The widest level this CPU supports
+	SimdLevel detectSimdLevel();
+	
+	// The level kernels run at, the detected one unless lowered
+	SimdLevel simdLevel();
+	
+	// Lowers the level kernels run at, for testing and benchmarking the narrower kernels. Levels
+	// the CPU doesn't support are capped to the detected one. Returns the level set.
+	SimdLevel setSimdLevel(SimdLevel level);
+	
+	// Quantizes count floats with the same quantization. Quantizations over 24 bits, finer than
+	// a float's precision, are done one at a time.
+	void quantizeFloats(const float* values, size_t count, const Quantization &quantization, unsigned int* out);
+	
+	// Each quaternion's smallest-three encoding in writeQuaternion's format, in one value of
+	// 2 + 3 * component_bits bits, each component to within a step of writeQuaternion's.
+	// component_bits must be at most 10.
+	void quantizeQuaternions(const Quaternion* values, size_t count, unsigned int component_bits, unsigned int* out);
+	
+	// out = a ^ b, byte by byte. out may be either input.
+	void xorBuffers(const char* a, const char* b, char* out, size_t length);
+	
+	// The index of the first byte that differs, or length if none do
+	size_t firstDifference(const char* a, const char* b, size_t length);
+	
+	// The index of the first word that isn't zero, or count if all are, for skipping the clear
+	// stretches of a bitmask
+	size_t firstNonZero(const unsigned long long* words, size_t count);
+	
+	int simdUnitTest();
+}
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <tuple>
+#include <array>
+#include <string>
+#include <limits>
+#include <utility>
+#include <type_traits>
+
+#include "serialization.h"
+#include "datatypes.h"
+
+namespace razor {
+	// Structs become syncable by listing their synced members once, as a tuple of member pointers:
+	//
+	//     struct Player {
+	//         int id;
+	//         float health;
+	//         Vector3 position;
+	//         std::string name;
+	//         static constexpr auto syncable_fields = std::make_tuple(
+	//             &Player::id, &Player::health, &Player::position, &Player::name);
+	//     };
+	//
+	// The templates below expand each operation over the fields at compile time, so encoding a
+	// struct is the same straight-line sequence of copies a hand-written serializer would be.
+	// Fields may be arithmetic types and enums, bools, Vector3, Quaternion, std::string,
+	// std::array of any of these, and other syncable structs. Enums need a fixed underlying type.
+	//
+	// Decoding throws std::range_error for bools other than 0 or 1, and for enums outside the
+	// range SyncableEnumRange gives them, so values from the network are always valid.
+	
+	// Most fields a syncable struct can have, one bit each in a delta's change mask
+	inline constexpr auto SYNCABLE_MAX_FIELDS = 64;
+	
+	template<class T> concept Syncable = requires {
+		std::tuple_size<std::remove_cvref_t<decltype(T::syncable_fields)>>::value;
+	};
+	
+	template<class T> struct SyncableField;
+	
+	// The values an enum field may decode to, its whole underlying type unless specialized:
+	//
+	//     template<> struct SyncableEnumRange<Team> {
+	//         static constexpr Team min = TEAM_RED, max = TEAM_BLUE;
+	//     };
+	template<class T> struct SyncableEnumRange {
+		static constexpr auto min = (T)std::numeric_limits<std::underlying_type_t<T>>::min();
+		static constexpr auto max = (T)std::numeric_limits<std::underlying_type_t<T>>::max();
+	};
+	
+	// Fixed-size values copied as their bytes, as copyIn does
+	template<class T> requires (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) ||
+			std::is_same_v<T, Vector3> || std::is_same_v<T, Quaternion>
+	struct SyncableField<T> {
+		static constexpr bool fixed = true;
+		static constexpr size_t size = sizeof(T);
+		
+		static size_t encodedSize(const T &) {
+			return size;
+		}
+		
+		template<bool checked> static void encode(const T &value, BufferWriter<checked> &out) {
+			out.write(value);
+		}
+		
+		template<bool checked> static void decode(T *value, BufferReader<checked> &in) {
+			in.read(value);
+		}
+		
+		// bitwise, so that floats compare equal exactly when they encode the same
+		static bool equal(const T &a, const T &b) {
+			return std::memcmp(&a, &b, sizeof(T)) == 0;
+		}
+		
+		static unsigned long long hash(const T &value, unsigned long long seed) {
+			return hashData(&value, sizeof(T), seed);
+		}
+	};
+	
+	// A byte, 0 or 1
+	template<> struct SyncableField<bool> {
+		static constexpr bool fixed = true;
+		static constexpr size_t size = 1;
+		
+		static size_t encodedSize(const bool &) {
+			return size;
+		}
+		
+		template<bool checked> static void encode(const bool &value, BufferWriter<checked> &out) {
+			out.write((unsigned char)value);
+		}
+		
+		template<bool checked> static void decode(bool *value, BufferReader<checked> &in) {
+			auto byte = in.template read<unsigned char>();
+			if(byte > 1)
+				throw std::range_error("Syncable bool out of range");
+			*value = byte;
+		}
+		
+		static bool equal(const bool &a, const bool &b) {
+			return a == b;
+		}
+		
+		static unsigned long long hash(const bool &value, unsigned long long seed) {
+			unsigned char byte = value;
+			return hashData(&byte, 1, seed);
+		}
+	};
+	
+	// The underlying value. Enums without a fixed underlying type can't hold every value of it,
+	// so they aren't allowed.
+	template<class T> requires std::is_enum_v<T>
+	struct SyncableField<T> {
+		typedef std::underlying_type_t<T> U;
+		static_assert(requires { T{U{}}; }, "Syncable enums need a fixed underlying type");
+		
+		static constexpr bool fixed = true;
+		static constexpr size_t size = sizeof(U);
+		
+		static size_t encodedSize(const T &) {
+			return size;
+		}
+		
+		template<bool checked> static void encode(const T &value, BufferWriter<checked> &out) {
+			out.write((U)value);
+		}
+		
+		template<bool checked> static void decode(T *value, BufferReader<checked> &in) {
+			auto underlying = in.template read<U>();
+			if(underlying < (U)SyncableEnumRange<T>::min || underlying > (U)SyncableEnumRange<T>::max)
+				throw std::range_error("Syncable enum out of range");
+			*value = (T)underlying;
+		}
+		
+		static bool equal(const T &a, const T &b) {
+			return a == b;
+		}
+		
+		static unsigned long long hash(const T &value, unsigned long long seed) {
+			U underlying = (U)value;
+			return hashData(&underlying, sizeof(U), seed);
+		}
+	};
+	
+	// A varint length then the bytes
+	template<> struct SyncableField<std::string> {
+		static constexpr bool fixed = false;
+		static constexpr size_t size = 0;
+		
+		static size_t encodedSize(const std::string &value) {
+			return varintSize((unsigned int)value.size()) + value.size();
+		}
+		
+		template<bool checked> static void encode(const std::string &value, BufferWriter<checked> &out) {
+			out.writeVarintString(value);
+		}
+		
+		template<bool checked> static void decode(std::string *value, BufferReader<checked> &in) {
+			value->assign(in.readVarintString());
+		}
+		
+		static bool equal(const std::string &a, const std::string &b) {
+			return a == b;
+		}
+		
+		static unsigned long long hash(const std::string &value, unsigned long long seed) {
+			return hashData(value.data(), value.size(), seed + value.size());
+		}
+	};
+	
+	template<class T, size_t N> struct SyncableField<std::array<T, N>> {
+		static constexpr bool fixed = SyncableField<T>::fixed;
+		static constexpr size_t size = SyncableField<T>::size * N;
+		
+		static size_t encodedSize(const std::array<T, N> &value) {
+			if constexpr(fixed) {
+				return size;
+			} else {
+				size_t total = 0;
+				for(auto &element : value)
+					total += SyncableField<T>::encodedSize(element);
+				return total;
+			}
+		}
+		
+		template<bool checked> static void encode(const std::array<T, N> &value, BufferWriter<checked> &out) {
+			for(auto &element : value)
+				SyncableField<T>::encode(element, out);
+		}
+		
+		template<bool checked> static void decode(std::array<T, N> *value, BufferReader<checked> &in) {
+			for(auto &element : *value)
+				SyncableField<T>::decode(&element, in);
+		}
+		
+		static bool equal(const std::array<T, N> &a, const std::array<T, N> &b) {
+			for(size_t i=0; i<N; i++) {
+				if(!SyncableField<T>::equal(a[i], b[i]))
+					return false;
+			}
+			return true;
+		}
+		
+		static unsigned long long hash(const std::array<T, N> &value, unsigned long long seed) {
+			for(auto &element : value)
+				seed = SyncableField<T>::hash(element, seed);
+			return seed;
+		}
+	};
+	
+	// Calls f(index, member pointer) for each of a syncable struct's fields, expanded at compile time
+	template<Syncable T, class F> inline void forEachSyncableField(F &&f) {
+		[&]<size_t... I>(std::index_sequence<I...>) {
+			(f(std::integral_constant<size_t, I>(), std::get<I>(T::syncable_fields)), ...);
+		}(std::make_index_sequence<std::tuple_size_v<std::remove_cvref_t<decltype(T::syncable_fields)>>>());
+	}
+	
+	template<Syncable T> inline constexpr size_t syncableFieldCount() {
+		return std::tuple_size_v<std::remove_cvref_t<decltype(T::syncable_fields)>>;
+	}
+	
+	// The type of a member pointer's member
+	template<class M> struct SyncableMember;
+	template<class C, class V> struct SyncableMember<V C::*> {
+		using type = V;
+	};
+	
+	// Whether every field of a syncable struct has a fixed encoded size
+	template<Syncable T> inline constexpr bool syncableFixed() {
+		return std::apply([](auto... fields) {
+			return (SyncableField<typename SyncableMember<decltype(fields)>::type>::fixed && ...);
+		}, T::syncable_fields);
+	}
+	
+	// The encoded size of a struct whose fields are all fixed size, 0 otherwise
+	template<Syncable T> inline constexpr size_t syncableSize() {
+		return std::apply([](auto... fields) {
+			return (SyncableField<typename SyncableMember<decltype(fields)>::type>::size + ... + 0);
+		}, T::syncable_fields) * syncableFixed<T>();
+	}
+	
+	// Syncable structs nest as fields of others
+	template<Syncable T> struct SyncableField<T> {
+		static constexpr bool fixed = syncableFixed<T>();
+		static constexpr size_t size = syncableSize<T>();
+		
+		static size_t encodedSize(const T &value) {
+			if constexpr(fixed) {
+				return size;
+			} else {
+				return std::apply([&](auto... fields) {
+					return (SyncableField<typename SyncableMember<decltype(fields)>::type>::encodedSize(value.*fields) + ... + 0);
+				}, T::syncable_fields);
+			}
+		}
+		
+		template<bool checked> static void encode(const T &value, BufferWriter<checked> &out) {
+			std::apply([&](auto... fields) {
+				(SyncableField<typename SyncableMember<decltype(fields)>::type>::encode(value.*fields, out), ...);
+			}, T::syncable_fields);
+		}
+		
+		template<bool checked> static void decode(T *value, BufferReader<checked> &in) {
+			std::apply([&](auto... fields) {
+				(SyncableField<typename SyncableMember<decltype(fields)>::type>::decode(&(value->*fields), in), ...);
+			}, T::syncable_fields);
+		}
+		
+		static bool equal(const T &a, const T &b) {
+			return std::apply([&](auto... fields) {
+				return (SyncableField<typename SyncableMember<decltype(fields)>::type>::equal(a.*fields, b.*fields) && ...);
+			}, T::syncable_fields);
+		}
+		
+		static unsigned long long hash(const T &value, unsigned long long seed) {
+			std::apply([&](auto... fields) {
+				((seed = SyncableField<typename SyncableMember<decltype(fields)>::type>::hash(value.*fields, seed)), ...);
+			}, T::syncable_fields);
+			return seed;
+		}
+	};
+	
+	template<Syncable T> inline size_t encodedSize(const T &value) {
+		return SyncableField<T>::encodedSize(value);
+	}
+	
+	// Writes every field in declaration order. A fixed-size struct's capacity is checked once.
+	template<Syncable T, bool checked> inline void encode(const T &value, BufferWriter<checked> &out) {
+		if constexpr(checked && syncableFixed<T>()) {
+			out.reserve(syncableSize<T>());
+			BufferWriter<false> unchecked(std::span<char>(out.data + out.position, syncableSize<T>()));
+			SyncableField<T>::encode(value, unchecked);
+			out.position += syncableSize<T>();
+		} else {
+			SyncableField<T>::encode(value, out);
+		}
+	}
+	
+	// Reads every field in declaration order. Throws std::range_error if the data runs out.
+	template<Syncable T, bool checked> inline void decode(T *value, BufferReader<checked> &in) {
+		if constexpr(checked && syncableFixed<T>()) {
+			in.require(syncableSize<T>());
+			BufferReader<false> unchecked(std::string_view(in.data + in.position, syncableSize<T>()));
+			SyncableField<T>::decode(value, unchecked);
+			in.position += syncableSize<T>();
+		} else {
+			SyncableField<T>::decode(value, in);
+		}
+	}
+	
+	// A mask with bit i set if field i differs
+	template<Syncable T> inline unsigned long long diffFields(const T &a, const T &b) {
+		static_assert(syncableFieldCount<T>() <= SYNCABLE_MAX_FIELDS, "Too many syncable fields for a change mask");
+		unsigned long long mask = 0;
+		forEachSyncableField<T>([&](auto index, auto field) {
+			using V = typename SyncableMember<decltype(field)>::type;
+			if(!SyncableField<V>::equal(a.*field, b.*field))
+				mask |= 1ULL << index;
+		});
+		return mask;
+	}
+	
+	// Writes a varint mask of the fields that differ from reference, then only those fields.
+	// Returns the mask.
+	template<Syncable T, bool checked> inline unsigned long long encodeDelta(const T &value, const T &reference,
+			BufferWriter<checked> &out) {
+		auto mask = diffFields(value, reference);
+		out.writeVarint(mask);
+		forEachSyncableField<T>([&](auto index, auto field) {
+			using V = typename SyncableMember<decltype(field)>::type;
+			if(mask & (1ULL << index))
+				SyncableField<V>::encode(value.*field, out);
+		});
+		return mask;
+	}
+	
+	// Applies a delta to value, which must hold the reference it was encoded against. Returns the
+	// mask of fields changed.
+	template<Syncable T, bool checked> inline unsigned long long decodeDelta(T *value, BufferReader<checked> &in) {
+		auto mask = in.template readVarint<unsigned long long>();
+		if constexpr(syncableFieldCount<T>() < SYNCABLE_MAX_FIELDS) {
+			if(mask >> syncableFieldCount<T>())
+				throw std::range_error("Syncable delta has fields that don't exist");
+		}
+		forEachSyncableField<T>([&](auto index, auto field) {
+			using V = typename SyncableMember<decltype(field)>::type;
+			if(mask & (1ULL << index))
+				SyncableField<V>::decode(&(value->*field), in);
+		});
+		return mask;
+	}
+	
+	// A hash of the fields' values, for comparing states without sending them
+	template<Syncable T> inline unsigned long long hashSyncable(const T &value, unsigned long long seed=0) {
+		return SyncableField<T>::hash(value, seed);
+	}
+	
+	int syncableUnitTest();
+}
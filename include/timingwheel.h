@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include "misc.h"
+
+namespace razor {
+	// Granularity of timer expiry times
+	inline constexpr nanotime TIMING_WHEEL_RESOLUTION = NANOS_PER_MILLI;
+	
+	// Each level of the wheel has 2^TIMING_WHEEL_BITS slots
+	inline constexpr auto TIMING_WHEEL_BITS = 6;
+	inline constexpr auto TIMING_WHEEL_SLOTS = 1 << TIMING_WHEEL_BITS;
+	
+	// Levels of the wheel, each spanning TIMING_WHEEL_SLOTS times the level below. Four levels
+	// of 1ms resolution cover about 4.6 hours; later timers wait in the top level.
+	inline constexpr auto TIMING_WHEEL_LEVELS = 4;
+	
+	// identifies a scheduled timer. 0 is never a valid handle.
+	typedef unsigned long long timerhandle;
+	
+	// Hierarchical timing wheel. Timers are kept in doubly linked lists, one per slot, so
+	// scheduling and cancelling are O(1). Level 0 holds timers due within TIMING_WHEEL_SLOTS
+	// resolution steps, and each step fires one slot. When level 0 wraps, the next level's
+	// current slot is cascaded down into it, so every timer moves at most once per level.
+	class TimingWheel {
+	public:
+		struct Timer {
+			ticktype expires; // in resolution steps
+			unsigned long long data;
+			unsigned int generation; // bumped when the timer fires or is cancelled
+			int slot; // -1 while unused
+			int prev, next; // neighbours in the slot's list, -1 at the ends
+		};
+		
+		nanotime resolution;
+		ticktype current; // the last step fired
+		std::vector<Timer> timers;
+		std::vector<int> free_timers;
+		// head timer of each level's slots, at level * TIMING_WHEEL_SLOTS + slot
+		std::vector<int> slots;
+		unsigned int active;
+		unsigned int active_level0; // timers in level 0, without which whole rotations are skipped
+		
+		TimingWheel(nanotime now=0, nanotime resolution=TIMING_WHEEL_RESOLUTION);
+		
+		void clear(nanotime now);
+		
+		// Timers due at or before the last advance fire on the next one
+		timerhandle schedule(nanotime when, unsigned long long data);
+		// returns false if the timer already fired or was cancelled
+		bool reschedule(timerhandle handle, nanotime when);
+		bool cancel(timerhandle handle);
+		bool pending(timerhandle handle);
+		unsigned int size();
+		
+		// Fires every timer due by now, appending their data in expiry order
+		void advance(nanotime now, std::vector<unsigned long long>* expired);
+		
+	private:
+		int find(timerhandle handle);
+		void link(int index);
+		void unlink(int index);
+		void cascade(int level, unsigned int slot);
+		void release(int index);
+	};
+	
+	int timingWheelUnitTest();
+}
@@ -0,0 +1,253 @@
+#include "clocksync.h"
+
+#include <cmath>
+#include <random>
+#include <iostream>
+
+namespace razor {
+	ClockSync::ClockSync() {
+		this->clear();
+	}
+	
+	void ClockSync::clear() {
+		this->samples.clear();
+		this->offset = 0;
+		this->skew = 0;
+		this->reference_time = 0;
+	}
+	
+	void ClockSync::addSample(nanotime request_sent, nanotime request_received,
+			nanotime reply_sent, nanotime reply_received) {
+		// the remote's hold time is measured on its own clock, so it can't make the round trip negative
+		nanotimediff held = reply_sent - request_received;
+		nanotimediff round_trip = reply_received - request_sent;
+		if(held < 0 || held > round_trip)
+			held = 0;
+		
+		Sample s;
+		s.local_time = request_sent + (reply_received - request_sent) / 2;
+		s.offset = ((nanotimediff)(request_received - request_sent) + (nanotimediff)(reply_sent - reply_received)) / 2;
+		s.round_trip = round_trip - held;
+		
+		while(this->samples.size() >= CLOCK_SYNC_WINDOW)
+			this->samples.pop_front();
+		this->samples.push_back(s);
+		
+		this->estimate();
+	}
+	
+	// Weighted least squares fit of offset over local time. A sample's offset is off by at most half
+	// of how much its round trip exceeds the lowest, so it's weighted by the inverse square of that.
+	void ClockSync::estimate() {
+		nanotime min_round_trip = this->minRoundTrip();
+		this->reference_time = this->samples.back().local_time;
+		
+		double total_weight = 0, mean_time = 0, mean_offset = 0;
+		for(auto &s : this->samples) {
+			double error = (s.round_trip - min_round_trip) / 2.0 + CLOCK_SYNC_ERROR_FLOOR;
+			double weight = 1.0 / (error * error);
+			total_weight += weight;
+			mean_time += weight * (nanotimediff)(s.local_time - this->reference_time);
+			mean_offset += weight * s.offset;
+		}
+		mean_time /= total_weight;
+		mean_offset /= total_weight;
+		
+		double covariance = 0, variance = 0;
+		for(auto &s : this->samples) {
+			double error = (s.round_trip - min_round_trip) / 2.0 + CLOCK_SYNC_ERROR_FLOOR;
+			double weight = 1.0 / (error * error);
+			double dt = (nanotimediff)(s.local_time - this->reference_time) - mean_time;
+			covariance += weight * dt * (s.offset - mean_offset);
+			variance += weight * dt * dt;
+		}
+		
+		// a drift fitted over too short a time is noise
+		this->skew = 0;
+		if(this->samples.size() >= CLOCK_SYNC_MIN_SKEW_SAMPLES && variance > 0)
+			this->skew = std::clamp(covariance / variance, -CLOCK_SYNC_MAX_SKEW, CLOCK_SYNC_MAX_SKEW);
+		this->offset = mean_offset - this->skew * mean_time;
+	}
+	
+	nanotimediff ClockSync::offsetAt(nanotime local_time) {
+		return this->offset + this->skew * (nanotimediff)(local_time - this->reference_time);
+	}
+	
+	nanotime ClockSync::minRoundTrip() {
+		return this->roundTripPercentile(0);
+	}
+	
+	nanotime ClockSync::roundTripPercentile(float fraction) {
+		if(this->samples.size() == 0)
+			return 0;
+		
+		std::vector<nanotime> round_trips;
+		for(auto &s : this->samples) {
+			round_trips.push_back(s.round_trip);
+		}
+		size_t index = std::min<size_t>(round_trips.size() - 1, fraction * round_trips.size());
+		std::nth_element(round_trips.begin(), round_trips.begin() + index, round_trips.end());
+		return round_trips[index];
+	}
+	
+	LeadController::LeadController() {
+		this->clear();
+	}
+	
+	void LeadController::clear() {
+		this->margins.clear();
+		this->lead = 0;
+		this->target = 0;
+		this->last_step = 0;
+		this->sent_leads.assign(LEAD_HISTORY_TICKS, {0, 0});
+	}
+	
+	void LeadController::recordLead(ticktype tick_number) {
+		this->sent_leads[tick_number % this->sent_leads.size()] = {tick_number, this->lead};
+	}
+	
+	// The lead has slewed since the command was sent, by at least a round trip's worth
+	void LeadController::addMargin(ticktype tick_number, nanotimediff margin) {
+		auto &sent = this->sent_leads[tick_number % this->sent_leads.size()];
+		if(sent.first != tick_number)
+			return;
+		while(this->margins.size() >= LEAD_WINDOW)
+			this->margins.pop_front();
+		this->margins.push_back(margin - sent.second);
+		
+		std::vector<nanotimediff> sorted(this->margins.begin(), this->margins.end());
+		size_t index = LEAD_LATE_FRACTION * sorted.size();
+		std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+		this->target = LEAD_SAFETY_MARGIN - sorted[index];
+	}
+	
+	bool LeadController::ready() {
+		return this->margins.size() >= LEAD_MIN_SAMPLES;
+	}
+	
+	nanotimediff LeadController::step(nanotime now) {
+		if(this->last_step != 0 && now > this->last_step) {
+			nanotimediff max_change = LEAD_SLEW_RATE * (now - this->last_step);
+			this->lead += std::clamp(this->target - this->lead, -max_change, max_change);
+		}
+		this->last_step = now;
+		return this->lead;
+	}
+	
+	// Simulates pings to a remote clock that is offset and drifting, over a link with a fixed
+	// delay plus random queueing of up to jitter each way and occasional spikes. Returns the
+	// largest offset error of the estimator, and of the mean of raw offsets, after warming up.
+	static void simulateClockSync(nanotime jitter, unsigned int seed,
+			nanotime* max_error, nanotime* max_mean_error) {
+		const nanotimediff initial_offset = 37 * NANOS_PER_MILLI;
+		const double skew = 100e-6;
+		const nanotime base_delay = 20 * NANOS_PER_MILLI;
+		const nanotime hold = NANOS_PER_MILLI / 2; // the remote's time to its next tick
+		
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<double> uniform(0, 1);
+		auto queueing = [&]() -> nanotime {
+			double r = uniform(random);
+			if(r < 0.3)
+				return 0;
+			if(r < 0.95)
+				return uniform(random) * jitter;
+			return 5 * jitter;
+		};
+		auto remoteTime = [&](nanotime local_time) -> nanotime {
+			return local_time + initial_offset + skew * (double)local_time;
+		};
+		
+		ClockSync cs;
+		std::deque<nanotimediff> raw_offsets;
+		*max_error = 0;
+		*max_mean_error = 0;
+		nanotime now = 0;
+		for(int i=0; i<120; i++, now += NANOS_PER_SECOND) {
+			nanotime sent = now;
+			nanotime request_arrival = sent + base_delay + queueing();
+			nanotime reply_departure = request_arrival + hold;
+			nanotime arrived = reply_departure + base_delay + queueing();
+			cs.addSample(sent, remoteTime(request_arrival), remoteTime(reply_departure), arrived);
+			
+			while(raw_offsets.size() >= CLOCK_SYNC_WINDOW)
+				raw_offsets.pop_front();
+			raw_offsets.push_back(cs.samples.back().offset);
+			
+			if(i < CLOCK_SYNC_WINDOW)
+				continue;
+			
+			nanotimediff truth = remoteTime(arrived) - arrived;
+			nanotimediff error = std::llabs(cs.offsetAt(arrived) - truth);
+			*max_error = std::max<nanotime>(*max_error, error);
+			
+			double mean = 0;
+			for(auto o : raw_offsets) mean += o;
+			mean /= raw_offsets.size();
+			*max_mean_error = std::max<nanotime>(*max_mean_error, std::llabs((nanotimediff)mean - truth));
+		}
+	}
+	
+	int clockSyncUnitTest() {
+		// exact offsets without jitter
+		const nanotime ms = NANOS_PER_MILLI;
+		ClockSync cs;
+		cs.addSample(1*ms, 6*ms, 6.5*ms, 3.5*ms); // remote is 4ms ahead, 1ms each way
+		if(cs.offset != 4*ms) return 1;
+		if(cs.minRoundTrip() != 2*ms) return 2;
+		
+		// high round trip samples barely move the estimate
+		cs.addSample(10*ms, 25*ms, 25*ms, 22*ms);
+		if(std::llabs(cs.offsetAt(10*ms) - (nanotimediff)(4*ms)) > 10'000) return 3;
+		if(cs.roundTripPercentile(1) != 12*ms) return 4;
+		
+		// offset error under simulated jitter stays under a millisecond, and under a plain mean's
+		nanotime jitters[] = {0, 5 * NANOS_PER_MILLI, 20 * NANOS_PER_MILLI, 50 * NANOS_PER_MILLI};
+		for(unsigned int seed=1; seed<=3; seed++) {
+			for(auto jitter : jitters) {
+				nanotime max_error, max_mean_error;
+				simulateClockSync(jitter, seed, &max_error, &max_mean_error);
+				//std::cout << "jitter " << jitter / NANOS_PER_MILLI << "ms: max offset error "
+				//	<< max_error / 1000 << "us, mean estimator " << max_mean_error / 1000 << "us" << std::endl;
+				if(max_error > NANOS_PER_MILLI) return 5;
+				if(jitter > 0 && max_error >= max_mean_error) return 6;
+			}
+		}
+		
+		// The lead settles where 2% of commands arrive inside the safety margin, without jumping.
+		// Margins come back ten ticks after their commands left, while the lead is still slewing.
+		const nanotimediff delay = 40 * ms;
+		LeadController lc;
+		lc.lead = 100 * ms;
+		std::mt19937 random(7);
+		std::uniform_int_distribution<nanotimediff> jitter(0, 10 * ms);
+		std::deque<std::pair<ticktype, nanotimediff>> in_flight;
+		nanotime now = NANOS_PER_SECOND;
+		lc.step(now);
+		for(ticktype tick=1; tick<=2000; tick++) {
+			lc.recordLead(tick);
+			in_flight.push_back({tick, lc.lead - delay - jitter(random)});
+			if(in_flight.size() > 10) {
+				lc.addMargin(in_flight.front().first, in_flight.front().second);
+				in_flight.pop_front();
+			}
+			for(auto margin : lc.margins) {
+				if(margin > -delay || margin < -delay - 10 * (nanotimediff)ms) return 7;
+			}
+			nanotimediff before = lc.lead;
+			now += 16 * ms;
+			lc.step(now);
+			if(std::llabs(lc.lead - before) > LEAD_SLEW_RATE * 16 * ms + 1) return 8;
+		}
+		if(!lc.ready()) return 9;
+		nanotimediff settled = delay + 10 * ms + LEAD_SAFETY_MARGIN;
+		if(std::llabs(lc.lead - settled) > ms) return 10;
+		// margins for ticks that were never sent, or have left the history, are dropped
+		auto kept = lc.margins;
+		lc.addMargin(5000, 0);
+		lc.addMargin(1, 0);
+		if(lc.margins != kept) return 11;
+		
+		return 0;
+	}
+}
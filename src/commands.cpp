@@ -0,0 +1,228 @@
+#include "commands.h"
+
+namespace razor {
+	CommandBuffer::CommandBuffer() {
+		this->slots.resize(COMMAND_BUFFER_TICKS);
+		this->clear();
+	}
+	
+	CommandBuffer::Slot* CommandBuffer::slotFor(ticktype tick_number) {
+		Slot* slot = &this->slots[tick_number % this->slots.size()];
+		if(slot->tick_number == tick_number)
+			return slot;
+		if(slot->tick_number > tick_number)
+			return nullptr; // the tick has already left the buffer
+		
+		// recycle the slot for a newer tick
+		slot->tick_number = tick_number;
+		slot->finalized = false;
+		slot->commands.clear();
+		return slot;
+	}
+	
+	bool CommandBuffer::add(const TickCommand &command) {
+		Slot* slot = this->slotFor(command.tick_number);
+		if(slot == nullptr || slot->finalized)
+			return false;
+		slot->commands.push_back(command);
+		return true;
+	}
+	
+	std::span<const TickCommand> CommandBuffer::finalize(ticktype tick_number) {
+		Slot* slot = this->slotFor(tick_number);
+		if(slot == nullptr)
+			return {};
+		if(!slot->finalized) {
+			std::stable_sort(slot->commands.begin(), slot->commands.end(), 
+				[](const TickCommand &a, const TickCommand &b) {
+					if(a.origin != b.origin)
+						return a.origin < b.origin;
+					return a.seq < b.seq;
+				});
+			slot->finalized = true;
+		}
+		return slot->commands;
+	}
+	
+	void CommandBuffer::assign(ticktype tick_number, std::vector<TickCommand> &&commands) {
+		Slot* slot = this->slotFor(tick_number);
+		if(slot == nullptr)
+			return;
+		slot->commands = std::move(commands);
+		slot->finalized = true;
+	}
+	
+	bool CommandBuffer::isFinalized(ticktype tick_number) {
+		Slot* slot = &this->slots[tick_number % this->slots.size()];
+		return slot->tick_number == tick_number && slot->finalized;
+	}
+	
+	std::span<const TickCommand> CommandBuffer::commandsForTick(ticktype tick_number) {
+		Slot* slot = &this->slots[tick_number % this->slots.size()];
+		if(slot->tick_number != tick_number)
+			return {};
+		return slot->commands;
+	}
+	
+	void CommandBuffer::clear() {
+		for(auto &slot : this->slots) {
+			slot.tick_number = 0;
+			slot.finalized = false;
+			slot.commands.clear();
+		}
+	}
+	
+	bool CommandRegistry::isEncoded(std::string_view command) {
+		return command.size() > 0 && command[0] == COMMAND_OPCODE_MARKER;
+	}
+	
+	bool CommandRegistry::readOpcode(BufferReader<> &in, unsigned int* opcode) {
+		if(in.read<char>() != COMMAND_OPCODE_MARKER)
+			return false;
+		in.readVarint(opcode);
+		return true;
+	}
+	
+	const std::string& CommandRegistry::name(unsigned int opcode) {
+		static const std::string unknown;
+		return opcode < this->entries.size() ? this->entries[opcode].name : unknown;
+	}
+	
+	bool CommandRegistry::dispatch(const TickCommand &command) {
+		if(!CommandRegistry::isEncoded(command.command))
+			return false;
+		try {
+			BufferReader<> in(command.command);
+			unsigned int opcode;
+			CommandRegistry::readOpcode(in, &opcode);
+			if(opcode >= this->entries.size())
+				return false;
+			auto &entry = this->entries[opcode];
+			return entry.dispatch(entry.handler, command, in);
+		} catch(std::range_error &e) {
+			return false;
+		}
+	}
+	
+	bool CommandRegistry::validate(std::string_view command) {
+		if(!CommandRegistry::isEncoded(command))
+			return true;
+		try {
+			BufferReader<> in(command);
+			unsigned int opcode;
+			CommandRegistry::readOpcode(in, &opcode);
+			return opcode < this->entries.size() && this->entries[opcode].validate(in);
+		} catch(std::range_error &e) {
+			return false;
+		}
+	}
+	
+	void CommandRegistry::clear() {
+		this->entries.clear();
+		this->opcodes.clear();
+	}
+	
+	// Each name's length goes into the seed, so names can't run together
+	unsigned long long CommandRegistry::hash() {
+		unsigned long long hash = 0;
+		for(auto &entry : this->entries)
+			hash = hashData(entry.name.data(), entry.name.size(), hash + entry.name.size());
+		return hash;
+	}
+	
+	struct TestMoveCommand {
+		unsigned int unit;
+		Vector3 target;
+		bool queued;
+		static constexpr auto syncable_fields = std::make_tuple(&TestMoveCommand::unit,
+			&TestMoveCommand::target, &TestMoveCommand::queued);
+	};
+	
+	struct TestChatCommand {
+		std::string text;
+		static constexpr auto syncable_fields = std::make_tuple(&TestChatCommand::text);
+	};
+	
+	std::vector<std::string> test_handled_commands;
+	
+	void testMoveHandler(const TickCommand &command, const TestMoveCommand &move) {
+		test_handled_commands.push_back(command.origin + " move " + std::to_string(move.unit) + " " +
+			std::to_string((int)move.target.x) + (move.queued ? " queued" : ""));
+	}
+	
+	// Returns 0 on success. Otherwise returns the number of the test that failed.
+	int commandsUnitTest() {
+		CommandBuffer b;
+		
+		// commands arrive out of order from two slaves
+		if(!b.add({10, "10.0.0.2:1000", 2, "b2"})) return 1;
+		if(!b.add({10, "10.0.0.1:1000", 1, "a1"})) return 2;
+		if(!b.add({10, "10.0.0.2:1000", 1, "b1"})) return 3;
+		if(!b.add({11, "10.0.0.1:1000", 2, "a2"})) return 4;
+		
+		auto commands = b.finalize(10);
+		if(commands.size() != 3) return 5;
+		if(commands[0].command != "a1" || commands[1].command != "b1" || 
+				commands[2].command != "b2") return 6;
+		
+		// finalized ticks can't change
+		if(b.add({10, "10.0.0.1:1000", 3, "late"})) return 7;
+		if(b.commandsForTick(10).size() != 3) return 8;
+		if(!b.isFinalized(10) || b.isFinalized(11)) return 9;
+		if(b.commandsForTick(11).size() != 1) return 10;
+		
+		// ticks that have left the buffer are rejected
+		if(!b.add({10 + COMMAND_BUFFER_TICKS, "10.0.0.1:1000", 4, "far"})) return 11;
+		if(b.add({10, "10.0.0.1:1000", 5, "old"})) return 12;
+		if(b.commandsForTick(10).size() != 0) return 13;
+		
+		// assigned lists keep the daemon's order
+		std::vector<TickCommand> received;
+		received.push_back({20, "", 0, "z"});
+		received.push_back({20, "", 0, "y"});
+		b.assign(20, std::move(received));
+		if(!b.isFinalized(20)) return 14;
+		if(b.commandsForTick(20)[0].command != "z") return 15;
+		
+		// registered commands are a marker, an opcode and the packed fields
+		CommandRegistry registry;
+		if(registry.add<TestMoveCommand>("move", &testMoveHandler) != 0 || registry.add<TestChatCommand>("chat") != 1) return 16;
+		try {
+			registry.add<TestChatCommand>("chat again");
+			return 17;
+		} catch(std::runtime_error &e) {}
+		auto move = registry.encode(TestMoveCommand{42, {100, 5, 0}, true});
+		if(move.size() != 2 + 4 + 12 + 1 || !CommandRegistry::isEncoded(move) || registry.name(0) != "move") return 18;
+		if(!registry.dispatch({30, "10.0.0.1:1000", 1, move}) ||
+				test_handled_commands != std::vector<std::string>({"10.0.0.1:1000 move 42 100 queued"})) return 19;
+		
+		TestChatCommand chat;
+		auto chat_command = registry.encode(TestChatCommand{"gg"});
+		if(!registry.decode(chat_command, &chat) || chat.text != "gg") return 20;
+		TestMoveCommand wrong_type;
+		if(registry.decode(chat_command, &wrong_type) || registry.dispatch({30, "LOCAL", 2, chat_command})) return 21;
+		
+		// text passes validation untouched, and unknown or malformed commands don't
+		if(!registry.validate("player add") || registry.dispatch({30, "LOCAL", 3, "player add"})) return 22;
+		if(!registry.validate(move) || registry.validate(move.substr(0, move.size() - 1)) ||
+				registry.validate(move + "x") || registry.validate(std::string("\0\x05", 2))) return 23;
+		if(test_handled_commands.size() != 1) return 24;
+		
+		// the hash tells registries with the same names in another order apart
+		CommandRegistry swapped;
+		swapped.add<TestChatCommand>("chat");
+		swapped.add<TestMoveCommand>("move");
+		if(swapped.hash() == registry.hash() || CommandRegistry().hash() == registry.hash()) return 25;
+		swapped.clear();
+		swapped.add<TestMoveCommand>("move");
+		swapped.add<TestChatCommand>("chat");
+		if(swapped.hash() != registry.hash()) return 26;
+		
+		// fields that decode to invalid values fail validation rather than reaching a handler
+		auto invalid_bool = move;
+		invalid_bool.back() = 2;
+		if(registry.validate(invalid_bool) || registry.dispatch({30, "LOCAL", 4, invalid_bool})) return 27;
+		
+		return 0;
+	}
+}
@@ -0,0 +1,262 @@
+#include "compression.h"
+
+#include <bit>
+#include <random>
+
+namespace razor {
+	size_t compressBound(size_t length) {
+		return length + length / 255 + 16;
+	}
+	
+	static inline unsigned int read32(const char* p) {
+		unsigned int value;
+		std::memcpy(&value, p, 4);
+		return value;
+	}
+	
+	static inline unsigned int compressionHash(unsigned int sequence) {
+		return (sequence * 2654435761U) >> (32 - COMPRESSION_HASH_LOG);
+	}
+	
+	// Counts matching bytes a word at a time
+	static inline size_t matchLength(const char* a, const char* b, const char* limit) {
+		const char* start = a;
+		while(a + 8 <= limit) {
+			unsigned long long wa, wb;
+			std::memcpy(&wa, a, 8);
+			std::memcpy(&wb, b, 8);
+			if(wa != wb)
+				return a - start + std::countr_zero(wa ^ wb) / 8;
+			a += 8;
+			b += 8;
+		}
+		while(a < limit && *a == *b) {
+			a++;
+			b++;
+		}
+		return a - start;
+	}
+	
+	// 15 in a token's nibble means the length continues in bytes of 255 and a last one below it
+	static inline char* writeLength(char* op, size_t length) {
+		for(; length >= 255; length -= 255)
+			*op++ = (char)255;
+		*op++ = (char)length;
+		return op;
+	}
+	
+	static char* writeSequence(char* op, const char* anchor, size_t literals, size_t offset, size_t match) {
+		char* token = op++;
+		*token = (char)(std::min<size_t>(literals, 15) << 4);
+		if(literals >= 15)
+			op = writeLength(op, literals - 15);
+		std::memcpy(op, anchor, literals);
+		op += literals;
+		if(match == 0) // the last literals
+			return op;
+		
+		*op++ = (char)(offset & 0xFF);
+		*op++ = (char)(offset >> 8);
+		match -= COMPRESSION_MIN_MATCH;
+		*token |= (char)std::min<size_t>(match, 15);
+		if(match >= 15)
+			op = writeLength(op, match - 15);
+		return op;
+	}
+	
+	// Compresses data[start, end), where the bytes before start are the dictionary
+	static size_t compressWindow(const char* data, size_t start, size_t end, char* out) {
+		unsigned int table[1 << COMPRESSION_HASH_LOG] = {};
+		for(size_t p = start > COMPRESSION_WINDOW ? start - COMPRESSION_WINDOW : 0; p + 4 <= start; p++)
+			table[compressionHash(read32(data + p))] = p;
+		
+		char* op = out;
+		size_t anchor = start, ip = start;
+		if(end - start >= COMPRESSION_MF_LIMIT + 1) {
+			size_t match_limit = end - COMPRESSION_MF_LIMIT;
+			size_t misses = 0;
+			while(ip < match_limit) {
+				auto sequence = read32(data + ip);
+				auto &entry = table[compressionHash(sequence)];
+				size_t ref = entry;
+				entry = ip;
+				if(ref >= ip || ip - ref > COMPRESSION_WINDOW || read32(data + ref) != sequence) {
+					// data that doesn't compress is skipped faster the longer it goes on
+					ip += 1 + (misses++ >> 6);
+					continue;
+				}
+				misses = 0;
+				
+				while(ip > anchor && ref > 0 && data[ip - 1] == data[ref - 1]) {
+					ip--;
+					ref--;
+				}
+				size_t match = COMPRESSION_MIN_MATCH + matchLength(data + ip + COMPRESSION_MIN_MATCH,
+					data + ref + COMPRESSION_MIN_MATCH, data + end - COMPRESSION_LAST_LITERALS);
+				op = writeSequence(op, data + anchor, ip - anchor, ip - ref, match);
+				ip += match;
+				anchor = ip;
+				if(ip < match_limit)
+					table[compressionHash(read32(data + ip - 2))] = ip - 2;
+			}
+		}
+		op = writeSequence(op, data + anchor, end - anchor, 0, 0);
+		return op - out;
+	}
+	
+	void compress(std::string_view input, std::string* output, std::string_view dictionary) {
+		output->resize(compressBound(input.size()));
+		size_t length;
+		if(dictionary.size() == 0) {
+			length = compressWindow(input.data(), 0, input.size(), output->data());
+		} else {
+			if(dictionary.size() > COMPRESSION_WINDOW)
+				dictionary = dictionary.substr(dictionary.size() - COMPRESSION_WINDOW);
+			std::string window;
+			window.reserve(dictionary.size() + input.size());
+			window.append(dictionary);
+			window.append(input);
+			length = compressWindow(window.data(), dictionary.size(), window.size(), output->data());
+		}
+		output->resize(length);
+	}
+	
+	static size_t readLength(const char* &ip, const char* end) {
+		size_t length = 0;
+		unsigned char byte;
+		do {
+			if(ip == end)
+				throw std::range_error("Compressed length past the end");
+			byte = *ip++;
+			length += byte;
+		} while(byte == 255);
+		return length;
+	}
+	
+	void decompress(std::string_view input, size_t length, std::string* output, std::string_view dictionary) {
+		if(dictionary.size() > COMPRESSION_WINDOW)
+			dictionary = dictionary.substr(dictionary.size() - COMPRESSION_WINDOW);
+		// the output follows the dictionary so matches can reach back into it
+		output->resize(dictionary.size() + length);
+		if(dictionary.size() > 0)
+			std::memcpy(output->data(), dictionary.data(), dictionary.size());
+		
+		const char* ip = input.data();
+		const char* in_end = ip + input.size();
+		char* out_start = output->data();
+		char* op = out_start + dictionary.size();
+		char* out_end = out_start + output->size();
+		while(true) {
+			if(ip == in_end)
+				throw std::range_error("Compressed data is missing its last literals");
+			unsigned char token = *ip++;
+			
+			size_t literals = token >> 4;
+			if(literals == 15)
+				literals += readLength(ip, in_end);
+			if(literals > (size_t)(in_end - ip) || literals > (size_t)(out_end - op))
+				throw std::range_error("Compressed literals past the end");
+			// short copies in one fixed 16 byte move when there's room past them
+			if(literals <= 16 && in_end - ip >= 16 && out_end - op >= 16) {
+				std::memcpy(op, ip, 16);
+			} else {
+				std::memcpy(op, ip, literals);
+			}
+			ip += literals;
+			op += literals;
+			if(ip == in_end)
+				break;
+			
+			if(in_end - ip < 2)
+				throw std::range_error("Compressed offset past the end");
+			size_t offset = (unsigned char)ip[0] | ((unsigned char)ip[1] << 8);
+			ip += 2;
+			size_t match = token & 15;
+			if(match == 15)
+				match += readLength(ip, in_end);
+			match += COMPRESSION_MIN_MATCH;
+			if(offset == 0 || offset > (size_t)(op - out_start) || match > (size_t)(out_end - op))
+				throw std::range_error("Compressed match out of range");
+			
+			// An overlapping match repeats the last offset bytes. Copying from the same start doubles
+			// the span that can be copied without overlap each time.
+			const char* ref = op - offset;
+			char* match_end = op + match;
+			if(offset >= 16 && out_end - match_end >= 16) {
+				for(; op < match_end; op += 16, ref += 16)
+					std::memcpy(op, ref, 16);
+				op = match_end;
+			}
+			while(op < match_end) {
+				size_t span = std::min<size_t>(match_end - op, op - ref);
+				std::memcpy(op, ref, span);
+				op += span;
+			}
+		}
+		if(op != out_end)
+			throw std::range_error("Compressed data is the wrong length");
+		if(dictionary.size() > 0)
+			output->erase(0, dictionary.size());
+	}
+	
+	int compressionUnitTest() {
+		// a game state of entity records: ids, zeroes, repeated floats and small ints
+		std::mt19937 random(49);
+		std::string state;
+		BufferWriter<> out(&state);
+		for(int i=0; i<2000; i++) {
+			out.write(i);
+			out.write(random() % 4 == 0 ? (float)(random() % 1000) : 0.0f);
+			out.write(1.0f);
+			out.write((unsigned short)(random() % 8));
+			out.write(0ULL);
+		}
+		out.finish();
+		
+		std::string compressed, decompressed;
+		compress(state, &compressed);
+		if(compressed.size() * 2 > state.size()) return 1;
+		decompress(compressed, state.size(), &decompressed);
+		if(decompressed != state) return 2;
+		
+		// short, empty, incompressible and long repeated inputs round trip
+		std::string noise;
+		for(int i=0; i<5000; i++)
+			noise.push_back((char)random());
+		for(auto input : {std::string(), std::string("a"), std::string(12, 'b'), std::string(13, 'c'),
+				std::string(100000, 'd'), noise}) {
+			compress(input, &compressed);
+			if(compressed.size() > compressBound(input.size())) return 3;
+			decompress(compressed, input.size(), &decompressed);
+			if(decompressed != input) return 4;
+		}
+		
+		// a dictionary of a previous state lets even a short one match it
+		std::string dictionary = state.substr(0, 4000);
+		std::string similar = state.substr(20, 200);
+		std::string with_dictionary;
+		compress(similar, &compressed);
+		compress(similar, &with_dictionary, dictionary);
+		if(with_dictionary.size() >= compressed.size() || with_dictionary.size() > 20) return 5;
+		decompress(with_dictionary, similar.size(), &decompressed, dictionary);
+		if(decompressed != similar) return 6;
+		
+		// wrong lengths and corrupt data throw rather than overrun
+		compress(state, &compressed);
+		for(size_t length : {state.size() - 1, state.size() + 1}) {
+			try {
+				decompress(compressed, length, &decompressed);
+				return 7;
+			} catch(std::range_error &e) {}
+		}
+		for(int i=0; i<200; i++) {
+			auto corrupt = compressed.substr(0, 1 + random() % compressed.size());
+			corrupt[random() % corrupt.size()] ^= 1 << (random() % 8);
+			try {
+				decompress(corrupt, state.size(), &decompressed);
+			} catch(std::range_error &e) {}
+		}
+		
+		return 0;
+	}
+}
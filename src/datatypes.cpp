@@ -0,0 +1,334 @@
+#include "datatypes.h"
+#include "simd.h"
+
+#include <random>
+
+namespace razor {
+	unsigned int Quantization::quantize(float value) const {
+		double range = (double)this->max - this->min;
+		if(!(range > 0) || std::isnan(value)) // NaN goes to min, as in the SIMD kernels
+			return 0;
+		double t = ((double)std::clamp(value, this->min, this->max) - this->min) / range;
+		return (unsigned int)(t * bitMask(this->bits) + 0.5);
+	}
+	
+	float Quantization::dequantize(unsigned int value) const {
+		double range = (double)this->max - this->min;
+		return (float)(this->min + range * std::min<double>(value, bitMask(this->bits)) / bitMask(this->bits));
+	}
+	
+	float Quantization::precision() const {
+		return (float)(((double)this->max - this->min) / bitMask(this->bits) / 2);
+	}
+	
+	Quantization quantizationFor(float min, float max, float precision) {
+		double steps = std::ceil(((double)max - min) / (2.0 * precision));
+		unsigned int bits = bitsRequired((unsigned long long)std::clamp(steps, 1.0, 4294967295.0));
+		return Quantization{min, max, std::min(bits, 32U)};
+	}
+	
+	void writeFloat(BitWriter &out, float value, const Quantization &quantization) {
+		out.writeBits(quantization.quantize(value), quantization.bits);
+	}
+	
+	float readFloat(BitReader &in, const Quantization &quantization) {
+		return quantization.dequantize(in.readBits(quantization.bits));
+	}
+	
+	void writeVector3(BitWriter &out, const Vector3 &value, const Quantization &quantization) {
+		writeFloat(out, value.x, quantization);
+		writeFloat(out, value.y, quantization);
+		writeFloat(out, value.z, quantization);
+	}
+	
+	Vector3 readVector3(BitReader &in, const Quantization &quantization) {
+		Vector3 value;
+		value.x = readFloat(in, quantization);
+		value.y = readFloat(in, quantization);
+		value.z = readFloat(in, quantization);
+		return value;
+	}
+	
+	void writeQuaternion(BitWriter &out, const Quaternion &value, unsigned int component_bits) {
+		float components[4] = {value.x, value.y, value.z, value.w};
+		float length = std::sqrt(value.x*value.x + value.y*value.y + value.z*value.z + value.w*value.w);
+		if(!(length > 0)) { // not a rotation, send the identity
+			components[3] = length = 1;
+		}
+		unsigned int largest = 0;
+		for(unsigned int i=1; i<4; i++) {
+			if(std::abs(components[i]) > std::abs(components[largest]))
+				largest = i;
+		}
+		float scale = (components[largest] < 0 ? -1 : 1) / length;
+		Quantization range = {-(float)M_SQRT1_2, (float)M_SQRT1_2, component_bits};
+		out.writeBits(largest, 2);
+		for(unsigned int i=0; i<4; i++) {
+			if(i != largest)
+				writeFloat(out, components[i] * scale, range);
+		}
+	}
+	
+	Quaternion readQuaternion(BitReader &in, unsigned int component_bits) {
+		float components[4];
+		Quantization range = {-(float)M_SQRT1_2, (float)M_SQRT1_2, component_bits};
+		unsigned int largest = in.readBits(2);
+		float sum = 0;
+		for(unsigned int i=0; i<4; i++) {
+			if(i != largest) {
+				components[i] = readFloat(in, range);
+				sum += components[i] * components[i];
+			}
+		}
+		components[largest] = std::sqrt(std::max(0.0f, 1 - sum));
+		return {components[0], components[1], components[2], components[3]};
+	}
+	
+	void encodePositions(std::span<const Vector3> values, const Quantization &quantization, BitWriter &out) {
+		static_assert(sizeof(Vector3) == 3 * sizeof(float), "Vector3s are quantized as a flat float array");
+		unsigned int quantized[3 * ENCODE_BATCH];
+		for(size_t start=0; start<values.size(); start+=ENCODE_BATCH) {
+			size_t n = std::min<size_t>(ENCODE_BATCH, values.size() - start);
+			quantizeFloats(&values[start].x, 3 * n, quantization, quantized);
+			out.writeBitsArray(quantized, 3 * n, quantization.bits);
+		}
+	}
+	
+	void decodePositions(BitReader &in, const Quantization &quantization, std::span<Vector3> out) {
+		for(auto &value : out)
+			value = readVector3(in, quantization);
+	}
+	
+	void encodeQuaternions(std::span<const Quaternion> values, BitWriter &out, unsigned int component_bits) {
+		static_assert(sizeof(Quaternion) == 4 * sizeof(float), "Quaternions are loaded four floats at a time");
+		if(component_bits > 10) { // too wide to pack each in 32 bits
+			for(auto &value : values)
+				writeQuaternion(out, value, component_bits);
+			return;
+		}
+		unsigned int quantized[ENCODE_BATCH];
+		for(size_t start=0; start<values.size(); start+=ENCODE_BATCH) {
+			size_t n = std::min<size_t>(ENCODE_BATCH, values.size() - start);
+			quantizeQuaternions(&values[start], n, component_bits, quantized);
+			out.writeBitsArray(quantized, n, 2 + 3 * component_bits);
+		}
+	}
+	
+	void decodeQuaternions(BitReader &in, std::span<Quaternion> out, unsigned int component_bits) {
+		for(auto &value : out)
+			value = readQuaternion(in, component_bits);
+	}
+	
+	Matrix44 composeTransform(const Vector3 &position, const Quaternion &rotation, const Vector3 &scale) {
+		float length = std::sqrt(rotation.x*rotation.x + rotation.y*rotation.y + rotation.z*rotation.z + rotation.w*rotation.w);
+		float x = rotation.x / length, y = rotation.y / length, z = rotation.z / length, w = rotation.w / length;
+		Matrix44 matrix;
+		float *m = matrix.m;
+		m[0] = (1 - 2*(y*y + z*z)) * scale.x;
+		m[1] = 2*(x*y - z*w) * scale.y;
+		m[2] = 2*(x*z + y*w) * scale.z;
+		m[3] = position.x;
+		m[4] = 2*(x*y + z*w) * scale.x;
+		m[5] = (1 - 2*(x*x + z*z)) * scale.y;
+		m[6] = 2*(y*z - x*w) * scale.z;
+		m[7] = position.y;
+		m[8] = 2*(x*z - y*w) * scale.x;
+		m[9] = 2*(y*z + x*w) * scale.y;
+		m[10] = (1 - 2*(x*x + y*y)) * scale.z;
+		m[11] = position.z;
+		m[12] = m[13] = m[14] = 0;
+		m[15] = 1;
+		return matrix;
+	}
+	
+	void decomposeTransform(const Matrix44 &matrix, Vector3 *position, Quaternion *rotation, Vector3 *scale) {
+		const float *m = matrix.m;
+		*position = {m[3], m[7], m[11]};
+		
+		// each column is a rotated axis stretched by its scale
+		float s[3], r[3][3];
+		for(int c=0; c<3; c++) {
+			s[c] = std::sqrt(m[c]*m[c] + m[4 + c]*m[4 + c] + m[8 + c]*m[8 + c]);
+		}
+		float determinant = m[0] * (m[5]*m[10] - m[6]*m[9]) - m[1] * (m[4]*m[10] - m[6]*m[8]) +
+			m[2] * (m[4]*m[9] - m[5]*m[8]);
+		if(determinant < 0)
+			s[0] = -s[0];
+		for(int c=0; c<3; c++) {
+			float divisor = s[c] != 0 ? s[c] : 1;
+			for(int row=0; row<3; row++)
+				r[row][c] = m[row*4 + c] / divisor;
+		}
+		*scale = {s[0], s[1], s[2]};
+		
+		// from the largest of the diagonal sums, to keep the square root away from zero
+		float trace = r[0][0] + r[1][1] + r[2][2];
+		if(trace > 0) {
+			float k = std::sqrt(trace + 1) * 2;
+			*rotation = {(r[2][1] - r[1][2]) / k, (r[0][2] - r[2][0]) / k, (r[1][0] - r[0][1]) / k, k / 4};
+		} else if(r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+			float k = std::sqrt(1 + r[0][0] - r[1][1] - r[2][2]) * 2;
+			*rotation = {k / 4, (r[0][1] + r[1][0]) / k, (r[0][2] + r[2][0]) / k, (r[2][1] - r[1][2]) / k};
+		} else if(r[1][1] > r[2][2]) {
+			float k = std::sqrt(1 + r[1][1] - r[0][0] - r[2][2]) * 2;
+			*rotation = {(r[0][1] + r[1][0]) / k, k / 4, (r[1][2] + r[2][1]) / k, (r[0][2] - r[2][0]) / k};
+		} else {
+			float k = std::sqrt(1 + r[2][2] - r[0][0] - r[1][1]) * 2;
+			*rotation = {(r[0][2] + r[2][0]) / k, (r[1][2] + r[2][1]) / k, k / 4, (r[1][0] - r[0][1]) / k};
+		}
+	}
+	
+	void writeMatrix44(BitWriter &out, const Matrix44 &value, const Quantization &position,
+			const Quantization &scale, unsigned int rotation_bits) {
+		Vector3 translation, stretch;
+		Quaternion rotation;
+		decomposeTransform(value, &translation, &rotation, &stretch);
+		writeVector3(out, translation, position);
+		writeQuaternion(out, rotation, rotation_bits);
+		writeVector3(out, stretch, scale);
+	}
+	
+	Matrix44 readMatrix44(BitReader &in, const Quantization &position, const Quantization &scale,
+			unsigned int rotation_bits) {
+		auto translation = readVector3(in, position);
+		auto rotation = readQuaternion(in, rotation_bits);
+		auto stretch = readVector3(in, scale);
+		return composeTransform(translation, rotation, stretch);
+	}
+	
+	int datatypesUnitTest() {
+		// positions over a kilometre to within 1/64 of a metre
+		auto positions = quantizationFor(-512, 512, 1.0f / 64);
+		if(positions.bits != 16 || positions.precision() > 1.0f / 64) return 1;
+		float values[] = {-512, -100.3f, -0.01f, 0, 0.5f, 37.77f, 511.99f, 512};
+		for(auto value : values) {
+			if(std::abs(positions.dequantize(positions.quantize(value)) - value) > positions.precision() * 1.001f)
+				return 2;
+		}
+		if(positions.dequantize(positions.quantize(-1000)) != -512 || positions.dequantize(positions.quantize(1e9f)) != 512)
+			return 3;
+		
+		std::string stream;
+		BitWriter out(&stream);
+		writeVector3(out, {1.25f, -3.5f, 400}, positions);
+		out.finish();
+		if(stream.size() != 6) return 4;
+		BitReader in(stream);
+		auto vector = readVector3(in, positions);
+		if(std::abs(vector.x - 1.25f) > 1.0f / 64 || std::abs(vector.y + 3.5f) > 1.0f / 64 ||
+				std::abs(vector.z - 400) > 1.0f / 64) return 5;
+		
+		// smallest-three quaternions in 29 and 32 bits, whichever component is largest and
+		// whatever its sign
+		std::mt19937 random(44);
+		std::normal_distribution<float> normal;
+		std::vector<Quaternion> rotations;
+		for(int i=0; i<200; i++) {
+			Quaternion q = {normal(random), normal(random), normal(random), normal(random)};
+			float length = std::sqrt(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+			rotations.push_back({q.x / length, q.y / length, q.z / length, q.w / length});
+		}
+		rotations.push_back({0, 0, 0, 1});
+		rotations.push_back({0, -1, 0, 0});
+		for(unsigned int bits : {9U, 10U}) {
+			stream.clear();
+			BitWriter quaternion_out(&stream);
+			for(auto &q : rotations)
+				writeQuaternion(quaternion_out, q, bits);
+			if(quaternion_out.bitsWritten() != rotations.size() * (2 + 3 * bits)) return 6;
+			quaternion_out.finish();
+			BitReader quaternion_in(stream);
+			for(auto &q : rotations) {
+				auto decoded = readQuaternion(quaternion_in, bits);
+				float dot = q.x*decoded.x + q.y*decoded.y + q.z*decoded.z + q.w*decoded.w;
+				if(std::abs(dot) < (bits == 9 ? 0.9999f : 0.99998f)) return 7;
+			}
+		}
+		
+		// matrices split into the transform they were built from
+		Vector3 position = {10, -20, 30.5f}, scale = {2, 0.5f, 1.5f};
+		auto matrix = composeTransform(position, rotations[0], scale);
+		Vector3 position_out, scale_out;
+		Quaternion rotation_out;
+		decomposeTransform(matrix, &position_out, &rotation_out, &scale_out);
+		if(std::abs(position_out.y + 20) > 1e-5f || std::abs(scale_out.x - 2) > 1e-4f ||
+				std::abs(scale_out.y - 0.5f) > 1e-4f || std::abs(scale_out.z - 1.5f) > 1e-4f) return 8;
+		auto &r0 = rotations[0];
+		if(std::abs(r0.x*rotation_out.x + r0.y*rotation_out.y + r0.z*rotation_out.z + r0.w*rotation_out.w) < 0.99999f)
+			return 9;
+		
+		// transform heavy states shrink to well under a third of their floats
+		auto coarse_positions = quantizationFor(-512, 512, 1.0f / 32);
+		auto scales = quantizationFor(0, 16, 1.0f / 256);
+		stream.clear();
+		BitWriter transform_out(&stream);
+		for(unsigned int i=0; i<100; i++)
+			writeVector3(transform_out, {i * 3.3f, -(float)i, 250}, coarse_positions);
+		for(unsigned int i=0; i<100; i++)
+			writeQuaternion(transform_out, rotations[i]);
+		transform_out.finish();
+		if(stream.size() * 3 > 100 * sizeof(float) * 7) return 10;
+		
+		stream.clear();
+		BitWriter matrix_out(&stream);
+		for(unsigned int i=0; i<100; i++)
+			writeMatrix44(matrix_out, composeTransform({i * 3.3f, -(float)i, 250}, rotations[i], scale), coarse_positions, scales);
+		matrix_out.finish();
+		if(stream.size() * 4 > 100 * sizeof(Matrix44)) return 11;
+		BitReader matrix_in(stream);
+		for(unsigned int i=0; i<100; i++) {
+			auto expected = composeTransform({i * 3.3f, -(float)i, 250}, rotations[i], scale);
+			auto decoded = readMatrix44(matrix_in, coarse_positions, scales);
+			for(int e=0; e<16; e++) {
+				if(std::abs(decoded.m[e] - expected.m[e]) > 0.02f) return 12;
+			}
+		}
+		
+		// mirrored matrices keep their handedness in a negative x scale
+		decomposeTransform(composeTransform(position, rotations[1], {-1, 1, 1}), &position_out, &rotation_out, &scale_out);
+		if(std::abs(scale_out.x + 1) > 1e-4f || std::abs(scale_out.y - 1) > 1e-4f) return 13;
+		
+		// batches write what one at a time writes, to within a step of rounding
+		std::vector<Vector3> many_positions;
+		for(int i=0; i<1000; i++)
+			many_positions.push_back({normal(random) * 200, normal(random) * 200, (float)i - 500});
+		std::string one_at_a_time;
+		BitWriter single_writer(&one_at_a_time);
+		for(auto &p : many_positions)
+			writeVector3(single_writer, p, positions);
+		single_writer.finish();
+		stream.clear();
+		BitWriter batch_writer(&stream);
+		encodePositions(many_positions, positions, batch_writer);
+		encodeQuaternions(rotations, batch_writer);
+		batch_writer.finish();
+		if(stream.size() != (1000 * 3 * 16 + rotations.size() * 29 + 7) / 8) return 14;
+		std::vector<Vector3> positions_out(1000);
+		std::vector<Quaternion> rotations_out(rotations.size());
+		BitReader batch_reader(stream);
+		decodePositions(batch_reader, positions, positions_out);
+		decodeQuaternions(batch_reader, rotations_out);
+		for(int i=0; i<1000; i++) {
+			if(std::abs(positions_out[i].x - std::clamp(many_positions[i].x, -512.0f, 512.0f)) > 1.0f / 64 ||
+					std::abs(positions_out[i].z - many_positions[i].z) > 1.0f / 64) return 15;
+		}
+		for(size_t i=0; i<rotations.size(); i++) {
+			auto &q = rotations[i], &d = rotations_out[i];
+			if(std::abs(q.x*d.x + q.y*d.y + q.z*d.z + q.w*d.w) < 0.9999f) return 16;
+		}
+		std::vector<Vector3> single_out(1000);
+		BitReader single_reader(one_at_a_time);
+		decodePositions(single_reader, positions, single_out);
+		for(int i=0; i<1000; i++) {
+			if(std::abs(single_out[i].y - positions_out[i].y) > 2 * positions.precision()) return 17;
+		}
+		
+		// NaN quantizes to min one at a time and in batches
+		unsigned int nan_quantized[2];
+		float nans[2] = {NAN, -NAN};
+		quantizeFloats(nans, 2, positions, nan_quantized);
+		if(positions.quantize(NAN) != 0 || nan_quantized[0] != 0 || nan_quantized[1] != 0) return 18;
+		
+		return 0;
+	}
+}
@@ -0,0 +1,133 @@
+#include "delta.h"
+
+namespace razor {
+	static void writeDeltaRun(BufferWriter<> &out, size_t gap, const char* baseline, const char* state, size_t length) {
+		out.writeVarint((unsigned int)gap);
+		out.writeVarint((unsigned int)length);
+		out.reserve(length);
+		xorBuffers(baseline, state, out.data + out.position, length);
+		out.position += length;
+	}
+	
+	void diffState(std::string_view baseline, std::string_view state, std::string* delta) {
+		delta->clear();
+		BufferWriter<> out(delta);
+		out.writeVarint((unsigned int)state.size());
+		
+		const char* a = baseline.data();
+		const char* b = state.data();
+		size_t common = std::min(baseline.size(), state.size());
+		size_t position = 0, previous = 0;
+		while(position < common) {
+			position += firstDifference(a + position, b + position, common - position);
+			if(position == common)
+				break;
+			
+			// a word at a time until a whole word matches, then back over the equal bytes before it
+			size_t end = position;
+			while(end + DELTA_MIN_MATCH <= common && std::memcmp(a + end, b + end, DELTA_MIN_MATCH) != 0)
+				end += DELTA_MIN_MATCH;
+			if(end + DELTA_MIN_MATCH > common)
+				end = common;
+			while(a[end - 1] == b[end - 1])
+				end--;
+			
+			writeDeltaRun(out, position - previous, a + position, b + position, end - position);
+			position = previous = end;
+		}
+		
+		// growth is XORed with zeroes, so goes as it is
+		if(state.size() > common) {
+			out.writeVarint((unsigned int)(common - previous));
+			out.writeVarint((unsigned int)(state.size() - common));
+			out.writeArray(b + common, state.size() - common);
+		}
+		out.finish();
+	}
+	
+	void patchState(std::string_view baseline, std::string_view delta, std::string* state) {
+		BufferReader<> in(delta);
+		auto length = in.readVarint<unsigned int>();
+		// every byte past the baseline is in the delta, which bounds the length before allocating it
+		if(length > baseline.size() + delta.size())
+			throw std::range_error("State delta length past its data");
+		
+		state->resize(length);
+		size_t common = std::min<size_t>(length, baseline.size());
+		std::memcpy(state->data(), baseline.data(), common);
+		std::memset(state->data() + common, 0, length - common);
+		
+		unsigned long long position = 0;
+		while(in.remaining() > 0) {
+			position += in.readVarint<unsigned int>();
+			auto run = in.readVarint<unsigned int>();
+			auto bytes = in.readBytes(run);
+			if(position + run > length)
+				throw std::range_error("State delta run past the end");
+			xorBuffers(state->data() + position, bytes.data(), state->data() + position, run);
+			position += run;
+		}
+	}
+	
+	int deltaUnitTest() {
+		std::string baseline;
+		for(int i=0; i<5000; i++)
+			baseline.push_back((char)(i * 7 + i / 13));
+		
+		// unchanged states are just the length
+		std::string delta, patched;
+		diffState(baseline, baseline, &delta);
+		if(delta.size() != varintSize((unsigned int)baseline.size())) return 1;
+		
+		// scattered changes cost their bytes and a couple of bytes of header each
+		auto state = baseline;
+		state[0] ^= 1;
+		state[100] ^= 0x80;
+		state[101] ^= 0x80;
+		for(int i=2000; i<2100; i += 3)
+			state[i] ^= 0x10;
+		state[4999] ^= 2;
+		diffState(baseline, state, &delta);
+		if(delta.size() > 2 + 3 * 3 + 2 + 3 + 2 + 100) return 2;
+		patchState(baseline, delta, &patched);
+		if(patched != state) return 3;
+		
+		// at every SIMD level, and growing and shrinking
+		auto detected = detectSimdLevel();
+		for(int level=SIMD_SCALAR; level<=detected; level++) {
+			setSimdLevel((SimdLevel)level);
+			for(size_t length : {(size_t)0, (size_t)37, (size_t)4900, (size_t)5000, (size_t)6001}) {
+				std::string resized = state.substr(0, length);
+				for(size_t i=resized.size(); i<length; i++)
+					resized.push_back((char)(i % 3));
+				diffState(baseline, resized, &delta);
+				patchState(baseline, delta, &patched);
+				if(patched != resized) return 4;
+			}
+		}
+		setSimdLevel(detected);
+		
+		// a run past the end, or a length longer than the data could make, is rejected
+		std::string bad;
+		BufferWriter<> bad_out(&bad);
+		bad_out.writeVarint(10U);
+		bad_out.writeVarint(8U);
+		bad_out.writeVarint(4U);
+		bad_out.writeArray("abcd", 4);
+		bad_out.finish();
+		try {
+			patchState(baseline.substr(0, 10), bad, &patched);
+			return 5;
+		} catch(std::range_error &e) {}
+		std::string huge;
+		BufferWriter<> huge_out(&huge);
+		huge_out.writeVarint(1U << 30);
+		huge_out.finish();
+		try {
+			patchState(baseline, huge, &patched);
+			return 6;
+		} catch(std::range_error &e) {}
+		
+		return 0;
+	}
+}
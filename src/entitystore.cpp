@@ -0,0 +1,439 @@
+#include "entitystore.h"
+
+namespace razor {
+	EntityStore::EntityStore() {
+		this->clear();
+	}
+	
+	void EntityStore::clear() {
+		this->fields.clear();
+		this->generations.clear();
+		this->live.clear();
+		this->free_slots.clear();
+		this->created.clear();
+		this->destroyed.clear();
+		this->capacity = 0;
+		this->slots = 0;
+		this->count = 0;
+	}
+	
+	unsigned int EntityStore::addField(unsigned int size) {
+		if(this->slots != 0)
+			throw std::runtime_error("EntityStore fields must be added before any entity is created");
+		if(size == 0)
+			throw std::runtime_error("EntityStore fields can't be empty");
+		
+		Field f;
+		f.size = size;
+		f.dirty_count = 0;
+		f.values.resize((size_t)this->capacity * size);
+		f.dirty.resize(this->capacity / 64);
+		f.summary.resize((f.dirty.size() + 63) / 64);
+		this->fields.push_back(std::move(f));
+		return this->fields.size() - 1;
+	}
+	
+	// capacities are powers of two from ENTITY_STORE_INITIAL_CAPACITY, so whole words of the masks
+	void EntityStore::grow(unsigned int slots) {
+		unsigned int capacity = std::max<unsigned int>(this->capacity, ENTITY_STORE_INITIAL_CAPACITY);
+		while(capacity < slots)
+			capacity *= 2;
+		this->capacity = std::min<unsigned int>(capacity, ENTITY_STORE_MAX_ENTITIES);
+		this->generations.resize(this->capacity, 0);
+		this->live.resize(this->capacity / 64, 0);
+		for(auto &f : this->fields) {
+			f.values.resize((size_t)this->capacity * f.size, 0);
+			f.dirty.resize(this->capacity / 64, 0);
+			f.summary.resize((f.dirty.size() + 63) / 64, 0);
+		}
+	}
+	
+	void EntityStore::mark(Field &f, unsigned int slot) {
+		auto word = slot / 64;
+		auto bit = 1ULL << (slot % 64);
+		if(f.dirty[word] & bit)
+			return;
+		f.dirty[word] |= bit;
+		f.summary[word / 64] |= 1ULL << (word % 64);
+		f.dirty_count++;
+	}
+	
+	void EntityStore::unmark(Field &f, unsigned int slot) {
+		auto word = slot / 64;
+		auto bit = 1ULL << (slot % 64);
+		if(!(f.dirty[word] & bit))
+			return;
+		f.dirty[word] &= ~bit;
+		if(f.dirty[word] == 0)
+			f.summary[word / 64] &= ~(1ULL << (word % 64));
+		f.dirty_count--;
+	}
+	
+	// New entities start zeroed with every field dirty, so their first change message carries them whole
+	void EntityStore::place(unsigned int slot, unsigned int generation, bool record) {
+		if(slot >= this->capacity)
+			this->grow(slot + 1);
+		// slots skipped over by a mirrored handle are free for create
+		for(; this->slots <= slot; this->slots++) {
+			if(this->slots != slot)
+				this->free_slots.push_back(this->slots);
+		}
+		
+		this->generations[slot] = generation;
+		this->live[slot / 64] |= 1ULL << (slot % 64);
+		this->count++;
+		for(auto &f : this->fields) {
+			std::memset(f.values.data() + (size_t)slot * f.size, 0, f.size);
+			this->mark(f, slot);
+		}
+		if(record)
+			this->created.push_back(this->handleAt(slot));
+	}
+	
+	void EntityStore::remove(unsigned int slot, bool record) {
+		if(record)
+			this->destroyed.push_back(this->handleAt(slot));
+		this->live[slot / 64] &= ~(1ULL << (slot % 64));
+		this->count--;
+		for(auto &f : this->fields) {
+			std::memset(f.values.data() + (size_t)slot * f.size, 0, f.size);
+			this->unmark(f, slot);
+		}
+		this->free_slots.push_back(slot);
+	}
+	
+	entityhandle EntityStore::create() {
+		// mirrored handles can take slots still on the free list, which are dropped here
+		while(this->free_slots.size() > 0 && this->handleAt(this->free_slots.back()) != NO_ENTITY)
+			this->free_slots.pop_back();
+		
+		unsigned int slot;
+		if(this->free_slots.size() > 0) {
+			slot = this->free_slots.back();
+			this->free_slots.pop_back();
+		} else if(this->slots < ENTITY_STORE_MAX_ENTITIES) {
+			slot = this->slots;
+		} else {
+			throw std::runtime_error("EntityStore is full");
+		}
+		
+		unsigned int generation = slot < this->capacity ? this->generations[slot] + 1 : 1;
+		this->place(slot, generation == 0 ? 1 : generation, true);
+		return this->handleAt(slot);
+	}
+	
+	void EntityStore::createAt(entityhandle handle) {
+		unsigned int slot = handle & 0xFFFFFFFF;
+		unsigned int generation = handle >> 32;
+		if(slot >= ENTITY_STORE_MAX_ENTITIES || generation == 0)
+			throw std::range_error("EntityStore handle out of range");
+		if(this->alive(handle))
+			return;
+		if(this->handleAt(slot) != NO_ENTITY)
+			this->remove(slot, false);
+		this->place(slot, generation, false);
+	}
+	
+	bool EntityStore::destroy(entityhandle handle) {
+		if(!this->alive(handle))
+			return false;
+		this->remove(handle & 0xFFFFFFFF, true);
+		return true;
+	}
+	
+	bool EntityStore::alive(entityhandle handle) {
+		unsigned int slot = handle & 0xFFFFFFFF;
+		return this->handleAt(slot) == handle && handle != NO_ENTITY;
+	}
+	
+	unsigned int EntityStore::size() {
+		return this->count;
+	}
+	
+	entityhandle EntityStore::handleAt(unsigned int slot) {
+		if(slot >= this->slots || !(this->live[slot / 64] & (1ULL << (slot % 64))))
+			return NO_ENTITY;
+		return ((entityhandle)this->generations[slot] << 32) | slot;
+	}
+	
+	EntityStore::Field* EntityStore::find(entityhandle handle, unsigned int field) {
+		if(!this->alive(handle))
+			throw std::range_error("EntityStore entity doesn't exist");
+		if(field >= this->fields.size())
+			throw std::range_error("EntityStore field doesn't exist");
+		return &this->fields[field];
+	}
+	
+	char* EntityStore::value(entityhandle handle, unsigned int field, unsigned int size) {
+		auto f = this->find(handle, field);
+		if(f->size != size)
+			throw std::range_error("EntityStore field of the wrong size");
+		return f->values.data() + (size_t)(handle & 0xFFFFFFFF) * size;
+	}
+	
+	void EntityStore::setBytes(entityhandle handle, unsigned int field, const void* value, unsigned int size) {
+		auto current = this->value(handle, field, size);
+		if(std::memcmp(current, value, size) == 0)
+			return;
+		std::memcpy(current, value, size);
+		this->mark(this->fields[field], handle & 0xFFFFFFFF);
+	}
+	
+	void EntityStore::markDirty(entityhandle handle, unsigned int field) {
+		this->mark(*this->find(handle, field), handle & 0xFFFFFFFF);
+	}
+	
+	bool EntityStore::dirty(entityhandle handle, unsigned int field) {
+		if(!this->alive(handle) || field >= this->fields.size())
+			return false;
+		unsigned int slot = handle & 0xFFFFFFFF;
+		return this->fields[field].dirty[slot / 64] & (1ULL << (slot % 64));
+	}
+	
+	unsigned int EntityStore::dirtyCount(unsigned int field) {
+		return this->fields.at(field).dirty_count;
+	}
+	
+	void EntityStore::clearDirty() {
+		for(auto &f : this->fields) {
+			if(f.dirty_count == 0)
+				continue;
+			size_t words = f.summary.size();
+			for(size_t s = firstNonZero(f.summary.data(), words); s < words;
+					s += 1 + firstNonZero(f.summary.data() + s + 1, words - s - 1)) {
+				for(auto sw = f.summary[s]; sw != 0; sw &= sw - 1)
+					f.dirty[s * 64 + std::countr_zero(sw)] = 0;
+				f.summary[s] = 0;
+			}
+			f.dirty_count = 0;
+		}
+		this->created.clear();
+		this->destroyed.clear();
+	}
+	
+	bool EntityStore::changed() {
+		if(this->created.size() > 0 || this->destroyed.size() > 0)
+			return true;
+		for(auto &f : this->fields) {
+			if(f.dirty_count > 0)
+				return true;
+		}
+		return false;
+	}
+	
+	static void writeHandle(BufferWriter<> &out, entityhandle handle) {
+		out.writeVarint((unsigned int)(handle & 0xFFFFFFFF));
+		out.writeVarint((unsigned int)(handle >> 32));
+	}
+	
+	static entityhandle readHandle(BufferReader<> &in) {
+		auto slot = in.readVarint<unsigned int>();
+		auto generation = in.readVarint<unsigned int>();
+		if(slot >= ENTITY_STORE_MAX_ENTITIES || generation == 0)
+			throw std::range_error("EntityStore handle out of range");
+		return ((entityhandle)generation << 32) | slot;
+	}
+	
+	// Entities created and destroyed in the same interval are listed as destroyed only. A slave
+	// never had them, and the generation keeps it from destroying anything else in the slot.
+	void EntityStore::writeChanges(BufferWriter<> &out) {
+		out.writeVarint((unsigned int)this->destroyed.size());
+		for(auto handle : this->destroyed)
+			writeHandle(out, handle);
+		
+		unsigned int created_count = 0;
+		for(auto handle : this->created)
+			created_count += this->alive(handle);
+		out.writeVarint(created_count);
+		for(auto handle : this->created) {
+			if(this->alive(handle))
+				writeHandle(out, handle);
+		}
+		
+		out.writeVarint((unsigned int)this->fields.size());
+		for(auto &f : this->fields) {
+			out.writeVarint(f.dirty_count);
+			unsigned int next = 0;
+			forEachBit(f.dirty, f.summary, [&](unsigned int slot) {
+				out.writeVarint(slot - next);
+				out.writeArray(f.values.data() + (size_t)slot * f.size, f.size);
+				next = slot + 1;
+			});
+		}
+	}
+	
+	void EntityStore::readChanges(BufferReader<> &in) {
+		auto destroyed_count = in.readVarint<unsigned int>();
+		for(unsigned int i=0; i<destroyed_count; i++) {
+			auto handle = readHandle(in);
+			if(this->alive(handle))
+				this->remove(handle & 0xFFFFFFFF, false);
+		}
+		auto created_count = in.readVarint<unsigned int>();
+		for(unsigned int i=0; i<created_count; i++)
+			this->createAt(readHandle(in));
+		this->readFields(in);
+	}
+	
+	// Each field's count, slot gaps and values. Values only mark entities dirty if they differ.
+	void EntityStore::readFields(BufferReader<> &in) {
+		if(in.readVarint<unsigned int>() != this->fields.size())
+			throw std::range_error("EntityStore changes are for other fields");
+		for(auto &f : this->fields) {
+			auto changes = in.readVarint<unsigned int>();
+			unsigned long long slot = 0;
+			for(unsigned int i=0; i<changes; i++, slot++) {
+				slot += in.readVarint<unsigned int>();
+				auto bytes = in.readBytes(f.size);
+				if(slot >= this->slots || this->handleAt(slot) == NO_ENTITY)
+					continue;
+				auto current = f.values.data() + slot * f.size;
+				if(std::memcmp(current, bytes.data(), f.size) != 0) {
+					std::memcpy(current, bytes.data(), f.size);
+					this->mark(f, slot);
+				}
+			}
+		}
+	}
+	
+	void EntityStore::writeSnapshot(BufferWriter<> &out) {
+		out.writeVarint((unsigned int)this->fields.size());
+		for(auto &f : this->fields)
+			out.writeVarint(f.size);
+		
+		out.writeVarint(this->count);
+		forEachBit(this->live, [&](unsigned int slot) {
+			writeHandle(out, this->handleAt(slot));
+		});
+		for(auto &f : this->fields) {
+			forEachBit(this->live, [&](unsigned int slot) {
+				out.writeArray(f.values.data() + (size_t)slot * f.size, f.size);
+			});
+		}
+	}
+	
+	void EntityStore::readSnapshot(BufferReader<> &in) {
+		if(in.readVarint<unsigned int>() != this->fields.size())
+			throw std::range_error("EntityStore snapshot is for other fields");
+		for(auto &f : this->fields) {
+			if(in.readVarint<unsigned int>() != f.size)
+				throw std::range_error("EntityStore snapshot is for other fields");
+		}
+		
+		// every handle takes at least two bytes, which bounds the count before reserving for it
+		auto entity_count = in.readVarint<unsigned int>();
+		in.require(2ULL * entity_count);
+		std::vector<entityhandle> handles(entity_count);
+		for(auto &handle : handles)
+			handle = readHandle(in);
+		
+		// entities the snapshot doesn't have are gone
+		std::vector<unsigned long long> kept(this->live.size(), 0);
+		for(auto handle : handles) {
+			unsigned int slot = handle & 0xFFFFFFFF;
+			if(this->alive(handle))
+				kept[slot / 64] |= 1ULL << (slot % 64);
+		}
+		for(size_t word=0; word<kept.size(); word++) {
+			for(auto w = this->live[word] & ~kept[word]; w != 0; w &= w - 1)
+				this->remove(word * 64 + std::countr_zero(w), false);
+		}
+		for(auto handle : handles)
+			this->createAt(handle);
+		
+		for(auto &f : this->fields) {
+			in.require((unsigned long long)f.size * entity_count);
+			for(auto handle : handles) {
+				auto bytes = in.readBytes(f.size);
+				auto current = f.values.data() + (size_t)(handle & 0xFFFFFFFF) * f.size;
+				if(std::memcmp(current, bytes.data(), f.size) != 0) {
+					std::memcpy(current, bytes.data(), f.size);
+					this->mark(f, handle & 0xFFFFFFFF);
+				}
+			}
+		}
+	}
+	
+	int entityStoreUnitTest() {
+		EntityStore store;
+		auto position = store.addField<Vector3>();
+		auto health = store.addField<float>();
+		auto team = store.addField<unsigned char>();
+		
+		// new entities are dirty in every field, and handles are stable and never 0
+		std::vector<entityhandle> handles;
+		for(int i=0; i<1000; i++)
+			handles.push_back(store.create());
+		if(store.size() != 1000 || handles[0] == NO_ENTITY || store.dirtyCount(position) != 1000) return 1;
+		try {
+			store.addField<int>();
+			return 2;
+		} catch(std::runtime_error &e) {}
+		for(int i=0; i<1000; i++)
+			store.set(handles[i], position, Vector3{(float)i, 0, 0});
+		if(store.get<Vector3>(handles[999], position).x != 999 || store.column<Vector3>(position)[5].x != 5) return 3;
+		
+		// only changes mark fields dirty, and clearing touches only what's dirty
+		store.clearDirty();
+		if(store.changed()) return 4;
+		store.set(handles[3], health, 0.0f);
+		store.set(handles[700], health, 50.0f);
+		store.set(handles[3], team, (unsigned char)1);
+		std::vector<entityhandle> dirty;
+		store.forEachDirty(health, [&](entityhandle handle) { dirty.push_back(handle); });
+		if(dirty != std::vector<entityhandle>({handles[700]}) || store.dirtyCount(team) != 1 ||
+				!store.dirty(handles[3], team) || store.dirty(handles[3], position)) return 5;
+		
+		// destroyed handles are rejected, even once their slot is reused
+		if(!store.destroy(handles[10]) || store.destroy(handles[10]) || store.alive(handles[10])) return 6;
+		auto reused = store.create();
+		if((reused & 0xFFFFFFFF) != 10 || reused == handles[10] || !store.alive(reused)) return 7;
+		try {
+			store.get<float>(handles[10], health);
+			return 8;
+		} catch(std::range_error &e) {}
+		
+		// a slave with the same fields mirrors the daemon through a snapshot then its changes
+		EntityStore mirror;
+		mirror.addField<Vector3>();
+		mirror.addField<float>();
+		mirror.addField<unsigned char>();
+		std::string snapshot;
+		BufferWriter<> snapshot_out(&snapshot);
+		store.writeSnapshot(snapshot_out);
+		snapshot_out.finish();
+		BufferReader<> snapshot_in(snapshot);
+		mirror.readSnapshot(snapshot_in);
+		if(mirror.size() != 1000 || !mirror.alive(reused) || mirror.alive(handles[10]) ||
+				mirror.get<Vector3>(handles[999], position).x != 999 || mirror.get<float>(handles[700], health) != 50) return 9;
+		
+		store.clearDirty();
+		mirror.clearDirty();
+		store.set(handles[500], health, 25.0f);
+		store.destroy(handles[20]);
+		auto spawned = store.create();
+		store.set(spawned, team, (unsigned char)2);
+		std::string changes;
+		BufferWriter<> changes_out(&changes);
+		store.writeChanges(changes_out);
+		changes_out.finish();
+		// 3 fields of a varint count, slot and value, the spawned entity's fields, and the lists
+		if(changes.size() > 3 + 2 * (2 + 4) + (12 + 4 + 1) + 4 * 3) return 10;
+		BufferReader<> changes_in(changes);
+		mirror.readChanges(changes_in);
+		if(mirror.size() != store.size() || mirror.alive(handles[20]) || !mirror.alive(spawned) ||
+				mirror.get<float>(handles[500], health) != 25 || mirror.get<unsigned char>(spawned, team) != 2) return 11;
+		if(mirror.dirtyCount(health) != 2 || !mirror.dirty(spawned, team)) return 12;
+		
+		// stores with other fields are rejected
+		EntityStore other;
+		other.addField<float>();
+		BufferReader<> other_in(changes);
+		try {
+			other.readChanges(other_in);
+			return 13;
+		} catch(std::range_error &e) {}
+		
+		return 0;
+	}
+}
@@ -0,0 +1,359 @@
+#include "history.h"
+
+#include <climits>
+#include <random>
+
+namespace razor {
+	TransformHistory::TransformHistory(unsigned int ticks) {
+		this->ticks = ticks;
+		this->columns = 0;
+		this->clear();
+	}
+	
+	void TransformHistory::clear() {
+		this->entity_columns.clear();
+		this->column_ids.clear();
+		this->free_columns.clear();
+		this->extent_x.clear();
+		this->extent_y.clear();
+		this->extent_z.clear();
+		this->row_ticks.assign(this->ticks, 0);
+		this->row_valid.assign(this->ticks, false);
+		std::fill(this->recorded.begin(), this->recorded.end(), 0);
+		this->current_tick = 0;
+		this->current_row = 0;
+	}
+	
+	// Doubles the entity columns of every row, moving the existing rows to the wider layout
+	void TransformHistory::growColumns() {
+		unsigned int new_columns = std::max<unsigned int>(HISTORY_INITIAL_ENTITIES, this->columns * 2);
+		auto relayout = [this, new_columns](auto &v) {
+			std::remove_reference_t<decltype(v)> wider(this->ticks * new_columns);
+			for(unsigned int row=0; row<this->ticks && this->columns > 0; row++) {
+				std::copy(v.begin() + row * this->columns, v.begin() + (row + 1) * this->columns,
+					wider.begin() + row * new_columns);
+			}
+			v.swap(wider);
+		};
+		relayout(this->position_x);
+		relayout(this->position_y);
+		relayout(this->position_z);
+		relayout(this->rotation_x);
+		relayout(this->rotation_y);
+		relayout(this->rotation_z);
+		relayout(this->rotation_w);
+		relayout(this->recorded);
+		this->columns = new_columns;
+	}
+	
+	void TransformHistory::add(unsigned int id, const Vector3 &half_extents) {
+		unsigned int column;
+		auto it = this->entity_columns.find(id);
+		if(it != this->entity_columns.end()) {
+			column = it->second;
+		} else {
+			if(this->free_columns.size() > 0) {
+				column = this->free_columns.back();
+				this->free_columns.pop_back();
+				this->column_ids[column] = id;
+			} else {
+				if(this->column_ids.size() == this->columns)
+					this->growColumns();
+				column = this->column_ids.size();
+				this->column_ids.push_back(id);
+				this->extent_x.push_back(0);
+				this->extent_y.push_back(0);
+				this->extent_z.push_back(0);
+			}
+			this->entity_columns[id] = column;
+			
+			// a reused column must not show its previous entity's history
+			for(unsigned int row=0; row<this->ticks; row++) {
+				this->recorded[row * this->columns + column] = 0;
+			}
+		}
+		this->extent_x[column] = half_extents.x;
+		this->extent_y[column] = half_extents.y;
+		this->extent_z[column] = half_extents.z;
+	}
+	
+	void TransformHistory::remove(unsigned int id) {
+		auto it = this->entity_columns.find(id);
+		if(it == this->entity_columns.end())
+			return;
+		unsigned int column = it->second;
+		for(unsigned int row=0; row<this->ticks; row++) {
+			this->recorded[row * this->columns + column] = 0;
+		}
+		this->column_ids[column] = UINT_MAX;
+		this->free_columns.push_back(column);
+		this->entity_columns.erase(it);
+	}
+	
+	bool TransformHistory::contains(unsigned int id) {
+		return this->entity_columns.count(id) > 0;
+	}
+	
+	void TransformHistory::beginTick(ticktype tick_number) {
+		this->current_tick = tick_number;
+		this->current_row = tick_number % this->ticks;
+		this->row_ticks[this->current_row] = tick_number;
+		this->row_valid[this->current_row] = true;
+		if(this->columns > 0) {
+			std::fill(this->recorded.begin() + this->current_row * this->columns,
+				this->recorded.begin() + (this->current_row + 1) * this->columns, 0);
+		}
+	}
+	
+	void TransformHistory::record(unsigned int id, const Vector3 &position, const Quaternion &rotation) {
+		auto it = this->entity_columns.find(id);
+		if(it == this->entity_columns.end())
+			return;
+		unsigned int i = this->current_row * this->columns + it->second;
+		this->position_x[i] = position.x;
+		this->position_y[i] = position.y;
+		this->position_z[i] = position.z;
+		this->rotation_x[i] = rotation.x;
+		this->rotation_y[i] = rotation.y;
+		this->rotation_z[i] = rotation.z;
+		this->rotation_w[i] = rotation.w;
+		this->recorded[i] = 1;
+	}
+	
+	bool TransformHistory::rowFor(ticktype tick_number, unsigned int* row) {
+		*row = tick_number % this->ticks;
+		return this->row_valid[*row] && this->row_ticks[*row] == tick_number;
+	}
+	
+	bool TransformHistory::interpolationRows(ticktype tick_number, float fraction,
+			unsigned int* row_a, unsigned int* row_b) {
+		if(this->columns == 0 || !this->rowFor(tick_number, row_a))
+			return false;
+		if(fraction <= 0) {
+			*row_b = *row_a;
+			return true;
+		}
+		return this->rowFor(tick_number + 1, row_b);
+	}
+	
+	bool TransformHistory::sample(ticktype tick_number, float fraction, unsigned int id,
+			Vector3* position, Quaternion* rotation) {
+		auto it = this->entity_columns.find(id);
+		unsigned int row_a, row_b;
+		if(it == this->entity_columns.end() || !this->interpolationRows(tick_number, fraction, &row_a, &row_b))
+			return false;
+		unsigned int a = row_a * this->columns + it->second;
+		unsigned int b = row_b * this->columns + it->second;
+		if(!this->recorded[a] || !this->recorded[b])
+			return false;
+		
+		position->x = this->position_x[a] + (this->position_x[b] - this->position_x[a]) * fraction;
+		position->y = this->position_y[a] + (this->position_y[b] - this->position_y[a]) * fraction;
+		position->z = this->position_z[a] + (this->position_z[b] - this->position_z[a]) * fraction;
+		
+		if(rotation != nullptr) {
+			// normalized lerp along the shorter arc
+			float dot = this->rotation_x[a] * this->rotation_x[b] + this->rotation_y[a] * this->rotation_y[b] +
+				this->rotation_z[a] * this->rotation_z[b] + this->rotation_w[a] * this->rotation_w[b];
+			float fb = dot < 0 ? -fraction : fraction;
+			float fa = 1.0f - fraction;
+			Quaternion q = {
+				this->rotation_x[a] * fa + this->rotation_x[b] * fb,
+				this->rotation_y[a] * fa + this->rotation_y[b] * fb,
+				this->rotation_z[a] * fa + this->rotation_z[b] * fb,
+				this->rotation_w[a] * fa + this->rotation_w[b] * fb
+			};
+			float length = std::sqrt(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+			if(length > 0) {
+				q.x /= length;
+				q.y /= length;
+				q.z /= length;
+				q.w /= length;
+			}
+			*rotation = q;
+		}
+		return true;
+	}
+	
+	unsigned int TransformHistory::samplePositions(ticktype tick_number, float fraction,
+			std::span<const unsigned int> ids, Vector3* positions, bool* found) {
+		unsigned int row_a, row_b;
+		if(!this->interpolationRows(tick_number, fraction, &row_a, &row_b)) {
+			std::fill(found, found + ids.size(), false);
+			return 0;
+		}
+		
+		const float* ax = &this->position_x[row_a * this->columns];
+		const float* ay = &this->position_y[row_a * this->columns];
+		const float* az = &this->position_z[row_a * this->columns];
+		const float* bx = &this->position_x[row_b * this->columns];
+		const float* by = &this->position_y[row_b * this->columns];
+		const float* bz = &this->position_z[row_b * this->columns];
+		const unsigned char* ra = &this->recorded[row_a * this->columns];
+		const unsigned char* rb = &this->recorded[row_b * this->columns];
+		
+		unsigned int count = 0;
+		for(size_t i=0; i<ids.size(); i++) {
+			auto it = this->entity_columns.find(ids[i]);
+			found[i] = it != this->entity_columns.end() && ra[it->second] && rb[it->second];
+			if(!found[i])
+				continue;
+			unsigned int c = it->second;
+			positions[i] = {
+				ax[c] + (bx[c] - ax[c]) * fraction,
+				ay[c] + (by[c] - ay[c]) * fraction,
+				az[c] + (bz[c] - az[c]) * fraction
+			};
+			count++;
+		}
+		return count;
+	}
+	
+	// Calls f(column, x, y, z) for every entity recorded in both rows
+	template <typename F>
+	void TransformHistory::forEachInterpolated(unsigned int row_a, unsigned int row_b, float fraction, F f) {
+		const float* ax = &this->position_x[row_a * this->columns];
+		const float* ay = &this->position_y[row_a * this->columns];
+		const float* az = &this->position_z[row_a * this->columns];
+		const float* bx = &this->position_x[row_b * this->columns];
+		const float* by = &this->position_y[row_b * this->columns];
+		const float* bz = &this->position_z[row_b * this->columns];
+		const unsigned char* ra = &this->recorded[row_a * this->columns];
+		const unsigned char* rb = &this->recorded[row_b * this->columns];
+		
+		unsigned int used = this->column_ids.size();
+		for(unsigned int c=0; c<used; c++) {
+			if(!(ra[c] & rb[c]))
+				continue;
+			f(c, ax[c] + (bx[c] - ax[c]) * fraction,
+				ay[c] + (by[c] - ay[c]) * fraction,
+				az[c] + (bz[c] - az[c]) * fraction);
+		}
+	}
+	
+	// Slab test of the ray against each entity's box around its interpolated position
+	void TransformHistory::raycast(ticktype tick_number, float fraction, const Vector3 &origin,
+			const Vector3 &direction, float max_distance, std::vector<RaycastHit>* hits) {
+		unsigned int row_a, row_b;
+		if(!this->interpolationRows(tick_number, fraction, &row_a, &row_b))
+			return;
+		
+		float length = std::sqrt(direction.x*direction.x + direction.y*direction.y + direction.z*direction.z);
+		if(length == 0)
+			return;
+		const float d[3] = {direction.x / length, direction.y / length, direction.z / length};
+		const float o[3] = {origin.x, origin.y, origin.z};
+		
+		size_t first_hit = hits->size();
+		this->forEachInterpolated(row_a, row_b, fraction, [&](unsigned int c, float x, float y, float z) {
+			const float center[3] = {x, y, z};
+			const float extent[3] = {this->extent_x[c], this->extent_y[c], this->extent_z[c]};
+			float t_min = 0, t_max = max_distance;
+			for(int axis=0; axis<3; axis++) {
+				float low = center[axis] - extent[axis];
+				float high = center[axis] + extent[axis];
+				// parallel rays are tested without dividing, which fast-math builds can't trust
+				if(std::fabs(d[axis]) < 1e-8f) {
+					if(o[axis] < low || o[axis] > high)
+						return;
+					continue;
+				}
+				float t1 = (low - o[axis]) / d[axis];
+				float t2 = (high - o[axis]) / d[axis];
+				t_min = std::max(t_min, std::min(t1, t2));
+				t_max = std::min(t_max, std::max(t1, t2));
+				if(t_min > t_max)
+					return;
+			}
+			hits->push_back({this->column_ids[c], t_min});
+		});
+		
+		std::sort(hits->begin() + first_hit, hits->end(), [](const RaycastHit &a, const RaycastHit &b) {
+			return a.distance < b.distance;
+		});
+	}
+	
+	void TransformHistory::overlapBox(ticktype tick_number, float fraction, const Vector3 &min,
+			const Vector3 &max, std::vector<unsigned int>* ids) {
+		unsigned int row_a, row_b;
+		if(!this->interpolationRows(tick_number, fraction, &row_a, &row_b))
+			return;
+		
+		this->forEachInterpolated(row_a, row_b, fraction, [&](unsigned int c, float x, float y, float z) {
+			if(x + this->extent_x[c] >= min.x && x - this->extent_x[c] <= max.x &&
+					y + this->extent_y[c] >= min.y && y - this->extent_y[c] <= max.y &&
+					z + this->extent_z[c] >= min.z && z - this->extent_z[c] <= max.z)
+				ids->push_back(this->column_ids[c]);
+		});
+	}
+	
+	int historyUnitTest() {
+		TransformHistory h(16);
+		Vector3 unit = {0.5f, 0.5f, 0.5f};
+		Quaternion identity = {0, 0, 0, 1};
+		h.add(1, unit);
+		h.add(2, unit);
+		h.add(3, unit);
+		
+		// entity 1 moves along x, 2 stays put, 3 joins at tick 105
+		for(ticktype t=100; t<110; t++) {
+			h.beginTick(t);
+			h.record(1, {(float)(t - 100), 0, 0}, identity);
+			h.record(2, {0, 10, 0}, identity);
+			if(t >= 105)
+				h.record(3, {5, 0, 10}, identity);
+		}
+		
+		Vector3 p;
+		if(!h.sample(105, 0.5f, 1, &p) || p.x != 5.5f || p.y != 0) return 1;
+		if(h.sample(104, 0.5f, 3, &p)) return 2;
+		if(!h.sample(105, 0, 3, &p) || p.z != 10) return 3;
+		if(h.sample(109, 0.5f, 1, &p)) return 4; // tick 110 isn't recorded yet
+		
+		// half way through a quarter turn about z
+		Quaternion q;
+		float s = std::sqrt(0.5f);
+		h.beginTick(110);
+		h.record(1, {10, 0, 0}, {0, 0, s, s});
+		h.beginTick(111);
+		if(!h.sample(109, 1.0f, 1, &p, &q)) return 5;
+		if(!h.sample(109, 0.5f, 1, &p, &q)) return 6;
+		if(std::fabs(q.z - std::sin(0.3926991f)) > 1e-3f || std::fabs(q.w - std::cos(0.3926991f)) > 1e-3f) return 7;
+		
+		// batch sampling
+		unsigned int ids[] = {1, 2, 3, 4};
+		Vector3 positions[4];
+		bool found[4];
+		if(h.samplePositions(106, 0.25f, ids, positions, found) != 3) return 8;
+		if(!found[0] || found[3] || positions[0].x != 6.25f || positions[1].y != 10) return 9;
+		
+		// the ray along x at y=10 hits only entity 2, and the one along z at tick 105 hits 1 then 3
+		std::vector<TransformHistory::RaycastHit> hits;
+		h.raycast(106, 0, {-5, 10, 0}, {1, 0, 0}, 100, &hits);
+		if(hits.size() != 1 || hits[0].id != 2 || hits[0].distance != 4.5f) return 10;
+		hits.clear();
+		h.raycast(105, 0, {5, 0, -5}, {0, 0, 1}, 100, &hits);
+		if(hits.size() != 2 || hits[0].id != 1 || hits[1].id != 3) return 11;
+		hits.clear();
+		h.raycast(105, 0, {5, 0, -5}, {0, 0, 1}, 10, &hits);
+		if(hits.size() != 1) return 12;
+		
+		std::vector<unsigned int> overlapping;
+		h.overlapBox(108, 0, {7, -1, -1}, {9, 1, 1}, &overlapping);
+		if(overlapping != std::vector<unsigned int>({1})) return 13;
+		
+		// rewinding past the ring fails, and removed entities leave no history behind
+		h.beginTick(116);
+		if(h.sample(100, 0, 1, &p)) return 14;
+		h.remove(1);
+		h.add(4, unit);
+		if(h.sample(106, 0, 4, &p)) return 15;
+		
+		// columns grow without losing history
+		for(unsigned int id=10; id<10+HISTORY_INITIAL_ENTITIES*2; id++)
+			h.add(id, unit);
+		if(!h.sample(106, 0, 2, &p) || p.y != 10) return 16;
+		
+		return 0;
+	}
+}
@@ -0,0 +1,188 @@
+#include "interest.h"
+
+namespace razor {
+	InterestGrid::InterestGrid(float cell_size) {
+		this->cell_size = cell_size;
+	}
+	
+	// cell coordinates are packed into 21 bits each
+	long long InterestGrid::cellKey(int cx, int cy, int cz) {
+		const long long mask = (1LL << 21) - 1;
+		return ((cx & mask) << 42) | ((cy & mask) << 21) | (cz & mask);
+	}
+	
+	int InterestGrid::cellCoordinate(float v) {
+		return (int)std::floor(v / this->cell_size);
+	}
+	
+	void InterestGrid::insertIntoCell(unsigned int id, Entry* entry) {
+		entry->cell = this->cellKey(this->cellCoordinate(entry->x), 
+				this->cellCoordinate(entry->y), this->cellCoordinate(entry->z));
+		auto &cell = this->cells[entry->cell];
+		entry->cell_index = cell.size();
+		cell.push_back(id);
+	}
+	
+	void InterestGrid::removeFromCell(Entry* entry) {
+		auto it = this->cells.find(entry->cell);
+		if(it == this->cells.end())
+			return;
+		auto &cell = it->second;
+		
+		// swap the last id into the removed slot
+		unsigned int moved_id = cell.back();
+		cell[entry->cell_index] = moved_id;
+		this->objects[moved_id].cell_index = entry->cell_index;
+		cell.pop_back();
+		if(cell.size() == 0)
+			this->cells.erase(it);
+	}
+	
+	void InterestGrid::add(unsigned int id, float x, float y, float z) {
+		if(this->contains(id))
+			this->remove(id);
+		Entry entry;
+		entry.x = x;
+		entry.y = y;
+		entry.z = z;
+		entry.global = false;
+		this->insertIntoCell(id, &entry);
+		this->objects[id] = entry;
+	}
+	
+	void InterestGrid::addGlobal(unsigned int id) {
+		if(this->contains(id))
+			this->remove(id);
+		Entry entry;
+		entry.x = entry.y = entry.z = 0;
+		entry.global = true;
+		entry.cell = 0;
+		entry.cell_index = this->global_objects.size();
+		this->global_objects.push_back(id);
+		this->objects[id] = entry;
+	}
+	
+	void InterestGrid::move(unsigned int id, float x, float y, float z) {
+		auto it = this->objects.find(id);
+		if(it == this->objects.end() || it->second.global)
+			return;
+		Entry* entry = &it->second;
+		long long cell = this->cellKey(this->cellCoordinate(x), this->cellCoordinate(y), this->cellCoordinate(z));
+		entry->x = x;
+		entry->y = y;
+		entry->z = z;
+		if(cell == entry->cell)
+			return;
+		this->removeFromCell(entry);
+		this->insertIntoCell(id, entry);
+	}
+	
+	void InterestGrid::remove(unsigned int id) {
+		auto it = this->objects.find(id);
+		if(it == this->objects.end())
+			return;
+		Entry entry = it->second;
+		if(entry.global) {
+			unsigned int moved_id = this->global_objects.back();
+			this->global_objects[entry.cell_index] = moved_id;
+			this->objects[moved_id].cell_index = entry.cell_index;
+			this->global_objects.pop_back();
+		} else {
+			this->removeFromCell(&entry);
+		}
+		this->objects.erase(id);
+	}
+	
+	bool InterestGrid::contains(unsigned int id) {
+		return this->objects.find(id) != this->objects.end();
+	}
+	
+	void InterestGrid::clear() {
+		this->objects.clear();
+		this->cells.clear();
+		this->global_objects.clear();
+	}
+	
+	// Radii spanning more cells than are occupied check the occupied cells instead, which also
+	// keeps the box's cell coordinates from wrapping in cellKey
+	void InterestGrid::query(float x, float y, float z, float radius, std::vector<unsigned int>* out) {
+		float radius_squared = radius * radius;
+		auto queryCell = [&](const std::vector<unsigned int> &ids) {
+			for(auto id : ids) {
+				auto &entry = this->objects[id];
+				float dx = entry.x - x, dy = entry.y - y, dz = entry.z - z;
+				if(dx*dx + dy*dy + dz*dz <= radius_squared)
+					out->push_back(id);
+			}
+		};
+		
+		double side = 2.0 * radius / this->cell_size + 2;
+		if(side * side * side > this->cells.size()) {
+			for(auto &cell : this->cells)
+				queryCell(cell.second);
+			return;
+		}
+		
+		int min_x = this->cellCoordinate(x - radius), max_x = this->cellCoordinate(x + radius);
+		int min_y = this->cellCoordinate(y - radius), max_y = this->cellCoordinate(y + radius);
+		int min_z = this->cellCoordinate(z - radius), max_z = this->cellCoordinate(z + radius);
+		
+		for(int cx=min_x; cx<=max_x; cx++) {
+			for(int cy=min_y; cy<=max_y; cy++) {
+				for(int cz=min_z; cz<=max_z; cz++) {
+					auto it = this->cells.find(this->cellKey(cx, cy, cz));
+					if(it != this->cells.end())
+						queryCell(it->second);
+				}
+			}
+		}
+	}
+	
+	// Returns 0 on success. Otherwise returns the number of the test that failed.
+	int interestUnitTest() {
+		InterestGrid g(10.0f);
+		g.add(1, 0, 0, 0);
+		g.add(2, 5, 0, 0);
+		g.add(3, 100, 0, 0);
+		g.add(4, -15, -3, 0);
+		g.addGlobal(5);
+		
+		std::vector<unsigned int> found;
+		g.query(0, 0, 0, 20, &found);
+		std::sort(found.begin(), found.end());
+		if(found != std::vector<unsigned int>({1, 2, 4})) return 1;
+		
+		// moving across cells
+		g.move(3, 1, 1, 1);
+		g.move(1, 200, 0, 0);
+		found.clear();
+		g.query(0, 0, 0, 6, &found);
+		std::sort(found.begin(), found.end());
+		if(found != std::vector<unsigned int>({2, 3})) return 2;
+		
+		// removal keeps the remaining cell entries valid
+		g.add(6, 2, 2, 2);
+		g.remove(3);
+		found.clear();
+		g.query(0, 0, 0, 6, &found);
+		std::sort(found.begin(), found.end());
+		if(found != std::vector<unsigned int>({2, 6})) return 3;
+		
+		if(g.global_objects.size() != 1 || !g.contains(5)) return 4;
+		g.remove(5);
+		if(g.global_objects.size() != 0 || g.contains(5)) return 5;
+		
+		// only cells overlapping the query are visited
+		found.clear();
+		g.query(200, 0, 0, 1, &found);
+		if(found.size() != 1 || found[0] != 1) return 6;
+		
+		// radii spanning the whole grid find each object once
+		found.clear();
+		g.query(0, 0, 0, 1e9f, &found);
+		std::sort(found.begin(), found.end());
+		if(found != std::vector<unsigned int>({1, 2, 4, 6})) return 7;
+		
+		return 0;
+	}
+}
@@ -0,0 +1,348 @@
+#include "interpolation.h"
+
+namespace razor {
+	InterpolationBuffer::InterpolationBuffer(unsigned int samples, InterpolationMode mode) {
+		this->samples = samples;
+		this->mode = mode;
+		this->max_extrapolation = INTERPOLATION_MAX_EXTRAPOLATION;
+		this->slots = 0;
+		this->clear();
+	}
+	
+	void InterpolationBuffer::clear() {
+		this->entity_slots.clear();
+		this->free_slots.clear();
+		this->used_slots = 0;
+		std::fill(this->count.begin(), this->count.end(), 0);
+	}
+	
+	// Slots are laid out one after another, so growing keeps existing samples in place
+	void InterpolationBuffer::growSlots() {
+		this->slots = std::max<unsigned int>(INTERPOLATION_INITIAL_ENTITIES, this->slots * 2);
+		unsigned int size = this->slots * this->samples;
+		this->newest.resize(this->slots, 0);
+		this->count.resize(this->slots, 0);
+		this->times.resize(size);
+		this->position_x.resize(size);
+		this->position_y.resize(size);
+		this->position_z.resize(size);
+		this->velocity_x.resize(size);
+		this->velocity_y.resize(size);
+		this->velocity_z.resize(size);
+		this->rotation_x.resize(size);
+		this->rotation_y.resize(size);
+		this->rotation_z.resize(size);
+		this->rotation_w.resize(size);
+	}
+	
+	void InterpolationBuffer::add(unsigned int id) {
+		if(this->entity_slots.count(id) > 0)
+			return;
+		unsigned int slot;
+		if(this->free_slots.size() > 0) {
+			slot = this->free_slots.back();
+			this->free_slots.pop_back();
+		} else {
+			if(this->used_slots == this->slots)
+				this->growSlots();
+			slot = this->used_slots++;
+		}
+		this->entity_slots[id] = slot;
+		this->newest[slot] = 0;
+		this->count[slot] = 0;
+	}
+	
+	void InterpolationBuffer::remove(unsigned int id) {
+		auto it = this->entity_slots.find(id);
+		if(it == this->entity_slots.end())
+			return;
+		this->count[it->second] = 0;
+		this->free_slots.push_back(it->second);
+		this->entity_slots.erase(it);
+	}
+	
+	bool InterpolationBuffer::contains(unsigned int id) {
+		return this->entity_slots.count(id) > 0;
+	}
+	
+	void InterpolationBuffer::push(unsigned int id, nanotime time, const Vector3 &position,
+			const Quaternion &rotation, const Vector3* velocity) {
+		auto it = this->entity_slots.find(id);
+		if(it == this->entity_slots.end())
+			return;
+		unsigned int slot = it->second;
+		unsigned int base = slot * this->samples;
+		unsigned int previous = base + this->newest[slot];
+		if(this->count[slot] > 0 && time <= this->times[previous])
+			return;
+		
+		unsigned int index = this->count[slot] > 0 ? (this->newest[slot] + 1) % this->samples : 0;
+		unsigned int i = base + index;
+		this->times[i] = time;
+		this->position_x[i] = position.x;
+		this->position_y[i] = position.y;
+		this->position_z[i] = position.z;
+		this->rotation_x[i] = rotation.x;
+		this->rotation_y[i] = rotation.y;
+		this->rotation_z[i] = rotation.z;
+		this->rotation_w[i] = rotation.w;
+		if(velocity != nullptr) {
+			this->velocity_x[i] = velocity->x;
+			this->velocity_y[i] = velocity->y;
+			this->velocity_z[i] = velocity->z;
+		} else if(this->count[slot] > 0) {
+			float seconds = (float)(time - this->times[previous]) / NANOS_PER_SECOND;
+			this->velocity_x[i] = (position.x - this->position_x[previous]) / seconds;
+			this->velocity_y[i] = (position.y - this->position_y[previous]) / seconds;
+			this->velocity_z[i] = (position.z - this->position_z[previous]) / seconds;
+		} else {
+			this->velocity_x[i] = 0;
+			this->velocity_y[i] = 0;
+			this->velocity_z[i] = 0;
+		}
+		this->newest[slot] = index;
+		this->count[slot] = std::min(this->count[slot] + 1, this->samples);
+	}
+	
+	SampleResult InterpolationBuffer::bracket(unsigned int slot, nanotime render_time, unsigned int* a,
+			unsigned int* b, float* t, float* span, float* extrapolation) {
+		*t = 0;
+		*span = 0;
+		*extrapolation = 0;
+		if(this->count[slot] == 0)
+			return SAMPLE_MISSING;
+		
+		unsigned int base = slot * this->samples;
+		unsigned int later = base + this->newest[slot];
+		if(this->times[later] <= render_time) {
+			*a = *b = later;
+			*extrapolation = (float)std::min(render_time - this->times[later], this->max_extrapolation) / NANOS_PER_SECOND;
+			return *extrapolation > 0 ? SAMPLE_EXTRAPOLATED : SAMPLE_INTERPOLATED;
+		}
+		
+		// walk back from the newest sample to the first at or before render_time
+		for(unsigned int k=1; k<this->count[slot]; k++) {
+			unsigned int earlier = base + (this->newest[slot] + this->samples - k) % this->samples;
+			if(this->times[earlier] <= render_time) {
+				*a = earlier;
+				*b = later;
+				nanotime gap = this->times[later] - this->times[earlier];
+				*t = (float)(render_time - this->times[earlier]) / gap;
+				*span = (float)gap / NANOS_PER_SECOND;
+				return SAMPLE_INTERPOLATED;
+			}
+			later = earlier;
+		}
+		
+		// older than everything kept, so hold the oldest sample
+		*a = *b = later;
+		return SAMPLE_INTERPOLATED;
+	}
+	
+	// Blends from a towards b, t of the way through span seconds, then moves on along a's
+	// velocity for extrapolation seconds. With t = 0 and span = 0 both modes reduce to a + va * e.
+	static inline float blend(InterpolationMode mode, float a, float b, float va, float vb,
+			float t, float span, float extrapolation) {
+		if(mode == INTERPOLATE_HERMITE) {
+			float t2 = t * t;
+			float t3 = t2 * t;
+			return (2*t3 - 3*t2 + 1) * a + (t3 - 2*t2 + t) * span * va +
+				(3*t2 - 2*t3) * b + (t3 - t2) * span * vb + va * extrapolation;
+		}
+		return a + (b - a) * t + va * extrapolation;
+	}
+	
+	SampleResult InterpolationBuffer::sample(unsigned int id, nanotime render_time, Vector3* position,
+			Quaternion* rotation) {
+		auto it = this->entity_slots.find(id);
+		if(it == this->entity_slots.end())
+			return SAMPLE_MISSING;
+		unsigned int a, b;
+		float t, span, extrapolation;
+		SampleResult result = this->bracket(it->second, render_time, &a, &b, &t, &span, &extrapolation);
+		if(result == SAMPLE_MISSING)
+			return result;
+		
+		position->x = blend(this->mode, this->position_x[a], this->position_x[b],
+			this->velocity_x[a], this->velocity_x[b], t, span, extrapolation);
+		position->y = blend(this->mode, this->position_y[a], this->position_y[b],
+			this->velocity_y[a], this->velocity_y[b], t, span, extrapolation);
+		position->z = blend(this->mode, this->position_z[a], this->position_z[b],
+			this->velocity_z[a], this->velocity_z[b], t, span, extrapolation);
+		if(rotation != nullptr) {
+			*rotation = slerp(
+				{this->rotation_x[a], this->rotation_y[a], this->rotation_z[a], this->rotation_w[a]},
+				{this->rotation_x[b], this->rotation_y[b], this->rotation_z[b], this->rotation_w[b]}, t);
+		}
+		return result;
+	}
+	
+	// Gathers each batch of entities' samples into stack arrays, then blends them in one
+	// branch free pass over contiguous floats that the compiler can vectorize
+	unsigned int InterpolationBuffer::samplePositions(nanotime render_time, std::span<const unsigned int> ids,
+			Vector3* positions, bool* found) {
+		float ax[INTERPOLATION_BATCH], ay[INTERPOLATION_BATCH], az[INTERPOLATION_BATCH];
+		float bx[INTERPOLATION_BATCH], by[INTERPOLATION_BATCH], bz[INTERPOLATION_BATCH];
+		float vax[INTERPOLATION_BATCH], vay[INTERPOLATION_BATCH], vaz[INTERPOLATION_BATCH];
+		float vbx[INTERPOLATION_BATCH], vby[INTERPOLATION_BATCH], vbz[INTERPOLATION_BATCH];
+		float t[INTERPOLATION_BATCH], span[INTERPOLATION_BATCH], extrapolation[INTERPOLATION_BATCH];
+		float ox[INTERPOLATION_BATCH], oy[INTERPOLATION_BATCH], oz[INTERPOLATION_BATCH];
+		
+		unsigned int total = 0;
+		for(size_t start=0; start<ids.size(); start+=INTERPOLATION_BATCH) {
+			unsigned int n = std::min<size_t>(INTERPOLATION_BATCH, ids.size() - start);
+			for(unsigned int i=0; i<n; i++) {
+				unsigned int a = 0, b = 0;
+				auto it = this->entity_slots.find(ids[start + i]);
+				found[start + i] = it != this->entity_slots.end() &&
+					this->bracket(it->second, render_time, &a, &b, &t[i], &span[i], &extrapolation[i]) != SAMPLE_MISSING;
+				if(!found[start + i]) {
+					// there may be no slots to load from, and the result is discarded anyway
+					ax[i] = ay[i] = az[i] = bx[i] = by[i] = bz[i] = 0;
+					vax[i] = vay[i] = vaz[i] = vbx[i] = vby[i] = vbz[i] = 0;
+					t[i] = span[i] = extrapolation[i] = 0;
+					continue;
+				}
+				ax[i] = this->position_x[a];
+				ay[i] = this->position_y[a];
+				az[i] = this->position_z[a];
+				bx[i] = this->position_x[b];
+				by[i] = this->position_y[b];
+				bz[i] = this->position_z[b];
+				vax[i] = this->velocity_x[a];
+				vay[i] = this->velocity_y[a];
+				vaz[i] = this->velocity_z[a];
+				vbx[i] = this->velocity_x[b];
+				vby[i] = this->velocity_y[b];
+				vbz[i] = this->velocity_z[b];
+			}
+			
+			if(this->mode == INTERPOLATE_HERMITE) {
+				for(unsigned int i=0; i<n; i++) {
+					ox[i] = blend(INTERPOLATE_HERMITE, ax[i], bx[i], vax[i], vbx[i], t[i], span[i], extrapolation[i]);
+					oy[i] = blend(INTERPOLATE_HERMITE, ay[i], by[i], vay[i], vby[i], t[i], span[i], extrapolation[i]);
+					oz[i] = blend(INTERPOLATE_HERMITE, az[i], bz[i], vaz[i], vbz[i], t[i], span[i], extrapolation[i]);
+				}
+			} else {
+				for(unsigned int i=0; i<n; i++) {
+					ox[i] = blend(INTERPOLATE_LINEAR, ax[i], bx[i], vax[i], vbx[i], t[i], span[i], extrapolation[i]);
+					oy[i] = blend(INTERPOLATE_LINEAR, ay[i], by[i], vay[i], vby[i], t[i], span[i], extrapolation[i]);
+					oz[i] = blend(INTERPOLATE_LINEAR, az[i], bz[i], vaz[i], vbz[i], t[i], span[i], extrapolation[i]);
+				}
+			}
+			
+			for(unsigned int i=0; i<n; i++) {
+				if(found[start + i]) {
+					positions[start + i] = {ox[i], oy[i], oz[i]};
+					total++;
+				}
+			}
+		}
+		return total;
+	}
+	
+	Quaternion slerp(const Quaternion &a, const Quaternion &b, float t) {
+		float dot = a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+		float sign = 1;
+		if(dot < 0) {
+			dot = -dot;
+			sign = -1;
+		}
+		float wa, wb;
+		if(dot > 0.9995f) {
+			// nearly parallel, where lerp is as good and the sine below loses precision
+			wa = 1 - t;
+			wb = t;
+		} else {
+			float angle = std::acos(dot);
+			float sine = std::sin(angle);
+			wa = std::sin((1 - t) * angle) / sine;
+			wb = std::sin(t * angle) / sine;
+		}
+		wb *= sign;
+		Quaternion q = {a.x*wa + b.x*wb, a.y*wa + b.y*wb, a.z*wa + b.z*wb, a.w*wa + b.w*wb};
+		float length = std::sqrt(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+		if(length > 0) {
+			q.x /= length;
+			q.y /= length;
+			q.z /= length;
+			q.w /= length;
+		}
+		return q;
+	}
+	
+	int interpolationUnitTest() {
+		const nanotime step = 50 * NANOS_PER_MILLI;
+		const nanotime start = 1000 * NANOS_PER_SECOND;
+		Quaternion identity = {0, 0, 0, 1};
+		InterpolationBuffer buffer(4);
+		buffer.add(1);
+		buffer.add(2);
+		
+		Vector3 p;
+		if(buffer.sample(1, start, &p) != SAMPLE_MISSING) return 1;
+		
+		// entity 1 moves 1 unit per sample (20 per second), entity 2 accelerates
+		for(int i=0; i<6; i++) {
+			buffer.push(1, start + i * step, {(float)i, 0, 0}, identity);
+			Vector3 velocity = {0, 2.0f * i * 20, 0};
+			buffer.push(2, start + i * step, {0, (float)(i * i), 0}, identity, &velocity);
+		}
+		buffer.push(1, start + step, {100, 0, 0}, identity); // stale, ignored
+		
+		if(buffer.sample(1, start + 4 * step + step / 2, &p) != SAMPLE_INTERPOLATED || std::fabs(p.x - 4.5f) > 1e-4f) return 2;
+		// only 4 samples are kept, so earlier times hold the oldest
+		if(buffer.sample(1, start, &p) != SAMPLE_INTERPOLATED || p.x != 2) return 3;
+		// extrapolation follows the velocity, up to max_extrapolation
+		if(buffer.sample(1, start + 5 * step + step, &p) != SAMPLE_EXTRAPOLATED || std::fabs(p.x - 6) > 1e-3f) return 4;
+		if(buffer.sample(1, start + 5 * step + 10 * step, &p) != SAMPLE_EXTRAPOLATED || std::fabs(p.x - 7) > 1e-3f) return 5;
+		
+		// hermite follows the curve between samples where linear cuts across it
+		nanotime mid = start + 3 * step + step / 2;
+		buffer.sample(2, mid, &p);
+		if(std::fabs(p.y - 12.5f) > 1e-3f) return 6;
+		buffer.mode = INTERPOLATE_HERMITE;
+		buffer.sample(2, mid, &p);
+		if(std::fabs(p.y - 12.25f) > 1e-3f) return 7;
+		
+		// batches match single samples, across more than one batch
+		std::vector<unsigned int> ids;
+		for(unsigned int i=0; i<INTERPOLATION_BATCH + 10; i++)
+			ids.push_back(i % 3);
+		std::vector<Vector3> positions(ids.size());
+		bool found[INTERPOLATION_BATCH + 10];
+		if(buffer.samplePositions(mid, ids, positions.data(), found) != ids.size() - std::count(ids.begin(), ids.end(), 0)) return 8;
+		for(size_t i=0; i<ids.size(); i++) {
+			if(found[i] != (ids[i] != 0)) return 9;
+			if(found[i]) {
+				buffer.sample(ids[i], mid, &p);
+				if(std::fabs(p.x - positions[i].x) > 1e-5f || std::fabs(p.y - positions[i].y) > 1e-5f) return 10;
+			}
+		}
+		
+		// rotations take the shortest arc at a constant rate
+		float s = std::sqrt(0.5f);
+		Quaternion q = slerp(identity, {0, 0, s, s}, 1.0f / 3);
+		if(std::fabs(q.z - std::sin(0.2617994f)) > 1e-4f || std::fabs(q.w - std::cos(0.2617994f)) > 1e-4f) return 11;
+		q = slerp(identity, {0, 0, -s, -s}, 0.5f);
+		if(std::fabs(q.z - std::sin(0.3926991f)) > 1e-4f) return 12;
+		
+		// slots are reused without their old samples
+		buffer.remove(1);
+		buffer.add(3);
+		if(buffer.sample(3, mid, &p) != SAMPLE_MISSING) return 13;
+		for(unsigned int id=10; id<10+INTERPOLATION_INITIAL_ENTITIES; id++)
+			buffer.add(id);
+		if(buffer.sample(2, mid, &p) != SAMPLE_INTERPOLATED || std::fabs(p.y - 12.25f) > 1e-3f) return 14;
+		
+		// entities that aren't found are skipped, even before any slot is allocated
+		InterpolationBuffer empty;
+		unsigned int missing_ids[] = {5, 6};
+		Vector3 missing_positions[2];
+		bool missing_found[2];
+		if(empty.samplePositions(start, missing_ids, missing_positions, missing_found) != 0 ||
+				missing_found[0] || missing_found[1]) return 15;
+		
+		return 0;
+	}
+}
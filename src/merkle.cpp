@@ -0,0 +1,123 @@
+#include "merkle.h"
+
+namespace razor {
+	MerkleTree::MerkleTree() {
+		this->clear();
+	}
+	
+	void MerkleTree::build(const void* data, unsigned int length) {
+		this->levels.clear();
+		this->length = length;
+		
+		// leaves are seeded with the length so trees of differently sized data never match
+		std::vector<unsigned long long> leaves;
+		unsigned int leaf_count = length == 0 ? 1 : (length + MERKLE_CHUNK_SIZE - 1) / MERKLE_CHUNK_SIZE;
+		leaves.resize(leaf_count);
+		for(unsigned int i=0; i<leaf_count; i++) {
+			unsigned int start = i * MERKLE_CHUNK_SIZE;
+			unsigned int chunk_length = std::min<unsigned int>(MERKLE_CHUNK_SIZE, length - start);
+			leaves[i] = hashData((const uint8_t*)data + start, chunk_length, length);
+		}
+		this->levels.push_back(std::move(leaves));
+		
+		while(this->levels.back().size() > 1) {
+			auto &children = this->levels.back();
+			std::vector<unsigned long long> parents;
+			parents.resize((children.size() + 1) / 2);
+			for(unsigned int i=0; i<parents.size(); i++) {
+				unsigned int child_count = std::min<unsigned int>(2, children.size() - i*2);
+				parents[i] = hashData(&children[i*2], child_count * sizeof(unsigned long long));
+			}
+			this->levels.push_back(std::move(parents));
+		}
+	}
+	
+	void MerkleTree::clear() {
+		this->levels.clear();
+		this->length = 0;
+	}
+	
+	unsigned long long MerkleTree::root() {
+		if(this->levels.size() == 0)
+			return 0;
+		return this->levels.back()[0];
+	}
+	
+	unsigned int MerkleTree::depth() {
+		return this->levels.size();
+	}
+	
+	unsigned int MerkleTree::leafCount() {
+		if(this->levels.size() == 0)
+			return 0;
+		return this->levels[0].size();
+	}
+	
+	unsigned long long MerkleTree::node(unsigned int level, unsigned int index) {
+		if(level >= this->levels.size() || index >= this->levels[level].size())
+			return 0;
+		return this->levels[level][index];
+	}
+	
+	void MerkleTree::descendants(unsigned int level, unsigned int index, unsigned int target_level,
+			unsigned int* first, unsigned int* last) {
+		*first = 0;
+		*last = 0;
+		if(level >= this->levels.size() || target_level > level)
+			return;
+		unsigned int shift = level - target_level;
+		unsigned int level_size = this->levels[target_level].size();
+		*first = std::min<unsigned int>(index << shift, level_size);
+		*last = std::min<unsigned int>((index + 1) << shift, level_size);
+	}
+	
+	// Returns 0 on success. Otherwise returns the number of the test that failed.
+	int merkleUnitTest() {
+		std::string a;
+		for(int i=0; i<5000; i++)
+			a.push_back((char)(i * 7));
+		std::string b = a;
+		
+		MerkleTree ta, tb;
+		ta.build(a.c_str(), a.size());
+		tb.build(b.c_str(), b.size());
+		
+		if(ta.leafCount() != 20) return 1;
+		if(ta.depth() != 6) return 2;
+		if(ta.root() != tb.root()) return 3;
+		
+		// change one byte in chunk 13
+		b[13 * MERKLE_CHUNK_SIZE + 5] ^= 1;
+		tb.build(b.c_str(), b.size());
+		if(ta.root() == tb.root()) return 4;
+		
+		// descend from the root to the mismatching leaf
+		std::vector<unsigned int> mismatches = {0};
+		unsigned int level = ta.depth() - 1;
+		while(level > 0) {
+			unsigned int target_level = level > MERKLE_DESCENT_LEVELS ? level - MERKLE_DESCENT_LEVELS : 0;
+			std::vector<unsigned int> next;
+			for(auto index : mismatches) {
+				unsigned int first, last;
+				ta.descendants(level, index, target_level, &first, &last);
+				for(unsigned int i=first; i<last; i++) {
+					if(ta.node(target_level, i) != tb.node(target_level, i))
+						next.push_back(i);
+				}
+			}
+			mismatches = next;
+			level = target_level;
+		}
+		if(mismatches.size() != 1 || mismatches[0] != 13) return 5;
+		
+		// different lengths never match, even with identical prefixes
+		tb.build(a.c_str(), a.size() - 1);
+		if(ta.node(0, 0) == tb.node(0, 0)) return 6;
+		
+		MerkleTree empty;
+		empty.build(a.c_str(), 0);
+		if(empty.leafCount() != 1 || empty.depth() != 1) return 7;
+		
+		return 0;
+	}
+}
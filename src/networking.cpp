@@ -25,6 +25,12 @@ namespace razor {
 		cur_local_packet_id++;
 	}
 	
+	unsigned int Packet::reserveIDs(unsigned int count) {
+		unsigned int first_id = cur_local_packet_id;
+		cur_local_packet_id += count;
+		return first_id;
+	}
+	
 	unsigned short Packet::length() {
 		unsigned short len = 4+1; // id + num_segments
 		for(int i=0; i<this->segments.size(); i++) {
@@ -78,9 +84,15 @@ namespace razor {
 	}
 
 	Connection::Connection() {
+		this->socket = nullptr;
 		this->log_file = nullptr;
 		this->next_channel = 1;
 		this->remote_host_and_port = ANY_ADDRESS;
+		this->pacing = false;
+		this->peer_rate_limit = 0;
+		this->global_rate_limit = 0;
+		this->global_tokens = PACING_BURST;
+		this->global_last_refill = 0;
 	}
 		
 	Connection::~Connection() {
@@ -147,7 +159,10 @@ namespace razor {
 	}
 		
 	void Connection::closeSocket() {
+		if(this->socket == nullptr)
+			return;
 		SDLNet_UDP_Close(this->socket);
+		this->socket = nullptr;
 	}
 		
 	int Connection::getChannel(const std::string &host_and_port) {
@@ -181,6 +196,7 @@ namespace razor {
 			return; // not bound
 		SDLNet_UDP_Unbind(this->socket, it->second);
 		this->channels.erase(host_and_port);
+		this->pacers.erase(host_and_port);
 	}
 		
 	void Connection::unbindAll() {
@@ -193,13 +209,15 @@ namespace razor {
 			it++;
 		}
 		this->channels.clear();
+		this->pacers.clear();
 	}
 		
 		// internal send
-	bool Connection::sendPacket(int channel, unsigned char multipart_total,
+	// multipart ids must be consecutive so the receiver can find the first part
+	bool Connection::sendPacket(int channel, unsigned int id, unsigned char multipart_total,
 			unsigned char multipart_index, const std::string &message_part) {
 		Packet p;
-		p.assignID();
+		p.id = id;
 		
 		char multipart_header[3];
 		multipart_header[0] = 'M';
@@ -218,16 +236,11 @@ namespace razor {
 			std::fputc('\n', this->log_file);
 		}
 		
-		// send four copies to lower chances of non-delivery
+		// each datagram is sent once. Loss of commands is covered by Razor's command
+		// redundancy window rather than by duplicating packets.
 		bool result = true;
 		if(SDLNet_UDP_Send(this->socket, channel, up) == 0)
 			result = false;
-		if(SDLNet_UDP_Send(this->socket, channel, up) == 0)
-			result = false;
-		/*if(SDLNet_UDP_Send(this->socket, channel, up) == -1)
-			result = false;
-		if(SDLNet_UDP_Send(this->socket, channel, up) == -1)
-			result = false;*/
 		
 		// std::cout << "< Sent packet. Succeeded: " << result << std::endl; TODO: fix bullet destroy
 			
@@ -236,7 +249,7 @@ namespace razor {
 	}
 		
 	// returns whether the message was sent
-	bool Connection::send(const std::string &host_and_port, const std::string &message) {
+	bool Connection::send(const std::string &host_and_port, const std::string &message, unsigned char lane) {
 		if(this->socket == nullptr)
 			return false;
 		
@@ -258,35 +271,177 @@ namespace razor {
 			multiparts.push_back(message_part);
 		}
 		
+		unsigned int first_id = Packet::reserveIDs(multiparts.size());
+		
+		if(this->pacing) {
+			auto &pacer = this->pacerFor(host_and_port);
+			// control messages are small and must never be refused
+			if(lane != SEND_LANE_CONTROL && pacer.queued_bytes > 0 &&
+					pacer.queued_bytes + size > PACING_MAX_QUEUED)
+				return false;
+			for(unsigned int i=0; i<multiparts.size(); i++) {
+				pacer.queued_bytes += multiparts[i].size();
+				pacer.lanes[lane].push_back(
+					{channel, first_id + i, (unsigned char)multiparts.size(), (unsigned char)i, multiparts[i]});
+			}
+			this->flush();
+			return true;
+		}
+		
 		bool success = true;
 		for(int i=0; i<multiparts.size(); i++) {
-			success = success && sendPacket(channel, multiparts.size(), i, multiparts[i]);
+			success = success && sendPacket(channel, first_id + i, multiparts.size(), i, multiparts[i]);
 		}
 		
 		return success;
 	}
+	
+	void Connection::setPacing(bool is_pacing, unsigned int peer_rate_limit, unsigned int global_rate_limit) {
+		this->pacing = is_pacing;
+		this->peer_rate_limit = peer_rate_limit;
+		this->global_rate_limit = global_rate_limit;
+		if(!is_pacing)
+			this->flush();
+	}
+	
+	Connection::Pacer& Connection::pacerFor(const std::string &host_and_port) {
+		auto it = this->pacers.find(host_and_port);
+		if(it != this->pacers.end())
+			return it->second;
+		
+		auto &pacer = this->pacers[host_and_port];
+		pacer.rate = std::min(PACING_INITIAL_RATE, this->rateCeiling());
+		pacer.tokens = PACING_BURST;
+		pacer.last_refill = razor::nanoNow();
+		pacer.base_delay = 0;
+		pacer.queued_bytes = 0;
+		return pacer;
+	}
+	
+	double Connection::rateCeiling() {
+		double ceiling = PACING_MAX_RATE;
+		if(this->peer_rate_limit > 0)
+			ceiling = std::min(ceiling, (double)this->peer_rate_limit);
+		if(this->global_rate_limit > 0)
+			ceiling = std::min(ceiling, (double)this->global_rate_limit);
+		return ceiling;
+	}
+	
+	// Sends queued datagrams round-robin across remotes while both the remote's and the global
+	// bucket have tokens, taking each remote's highest priority lane first. Without pacing
+	// everything queued is sent.
+	void Connection::flush() {
+		auto now = razor::nanoNow();
+		
+		if(this->global_rate_limit > 0) {
+			this->global_tokens = std::min(PACING_BURST, this->global_tokens +
+				(double)this->global_rate_limit * (now - this->global_last_refill) / NANOS_PER_SECOND);
+		}
+		this->global_last_refill = now;
+		for(auto &p : this->pacers) {
+			auto &pacer = p.second;
+			pacer.tokens = std::min(PACING_BURST, pacer.tokens +
+				pacer.rate * (now - pacer.last_refill) / NANOS_PER_SECOND);
+			pacer.last_refill = now;
+		}
+		
+		bool sent = true;
+		while(sent) {
+			sent = false;
+			for(auto &p : this->pacers) {
+				auto &pacer = p.second;
+				auto lane = std::find_if(std::begin(pacer.lanes), std::end(pacer.lanes),
+					[](const std::deque<QueuedPacket> &l) { return !l.empty(); });
+				if(lane == std::end(pacer.lanes))
+					continue;
+				
+				auto &packet = lane->front();
+				double cost = packet.message_part.size();
+				if(this->pacing) {
+					if(pacer.tokens < cost)
+						continue;
+					if(this->global_rate_limit > 0 && this->global_tokens < cost)
+						return;
+					pacer.tokens -= cost;
+					if(this->global_rate_limit > 0)
+						this->global_tokens -= cost;
+				}
+				
+				this->sendPacket(packet.channel, packet.id, packet.multipart_total,
+					packet.multipart_index, packet.message_part);
+				pacer.queued_bytes -= packet.message_part.size();
+				lane->pop_front();
+				sent = true;
+			}
+		}
+	}
+	
+	// A rate-based LEDBAT. The rate grows while the queueing delay above the lowest round trip
+	// seen is under PACING_TARGET_DELAY, shrinks in proportion when over it, and backs off on loss.
+	void Connection::updateRate(const std::string &host_and_port, nanotime round_trip, float loss) {
+		if(round_trip == 0)
+			return;
+		
+		auto &pacer = this->pacerFor(host_and_port);
+		if(pacer.base_delay == 0 || round_trip < pacer.base_delay)
+			pacer.base_delay = round_trip;
+		
+		double queueing_delay = round_trip - pacer.base_delay;
+		double off_target = (PACING_TARGET_DELAY - queueing_delay) / PACING_TARGET_DELAY;
+		off_target = std::max(off_target, -1.0);
+		pacer.rate *= 1.0 + PACING_GAIN * off_target;
+		pacer.rate *= 1.0 - std::min(loss, 1.0f) / 2.0;
+		pacer.rate = std::clamp(pacer.rate, PACING_MIN_RATE, std::max(PACING_MIN_RATE, this->rateCeiling()));
+	}
+	
+	unsigned int Connection::queuedBytes(const std::string &host_and_port) {
+		auto it = this->pacers.find(host_and_port);
+		if(it == this->pacers.end())
+			return 0;
+		return it->second.queued_bytes;
+	}
 		
-	bool Connection::sendAll(const std::string &message) {
+	bool Connection::sendAll(const std::string &message, unsigned char lane) {
 		bool success = true;
 		for(auto p : this->channels) {
-			success = success && this->send(p.first, message);
+			success = success && this->send(p.first, message, lane);
 		}
 		return success;
 	}
 		
 	// returns if anything was recieved
-	bool Connection::receive(std::string* host_and_port, std::string* message) {
+	bool Connection::receive(std::string* host_and_port, std::string* message, nanotime* timestamp) {
 		if(this->socket == nullptr)
 			return false;
 		
 		if(this->received_messages.size() > 0) {
 			DirectedMessage m = this->received_messages.front();
-			this->received_messages.pop_back();
+			this->received_messages.pop_front();
 			*host_and_port = m.host_and_port;
 			*message = m.message;
+			if(timestamp != nullptr)
+				*timestamp = m.timestamp;
 			return true;
 		}
-				
+		
+		nanotime read_time;
+		bool received = this->receiveFromSocket(host_and_port, message, &read_time);
+		if(received && timestamp != nullptr)
+			*timestamp = read_time;
+		return received;
+	}
+	
+	void Connection::poll() {
+		if(this->socket == nullptr)
+			return;
+		
+		DirectedMessage m;
+		while(this->receiveFromSocket(&m.host_and_port, &m.message, &m.timestamp)) {
+			this->received_messages.push_back(m);
+		}
+	}
+	
+	bool Connection::receiveFromSocket(std::string* host_and_port, std::string* message, nanotime* timestamp) {
 		// Clean up old received_uids
 		auto now = razor::nanoNow();
 		for(auto i=this->received_uids.begin(); i!=this->received_uids.end(); ) {
@@ -303,6 +458,7 @@ namespace razor {
 		// this loop goes through physical packets, discarding duplicates, and eventually assembling a multipart
 		while(true) {
 			int result = SDLNet_UDP_Recv(this->socket, up);
+			nanotime read_time = razor::nanoNow();
 			if(result == 0) {
 				// No packet received
 				SDLNet_FreePacket(up);
@@ -312,7 +468,7 @@ namespace razor {
 				// Error
 				std::cout << "< Receive networking error." << std::endl;
 				SDLNet_FreePacket(up);
-				continue;
+				return false;
 			}
 			
 			// discard packets from non-authorized sources
@@ -320,7 +476,6 @@ namespace razor {
 			if(this->remote_host_and_port != ANY_ADDRESS &&
 				this->remote_host_and_port != host) {
 				//std::cout << "< Received packet from source other than remote." << std::endl;
-				SDLNet_FreePacket(up);
 				continue;
 			}
 			
@@ -354,7 +509,7 @@ namespace razor {
 			unsigned char mp_idx = ((char*)(p.segments[0].data))[2];
 			if(mp_idx-1 > mp_len) // check sanity
 				continue; // drop insane
-			unsigned char mp_first_id = p.id - mp_idx;
+			unsigned int mp_first_id = p.id - mp_idx;
 			
 			std::string first_packet_uid = getPacketUIDString(host, mp_first_id);
 			auto it2 = this->pending_multipart_messages.find(first_packet_uid);
@@ -372,6 +527,7 @@ namespace razor {
 			// collect the part into the appropriate multipart vector
 			DirectedMessage mpp;
 			mpp.host_and_port = host;
+			mpp.timestamp = read_time;
 			mpp.message.resize(p.segments[1].length);
 			mpp.message.assign((char*)p.segments[1].data, p.segments[1].length);
 			(*multiparts)[mp_idx] = mpp;
@@ -379,6 +535,7 @@ namespace razor {
 			// if the multipart is complete, return it
 			if(Connection::multipartIsComplete(multiparts)) {
 				*host_and_port = host;
+				*timestamp = read_time;
 				*message = "";
 				for(int i=0; i<multiparts->size(); i++) {
 					message->append((*multiparts)[i].message);
@@ -394,6 +551,23 @@ namespace razor {
 		return false;
 	}
 
+	void Connection::expireMultiparts(nanotime older_than) {
+		for(auto it=this->pending_multipart_messages.begin(); it!=this->pending_multipart_messages.end(); ) {
+			bool expired = false;
+			for(auto &part : it->second) {
+				if(part.host_and_port.size() > 0 && part.timestamp < older_than) {
+					expired = true;
+					break;
+				}
+			}
+			if(expired) {
+				it = this->pending_multipart_messages.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	
 	void Connection::enableLogging() {
 		this->log_file = std::fopen("networking.log", "wb");
 	}
@@ -455,6 +629,65 @@ namespace razor {
 		// Check if duplicate packets are thrown out. Should return false.
 		if(c1.receive(&outhost, &outmsg)) return 12;
 		
+		// Paced sends beyond the burst are released over time
+		c2.setPacing(true, 50000);
+		inmsg.clear();
+		for(int i=0; i<10000; i++)
+			inmsg.push_back('a' + i % 26);
+		auto start = nanoNow();
+		if(!c2.send("127.0.0.1:11223", inmsg)) return 13;
+		if(c2.queuedBytes("127.0.0.1:11223") == 0) return 14;
+		if(c1.receive(&outhost, &outmsg)) return 15;
+		// a control message sent later overtakes the queued bulk fragments
+		std::string control_msg = "pong";
+		if(!c2.send("127.0.0.1:11223", control_msg, SEND_LANE_CONTROL)) return 16;
+		sleep(5);
+		c2.flush();
+		if(!c1.receive(&outhost, &outmsg)) return 17;
+		if(outmsg != control_msg) return 18;
+		while(c2.queuedBytes("127.0.0.1:11223") > 0 && nanoNow() - start < NANOS_PER_SECOND) {
+			c2.flush();
+			sleep(5);
+		}
+		if(nanoNow() - start < 80 * NANOS_PER_MILLI) return 19;
+		if(!c1.receive(&outhost, &outmsg)) return 20;
+		if(outmsg != inmsg) return 21;
+		
+		// Queueing delay above the target and loss lower the rate; delay under it raises it
+		auto &pacer = c2.pacers["127.0.0.1:11223"];
+		c2.updateRate("127.0.0.1:11223", 20 * NANOS_PER_MILLI, 0);
+		double rate = pacer.rate;
+		c2.setPacing(true, 0);
+		c2.updateRate("127.0.0.1:11223", 20 * NANOS_PER_MILLI, 0);
+		if(pacer.rate <= rate) return 22;
+		rate = pacer.rate;
+		c2.updateRate("127.0.0.1:11223", 120 * NANOS_PER_MILLI, 0);
+		if(pacer.rate >= rate) return 23;
+		rate = pacer.rate;
+		c2.updateRate("127.0.0.1:11223", 20 * NANOS_PER_MILLI, 0.5f);
+		if(pacer.rate >= rate) return 24;
+		
+		// Polled messages keep the time they were read from the socket
+		c2.setPacing(false);
+		inmsg = "Polled";
+		if(!c2.send("127.0.0.1:11223", inmsg)) return 25;
+		sleep(5);
+		c1.poll();
+		auto polled = nanoNow();
+		sleep(20);
+		nanotime received_time;
+		if(!c1.receive(&outhost, &outmsg, &received_time)) return 26;
+		if(outmsg != inmsg || received_time > polled) return 27;
+		
+		// Multiparts missing parts are dropped once their first part is old enough
+		std::vector<Connection::DirectedMessage> partial(2);
+		partial[1] = {"127.0.0.1:11224", "part", polled};
+		c1.pending_multipart_messages["partial"] = partial;
+		c1.expireMultiparts(polled);
+		if(c1.pending_multipart_messages.size() != 1) return 28;
+		c1.expireMultiparts(polled + 1);
+		if(c1.pending_multipart_messages.size() != 0) return 29;
+		
 		return 0;
 	}
 }
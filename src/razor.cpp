@@ -14,14 +14,67 @@ namespace razor {
 		this->future_time = 0;
 		this->next_sync_tick = 0;
 		this->last_sync_tick = 0;
-		this->next_ping_time = 0;
+		this->next_peer_id = 1;
+		this->keepalive = KEEPALIVE;
+		this->timeout = TIMEOUT;
+		this->ping_timer = 0;
+		this->daemon_timeout_timer = 0;
+		this->reassembly_timer = 0;
+		this->timers.clear(razor::nanoNow());
 		this->next_command_time = 0;
 		this->ping = 0;
+		this->ping_loss = 0;
+		this->awaiting_pong = false;
+		this->sync_phase_count = 0;
+		this->tick_period = 0;
+		this->last_tick_time = 0;
+		this->last_tick_number = 0;
 		this->time_delta_to_daemon = 0;
 		this->destroyed = false;
+		this->next_command_seq = 1;
+		this->command_budget = COMMAND_REDUNDANCY_BUDGET;
+		this->get_state_data_func = nullptr;
+		this->tick_commands_func = nullptr;
+		this->peer_disconnected_func = nullptr;
+		this->next_finalize_tick = 0;
+		this->batch_receive_tick = 0;
+		this->next_batch_tick = 0;
+		this->batch_request_tick = 0;
+		this->lockstep = false;
+		this->lockstep_command_delay = LOCKSTEP_COMMAND_DELAY;
+		this->last_hashed_tick = 0;
+		this->set_state_data_func = nullptr;
+		this->get_state_hash_func = nullptr;
+		this->get_state_data_at_tick_func = nullptr;
+		this->merkle_sync = false;
+		this->merkle_tick = 0;
+		this->merkle_root = 0;
+		this->interest_management = false;
+		this->object_state_cache_tick = 0;
+		this->get_object_state_func = nullptr;
+		this->set_object_state_func = nullptr;
+		this->object_left_interest_func = nullptr;
+		this->object_relevance_func = nullptr;
+		this->object_priority_func = nullptr;
+		this->sync_budget = 0;
+		this->join_stream = false;
+		this->join_stream_budget = JOIN_STREAM_BUDGET;
+		this->join_receiving = false;
+		this->join_receive_tick = 0;
+		this->join_last_progress = 0;
+		this->join_remaining = 0;
+		this->entity_sync = false;
+		this->entity_tick = 0;
+		this->delta_sync = false;
+		this->has_sync_baseline = false;
+		this->sync_baseline_tick = 0;
+		this->compression = false;
+		this->compression_dictionary_hash = 0;
+		this->compressed_ready[0] = this->compressed_ready[1] = false;
+		this->state_hashes.resize(LOCKSTEP_HASH_HISTORY, StateHash{0, 0});
 		this->send_buffer = new char[SEND_BUFFER_SIZE];
 		this->packed_command_buffer = new char[MAX_COMMANDS_PER_PACKET * 
-													(MAX_COMMAND_LENGTH + 8)
+													(MAX_COMMAND_LENGTH + 2 * VARINT_MAX_BYTES) // tick, seq and length
 													+ 2]; // extra 2 for number of commands
 	};
 	
@@ -35,35 +88,34 @@ namespace razor {
 			std::cout << "< Closed networking socket." << std::endl;
 			delete [] this->send_buffer;
 			delete [] this->packed_command_buffer;
+			this->destroyed = true;
 		}
 	}
 	
 	nanotimediff Razor::calculateLocalTimeDifference() {
-		if(this->time_delta_log.size() == 0)
+		if(this->clock_sync.samples.size() == 0)
 			return 0;
 		
-		// average the time_delta_log
-		double avg_td = 0;
-		for(int i=0; i<this->time_delta_log.size(); i++) {
-			avg_td += this->time_delta_log[i];
-		}
-		avg_td /= this->time_delta_log.size();
-		
+		// difference between the two time systems' zero_time (from local to daemon)
+		double avg_td = (nanotimediff)(this->daemon_zero_time - this->local_zero_time) -
+			this->clock_sync.offsetAt(razor::nanoNow());
 		
-		// get the max of the ping_log
-		nanotimediff max_ping = 0;
-		for(int i=0; i<this->ping_log.size(); i++) {
-			nanotime ping = this->ping_log[i];
-			if(ping > max_ping) {
-				max_ping = ping;
-			}
-		}
+		// most recent round trips, leaving the rarest spikes to the multiplier
+		nanotimediff max_ping = this->clock_sync.roundTripPercentile(FUTURE_TIME_PING_PERCENTILE);
 		
 		// add a buffer of future time to account for ping spikes
 		nanotime future_time = (max_ping/2.0f) // 1-way travel time
 			* FUTURE_TIME_PING_MULTIPLIER // ping spike multiplier
 			+ FUTURE_TIME_PING_FIXED; // fixed ping spike headroom
 		
+		// once the daemon has reported enough command arrivals, they steer the future time instead
+		if(this->lead_controller.ready()) {
+			future_time = std::max<nanotimediff>(0, this->lead_controller.step(razor::nanoNow()));
+		} else {
+			this->lead_controller.lead = future_time;
+			this->lead_controller.step(razor::nanoNow());
+		}
+		
 		//std::cout << "avg_td " << avg_td / NANOS_PER_MILLI;
 		//std::cout << " max_ping " << max_ping / NANOS_PER_MILLI;
 		//std::cout << " ping_headroom " << ping_headroom / NANOS_PER_MILLI << std::endl;
@@ -75,153 +127,787 @@ namespace razor {
 		return avg_td - future_time;
 	}
 	
+	// Writes into a buffer reserved for MESSAGE_HEADER_SIZE plus the body.
 	// returns number of bytes copied
-	int Razor::serializeMessage(void* data, NetworkMessage* in) {
-		int pos = 0;
-		pos += copyIn(data, pos, in->type);
-		pos += copyIn(data, pos, in->timestamp);
-		pos += copyIn(data, pos, in->ticknumber);
-		pos += copyInString(data, pos, &in->message);
-		return pos;
+	int Razor::serializeMessage(BufferWriter<false> &out, NetworkMessage* in) {
+		unsigned int start = out.position;
+		out.write(in->type);
+		out.write(in->timestamp);
+		out.writeVarint(in->ticknumber);
+		out.writeVarint(in->ack);
+		out.writeVarintString(in->message);
+		return out.position - start;
 	}
 	
+	// Throws std::range_error if the message is truncated.
 	// returns number of bytes copied
-	int Razor::deserializeMessage(NetworkMessage* out, void* data) {
-		int pos = 0;
-		pos += copyOut(&out->type, data, pos);
-		pos += copyOut(&out->timestamp, data, pos);
-		pos += copyOut(&out->ticknumber, data, pos);
-		pos += copyOutString(&out->message, data, pos);
-		return pos;
+	int Razor::deserializeMessage(NetworkMessage* out, BufferReader<> &in) {
+		unsigned int start = in.position;
+		in.read(&out->type);
+		in.read(&out->timestamp);
+		in.readVarint(&out->ticknumber);
+		in.readVarint(&out->ack);
+		out->message.assign(in.readVarintString());
+		return in.position - start;
 	}
 	
-	int Razor::serializePong(char* data, nanotime remote_timestamp, nanotime zero_time) {
+	// Pongs carry the ping's send time and the daemon's receive time. The message's own
+	// timestamp is the pong's send time.
+	// Structure:
+	// - REMOTE_TIMESTAMP 8 bytes
+	// - RECEIVED_TIMESTAMP 8 bytes
+	// - ZERO_TIME 8 bytes
+	int Razor::serializePong(char* data, nanotime remote_timestamp, nanotime received_timestamp, nanotime zero_time) {
 		int pos = 0;
 		pos += copyIn(data, pos, remote_timestamp);
+		pos += copyIn(data, pos, received_timestamp);
 		pos += copyIn(data, pos, zero_time);
 		return pos;
 	}
 	
-	int Razor::deserializePong(char* data, nanotime *start_timestamp, nanotime *zero_time) {
-		int pos = 0;
-		pos += copyOut(start_timestamp, data, pos);
-		pos += copyOut(zero_time, data, pos);
-		return pos;
+	// Throws std::range_error if the pong is truncated.
+	int Razor::deserializePong(BufferReader<> &in, nanotime *start_timestamp, nanotime *received_timestamp, nanotime *zero_time) {
+		unsigned int start = in.position;
+		in.read(start_timestamp);
+		in.read(received_timestamp);
+		in.read(zero_time);
+		return in.position - start;
 	}
 	
-	int Razor::serializeCommand(char* data, int pos, ticktype tick_number, std::string* command) {
+	// Ticks and sequence numbers are varint deltas from the previous command's in the message, or
+	// from zero for the first, and the command has a varint length.
+	int Razor::serializeCommand(char* data, int pos, ticktype tick_number, unsigned int seq, std::string* command,
+			ticktype reference_tick, unsigned int reference_seq) {
 		if(command->length() > MAX_COMMAND_LENGTH) {
 			std::cout << "< WARNING: Command serialization over length: " << command->length() 
 					<< " > " << MAX_COMMAND_LENGTH << " [" << *command << "]" << std::endl;
 		}
 		int len = 0;
-		len += copyIn(data, pos+len, tick_number);
-		len += copyInString(data, pos+len, command);
+		len += copyInVarintDelta(data, pos+len, tick_number, reference_tick);
+		len += copyInVarintDelta(data, pos+len, seq, reference_seq);
+		len += copyInVarintString(data, pos+len, *command);
 		return len;
 	}
 	
-	int Razor::deserializeCommand(char* data, int pos, ticktype *tick_number, std::string *command) {
-		int len = 0;
-		len += copyOut(tick_number, data, pos+len);
-		if(len > MAX_COMMAND_LENGTH) {
-			std::cout << "< WARNING: Command deserialization over length: " << len 
+	void Razor::deserializeCommand(BufferReader<> &in, ticktype *tick_number, unsigned int *seq, std::string *command,
+			ticktype reference_tick, unsigned int reference_seq) {
+		*tick_number = in.readVarintDelta(reference_tick);
+		*seq = in.readVarintDelta(reference_seq);
+		auto command_view = in.readVarintString();
+		if(command_view.size() > MAX_COMMAND_LENGTH) {
+			std::cout << "< WARNING: Command deserialization over length: " << command_view.size()
 					<< " > " << MAX_COMMAND_LENGTH << std::endl;
 		}
-		len += copyOutString(command, data, pos+len);
-		return len;
+		command->assign(command_view);
 	}
 	
-	void Razor::queueOutgoingNetworkMessage(const std::string &dest, unsigned char type, const std::string& message) {
+	void Razor::queueOutgoingNetworkMessage(const std::string &dest, unsigned char type, std::string message) {
 		NetworkMessage nm;
 		nm.origin_host_and_port = LOCAL;
 		nm.dest_host_and_port = dest;
 		// TODO: setup current frame number
 		nm.ticknumber = 0;//this->server->tick_number;
 		nm.timestamp = razor::nanoNow();
+		nm.ack = 0;
 		nm.type = type;
-		nm.message = message;
-		this->send_queue.push_back(nm);
+		nm.message = std::move(message);
+		this->send_queues[Razor::laneFor(type)].push_back(std::move(nm));
+	}
+	
+	// Timing-sensitive messages go ahead of commands, and commands ahead of state transfers
+	unsigned char Razor::laneFor(unsigned char type) {
+		switch(type) {
+			case MESSAGE_COMMAND:
+			case MESSAGE_COMMAND_BATCH:
+			case MESSAGE_BATCH_REQUEST:
+				return SEND_LANE_COMMANDS;
+			case MESSAGE_SYNC:
+			case MESSAGE_MERKLE_NODES:
+			case MESSAGE_MERKLE_CHUNKS:
+			case MESSAGE_SYNC_OBJECTS:
+			case MESSAGE_JOIN_STREAM:
+			case MESSAGE_ENTITY_CHANGES:
+			case MESSAGE_ENTITY_SYNC:
+			case MESSAGE_SYNC_DELTA:
+				return SEND_LANE_BULK;
+			default:
+				return SEND_LANE_CONTROL;
+		}
+	}
+	
+	void Razor::queueCommandMessage(const std::string &dest, unsigned short command_counter, int length) {
+		std::string temp;
+		copyIn(this->packed_command_buffer, 0, command_counter); // number of commands at beginning
+		temp.resize(length);
+		temp.assign(this->packed_command_buffer, length);
+		queueOutgoingNetworkMessage(dest, MESSAGE_COMMAND, temp);
 	}
 	
 	void Razor::queueOutgoingCommands() {
-		std::string dest;
-		if(this->daemon) {
-			dest = BROADCAST;
-		} else {
-			if(!this->slaved) { // if not a daemon and not slaved, clear the queue and do nothing
-				this->clearOutgoingCommands();
-				return;
-			}
-			dest = this->daemon_host_and_port;
+		// daemons broadcast finalized command batches instead, see finalizeCommands
+		if(this->daemon)
+			return;
+		
+		if(!this->slaved) { // if not a daemon and not slaved, clear the queue and do nothing
+			this->clearOutgoingCommands();
+			return;
 		}
 		
-		unsigned short command_counter = 0;
-		int pos = 2; // 2 because the number of 
+		this->queueRedundantCommands();
+	}
+	
+	// Slaves send a single command message containing every unacknowledged command
+	// from the last COMMAND_REDUNDANCY_TICKS ticks, oldest first, up to command_budget bytes.
+	void Razor::queueRedundantCommands() {
+		auto tick_number = this->local_tick_number;
+		
+		// move new commands into the redundancy window
 		while(this->outgoing_commands.size() > 0) {
 			auto out_command = this->outgoing_commands.front();
 			this->outgoing_commands.pop_front();
 			
-			//std::cout << "< Sending command: " << out_command.command << std::endl;
-			
 			// discard long commands
 			if(out_command.command.size() > MAX_COMMAND_LENGTH) {
 				std::cout << "< Command exceeds maximum length for network sync: " << out_command.command << std::endl;
 				continue;
 			}
-			pos += this->serializeCommand(packed_command_buffer, pos, out_command.tick_number, &out_command.command);
-			if(command_counter == MAX_COMMANDS_PER_PACKET) {
-				// if the max commands is reached, send a packed packet
-				std::string temp;
-				copyIn(this->packed_command_buffer, 0, command_counter); // number of commands at beginning
-				temp.resize(pos);
-				temp.assign(this->packed_command_buffer, pos);
-				queueOutgoingNetworkMessage(dest, MESSAGE_COMMAND, temp);
-				pos = 2;
-				command_counter = 0;
-			} else {
-				command_counter++;
-			}
+			this->unacked_commands.push_back(out_command);
 		}
 		
-		if(command_counter > 0) {
-			// send any remaining commands in another packed packet
-			std::string temp;
-			copyIn(this->packed_command_buffer, 0, command_counter); // number of commands at beginning
-			temp.resize(pos);
-			temp.assign(this->packed_command_buffer, pos);
-			queueOutgoingNetworkMessage(dest, MESSAGE_COMMAND, temp);
+		// commands that have fallen out of the window are abandoned
+		while(this->unacked_commands.size() > 0 &&
+				this->unacked_commands.front().tick_number + COMMAND_REDUNDANCY_TICKS < tick_number) {
+			this->unacked_commands.pop_front();
+		}
+		
+		if(this->unacked_commands.size() == 0)
+			return;
+		
+		unsigned short command_counter = 0;
+		int pos = 2; // 2 because the number of commands is first
+		ticktype previous_tick = 0;
+		unsigned int previous_seq = 0;
+		for(auto &out_command : this->unacked_commands) {
+			if(command_counter == MAX_COMMANDS_PER_PACKET)
+				break;
+			int command_length = this->serializeCommand(packed_command_buffer, pos, out_command.tick_number, 
+					out_command.seq, &out_command.command, previous_tick, previous_seq);
+			// always send at least the oldest command so the window can't stall
+			if(command_counter > 0 && pos + command_length > this->command_budget)
+				break;
+			pos += command_length;
+			previous_tick = out_command.tick_number;
+			previous_seq = out_command.seq;
+			command_counter++;
 		}
+		
+		this->queueCommandMessage(this->daemon_host_and_port, command_counter, pos);
 	}
 	
 	
 	// Message send functions
+	// Slaves accepting compressed messages say so, with their dictionary's hash, and every request
+	// carries the command registry's hash
 	void Razor::sendRequestFullSync() {
-		std::string empty;
+		std::string request;
+		BufferWriter<> out(&request);
+		out.write((unsigned char)(this->compression ? 1 : 0));
+		out.write(this->compression ? this->compression_dictionary_hash : 0ULL);
+		out.write(this->command_registry.hash());
+		out.finish();
 		this->queueOutgoingNetworkMessage(
-				this->daemon_host_and_port, MESSAGE_REQUEST_FULL, empty);
+				this->daemon_host_and_port, MESSAGE_REQUEST_FULL, request);
 	}
 	
 	// Pongs also return the requester's timestamp
-	void Razor::sendPong(std::string dest, nanotime remote_timestamp) {
+	void Razor::sendPong(std::string dest, nanotime remote_timestamp, nanotime received_timestamp) {
 		auto zero_time = this->local_zero_time;
-		char pong_data[16]; // two 8 byte long longs
-		serializePong(pong_data, remote_timestamp, zero_time);
+		char pong_data[24]; // three 8 byte long longs
+		int length = serializePong(pong_data, remote_timestamp, received_timestamp, zero_time);
 		std::string pong_str;
-		pong_str.resize(16);
-		pong_str.assign(pong_data, 16);
+		pong_str.resize(length);
+		pong_str.assign(pong_data, length);
 		this->queueOutgoingNetworkMessage(dest, MESSAGE_PONG, pong_str);
 	}
 	
 	// Ping the server
+	// Pings carry the slave's current ping and loss rate so the daemon can pace its syncs, and the
+	// last ping's own round trip, since the daemon's congestion control steers on raw samples.
+	// Structure:
+	// - PING 8 bytes (milliseconds)
+	// - LOSS 4 bytes (float)
+	// - ROUND_TRIP 8 bytes (nanoseconds, 0 if the last ping was lost)
 	void Razor::sendPing(std::string dest) {
-		std::string ping_str = " ";
+		// a ping still unanswered when the next one is sent counts as lost
+		float lost = this->awaiting_pong ? 1.0f : 0.0f;
+		nanotime round_trip = 0;
+		if(!this->awaiting_pong && this->clock_sync.samples.size() > 0)
+			round_trip = this->clock_sync.samples.back().round_trip;
+		this->ping_loss += (lost - this->ping_loss) / PING_LOG_SIZE;
+		this->awaiting_pong = true;
+		
+		char ping_data[20];
+		int pos = 0;
+		pos += copyIn(ping_data, pos, this->ping);
+		pos += copyIn(ping_data, pos, this->ping_loss);
+		pos += copyIn(ping_data, pos, round_trip);
+		std::string ping_str;
+		ping_str.resize(pos);
+		ping_str.assign(ping_data, pos);
 		this->queueOutgoingNetworkMessage(dest, MESSAGE_PING, ping_str);
 	}
 	
+	// Disconnects are transmitted straight away, since the channel is unbound right after
 	void Razor::sendDisconnect(std::string dest) {
+		NetworkMessage nm;
+		nm.origin_host_and_port = LOCAL;
+		nm.dest_host_and_port = dest;
+		nm.ticknumber = 0;
+		nm.ack = 0;
+		nm.type = MESSAGE_DISCONNECT;
+		this->compressed_ready[0] = this->compressed_ready[1] = false;
+		this->transmitMessage(dest, &nm);
+		this->connection.flush();
+	}
+	
+	// Acks carry no body, the acknowledgement is in the message header
+	void Razor::sendAck(std::string dest) {
 		std::string empty;
-		this->queueOutgoingNetworkMessage(
-			dest, MESSAGE_DISCONNECT, empty);
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_ACK, empty);
+	}
+	
+	// Sends the command lists of finalized ticks, oldest first. Each list is in execution order.
+	void Razor::sendCommandBatch(const std::string &dest, const std::deque<ticktype> &batch_ticks) {
+		int pos = 0;
+		unsigned short tick_count = batch_ticks.size();
+		pos += copyIn(send_buffer, pos, tick_count);
+		ticktype previous_tick = 0;
+		for(auto batch_tick : batch_ticks) {
+			auto commands = this->command_buffer.commandsForTick(batch_tick);
+			unsigned short commands_number = commands.size();
+			pos += copyInVarintDelta(send_buffer, pos, batch_tick, previous_tick);
+			pos += copyInVarint(send_buffer, pos, commands_number);
+			for(auto &c : commands) {
+				pos += copyInVarintString(send_buffer, pos, c.command);
+			}
+			previous_tick = batch_tick;
+		}
+		
+		std::string message;
+		message.resize(pos);
+		message.assign(send_buffer, pos);
+		
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_COMMAND_BATCH, message);
+	}
+	
+	// Lockstep slaves ask again for the batches of ticks whose repeats have all passed without
+	// arriving, since they can't simulate past them.
+	// Structure:
+	// - COUNT 2 bytes
+	// <for each missing tick>
+	// - TICK varint delta from the previous tick
+	void Razor::sendBatchRequest() {
+		auto tick_number = this->local_tick_number;
+		if(this->batch_receive_tick == 0 || this->batch_request_tick + BATCH_REQUEST_DELAY > tick_number)
+			return;
+		
+		// older ticks have left the command buffer, and only a full sync can replace them
+		if(this->next_batch_tick + COMMAND_BUFFER_TICKS <= this->batch_receive_tick)
+			this->next_batch_tick = this->batch_receive_tick - COMMAND_BUFFER_TICKS + 1;
+		while(this->next_batch_tick < this->batch_receive_tick &&
+				this->command_buffer.isFinalized(this->next_batch_tick)) {
+			this->next_batch_tick++;
+		}
+		
+		std::string message;
+		BufferWriter<> out(&message);
+		out.write((unsigned short)0);
+		unsigned short count = 0;
+		ticktype previous_tick = 0;
+		for(auto missing_tick = this->next_batch_tick; count < BATCH_REQUEST_MAX_TICKS &&
+				missing_tick + COMMAND_BATCH_REDUNDANCY <= this->batch_receive_tick; missing_tick++) {
+			if(this->command_buffer.isFinalized(missing_tick))
+				continue;
+			out.writeVarintDelta(missing_tick, previous_tick);
+			previous_tick = missing_tick;
+			count++;
+		}
+		if(count == 0)
+			return;
+		copyIn(out.data, 0, count);
+		out.finish();
+		
+		this->batch_request_tick = tick_number;
+		this->queueOutgoingNetworkMessage(this->daemon_host_and_port, MESSAGE_BATCH_REQUEST, std::move(message));
+	}
+	
+	void Razor::sendStateHash(ticktype tick_number, unsigned long long hash) {
+		char hash_data[16]; // 8 byte tick, 8 byte hash
+		int pos = 0;
+		pos += copyIn(hash_data, pos, tick_number);
+		pos += copyIn(hash_data, pos, hash);
+		std::string hash_str;
+		hash_str.resize(pos);
+		hash_str.assign(hash_data, pos);
+		this->queueOutgoingNetworkMessage(this->daemon_host_and_port, MESSAGE_STATE_HASH, hash_str);
+	}
+	
+	// Hashes the current state into a Merkle tree and sends only its root
+	void Razor::sendSyncRoot(std::string dest) {
+		if(this->get_state_data_func == nullptr)
+			throw std::runtime_error("registerGetStateDataFunc must be called before sendSyncRoot");
+		
+		this->merkle_state.clear();
+		(*this->get_state_data_func)(&this->merkle_state);
+		this->merkle_tree.build(this->merkle_state.c_str(), this->merkle_state.size());
+		this->merkle_tick = this->local_tick_number;
+		
+		char root_data[20]; // 8 byte tick, 4 byte length, 8 byte root
+		int pos = 0;
+		pos += copyIn(root_data, pos, this->merkle_tick);
+		pos += copyIn(root_data, pos, this->merkle_tree.length);
+		pos += copyIn(root_data, pos, this->merkle_tree.root());
+		std::string root_str;
+		root_str.resize(pos);
+		root_str.assign(root_data, pos);
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_SYNC_ROOT, root_str);
+	}
+	
+	// Slaves request the descendants of mismatching nodes, or the chunks of mismatching
+	// leaves (level 0). Without indices it requests a full sync.
+	void Razor::sendMerkleRequest(unsigned int level, const std::vector<unsigned int> &indices) {
+		int pos = 0;
+		unsigned int count = indices.size();
+		pos += copyIn(send_buffer, pos, this->merkle_tick);
+		pos += copyIn(send_buffer, pos, level);
+		pos += copyIn(send_buffer, pos, count);
+		for(auto index : indices) {
+			pos += copyIn(send_buffer, pos, index);
+		}
+		
+		std::string message;
+		message.resize(pos);
+		message.assign(send_buffer, pos);
+		this->queueOutgoingNetworkMessage(this->daemon_host_and_port, MESSAGE_MERKLE_REQUEST, message);
+	}
+	
+	// Daemons answer with the hashes of the requested nodes' descendants MERKLE_DESCENT_LEVELS down
+	void Razor::sendMerkleNodes(std::string dest, unsigned int level, const std::vector<unsigned int> &indices) {
+		unsigned int target_level = level > MERKLE_DESCENT_LEVELS ? level - MERKLE_DESCENT_LEVELS : 0;
+		std::vector<unsigned int> nodes;
+		for(auto index : indices) {
+			unsigned int first, last;
+			this->merkle_tree.descendants(level, index, target_level, &first, &last);
+			for(unsigned int i=first; i<last; i++) {
+				nodes.push_back(i);
+			}
+		}
+		
+		int pos = 0;
+		unsigned int count = nodes.size();
+		pos += copyIn(send_buffer, pos, this->merkle_tick);
+		pos += copyIn(send_buffer, pos, target_level);
+		pos += copyIn(send_buffer, pos, count);
+		for(auto index : nodes) {
+			pos += copyIn(send_buffer, pos, index);
+			pos += copyIn(send_buffer, pos, this->merkle_tree.node(target_level, index));
+		}
+		
+		std::string message;
+		message.resize(pos);
+		message.assign(send_buffer, pos);
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_MERKLE_NODES, message);
+	}
+	
+	void Razor::sendMerkleChunks(std::string dest, const std::vector<unsigned int> &indices) {
+		for(unsigned int sent = 0; sent < indices.size(); sent += MERKLE_MAX_CHUNKS_PER_MESSAGE) {
+			unsigned int count = std::min<unsigned int>(MERKLE_MAX_CHUNKS_PER_MESSAGE, indices.size() - sent);
+			int pos = 0;
+			pos += copyIn(send_buffer, pos, this->merkle_tick);
+			pos += copyIn(send_buffer, pos, count);
+			for(unsigned int i=sent; i<sent+count; i++) {
+				unsigned int index = indices[i];
+				unsigned int start = index * MERKLE_CHUNK_SIZE;
+				std::string chunk;
+				if(start < this->merkle_state.size())
+					chunk = this->merkle_state.substr(start, MERKLE_CHUNK_SIZE);
+				pos += copyIn(send_buffer, pos, index);
+				pos += copyInString(send_buffer, pos, &chunk);
+			}
+			
+			std::string message;
+			message.resize(pos);
+			message.assign(send_buffer, pos);
+			this->queueOutgoingNetworkMessage(dest, MESSAGE_MERKLE_CHUNKS, message);
+		}
+	}
+	
+	// Sends a slave the states of the objects relevant to it, split into messages of about
+	// SYNC_OBJECTS_MESSAGE_SIZE bytes. The last message lists the objects that are no longer relevant.
+	// Structure:
+	// - TICK 8 bytes
+	// - COUNT 4 bytes
+	// <for each object>
+	// - ID 4 bytes
+	// - STATE string
+	// - DEPARTED_COUNT 4 bytes
+	// <for each departed object>
+	// - ID 4 bytes
+	// With a budget, only the objects with the highest accumulated priority are sent, until their
+	// states fill budget bytes. Each unsent object's accumulator grows by its priority every call.
+	void Razor::sendObjectSync(std::string dest, unsigned int budget) {
+		auto it = this->peers.find(dest);
+		if(it == this->peers.end())
+			return;
+		auto &peer = it->second;
+		
+		std::vector<unsigned int> relevant;
+		this->relevantObjects(dest, &relevant);
+		std::unordered_set<unsigned int> now_relevant(relevant.begin(), relevant.end());
+		std::vector<unsigned int> departed;
+		for(auto id : peer.relevant_objects) {
+			if(now_relevant.count(id) == 0) {
+				departed.push_back(id);
+				peer.object_priorities.erase(id);
+				peer.join_unsent.erase(id);
+			}
+		}
+		peer.relevant_objects = std::move(now_relevant);
+		
+		if(budget > 0) {
+			for(auto id : relevant) {
+				peer.object_priorities[id] += this->objectPriority(dest, id);
+			}
+			std::stable_sort(relevant.begin(), relevant.end(), [&peer](unsigned int a, unsigned int b) {
+				return peer.object_priorities[a] > peer.object_priorities[b];
+			});
+		}
+		
+		const int header_length = 12; // tick and count
+		int pos = header_length;
+		unsigned int count = 0;
+		unsigned int spent = 0;
+		for(auto id : relevant) {
+			auto &state = this->objectState(id);
+			if(budget > 0) {
+				// the first object is always sent so ones larger than the budget aren't starved
+				if(spent > 0 && spent + state.size() > budget)
+					break;
+				spent += state.size();
+				peer.object_priorities[id] = 0;
+			}
+			peer.join_unsent.erase(id);
+			if(count > 0 && pos + 8 + state.size() + 4 > SYNC_OBJECTS_MESSAGE_SIZE) {
+				unsigned int no_departures = 0;
+				pos += copyIn(send_buffer, pos, no_departures);
+				this->queueObjectSyncMessage(dest, count, pos);
+				pos = header_length;
+				count = 0;
+			}
+			pos += copyIn(send_buffer, pos, id);
+			pos += copyInString(send_buffer, pos, &state);
+			count++;
+		}
+		
+		unsigned int departed_count = departed.size();
+		pos += copyIn(send_buffer, pos, departed_count);
+		for(auto id : departed) {
+			pos += copyIn(send_buffer, pos, id);
+		}
+		this->queueObjectSyncMessage(dest, count, pos);
+		
+		if(peer.joining && this->interest_management && peer.join_unsent.empty())
+			peer.joining = false;
+	}
+	
+	// Starts streaming the daemon's state to a joining slave. Without interest management the state
+	// is snapshotted and queued in chunks. With it, the relevant objects are seeded with priorities
+	// falling off with distance, so the budgeted object syncs send the nearest first.
+	void Razor::startJoinStream(const std::string &dest) {
+		auto peer_it = this->peers.find(dest);
+		if(peer_it == this->peers.end())
+			return;
+		auto &peer = peer_it->second;
+		peer.joining = true;
+		peer.join_tick = this->local_tick_number;
+		peer.join_last_activity = this->local_tick_number;
+		peer.join_queue.clear();
+		peer.join_state.clear();
+		peer.join_unsent.clear();
+		
+		if(this->interest_management) {
+			std::vector<unsigned int> relevant;
+			this->relevantObjects(dest, &relevant);
+			peer.object_priorities.clear();
+			for(auto id : relevant) {
+				float distance = 0;
+				auto it = this->interest.objects.find(id);
+				if(peer.has_interest && it != this->interest.objects.end() && !it->second.global) {
+					float dx = it->second.x - peer.interest_x;
+					float dy = it->second.y - peer.interest_y;
+					float dz = it->second.z - peer.interest_z;
+					distance = std::sqrt(dx*dx + dy*dy + dz*dz);
+				}
+				peer.object_priorities[id] = JOIN_OBJECT_PRIORITY / (1.0f + distance);
+				peer.join_unsent.insert(id);
+			}
+			if(peer.join_unsent.empty())
+				peer.joining = false;
+			return;
+		}
+		
+		if(this->get_state_data_func == nullptr)
+			throw std::runtime_error("registerGetStateDataFunc must be called before startJoinStream");
+		(*this->get_state_data_func)(&peer.join_state);
+		if(peer.join_state.size() > JOIN_STREAM_MAX_STATE) {
+			// slaves refuse streams this large, and a single sync carries far less
+			std::cout << "< State of " << peer.join_state.size() << " bytes is too large to send to " <<
+				dest << std::endl;
+			peer.joining = false;
+			peer.join_state.clear();
+			return;
+		}
+		if(this->delta_sync) {
+			peer.has_sync_baseline = true;
+			peer.sync_baseline_tick = peer.join_tick;
+			peer.sync_baseline = peer.join_state;
+		}
+		
+		// an empty state is still sent as one empty chunk so the slave can complete
+		unsigned int chunks = std::max(1U, (unsigned int)(
+			(peer.join_state.size() + JOIN_STREAM_CHUNK_SIZE - 1) / JOIN_STREAM_CHUNK_SIZE));
+		for(unsigned int i=0; i<chunks; i++) {
+			peer.join_queue.push_back(i);
+		}
+		
+		std::cout << "< Starting join stream to " << dest << std::endl;
+	}
+	
+	// Sends every joining slave its share of the join stream for this tick
+	void Razor::sendJoinStreams() {
+		auto tick_number = this->local_tick_number;
+		for(auto &c : this->connection.channels) {
+			auto it = this->peers.find(c.first);
+			if(it == this->peers.end() || !it->second.joining)
+				continue;
+			auto &peer = it->second;
+			
+			if(this->interest_management) {
+				// budgeted object syncs already run every tick
+				if(this->sync_budget == 0)
+					this->sendObjectSync(c.first, this->join_stream_budget);
+			} else if(!peer.join_queue.empty()) {
+				this->sendJoinChunks(c.first, peer);
+			} else if(peer.join_last_activity + JOIN_STREAM_TIMEOUT < tick_number) {
+				// the slave's final JOIN_RESUME was lost
+				peer.joining = false;
+				peer.join_state.clear();
+			}
+		}
+	}
+	
+	// Structure:
+	// - TICK 8 bytes
+	// - TOTAL_LENGTH 4 bytes
+	// - COUNT 2 bytes
+	// <for each chunk>
+	// - INDEX 4 bytes
+	// - DATA string
+	void Razor::sendJoinChunks(const std::string &dest, PeerState &peer) {
+		const int header_length = 14; // tick, total length, and count
+		int pos = header_length;
+		unsigned short count = 0;
+		unsigned int spent = 0;
+		unsigned int total_length = peer.join_state.size();
+		
+		auto queueMessage = [&]() {
+			int header_pos = 0;
+			header_pos += copyIn(send_buffer, header_pos, peer.join_tick);
+			header_pos += copyIn(send_buffer, header_pos, total_length);
+			header_pos += copyIn(send_buffer, header_pos, count);
+			std::string message;
+			message.resize(pos);
+			message.assign(send_buffer, pos);
+			this->queueOutgoingNetworkMessage(dest, MESSAGE_JOIN_STREAM, message);
+			pos = header_length;
+			count = 0;
+		};
+		
+		while(!peer.join_queue.empty() && spent < this->join_stream_budget) {
+			unsigned int index = peer.join_queue.front();
+			peer.join_queue.pop_front();
+			unsigned long long offset = (unsigned long long)index * JOIN_STREAM_CHUNK_SIZE;
+			if(offset > total_length)
+				continue; // a bad resume index
+			std::string chunk = peer.join_state.substr(offset, JOIN_STREAM_CHUNK_SIZE);
+			
+			if(count > 0 && pos + 8 + chunk.size() > JOIN_STREAM_MESSAGE_SIZE)
+				queueMessage();
+			pos += copyIn(send_buffer, pos, index);
+			pos += copyInString(send_buffer, pos, &chunk);
+			spent += chunk.size();
+			count++;
+		}
+		if(count > 0)
+			queueMessage();
+		peer.join_last_activity = this->local_tick_number;
+	}
+	
+	// Lists the chunks a slave is still missing, or none once the stream is complete.
+	// Structure:
+	// - TICK 8 bytes
+	// - COUNT 4 bytes
+	// <for each missing chunk>
+	// - INDEX 4 bytes
+	void Razor::sendJoinResume() {
+		int pos = 0;
+		unsigned int count = 0;
+		pos += copyIn(send_buffer, pos, this->join_receive_tick);
+		pos += copyIn(send_buffer, pos, count);
+		for(unsigned int i=0; i<this->join_received.size() && count < JOIN_RESUME_MAX_CHUNKS; i++) {
+			if(!this->join_received[i]) {
+				pos += copyIn(send_buffer, pos, i);
+				count++;
+			}
+		}
+		copyIn(send_buffer, 8, count);
+		
+		std::string message;
+		message.resize(pos);
+		message.assign(send_buffer, pos);
+		this->queueOutgoingNetworkMessage(this->daemon_host_and_port, MESSAGE_JOIN_RESUME, message);
+	}
+	
+	void Razor::receiveJoinStream(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto stream_tick = in.read<ticktype>();
+		auto total_length = in.read<unsigned int>();
+		auto count = in.read<unsigned short>();
+		
+		if(total_length > JOIN_STREAM_MAX_STATE)
+			return;
+		
+		// chunks of an older stream are ignored, a newer stream replaces the current one
+		if(this->join_receiving && stream_tick < this->join_receive_tick)
+			return;
+		if(!this->join_receiving || stream_tick != this->join_receive_tick) {
+			if(!this->join_receiving && stream_tick <= this->join_receive_tick)
+				return; // a late chunk of a completed stream
+			unsigned int chunks = std::max(1ULL,
+				((unsigned long long)total_length + JOIN_STREAM_CHUNK_SIZE - 1) / JOIN_STREAM_CHUNK_SIZE);
+			this->join_receiving = true;
+			this->join_receive_tick = stream_tick;
+			this->join_buffer.assign(total_length, '\0');
+			this->join_received.assign(chunks, false);
+			this->join_remaining = chunks;
+			this->merkle_pending_chunks.clear();
+		}
+		this->join_last_progress = this->local_tick_number;
+		
+		for(unsigned short i=0; i<count; i++) {
+			auto index = in.read<unsigned int>();
+			auto chunk = in.readString();
+			unsigned long long offset = (unsigned long long)index * JOIN_STREAM_CHUNK_SIZE;
+			if(index >= this->join_received.size() || this->join_received[index] ||
+					offset + chunk.size() > total_length)
+				continue;
+			this->join_buffer.replace(offset, chunk.size(), chunk);
+			this->join_received[index] = true;
+			this->join_remaining--;
+		}
+		
+		if(this->join_remaining == 0) {
+			this->join_receiving = false;
+			this->join_received.clear();
+			this->sendJoinResume(); // tells the daemon the stream is complete
+			std::string state;
+			std::swap(state, this->join_buffer);
+			this->loadSync(&state, stream_tick);
+		}
+	}
+	
+	// Reports how long before its tick each newly received command arrived, negative if late.
+	// Structure:
+	// - COUNT 2 bytes
+	// <for each command>
+	// - MARGIN 8 bytes (nanoseconds)
+	void Razor::sendCommandTiming(const std::string &dest, PeerState &peer) {
+		int pos = 0;
+		unsigned short count = peer.command_margins.size();
+		pos += copyIn(send_buffer, pos, count);
+		for(auto &margin : peer.command_margins) {
+			pos += copyIn(send_buffer, pos, margin.first);
+			pos += copyIn(send_buffer, pos, margin.second);
+		}
+		peer.command_margins.clear();
+		
+		std::string message;
+		message.resize(pos);
+		message.assign(send_buffer, pos);
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_COMMAND_TIMING, message);
+	}
+	
+	void Razor::receiveCommandTiming(NetworkMessage* nm) {
+		if(this->daemon)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto count = in.read<unsigned short>();
+		if(count > COMMAND_TIMING_MAX)
+			return;
+		for(unsigned short i=0; i<count; i++) {
+			auto tick_number = in.read<ticktype>();
+			this->lead_controller.addMargin(tick_number, in.read<nanotimediff>());
+		}
+	}
+	
+	void Razor::receiveJoinResume(NetworkMessage* nm) {
+		if(!this->daemon)
+			return;
+		
+		auto it = this->peers.find(nm->origin_host_and_port);
+		if(it == this->peers.end())
+			return;
+		auto &peer = it->second;
+		
+		BufferReader<> in(nm->message);
+		auto stream_tick = in.read<ticktype>();
+		auto count = in.read<unsigned int>();
+		if(!peer.joining || stream_tick != peer.join_tick || count > JOIN_RESUME_MAX_CHUNKS)
+			return;
+		
+		if(count == 0) {
+			peer.joining = false;
+			peer.join_state.clear();
+			peer.join_queue.clear();
+			return;
+		}
+		
+		// missing chunks go ahead of any still queued
+		std::vector<unsigned int> missing(count);
+		in.readArray(missing.data(), count);
+		peer.join_queue.insert(peer.join_queue.begin(), missing.begin(), missing.end());
+		peer.join_last_activity = this->local_tick_number;
+	}
+	
+	float Razor::objectPriority(const std::string &dest, unsigned int id) {
+		if(this->object_priority_func == nullptr)
+			return 1.0f;
+		return (*this->object_priority_func)(dest, id);
+	}
+	
+	void Razor::queueObjectSyncMessage(const std::string &dest, unsigned int count, int length) {
+		int pos = 0;
+		pos += copyIn(send_buffer, pos, this->local_tick_number);
+		pos += copyIn(send_buffer, pos, count);
+		
+		std::string message;
+		message.resize(length);
+		message.assign(send_buffer, length);
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_SYNC_OBJECTS, message);
 	}
 	
 	void Razor::sendSync(std::string dest) {
@@ -233,23 +919,94 @@ namespace razor {
 		std::string state;
         (*this->get_state_data_func)(&state);
 		
-		int pos = 0;
-		pos += copyIn(send_buffer, pos, tick_number);
-		pos += copyInString(send_buffer, pos, &state);
+		// a delta against the last state the slave was sent, when that's smaller. Broadcasts go in
+		// full, as slaves hold different baselines.
+		auto it = this->peers.find(dest);
+		if(this->delta_sync && dest != BROADCAST && it != this->peers.end()) {
+			auto &peer = it->second;
+			bool sent = false;
+			if(peer.has_sync_baseline) {
+				std::string delta;
+				diffState(peer.sync_baseline, state, &delta);
+				if(delta.size() < state.size()) {
+					std::string message;
+					BufferWriter<> out(&message);
+					out.write(tick_number);
+					out.write(peer.sync_baseline_tick);
+					out.writeString(delta);
+					out.finish();
+					this->queueOutgoingNetworkMessage(dest, MESSAGE_SYNC_DELTA, std::move(message));
+					sent = true;
+				}
+			}
+			peer.has_sync_baseline = true;
+			peer.sync_baseline_tick = tick_number;
+			peer.sync_baseline = state;
+			if(sent)
+				return;
+		}
 		
+		// written straight into the message rather than through send_buffer
 		std::string message;
-		message.resize(pos);
-		message.assign(send_buffer, pos);
+		BufferWriter<> out(&message);
+		out.reserve(sizeof(tick_number) + 4 + state.size());
+		out.write(tick_number);
+		out.writeString(state);
+		out.finish();
 		
-		this->queueOutgoingNetworkMessage(dest, MESSAGE_SYNC, message);
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_SYNC, std::move(message));
 		
 		std::cout << "< Sending full sync to " << dest << std::endl;
 	}
 	
+	// Sent every tick anything changed, so the dirty masks only ever hold one tick's changes
+	void Razor::sendEntityChanges() {
+		if(!this->entities.changed())
+			return;
+		
+		std::string message;
+		BufferWriter<> out(&message);
+		out.write(this->local_tick_number);
+		this->entities.writeChanges(out);
+		out.finish();
+		this->entities.clearDirty();
+		
+		if(this->connection.channels.size() > 0)
+			this->queueOutgoingNetworkMessage(BROADCAST, MESSAGE_ENTITY_CHANGES, std::move(message));
+	}
+	
+	void Razor::sendEntitySync(std::string dest) {
+		std::string message;
+		BufferWriter<> out(&message);
+		out.write(this->local_tick_number);
+		this->entities.writeSnapshot(out);
+		out.finish();
+		
+		this->queueOutgoingNetworkMessage(dest, MESSAGE_ENTITY_SYNC, std::move(message));
+	}
+	
 	void Razor::sendCommand(const std::string& command) {
 		auto tick_number = this->local_tick_number;
+		
+		// the daemon's own commands execute on the next tick it finalizes
+		if(this->daemon) {
+			TickCommand tc;
+			tc.tick_number = std::max(tick_number + 1, this->next_finalize_tick);
+			tc.origin = LOCAL;
+			tc.seq = this->next_command_seq++;
+			tc.command = command;
+			this->command_buffer.add(tc);
+			return;
+		}
+		
+		// lockstep slaves lag the daemon, so their commands are scheduled ahead of it
+		if(this->lockstep)
+			tick_number += this->lockstep_command_delay;
+		
+		this->lead_controller.recordLead(tick_number);
 		OutgoingCommand o;
 		o.tick_number = tick_number;
+		o.seq = this->next_command_seq++;
 		o.command = command;
 		outgoing_commands.push_back(o);
 	}
@@ -263,47 +1020,83 @@ namespace razor {
 			
 			this->sendRequestFullSync();
 			this->slaved = true;
+			this->armTimer(&this->daemon_timeout_timer, DAEMON_PEER_ID, TIMER_TIMEOUT,
+				razor::nanoNow() + this->timeout);
 		}
 	}
 	
-	void Razor::receivePong(NetworkMessage* nm) {
-		auto zero_time = this->local_zero_time;
+	// Slaves drop every command the daemon has acknowledged
+	void Razor::receiveAck(NetworkMessage* nm) {
+		if(this->daemon)
+			return;
+		
+		while(this->unacked_commands.size() > 0 &&
+				this->unacked_commands.front().seq <= nm->ack) {
+			this->unacked_commands.pop_front();
+		}
+	}
+	
+	// Records a slave's command. A command is identified by (peer, tick, seq), and since seq is
+	// unique per peer it is used as the key. Returns false if the command was already received.
+	bool Razor::acceptCommand(const std::string &origin, unsigned int first_seq, unsigned int seq) {
+		auto &peer = this->peers[origin];
+		
+		// the slave has abandoned everything older than the first command in its message
+		if(first_seq > 0 && first_seq - 1 > peer.command_ack) {
+			peer.command_ack = first_seq - 1;
+			while(peer.received_command_seqs.size() > 0 &&
+					*peer.received_command_seqs.begin() <= peer.command_ack) {
+				peer.received_command_seqs.erase(peer.received_command_seqs.begin());
+			}
+			peer.ack_pending = true;
+		}
+		
+		if(seq <= peer.command_ack || peer.received_command_seqs.count(seq) > 0)
+			return false;
 		
+		peer.received_command_seqs.insert(seq);
+		while(peer.received_command_seqs.size() > 0 &&
+				*peer.received_command_seqs.begin() == peer.command_ack + 1) {
+			peer.command_ack++;
+			peer.received_command_seqs.erase(peer.received_command_seqs.begin());
+		}
+		peer.ack_pending = true;
+		return true;
+	}
+	
+	void Razor::receivePing(NetworkMessage* nm) {
+		if(!this->daemon) // slaves should ignore ping requests
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto ping = in.read<nanotime>();
+		auto loss = in.read<float>();
+		auto round_trip = in.read<nanotime>();
+		auto &peer = this->peers[nm->origin_host_and_port];
+		peer.ping = ping;
+		peer.loss = loss;
+		// the reported ping is a maximum over recent pings, which would hide queueing delay
+		this->connection.updateRate(nm->origin_host_and_port, round_trip, peer.loss);
+		this->sendPong(nm->origin_host_and_port, nm->timestamp, nm->received_timestamp);
+	}
+	
+	void Razor::receivePong(NetworkMessage* nm) {
 		if(this->daemon) // deamons ignore pongs -- they have no need to synchronize
 					return;
+		this->awaiting_pong = false;
 		
-		unsigned long long start_timestamp;
-		deserializePong((char*)nm->message.c_str(), &start_timestamp, &(this->daemon_zero_time));
-		unsigned long long bounce_timestamp = nm->timestamp;
-		unsigned long long end_timestamp = razor::nanoNow();
+		// the four NTP timestamps: ping sent, ping received by the daemon, pong sent and pong received
+		nanotime start_timestamp, daemon_received_timestamp;
+		BufferReader<> in(nm->message);
+		deserializePong(in, &start_timestamp, &daemon_received_timestamp, &(this->daemon_zero_time));
+		nanotime bounce_timestamp = nm->timestamp;
+		nanotime end_timestamp = nm->received_timestamp;
 		
-		// clean ping log
-		while(this->ping_log.size() >= PING_LOG_SIZE)
-			this->ping_log.pop_front();
-		
-		// clean time delta log
-		while(this->time_delta_log.size() >= PING_LOG_SIZE)
-			this->time_delta_log.pop_front();
+		this->clock_sync.addSample(start_timestamp, daemon_received_timestamp, bounce_timestamp, end_timestamp);
 		
 		// the ping is the round trip time from slave->daemon->slave
-		nanotime ping = end_timestamp - start_timestamp;
-		this->ping_log.push_back(ping);
-		
-		// time_delta is estimated difference between the two time systems' 
-		// zero_time (from local to daemon).
-		// time delta is estimated by using the local half-ping timestamp
-		// and the server's "midway" timestamp adjusted
-		// they should correspond roughly to the same absolute time, so
-		// the difference will be a rough time delta.
-		// over time, the log will average out a reasonable time delta
-		nanotimediff time_delta = (start_timestamp + ping/2 - zero_time) -
-									(bounce_timestamp - this->daemon_zero_time);
-		this->time_delta_log.push_back(time_delta);
-		
-		/*std::cout << "ping " << ping / NANOS_PER_MILLI << std::endl;
-		std::cout << "bounce_timestamp " << bounce_timestamp / NANOS_PER_MILLI << std::endl;
-		std::cout << "daemon_zero_time " << this->daemon_zero_time / NANOS_PER_MILLI << std::endl;
-		std::cout << "time_delta " << time_delta / NANOS_PER_MILLI << std::endl;/**/
+		nanotime ping = this->clock_sync.samples.back().round_trip;
+		this->connection.updateRate(nm->origin_host_and_port, ping, this->ping_loss);
 		
 		// if this is the first ping, use the ping's data to initialize the future ticks
 		if(this->first_ping) {
@@ -312,52 +1105,355 @@ namespace razor {
 		}
 	}
 	
+	// Daemons validate slave commands and hold them in the command buffer until their tick
 	void Razor::receiveCommands(NetworkMessage* nm) {
-		auto tick_number = this->local_tick_number;
-		unsigned short commands_number;
-		const char* buffer = nm->message.c_str();
-		int pos = 0;
-		pos += copyOut(&commands_number, (void*)buffer, pos);
+		if(!this->daemon) // slaves receive commands as finalized batches
+			return;
+		
+		auto current_tick = this->local_tick_number;
+		BufferReader<> in(nm->message);
+		auto commands_number = in.read<unsigned short>();
 		if(commands_number > MAX_COMMANDS_PER_PACKET) {
 			std::cout << "< Received command packet with too many commands (" << commands_number << ")" << std::endl;
 			return;
 		}
+		unsigned int first_seq = 0;
+		ticktype previous_tick = 0;
+		unsigned int previous_seq = 0;
 		for(int i=0; i<commands_number; i++) {
-			ticktype tick_number;
-			std::string command;
-			pos += deserializeCommand((char*)buffer, pos, &tick_number, &command);
-			if(command.size() > MAX_COMMAND_LENGTH) {
-				std::cout << "< Received command over size limit (" << command.size() << ")" << std::endl;
+			TickCommand tc;
+			this->deserializeCommand(in, &tc.tick_number, &tc.seq, &tc.command, previous_tick, previous_seq);
+			previous_tick = tc.tick_number;
+			previous_seq = tc.seq;
+			if(i == 0)
+				first_seq = tc.seq;
+			if(tc.command.size() > MAX_COMMAND_LENGTH) {
+				std::cout << "< Received command over size limit (" << tc.command.size() << ")" << std::endl;
 				return;
 			}
-			if(this->daemon && tick_number < tick_number) {
-				std::cout << "< Received command in the past, discarding (received " << tick_number
-							<< " vs now " << tick_number << ")" << std::endl;
-				return;
+			// slaves repeat commands until acknowledged, so drop ones already received
+			if(!this->acceptCommand(nm->origin_host_and_port, first_seq, tc.seq))
+				continue;
+			// measured from when the command's tick is due to begin, not in whole ticks
+			auto &margins = this->peers[nm->origin_host_and_port].command_margins;
+			if(margins.size() < COMMAND_TIMING_MAX && this->last_tick_time != 0) {
+				margins.push_back({tc.tick_number, ((nanotimediff)tc.tick_number - (nanotimediff)this->last_tick_number) *
+					(nanotimediff)this->tick_period - (nanotimediff)(nm->received_timestamp - this->last_tick_time)});
 			}
-			if(this->daemon && tick_number - tick_number > COMMAND_MAX_FUTURE) {
-				std::cout << "< Received command too far in the future (" << tick_number << ") for now "
-							<< "(" << tick_number << ")" << std::endl;
-				return;
+			if(tc.tick_number < current_tick) {
+				std::cout << "< Received command in the past, discarding (received " << tc.tick_number
+							<< " vs now " << current_tick << ")" << std::endl;
+				continue;
+			}
+			if(tc.tick_number - current_tick > COMMAND_MAX_FUTURE) {
+				std::cout << "< Received command too far in the future (" << tc.tick_number << ") for now "
+							<< "(" << current_tick << ")" << std::endl;
+				continue;
+			}
+			// encoded commands must match a registered type, so malformed ones never reach other slaves
+			if(!this->command_registry.validate(tc.command)) {
+				std::cout << "< Received malformed encoded command" << std::endl;
+				continue;
 			}
 			
-			// if validated log the command
-			auto tick_and_command = std::to_string(tick_number).append(" ").append(command);
+			tc.origin = nm->origin_host_and_port;
+			if(!this->command_buffer.add(tc)) {
+				std::cout << "< Received command after its tick was finalized (" << tc.tick_number 
+							<< ")" << std::endl;
+			}
+		}
+	}
+	
+	// Slaves store each newly received tick batch and hand it to the application for replay
+	void Razor::receiveCommandBatch(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto tick_count = in.read<unsigned short>();
+		ticktype previous_tick = 0;
+		for(int i=0; i<tick_count; i++) {
+			auto batch_tick = in.readVarintDelta(previous_tick);
+			auto commands_number = in.readVarint<unsigned short>();
+			previous_tick = batch_tick;
 			
-			if(this->daemon) {
-				//std::cout << "< Received command @ " << this->server->tick_number << " : " << tick_and_command << std::endl;
-				sendCommand(command);
-			} else {
-				// Note: it is important that this comes before the logcommand below because it must check
-				//		to see if this is an existing command.
-				// TODO: add command play back
-				//this->server->consoleInternal(std::string("replaycommand ").append(tick_and_command), false);
+			std::vector<TickCommand> commands;
+			commands.resize(commands_number);
+			for(auto &c : commands) {
+				c.tick_number = batch_tick;
+				c.origin = nm->origin_host_and_port;
+				c.seq = 0;
+				c.command.assign(in.readVarintString());
 			}
 			
-			// Note: this must come after the replaycommand above because replay command checks if this command is logged.
-			// TODO: add command logging
-			//this->server->consoleInternal(std::string("logcommand ").append(tick_and_command), false);
+			if(this->batch_receive_tick == 0)
+				this->next_batch_tick = batch_tick;
+			this->batch_receive_tick = std::max(this->batch_receive_tick, batch_tick);
+			
+			if(this->command_buffer.isFinalized(batch_tick))
+				continue; // a repeat of a batch already received
+			
+			this->command_buffer.assign(batch_tick, std::move(commands));
+			if(this->tick_commands_func != nullptr)
+				(*this->tick_commands_func)(batch_tick, this->command_buffer.commandsForTick(batch_tick));
+		}
+	}
+	
+	// Daemons resend the batches a lockstep slave is missing, or a full sync if a tick has left
+	// the command buffer
+	void Razor::receiveBatchRequest(NetworkMessage* nm) {
+		if(!this->daemon || !this->lockstep)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto count = in.read<unsigned short>();
+		if(count > BATCH_REQUEST_MAX_TICKS)
+			return;
+		std::deque<ticktype> batch_ticks;
+		ticktype previous_tick = 0;
+		for(unsigned short i=0; i<count; i++) {
+			auto missing_tick = in.readVarintDelta(previous_tick);
+			previous_tick = missing_tick;
+			if(!this->command_buffer.isFinalized(missing_tick)) {
+				this->peers[nm->origin_host_and_port].lockstep_sync_tick = this->local_tick_number;
+				this->sendSync(nm->origin_host_and_port);
+				return;
+			}
+			batch_ticks.push_back(missing_tick);
+		}
+		if(batch_ticks.size() > 0)
+			this->sendCommandBatch(nm->origin_host_and_port, batch_ticks);
+	}
+	
+	// Daemons compare a lockstep slave's state hash with their own for the same tick and send
+	// a full sync if they diverge
+	void Razor::receiveStateHash(NetworkMessage* nm) {
+		if(!this->daemon || !this->lockstep)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto hash_tick = in.read<ticktype>();
+		auto hash = in.read<unsigned long long>();
+		
+		auto &own = this->state_hashes[hash_tick % this->state_hashes.size()];
+		if(own.tick_number != hash_tick)
+			return; // not hashed yet or too old to compare
+		
+		auto &peer = this->peers[nm->origin_host_and_port];
+		if(hash_tick < peer.lockstep_sync_tick)
+			return; // the slave hasn't caught up with its last resync
+		
+		if(own.hash != hash) {
+			std::cout << "< Lockstep state diverged at tick " << hash_tick << " for " 
+						<< nm->origin_host_and_port << std::endl;
+			peer.lockstep_sync_tick = this->local_tick_number;
+			this->sendSync(nm->origin_host_and_port);
+		}
+	}
+	
+	// Slaves compare the daemon's root with a tree of their own state for the same tick
+	void Razor::receiveSyncRoot(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto daemon_tick_number = in.read<ticktype>();
+		auto length = in.read<unsigned int>();
+		auto root = in.read<unsigned long long>();
+		
+		// the join stream will deliver the whole state
+		if(this->join_receiving)
+			return;
+		
+		this->merkle_state.clear();
+		if(this->get_state_data_at_tick_func != nullptr) {
+			(*this->get_state_data_at_tick_func)(&this->merkle_state, daemon_tick_number);
+		} else if(this->get_state_data_func != nullptr) {
+			(*this->get_state_data_func)(&this->merkle_state);
+		}
+		this->merkle_tick = daemon_tick_number;
+		this->merkle_root = root;
+		this->merkle_pending_chunks.clear();
+		
+		// chunks don't line up if the length changed, so ask for everything
+		if(this->merkle_state.size() != length) {
+			this->sendMerkleRequest(0, {});
+			return;
+		}
+		
+		this->merkle_tree.build(this->merkle_state.c_str(), this->merkle_state.size());
+		if(this->merkle_tree.root() == root)
+			return; // converged
+		
+		this->sendMerkleRequest(this->merkle_tree.depth() - 1, {0});
+	}
+	
+	void Razor::receiveMerkleRequest(NetworkMessage* nm) {
+		if(!this->daemon)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto request_tick = in.read<ticktype>();
+		auto level = in.read<unsigned int>();
+		auto count = in.read<unsigned int>();
+		
+		// a request without nodes is for a full sync, as a slave whose state length differs sends
+		if(count == 0) {
+			auto it = this->peers.find(nm->origin_host_and_port);
+			if(it != this->peers.end())
+				it->second.has_sync_baseline = false;
+			if(this->join_stream) {
+				this->startJoinStream(nm->origin_host_and_port);
+			} else {
+				this->sendSync(nm->origin_host_and_port);
+			}
+			return;
+		}
+		
+		// requests for an older tree are dropped, the slave will compare against the next root
+		if(request_tick != this->merkle_tick || level >= this->merkle_tree.depth() ||
+				count > this->merkle_tree.leafCount())
+			return;
+		
+		std::vector<unsigned int> indices;
+		indices.resize(count);
+		in.readArray(indices.data(), count);
+		
+		if(level == 0) {
+			this->sendMerkleChunks(nm->origin_host_and_port, indices);
+		} else {
+			this->sendMerkleNodes(nm->origin_host_and_port, level, indices);
+		}
+	}
+	
+	void Razor::receiveMerkleNodes(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto nodes_tick = in.read<ticktype>();
+		auto level = in.read<unsigned int>();
+		auto count = in.read<unsigned int>();
+		if(nodes_tick != this->merkle_tick || count > this->merkle_tree.leafCount())
+			return;
+		
+		std::vector<unsigned int> mismatches;
+		for(unsigned int i=0; i<count; i++) {
+			auto index = in.read<unsigned int>();
+			auto hash = in.read<unsigned long long>();
+			if(this->merkle_tree.node(level, index) != hash)
+				mismatches.push_back(index);
 		}
+		if(mismatches.size() == 0)
+			return;
+		
+		if(level == 0)
+			this->merkle_pending_chunks.insert(mismatches.begin(), mismatches.end());
+		this->sendMerkleRequest(level, mismatches);
+	}
+	
+	// Slaves patch the received chunks into their state, and load it once every chunk has arrived
+	void Razor::receiveMerkleChunks(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto chunks_tick = in.read<ticktype>();
+		auto count = in.read<unsigned int>();
+		if(chunks_tick != this->merkle_tick || this->merkle_pending_chunks.size() == 0)
+			return;
+		
+		for(unsigned int i=0; i<count; i++) {
+			auto index = in.read<unsigned int>();
+			auto chunk = in.readString();
+			unsigned int start = index * MERKLE_CHUNK_SIZE;
+			if(this->merkle_pending_chunks.count(index) == 0 || start + chunk.size() > this->merkle_state.size())
+				continue;
+			this->merkle_state.replace(start, chunk.size(), chunk);
+			this->merkle_pending_chunks.erase(index);
+		}
+		if(this->merkle_pending_chunks.size() > 0)
+			return;
+		
+		this->merkle_tree.build(this->merkle_state.c_str(), this->merkle_state.size());
+		if(this->merkle_tree.root() != this->merkle_root) {
+			std::cout << "< Merkle repair did not converge, requesting full sync" << std::endl;
+			this->sendMerkleRequest(0, {});
+			return;
+		}
+		
+		std::cout << "< Repaired state from Merkle sync" << std::endl;
+		if(this->set_state_data_func != nullptr)
+			(*this->set_state_data_func)(&this->merkle_state, this->merkle_tick, this->future_time);
+	}
+	
+	void Razor::receiveObjectSync(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto daemon_tick_number = in.read<ticktype>();
+		auto count = in.read<unsigned int>();
+		std::string state;
+		for(unsigned int i=0; i<count; i++) {
+			auto id = in.read<unsigned int>();
+			state.assign(in.readString());
+			if(this->set_object_state_func != nullptr)
+				(*this->set_object_state_func)(id, &state, daemon_tick_number);
+		}
+		auto departed_count = in.read<unsigned int>();
+		for(unsigned int i=0; i<departed_count; i++) {
+			auto id = in.read<unsigned int>();
+			if(this->object_left_interest_func != nullptr)
+				(*this->object_left_interest_func)(id);
+		}
+	}
+	
+	void Razor::receiveEntityChanges(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		// a snapshot holds everything in changes from its own tick, as they're sent first
+		BufferReader<> in(nm->message);
+		auto daemon_tick_number = in.read<ticktype>();
+		if(daemon_tick_number <= this->entity_tick)
+			return;
+		this->entities.readChanges(in);
+		this->entity_tick = daemon_tick_number;
+	}
+	
+	void Razor::receiveEntitySync(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto daemon_tick_number = in.read<ticktype>();
+		if(daemon_tick_number < this->entity_tick)
+			return;
+		this->entities.readSnapshot(in);
+		this->entity_tick = daemon_tick_number;
+	}
+	
+	void Razor::receiveSyncDelta(NetworkMessage* nm) {
+		if(this->daemon || !this->slaved)
+			return;
+		
+		BufferReader<> in(nm->message);
+		auto daemon_tick_number = in.read<ticktype>();
+		auto baseline_tick = in.read<ticktype>();
+		auto delta = in.readString();
+		
+		// without the baseline, such as after a lost sync, only a full sync will do
+		if(!this->has_sync_baseline || baseline_tick != this->sync_baseline_tick) {
+			this->sendRequestFullSync();
+			return;
+		}
+		
+		std::string state;
+		patchState(this->sync_baseline, delta, &state);
+		this->merkle_pending_chunks.clear();
+		this->join_receiving = false;
+		this->loadSync(&state, daemon_tick_number);
 	}
 	
 	void Razor::receiveSync(NetworkMessage* nm) {
@@ -367,22 +1463,37 @@ namespace razor {
 			return;
 		}
 		
+		// a full sync supersedes any Merkle repair in progress
+		this->merkle_pending_chunks.clear();
+		
 		// Set the server's tick time to the sync message's
 		// load in the gamedata sync
 		// Set the server's local_time_difference to the correct amount of future_ticks
-		ticktype daemon_tick_number;
-		std::string state;
-		
-		char* data = (char*)nm->message.c_str();
-		
-		int pos = 0;
-		pos += copyOut(&daemon_tick_number, data, pos);
-		pos += copyOutString(&state, data, pos);
+		BufferReader<> in(nm->message);
+		auto daemon_tick_number = in.read<ticktype>();
+		std::string state(in.readString());
 		
+		// a full sync supersedes a join stream in progress
+		this->join_receiving = false;
+		this->loadSync(&state, daemon_tick_number);
+	}
+	
+	// Loads a complete state from the daemon, received in a SYNC or assembled from a join stream
+	void Razor::loadSync(std::string* state, ticktype daemon_tick_number) {
 		//std::cout << "< Sync daemon tick: " << daemon_tick_number << ". Local tick: " << this->server->tick_number << std::endl;
 		
 		nanotimediff local_time_difference = this->future_time;
 		
+		if(this->delta_sync) {
+			this->has_sync_baseline = true;
+			this->sync_baseline_tick = daemon_tick_number;
+			this->sync_baseline = *state;
+		}
+		
+		// batches before the synced tick are no longer needed
+		if(this->lockstep)
+			this->next_batch_tick = std::max(this->next_batch_tick, daemon_tick_number);
+		
 		if(this->first_sync) {
 			this->first_sync = false;
 			this->create_player = true;
@@ -413,120 +1524,501 @@ namespace razor {
 					true); // priority = true
 			}/**/
 		}
+		
+		if(this->set_state_data_func != nullptr)
+			(*this->set_state_data_func)(state, daemon_tick_number, local_time_difference);
+	}
+	
+	void Razor::receiveMessages() {
+		auto tick_number = this->local_tick_number;
+		auto zero_time = this->local_zero_time;
+		
+		std::string host_and_port, message;
+		nanotime received_timestamp;
+		
+		while(this->connection.receive(&host_and_port, &message, &received_timestamp)) {
+			NetworkMessage nm;
+			nm.origin_host_and_port = host_and_port;
+			nm.dest_host_and_port = LOCAL;
+			nm.received_timestamp = received_timestamp;
+			
+			try {
+				BufferReader<> in(message);
+				this->deserializeMessage(&nm, in);
+				if(nm.type & MESSAGE_COMPRESSED)
+					this->decompressMessage(&nm);
+				
+				// any message keeps its sender's connection alive
+				if(this->daemon) {
+					this->touchPeer(host_and_port, received_timestamp);
+				} else {
+					this->armTimer(&this->daemon_timeout_timer, DAEMON_PEER_ID, TIMER_TIMEOUT,
+						received_timestamp + this->timeout);
+				}
+				
+				// every message from the daemon carries a command ack
+				this->receiveAck(&nm);
+				
+				if(nm.type == MESSAGE_COMMAND) {
+					//std::cout << "< Received command" << std::endl;
+					this->receiveCommands(&nm);
+				} else if(nm.type == MESSAGE_SYNC) {
+					std::cout << "< Received sync" << std::endl;
+					this->receiveSync(&nm);
+				} else if(nm.type == MESSAGE_PONG) {
+					std::cout << "< Received pong" << std::endl;
+					this->receivePong(&nm);
+				} else if(nm.type == MESSAGE_REQUEST_FULL) {
+					if(!this->daemon) // slaves should ignore sync requests
+						continue;
+					std::cout << "< Received request full sync" << std::endl;
+					BufferReader<> request(nm.message);
+					auto flags = request.read<unsigned char>();
+					auto dictionary_hash = request.read<unsigned long long>();
+					// opcodes from a slave with other command types would mean other commands
+					if(request.read<unsigned long long>() != this->command_registry.hash()) {
+						std::cout << "< Refusing slave with different command types" << std::endl;
+						this->disconnectPeer(nm.origin_host_and_port);
+						continue;
+					}
+					// (re)joining slaves restart their command sequence and need every relevant object
+					auto &joining = this->peers[nm.origin_host_and_port];
+					joining.command_ack = 0;
+					joining.received_command_seqs.clear();
+					joining.relevant_objects.clear();
+					joining.has_sync_baseline = false;
+					joining.compression = false;
+					joining.compression_dictionary = false;
+					joining.compression = this->compression && (flags & 1);
+					joining.compression_dictionary = joining.compression && this->compression_dictionary.size() > 0 &&
+						dictionary_hash == this->compression_dictionary_hash;
+					this->sendPong(nm.origin_host_and_port, nm.timestamp, nm.received_timestamp);
+					if(this->join_stream) {
+						this->startJoinStream(nm.origin_host_and_port);
+					} else if(this->interest_management) {
+						this->sendObjectSync(nm.origin_host_and_port);
+					} else if(this->entity_sync) {
+						this->sendEntitySync(nm.origin_host_and_port);
+					} else {
+						this->sendSync(nm.origin_host_and_port);
+					}
+				} else if(nm.type == MESSAGE_PING) {
+					this->receivePing(&nm);
+				} else if(nm.type == MESSAGE_DISCONNECT) {
+					std::cout << "< Received disconnect" << std::endl;
+					if(this->daemon) {
+						this->disconnectPeer(nm.origin_host_and_port, false);
+					} else {
+						this->disconnectFromDaemon();
+						this->daemon_host_and_port = "";
+					}
+				} else if(nm.type == MESSAGE_COMMAND_BATCH) {
+					this->receiveCommandBatch(&nm);
+				} else if(nm.type == MESSAGE_BATCH_REQUEST) {
+					this->receiveBatchRequest(&nm);
+				} else if(nm.type == MESSAGE_STATE_HASH) {
+					this->receiveStateHash(&nm);
+				} else if(nm.type == MESSAGE_SYNC_ROOT) {
+					this->receiveSyncRoot(&nm);
+				} else if(nm.type == MESSAGE_MERKLE_REQUEST) {
+					this->receiveMerkleRequest(&nm);
+				} else if(nm.type == MESSAGE_MERKLE_NODES) {
+					this->receiveMerkleNodes(&nm);
+				} else if(nm.type == MESSAGE_MERKLE_CHUNKS) {
+					this->receiveMerkleChunks(&nm);
+				} else if(nm.type == MESSAGE_SYNC_OBJECTS) {
+					this->receiveObjectSync(&nm);
+				} else if(nm.type == MESSAGE_JOIN_STREAM) {
+					this->receiveJoinStream(&nm);
+				} else if(nm.type == MESSAGE_JOIN_RESUME) {
+					this->receiveJoinResume(&nm);
+				} else if(nm.type == MESSAGE_COMMAND_TIMING) {
+					this->receiveCommandTiming(&nm);
+				} else if(nm.type == MESSAGE_ENTITY_CHANGES) {
+					this->receiveEntityChanges(&nm);
+				} else if(nm.type == MESSAGE_ENTITY_SYNC) {
+					this->receiveEntitySync(&nm);
+				} else if(nm.type == MESSAGE_SYNC_DELTA) {
+					this->receiveSyncDelta(&nm);
+				} else if(nm.type == MESSAGE_ACK) {
+					// handled by receiveAck above
+				} else {
+					std::cout << "< Received unknown network sync packet type." << std::endl;
+				}
+			} catch(...) {
+				std::exception_ptr p = std::current_exception();
+				std::cout << "< Error processing sync message: " << (p ? p.__cxa_exception_type()->name() : "unknown") << std::endl;
+			}
+		}
+	}
+	
+	void Razor::clearSendQueue() {
+		for(auto &queue : this->send_queues) {
+			std::deque<NetworkMessage> empty;
+			std::swap(queue, empty);
+		}
+	}
+	
+	void Razor::clearOutgoingCommands() {
+		std::deque<OutgoingCommand> empty;
+		std::swap(this->outgoing_commands, empty);
+	}
+	
+	void Razor::sendMessages(ticktype tick_number) {
+		// if a slave with no daemon, do not send.
+		if(!this->daemon && !this->slaved) {
+			this->clearSendQueue();
+			return;
+		}
+		
+		// if a slave that hasn't received its first pong, do not send commands
+		if(!this->daemon && this->first_ping) {
+			this->clearOutgoingCommands();
+		}
+		
+		// wait for the next command interval to send a batch of commands
+		if(this->next_command_time < tick_number) {
+			this->next_command_time = tick_number + COMMAND_DELAY;
+			this->queueOutgoingCommands();
+		}
+		
+		this->transmitSendQueue();
+		
+		// slaves that received no other traffic still need their command acks
+		if(this->daemon) {
+			for(auto &p : this->peers) {
+				// timing reports carry the ack too
+				if(!p.second.command_margins.empty()) {
+					this->sendCommandTiming(p.first, p.second);
+				} else if(p.second.ack_pending) {
+					this->sendAck(p.first);
+				}
+			}
+			this->transmitSendQueue();
+		}
+		
+		// paced datagrams queued on earlier ticks
+		this->connection.flush();
+	}
+	
+	// Lanes are drained in priority order, so pongs and acks leave before queued syncs
+	void Razor::transmitSendQueue() {
+		for(auto &queue : this->send_queues) {
+			while(queue.size() != 0) {
+				auto nm = queue.front();
+				queue.pop_front();
+				this->compressed_ready[0] = this->compressed_ready[1] = false;
+				bool result = true;
+				//std::cout << "< Sending message to " << nm.dest_host_and_port << " : " << nm.message << std::endl;
+				if(nm.dest_host_and_port == BROADCAST) {
+					// broadcasts are serialized per slave because each carries its own ack
+					for(auto &c : this->connection.channels) {
+						result = this->transmitMessage(c.first, &nm) && result;
+					}
+				} else {
+					result = this->transmitMessage(nm.dest_host_and_port, &nm);
+				}
+				if(!result) {
+					std::cout << "< Failed to send packet" << std::endl;
+				}
+			}
+		}
+	}
+	
+	bool Razor::transmitMessage(const std::string &dest, NetworkMessage* nm) {
+		nm->ack = 0;
+		nm->timestamp = razor::nanoNow(); // stamped at send time, not when queued
+		auto it = this->peers.find(dest);
+		if(it != this->peers.end()) {
+			nm->ack = it->second.command_ack;
+			it->second.ack_pending = false;
+			// anything sent keeps the connection alive
+			if(it->second.id != 0) {
+				this->armTimer(&it->second.keepalive_timer, it->second.id, TIMER_KEEPALIVE,
+					nm->timestamp + this->keepalive);
+			}
+		}
+		
+		bool compressed = it != this->peers.end() && this->compressMessage(it->second, nm);
+		
+		// one capacity check up front, and the buffer's allocation is kept between messages
+		this->transmit_buffer.clear();
+		BufferWriter<false> out(&this->transmit_buffer);
+		out.reserve(MESSAGE_HEADER_SIZE + nm->message.size());
+		this->serializeMessage(out, nm);
+		out.finish();
+		
+		// broadcasts go on to other slaves, which may not accept the compressed body
+		if(compressed) {
+			std::swap(nm->message, this->compressed_bodies[it->second.compression_dictionary]);
+			nm->type &= ~MESSAGE_COMPRESSED;
+		}
+		return this->connection.send(dest, this->transmit_buffer, Razor::laneFor(nm->type));
+	}
+	
+	// Swaps in the compressed body if the slave accepts it and it's smaller. Its length and
+	// whether the dictionary was used go before the compressed bytes.
+	bool Razor::compressMessage(PeerState &peer, NetworkMessage* nm) {
+		if(!this->compression || !peer.compression || nm->message.size() < COMPRESSION_THRESHOLD)
+			return false;
+		
+		unsigned char with_dictionary = peer.compression_dictionary;
+		auto &body = this->compressed_bodies[with_dictionary];
+		if(!this->compressed_ready[with_dictionary]) {
+			std::string compressed;
+			compress(nm->message, &compressed, with_dictionary ? std::string_view(this->compression_dictionary) : std::string_view());
+			body.clear();
+			BufferWriter<> out(&body);
+			out.writeVarint((unsigned int)nm->message.size());
+			out.write(with_dictionary);
+			out.writeArray(compressed.data(), compressed.size());
+			out.finish();
+			this->compressed_ready[with_dictionary] = true;
+		}
+		if(body.size() >= nm->message.size())
+			return false;
+		
+		std::swap(nm->message, body);
+		nm->type |= MESSAGE_COMPRESSED;
+		return true;
+	}
+	
+	// Throws std::range_error for malformed bodies and ones needing a dictionary this side lacks
+	void Razor::decompressMessage(NetworkMessage* nm) {
+		nm->type &= ~MESSAGE_COMPRESSED;
+		BufferReader<> in(nm->message);
+		auto length = in.readVarint<unsigned int>();
+		auto with_dictionary = in.read<unsigned char>();
+		auto compressed = in.readBytes(in.remaining());
+		if(with_dictionary && this->compression_dictionary.size() == 0)
+			throw std::range_error("Compressed message needs a dictionary");
+		// a match expands at most 255 times, which bounds the length before allocating it
+		if(length > 255ULL * compressed.size())
+			throw std::range_error("Compressed message length past its data");
+		
+		std::string message;
+		decompress(compressed, length, &message, with_dictionary ? std::string_view(this->compression_dictionary) : std::string_view());
+		nm->message = std::move(message);
+	}
+	
+	void Razor::updateFutureTime() {
+		this->future_time = this->calculateLocalTimeDifference();
+		// TODO: set local time difference
+		//this->server->setLocalTimeDifference(this->future_time);
+	}
+	
+	// Finalizes every tick up to the current one, hands each tick's commands to the
+	// application, and broadcasts the batches that are still being repeated
+	void Razor::finalizeCommands() {
+		auto tick_number = this->local_tick_number;
+		
+		// skip ahead if the tick number jumped further than the buffer holds
+		if(this->next_finalize_tick + COMMAND_BUFFER_TICKS < tick_number)
+			this->next_finalize_tick = tick_number;
+		
+		for(; this->next_finalize_tick <= tick_number; this->next_finalize_tick++) {
+			auto finalize_tick = this->next_finalize_tick;
+			auto commands = this->command_buffer.finalize(finalize_tick);
+			if(this->tick_commands_func != nullptr)
+				(*this->tick_commands_func)(finalize_tick, commands);
+			// lockstep slaves need every tick's batch, even empty ones, before they may simulate it
+			if(commands.size() > 0 || this->lockstep)
+				this->recent_batch_ticks.push_back(finalize_tick);
+		}
+		
+		while(this->recent_batch_ticks.size() > 0 &&
+				this->recent_batch_ticks.front() + COMMAND_BATCH_REDUNDANCY <= tick_number) {
+			this->recent_batch_ticks.pop_front();
+		}
+		
+		if(this->recent_batch_ticks.size() > 0)
+			this->sendCommandBatch(BROADCAST, this->recent_batch_ticks);
+	}
+	
+	unsigned long long Razor::stateHash() {
+		if(this->get_state_hash_func != nullptr)
+			return (*this->get_state_hash_func)();
+		
+		if(this->get_state_data_func == nullptr)
+			throw std::runtime_error("registerGetStateDataFunc must be called before stateHash");
+		
+		std::string state;
+		(*this->get_state_data_func)(&state);
+		return hashData(state.c_str(), state.size());
+	}
+	
+	// At the start of a tick the state is the result of the previous tick, so that is the
+	// tick the hash is recorded for
+	void Razor::hashLockstepState() {
+		auto tick_number = this->local_tick_number;
+		if(tick_number == 0 || tick_number - 1 == this->last_hashed_tick)
+			return;
+		
+		ticktype hash_tick = tick_number - 1;
+		auto hash = this->stateHash();
+		this->last_hashed_tick = hash_tick;
+		
+		if(this->daemon) {
+			this->state_hashes[hash_tick % this->state_hashes.size()] = StateHash{hash_tick, hash};
+		} else {
+			this->sendStateHash(hash_tick, hash);
+		}
+	}
+	
+	// Global objects, then objects in the slave's area of interest (or every object if it has none),
+	// filtered by the relevance callback
+	void Razor::relevantObjects(const std::string &dest, std::vector<unsigned int>* out) {
+		auto it = this->peers.find(dest);
+		
+		out->insert(out->end(), this->interest.global_objects.begin(), this->interest.global_objects.end());
+		if(it != this->peers.end() && it->second.has_interest) {
+			auto &peer = it->second;
+			this->interest.query(peer.interest_x, peer.interest_y, peer.interest_z, peer.interest_radius, out);
+		} else {
+			for(auto &o : this->interest.objects) {
+				if(!o.second.global)
+					out->push_back(o.first);
+			}
+		}
+		
+		if(this->object_relevance_func != nullptr) {
+			auto last = std::remove_if(out->begin(), out->end(), [this, &dest](unsigned int id) {
+				return !(*this->object_relevance_func)(dest, id);
+			});
+			out->erase(last, out->end());
+		}
 	}
 	
-	void Razor::receiveMessages() {
+	// Object states are serialized at most once per tick, however many slaves they're sent to
+	const std::string& Razor::objectState(unsigned int id) {
+		if(this->get_object_state_func == nullptr)
+			throw std::runtime_error("registerCallbackGetObjectState must be called before object syncs");
+		
+		if(this->object_state_cache_tick != this->local_tick_number) {
+			this->object_state_cache.clear();
+			this->object_state_cache_tick = this->local_tick_number;
+		}
+		
+		auto it = this->object_state_cache.find(id);
+		if(it != this->object_state_cache.end())
+			return it->second;
+		
+		auto &state = this->object_state_cache[id];
+		(*this->get_object_state_func)(id, &state);
+		return state;
+	}
+	
+	void Razor::daemonTick() {
 		auto tick_number = this->local_tick_number;
-		auto zero_time = this->local_zero_time;
 		
-		std::string host_and_port, message;
+		auto now = razor::nanoNow();
+		if(this->last_tick_time != 0) {
+			nanotimediff period = now - this->last_tick_time;
+			this->tick_period = this->tick_period == 0 ? period :
+				this->tick_period + (period - (nanotimediff)this->tick_period) / 16;
+		}
+		this->last_tick_time = now;
+		this->last_tick_number = tick_number;
 		
-		while(this->connection.receive(&host_and_port, &message)) {
-			NetworkMessage nm;
-			nm.origin_host_and_port = host_and_port;
-			nm.dest_host_and_port = LOCAL;
-			
-			try {
-				this->deserializeMessage(&nm, (void*)message.c_str());
-				
-				if(nm.type == MESSAGE_COMMAND) {
-					//std::cout << "< Received command" << std::endl;
-					this->receiveCommands(&nm);
-				} else if(nm.type == MESSAGE_SYNC) {
-					std::cout << "< Received sync" << std::endl;
-					this->receiveSync(&nm);
-				} else if(nm.type == MESSAGE_PONG) {
-					std::cout << "< Received pong" << std::endl;
-					this->receivePong(&nm);
-				} else if(nm.type == MESSAGE_REQUEST_FULL) {
-					if(!this->daemon) // slaves should ignore sync requests
-						continue;
-					std::cout << "< Received request full sync" << std::endl;
-					this->sendPong(nm.origin_host_and_port, nm.timestamp);
-					this->sendSync(nm.origin_host_and_port);
-				} else if(nm.type == MESSAGE_PING) {
-					if(!this->daemon) // slaves should ignore ping requests
-						continue;
-					this->sendPong(nm.origin_host_and_port, nm.timestamp);
-				} else if(nm.type == MESSAGE_DISCONNECT) {
-					// TODO
-				} else {
-					std::cout << "< Received unknown network sync packet type." << std::endl;
+		this->finalizeCommands();
+		this->sendJoinStreams();
+		
+		// lockstep daemons only sync slaves whose state hashes diverge
+		if(this->lockstep) {
+			this->hashLockstepState();
+			return;
+		}
+		
+		// budgeted object syncs are spread over every tick rather than sent in full periodically
+		if(this->interest_management && this->sync_budget > 0) {
+			for(auto &c : this->connection.channels) {
+				auto it = this->peers.find(c.first);
+				if(it != this->peers.end() && it->second.joining && this->join_stream_budget > this->sync_budget) {
+					this->sendObjectSync(c.first, this->join_stream_budget);
+					continue;
 				}
-			} catch(...) {
-				std::exception_ptr p = std::current_exception();
-				std::cout << "< Error processing sync message: " << (p ? p.__cxa_exception_type()->name() : "unknown") << std::endl;
+				this->sendObjectSync(c.first, this->sync_budget);
 			}
-		}
-	}
-	
-	void Razor::clearSendQueue() {
-		std::deque<NetworkMessage> empty;
-		std::swap(this->send_queue, empty);
-	}
-	
-	void Razor::clearOutgoingCommands() {
-		std::deque<OutgoingCommand> empty;
-		std::swap(this->outgoing_commands, empty);
-	}
-	
-	void Razor::sendMessages(ticktype tick_number) {
-		// if a slave with no daemon, do not send.
-		if(!this->daemon && !this->slaved) {
-			this->clearSendQueue();
+			this->last_sync_tick = tick_number;
 			return;
 		}
 		
-		// if a slave that hasn't received its first pong, do not send commands
-		if(!this->daemon && this->first_ping) {
-			this->clearOutgoingCommands();
+		// entity changes go every tick, and snapshots take the place of periodic full syncs
+		if(this->entity_sync && !this->interest_management) {
+			this->sendEntityChanges();
+			this->sendPeriodicSyncs();
+			return;
 		}
 		
-		// wait for the next command interval to send a batch of commands
-		if(this->next_command_time < tick_number) {
-			this->next_command_time = tick_number + COMMAND_DELAY;
-			this->queueOutgoingCommands();
+		// Merkle roots are a few bytes, so they're still broadcast together
+		if(this->merkle_sync && !this->interest_management && !this->delta_sync) {
+			if(this->next_sync_tick <= tick_number) {
+				this->next_sync_tick = tick_number + SYNC_DELAY;
+				this->sendSyncRoot(BROADCAST);
+				this->last_sync_tick = tick_number;
+			}
+			return;
 		}
 		
-		while(this->send_queue.size() != 0) {
-			auto nm = this->send_queue.front();
-			this->send_queue.pop_front();
-			int length = this->serializeMessage(this->send_buffer, &nm);
-			std::string message_serialized;
-			message_serialized.resize(length);
-			message_serialized.assign(this->send_buffer, length);
-			bool result = false;
-			//std::cout << "< Sending message to " << nm.dest_host_and_port << " : " << message_serialized << std::endl;
-			if(nm.dest_host_and_port == BROADCAST) {
-				result = this->connection.sendAll(message_serialized);
+		this->sendPeriodicSyncs();
+	}
+	
+	// Syncs the slaves whose staggered phase falls on this tick, rather than all of them at once
+	void Razor::sendPeriodicSyncs() {
+		auto tick_number = this->local_tick_number;
+		for(auto &c : this->connection.channels) {
+			auto it = this->peers.find(c.first);
+			if(it == this->peers.end())
+				continue;
+			auto &peer = it->second;
+			if(peer.next_sync_tick == 0)
+				peer.next_sync_tick = tick_number + this->nextSyncPhase();
+			if(peer.next_sync_tick > tick_number || peer.joining)
+				continue;
+			
+			peer.next_sync_tick = tick_number + this->syncDelay(peer);
+			if(this->interest_management) {
+				this->sendObjectSync(c.first);
+			} else if(this->entity_sync) {
+				this->sendEntitySync(c.first);
 			} else {
-				result = this->connection.send(nm.dest_host_and_port, message_serialized);
-			}
-			if(!result) {
-				std::cout << "< Failed to send packet" << std::endl;
+				this->sendSync(c.first); //this->last_sync_tick); delta syncs need work
 			}
+			this->last_sync_tick = tick_number;
 		}
 	}
 	
-	void Razor::updateFutureTime() {
-		this->future_time = this->calculateLocalTimeDifference();
-		// TODO: set local time difference
-		//this->server->setLocalTimeDifference(this->future_time);
+	// Successive multiples of the golden ratio stay evenly spread however many slaves join
+	ticktype Razor::nextSyncPhase() {
+		float fraction = this->sync_phase_count++ * 0.6180339887f;
+		fraction -= (unsigned int)fraction;
+		return 1 + (ticktype)(fraction * SYNC_DELAY);
 	}
 	
-	void Razor::daemonTick() {
-		auto tick_number = this->local_tick_number;
-		if(this->next_sync_tick <= tick_number) {
-			this->next_sync_tick = tick_number + SYNC_DELAY;
-			this->sendSync(BROADCAST); //this->last_sync_tick); delta syncs need work
-			this->last_sync_tick = tick_number;
-		}
+	// Syncs to a slave can't arrive faster than its round trip, and a lossy link is likely congested
+	ticktype Razor::syncDelay(const PeerState &peer) {
+		float delay = SYNC_DELAY;
+		if(peer.ping > SYNC_REFERENCE_PING)
+			delay *= (float)peer.ping / SYNC_REFERENCE_PING;
+		delay *= 1.0f + peer.loss * SYNC_LOSS_BACKOFF;
+		return std::min((ticktype)delay, (ticktype)SYNC_MAX_DELAY);
 	}
 	
 	void Razor::slaveTick(ticktype tick_number) {
 		this->connectIfNeeded();
 		this->updateFutureTime();
 		
+		if(this->lockstep && !this->first_sync) {
+			this->hashLockstepState();
+			this->sendBatchRequest();
+		}
+		
+		// ask again for join stream chunks that never arrived
+		if(this->join_receiving && this->join_last_progress + JOIN_STREAM_RESUME_TICKS < tick_number) {
+			this->join_last_progress = tick_number;
+			this->sendJoinResume();
+		}
+		
 		auto now = razor::nanoNow();
 		
 		/* TODO: connection event
@@ -545,10 +2037,124 @@ namespace razor {
 			//this->server->console(std::string("scenario setplayerteam ").append(local_player_name).append(" ").append(TEAM_1_NAME));
 			this->set_team = false;
 		}*/
-		if(this->next_ping_time <= now) {
-			//std::cout << "here " << now << " " << this->next_ping_time << std::endl;
-			this->next_ping_time = now + PING_DELAY;
+		// pings then repeat from their timer
+		if(this->slaved && !this->timers.pending(this->ping_timer)) {
 			this->sendPing(this->daemon_host_and_port);
+			this->armTimer(&this->ping_timer, DAEMON_PEER_ID, TIMER_PING, now + PING_DELAY);
+		}
+	}
+	
+	// Registers a daemon's slave on its first message and restarts its timeout
+	Razor::PeerState& Razor::touchPeer(const std::string &host_and_port, nanotime now) {
+		auto &peer = this->peers[host_and_port];
+		if(peer.id == 0) {
+			peer.id = this->next_peer_id++;
+			this->peer_hosts[peer.id] = host_and_port;
+		}
+		this->armTimer(&peer.timeout_timer, peer.id, TIMER_TIMEOUT, now + this->timeout);
+		if(!this->timers.pending(peer.keepalive_timer))
+			this->armTimer(&peer.keepalive_timer, peer.id, TIMER_KEEPALIVE, now + this->keepalive);
+		return peer;
+	}
+	
+	// Moves a pending timer, or schedules it again once it has fired
+	void Razor::armTimer(timerhandle* timer, unsigned int peer_id, unsigned char type, nanotime when) {
+		if(!this->timers.reschedule(*timer, when))
+			*timer = this->timers.schedule(when, ((unsigned long long)peer_id << 8) | type);
+	}
+	
+	// Fires the timers due since the last tick. Peers are only disconnected after the wheel has
+	// advanced, so none of their timers are touched while it moves.
+	void Razor::runTimers() {
+		auto now = razor::nanoNow();
+		if(!this->timers.pending(this->reassembly_timer))
+			this->armTimer(&this->reassembly_timer, DAEMON_PEER_ID, TIMER_REASSEMBLY, now + REASSEMBLY_TIMEOUT);
+		
+		this->expired_timers.clear();
+		this->timers.advance(now, &this->expired_timers);
+		for(auto data : this->expired_timers) {
+			unsigned int peer_id = data >> 8;
+			unsigned char type = data & 0xFF;
+			
+			if(type == TIMER_REASSEMBLY) {
+				this->connection.expireMultiparts(now - REASSEMBLY_TIMEOUT);
+				this->armTimer(&this->reassembly_timer, DAEMON_PEER_ID, TIMER_REASSEMBLY, now + REASSEMBLY_TIMEOUT);
+			} else if(!this->daemon) {
+				if(type == TIMER_PING) {
+					this->sendPing(this->daemon_host_and_port);
+					this->armTimer(&this->ping_timer, DAEMON_PEER_ID, TIMER_PING, now + PING_DELAY);
+				} else if(type == TIMER_TIMEOUT) {
+					std::cout << "< Daemon timed out" << std::endl;
+					this->disconnectFromDaemon();
+				}
+			} else {
+				auto it = this->peer_hosts.find(peer_id);
+				if(it == this->peer_hosts.end())
+					continue;
+				std::string host_and_port = it->second;
+				if(type == TIMER_KEEPALIVE) {
+					// the ack is queued, and re-arms the keepalive when it is transmitted
+					this->sendAck(host_and_port);
+				} else if(type == TIMER_TIMEOUT) {
+					std::cout << "< Slave " << host_and_port << " timed out" << std::endl;
+					this->disconnectPeer(host_and_port, false);
+				}
+			}
+		}
+	}
+	
+	void Razor::disconnectPeer(const std::string &host_and_port, bool notify) {
+		if(notify)
+			this->sendDisconnect(host_and_port);
+		
+		// messages still queued for the slave would bind its channel again
+		for(auto &queue : this->send_queues) {
+			std::erase_if(queue, [&host_and_port](const NetworkMessage &nm) {
+				return nm.dest_host_and_port == host_and_port;
+			});
+		}
+		
+		auto it = this->peers.find(host_and_port);
+		if(it != this->peers.end()) {
+			this->timers.cancel(it->second.keepalive_timer);
+			this->timers.cancel(it->second.timeout_timer);
+			this->peer_hosts.erase(it->second.id);
+			this->peers.erase(it);
+		}
+		this->connection.unbind(host_and_port);
+		std::cout << "< Disconnected " << host_and_port << std::endl;
+		
+		if(this->peer_disconnected_func != nullptr)
+			(*this->peer_disconnected_func)(host_and_port);
+	}
+	
+	// Slaves stop talking to a daemon that timed out or disconnected them. Unless the daemon
+	// address is cleared, they request a full sync again on their next tick.
+	void Razor::disconnectFromDaemon() {
+		this->slaved = false;
+		this->awaiting_pong = false;
+		this->join_receiving = false;
+		this->batch_receive_tick = 0;
+		this->entity_tick = 0;
+		this->timers.cancel(this->ping_timer);
+		this->timers.cancel(this->daemon_timeout_timer);
+		this->clearSendQueue();
+		
+		if(this->peer_disconnected_func != nullptr)
+			(*this->peer_disconnected_func)(this->daemon_host_and_port);
+	}
+	
+	void Razor::disconnect() {
+		if(this->daemon) {
+			std::vector<std::string> hosts;
+			for(auto &c : this->connection.channels)
+				hosts.push_back(c.first);
+			for(auto &host_and_port : hosts)
+				this->disconnectPeer(host_and_port);
+		} else if(this->slaved) {
+			this->sendDisconnect(this->daemon_host_and_port);
+			this->disconnectFromDaemon();
+			this->daemon_host_and_port = "";
 		}
 	}
 	
@@ -557,6 +2163,7 @@ namespace razor {
 		this->local_zero_time = zero_time;
 		
 		this->receiveMessages();
+		this->runTimers();
 		
 		if(this->daemon) {
 			this->daemonTick();
@@ -567,6 +2174,10 @@ namespace razor {
 		this->sendMessages(tick_number);
 	}
 	
+	void Razor::pollNetwork() {
+		this->connection.poll();
+	}
+	
 	void Razor::setPort(int port) {
 		std::string remote;
 		if(this->daemon) {
@@ -584,6 +2195,7 @@ namespace razor {
 	void Razor::setDaemon(bool is_daemon) {
 		this->daemon = is_daemon;
 		if(is_daemon) {
+			this->connection.remote_host_and_port = ANY_ADDRESS; // daemons accept any slave
 			std::cout << "< Activating daemon mode" << std::endl;
 		} else {
 			std::cout << "< Activating slave mode" << std::endl;
@@ -592,12 +2204,93 @@ namespace razor {
 	
 	void Razor::setDaemonAddress(const std::string &daemon_host_and_port) {
 		this->daemon_host_and_port = daemon_host_and_port;
+		if(!this->daemon)
+			this->connection.remote_host_and_port = daemon_host_and_port;
 	}
 	
 	void Razor::setLogNetworking() {
 		this->connection.enableLogging();
 	}
 	
+	void Razor::setCommandBudget(int bytes) {
+		this->command_budget = bytes;
+	}
+	
+	void Razor::setLockstep(bool is_lockstep, ticktype command_delay) {
+		this->lockstep = is_lockstep;
+		this->lockstep_command_delay = command_delay;
+		if(is_lockstep) {
+			std::cout << "< Activating lockstep mode" << std::endl;
+		}
+	}
+	
+	void Razor::setMerkleSync(bool is_merkle_sync) {
+		this->merkle_sync = is_merkle_sync;
+	}
+	
+	void Razor::setInterestManagement(bool is_interest_management, float cell_size) {
+		this->interest_management = is_interest_management;
+		this->interest.cell_size = cell_size;
+		this->interest.clear();
+	}
+	
+	void Razor::setSyncBudget(unsigned int bytes_per_tick) {
+		this->sync_budget = bytes_per_tick;
+	}
+	
+	void Razor::setJoinStream(bool is_join_stream, unsigned int bytes_per_tick) {
+		this->join_stream = is_join_stream;
+		this->join_stream_budget = bytes_per_tick;
+	}
+	
+	void Razor::setEntitySync(bool is_entity_sync) {
+		this->entity_sync = is_entity_sync;
+	}
+	
+	void Razor::setDeltaSync(bool is_delta_sync) {
+		this->delta_sync = is_delta_sync;
+	}
+	
+	void Razor::setCompression(bool is_compression, const std::string &dictionary) {
+		this->compression = is_compression;
+		this->compression_dictionary = dictionary;
+		this->compression_dictionary_hash = hashData(dictionary.data(), dictionary.size());
+	}
+	
+	void Razor::setPacing(bool is_pacing, unsigned int peer_rate_limit, unsigned int global_rate_limit) {
+		this->connection.setPacing(is_pacing, peer_rate_limit, global_rate_limit);
+	}
+	
+	// Running timeouts restart with the new duration
+	void Razor::setTimeouts(nanotime keepalive, nanotime timeout) {
+		this->keepalive = keepalive;
+		this->timeout = timeout;
+		auto now = razor::nanoNow();
+		for(auto &p : this->peers) {
+			this->timers.reschedule(p.second.timeout_timer, now + timeout);
+		}
+		this->timers.reschedule(this->daemon_timeout_timer, now + timeout);
+	}
+	
+	bool Razor::setAreaOfInterest(const std::string &slave_host_and_port, float x, float y, float z, float radius) {
+		auto it = this->peers.find(slave_host_and_port);
+		if(it == this->peers.end())
+			return false;
+		auto &peer = it->second;
+		peer.has_interest = true;
+		peer.interest_x = x;
+		peer.interest_y = y;
+		peer.interest_z = z;
+		peer.interest_radius = radius;
+		return true;
+	}
+	
+	bool Razor::isTickReady(ticktype tick_number) {
+		if(this->daemon || !this->lockstep)
+			return true;
+		return this->command_buffer.isFinalized(tick_number);
+	}
+	
 	void Razor::command(const std::string &command_data) {
 		this->sendCommand(command_data);
 	}
@@ -606,8 +2299,116 @@ namespace razor {
         this->get_state_data_func = get_state_data_func;
     }
 	
-    void testGetStateData(std::string*) {
+    void Razor::registerCallbackSetStateData(
+			void (*set_state_data_func)(std::string*, ticktype, nanotimediff)) {
+        this->set_state_data_func = set_state_data_func;
+    }
+	
+    void Razor::registerCallbackGetObjectState(void (*get_object_state_func)(unsigned int, std::string*)) {
+        this->get_object_state_func = get_object_state_func;
+    }
+	
+    void Razor::registerCallbackSetObjectState(
+			void (*set_object_state_func)(unsigned int, std::string*, ticktype)) {
+        this->set_object_state_func = set_object_state_func;
+    }
+	
+    void Razor::registerCallbackObjectLeftInterest(void (*object_left_interest_func)(unsigned int)) {
+        this->object_left_interest_func = object_left_interest_func;
+    }
+	
+    void Razor::registerCallbackObjectRelevance(
+			bool (*object_relevance_func)(const std::string&, unsigned int)) {
+        this->object_relevance_func = object_relevance_func;
+    }
+	
+    void Razor::registerCallbackObjectPriority(
+			float (*object_priority_func)(const std::string&, unsigned int)) {
+        this->object_priority_func = object_priority_func;
     }
+	
+    void Razor::registerCallbackGetStateDataAtTick(
+			void (*get_state_data_at_tick_func)(std::string*, ticktype)) {
+        this->get_state_data_at_tick_func = get_state_data_at_tick_func;
+    }
+	
+    void Razor::registerCallbackGetStateHash(unsigned long long (*get_state_hash_func)()) {
+        this->get_state_hash_func = get_state_hash_func;
+    }
+	
+    void Razor::registerCallbackTickCommands(
+			void (*tick_commands_func)(ticktype, std::span<const TickCommand>)) {
+        this->tick_commands_func = tick_commands_func;
+    }
+	
+    void Razor::registerCallbackPeerDisconnected(void (*peer_disconnected_func)(const std::string&)) {
+        this->peer_disconnected_func = peer_disconnected_func;
+    }
+	
+	std::string test_daemon_state;
+	
+    void testGetStateData(std::string* state) {
+		*state = test_daemon_state;
+    }
+	
+	std::vector<std::string> test_daemon_commands, test_slave_commands;
+	
+	struct TestSpawnCommand {
+		unsigned int unit;
+		Vector3 position;
+		static constexpr auto syncable_fields = std::make_tuple(&TestSpawnCommand::unit, &TestSpawnCommand::position);
+	};
+	
+	void testDaemonTickCommands(ticktype, std::span<const TickCommand> commands) {
+		for(auto &c : commands)
+			test_daemon_commands.push_back(c.command);
+	}
+	
+	void testSlaveTickCommands(ticktype, std::span<const TickCommand> commands) {
+		for(auto &c : commands)
+			test_slave_commands.push_back(c.command);
+	}
+	
+	std::string test_slave_state;
+	int test_slave_syncs = 0;
+	
+	void testGetSlaveStateData(std::string* state) {
+		*state = test_slave_state;
+	}
+	
+	void testSetSlaveStateData(std::string* state, ticktype, nanotimediff) {
+		test_slave_state = *state;
+		test_slave_syncs++;
+	}
+	
+	std::vector<std::string> test_disconnected;
+	
+	void testPeerDisconnected(const std::string &host_and_port) {
+		test_disconnected.push_back(host_and_port);
+	}
+	
+	std::set<unsigned int> test_slave_objects;
+	
+	void testGetObjectState(unsigned int id, std::string* state) {
+		*state = std::string(100, (char)id);
+	}
+	
+	void testSetObjectState(unsigned int id, std::string* state, ticktype) {
+		if(*state == std::string(100, (char)id))
+			test_slave_objects.insert(id);
+	}
+	
+	void testObjectLeftInterest(unsigned int id) {
+		test_slave_objects.erase(id);
+	}
+	
+	bool testObjectRelevance(const std::string &, unsigned int id) {
+		return id != 13;
+	}
+	
+	float testObjectPriority(const std::string &, unsigned int id) {
+		return id == 100 ? 10.0f : 1.0f;
+	}
     
 	int razorUnitTest() {
 		std::cout << "Creating server..." << std::endl;
@@ -657,6 +2458,459 @@ namespace razor {
 		// Check C's state versus S's
 		// Check C's future time
 		
+		// Daemon drops repeated commands and acks the highest contiguous sequence
+		std::string peer = "127.0.0.1:1";
+		if(!s->acceptCommand(peer, 1, 1)) return 1;
+		if(s->acceptCommand(peer, 1, 1)) return 2;
+		if(!s->acceptCommand(peer, 1, 3)) return 3;
+		if(s->peers[peer].command_ack != 1) return 4;
+		if(!s->acceptCommand(peer, 2, 2)) return 5;
+		if(s->peers[peer].command_ack != 3) return 6;
+		// the slave abandoned 4 and 5
+		if(!s->acceptCommand(peer, 6, 6)) return 7;
+		if(s->peers[peer].command_ack != 6) return 8;
+		
+		// Slave repeats unacknowledged commands until acked, within its budget
+		c->clearSendQueue();
+		c->sendCommand("command 1");
+		c->sendCommand("command 2");
+		c->sendCommand("command 3");
+		c->queueRedundantCommands();
+		if(c->unacked_commands.size() != 3) return 9;
+		auto &command_queue = c->send_queues[SEND_LANE_COMMANDS];
+		if(command_queue.size() != 1) return 10;
+		unsigned short commands_number = 0;
+		copyOut(&commands_number, (void*)command_queue.back().message.c_str(), 0);
+		if(commands_number != 3) return 11;
+		
+		Razor::NetworkMessage ack_message;
+		ack_message.ack = 2;
+		c->receiveAck(&ack_message);
+		if(c->unacked_commands.size() != 1 || c->unacked_commands.front().seq != 3) return 12;
+		
+		c->setCommandBudget(20);
+		c->sendCommand("command 4");
+		c->queueRedundantCommands();
+		copyOut(&commands_number, (void*)command_queue.back().message.c_str(), 0);
+		if(commands_number != 1) return 13;
+		c->clearSendQueue();
+		c->unacked_commands.clear();
+		c->setCommandBudget(COMMAND_REDUNDANCY_BUDGET);
+		
+		// Commands are executed on the daemon at their tick and replayed on the slave as a batch
+		s->registerCallbackTickCommands(&testDaemonTickCommands);
+		c->registerCallbackTickCommands(&testSlaveTickCommands);
+		s->command("daemon command");
+		for(frame = 4; frame < 30; frame++) {
+			s->tick(sbt+frame, nanoNow());
+			// the slave plays a few ticks ahead of the daemon
+			c->tick(sbt+frame+20, nanoNow()+error);
+			if(frame == 4)
+				c->command("slave command");
+			sleep(5);
+		}
+		if(test_daemon_commands.size() != 2) return 14;
+		if(test_daemon_commands[0] != "daemon command" || test_daemon_commands[1] != "slave command") return 15;
+		if(test_slave_commands != test_daemon_commands) return 16;
+		if(c->unacked_commands.size() != 0) return 17;
+		
+		// Lockstep: only a slave whose state hash diverges is sent a full sync
+		s->setLockstep();
+		c->setLockstep();
+		c->registerCallbackGetStateData(&testGetSlaveStateData);
+		c->registerCallbackSetStateData(&testSetSlaveStateData);
+		test_slave_state = "diverged";
+		test_slave_syncs = 0;
+		for(; frame < 50; frame++) {
+			s->tick(sbt+frame, nanoNow());
+			// lockstep slaves trail the daemon
+			c->tick(sbt+frame-2, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_syncs == 0) return 18;
+		if(test_slave_state != "") return 19;
+		if(!c->isTickReady(sbt+frame-3) || c->isTickReady(sbt+frame+1)) return 20;
+		int converged_syncs = test_slave_syncs;
+		for(; frame < 70; frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame-2, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_syncs != converged_syncs) return 21;
+		
+		// a slave that loses every repeat of a batch asks the daemon for it again
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			sleep(5);
+		}
+		std::string lost_host, lost_message;
+		while(c->connection.receive(&lost_host, &lost_message)) {}
+		ticktype lost_tick = sbt+frame-5;
+		if(c->isTickReady(lost_tick)) return 22;
+		for(int i=0; i<BATCH_REQUEST_DELAY + 10; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame-2, nanoNow()+error);
+			sleep(5);
+		}
+		if(!c->isTickReady(lost_tick) || !c->isTickReady(lost_tick+4)) return 23;
+		
+		// Merkle syncs repair only the chunks that differ
+		s->setLockstep(false);
+		c->setLockstep(false);
+		for(int i=0; i<3000; i++)
+			test_daemon_state.push_back((char)(i * 13));
+		test_slave_state = test_daemon_state;
+		test_slave_state[100] ^= 1;
+		test_slave_state[2500] ^= 1;
+		test_slave_syncs = 0;
+		s->sendSyncRoot(BROADCAST);
+		for(int i=0; i<10; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_syncs != 1) return 24;
+		if(test_slave_state != test_daemon_state) return 25;
+		
+		// converged slaves aren't sent anything but the root
+		s->sendSyncRoot(BROADCAST);
+		for(int i=0; i<10; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_syncs != 1) return 26;
+		
+		// Delta syncs send only the bytes changed since the slave's last sync
+		std::string slave_address = "127.0.0.1:12321";
+		s->setDeltaSync();
+		c->setDeltaSync();
+		s->peers[slave_address].next_sync_tick = sbt + frame + 1000;
+		s->sendSync(slave_address);
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_state != test_daemon_state || !c->has_sync_baseline) return 27;
+		test_daemon_state[1500] ^= 1;
+		s->sendSync(slave_address);
+		auto &delta_message = s->send_queues[SEND_LANE_BULK].back();
+		if(delta_message.type != MESSAGE_SYNC_DELTA || delta_message.message.size() > 40) return 28;
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_state != test_daemon_state) return 29;
+		
+		// a slave without the delta's baseline asks for a full sync
+		c->sync_baseline_tick--;
+		test_daemon_state[10] ^= 1;
+		s->sendSync(slave_address);
+		for(int i=0; i<10; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_state != test_daemon_state || c->sync_baseline != test_daemon_state) return 30;
+		// broadcasts go in full, without creating a peer for BROADCAST
+		s->sendSync(BROADCAST);
+		if(s->peers.count(BROADCAST) != 0 || s->send_queues[SEND_LANE_BULK].back().type != MESSAGE_SYNC) return 31;
+		s->setDeltaSync(false);
+		c->setDeltaSync(false);
+		
+		// Interest management sends each slave only the objects near it
+		s->setInterestManagement(true, 10.0f);
+		s->registerCallbackGetObjectState(&testGetObjectState);
+		s->registerCallbackObjectRelevance(&testObjectRelevance);
+		c->registerCallbackSetObjectState(&testSetObjectState);
+		c->registerCallbackObjectLeftInterest(&testObjectLeftInterest);
+		for(unsigned int id=1; id<=200; id++)
+			s->interest.add(id, id * 5.0f, 0, 0);
+		s->interest.addGlobal(1000);
+		if(!s->setAreaOfInterest(slave_address, 50, 0, 0, 12)) return 32;
+		// unknown slaves aren't given peers that would never time out
+		if(s->setAreaOfInterest("10.0.0.9:1000", 0, 0, 0, 1) || s->peers.count("10.0.0.9:1000") != 0) return 33;
+		s->sendObjectSync(slave_address);
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		// objects 8 through 12 (13 is filtered out) and the global object
+		if(test_slave_objects != std::set<unsigned int>({8, 9, 10, 11, 12, 1000})) return 34;
+		
+		s->setAreaOfInterest(slave_address, 500, 0, 0, 6);
+		s->sendObjectSync(slave_address);
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_objects != std::set<unsigned int>({99, 100, 101, 1000})) return 35;
+		
+		// A budget of two objects per tick sends the highest accumulated priorities first
+		s->registerCallbackObjectPriority(&testObjectPriority);
+		s->sendObjectSync(slave_address, 250);
+		auto &priorities = s->peers[slave_address].object_priorities;
+		if(priorities[100] != 0 || priorities[1000] != 0) return 36;
+		if(priorities[99] != 1 || priorities[101] != 1) return 37;
+		s->sendObjectSync(slave_address, 250);
+		if(priorities[100] != 0 || priorities[1000] != 1) return 38;
+		if(priorities[99] + priorities[101] != 2) return 39;
+		
+		test_slave_objects.clear();
+		s->setSyncBudget(250);
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_objects != std::set<unsigned int>({99, 100, 101, 1000})) return 40;
+		
+		// Sync phases are spread over SYNC_DELAY and delays grow with ping and loss
+		Razor phases;
+		std::set<ticktype> phase_set;
+		for(int i=0; i<8; i++) {
+			auto phase = phases.nextSyncPhase();
+			if(phase < 1 || phase > SYNC_DELAY) return 41;
+			phase_set.insert(phase);
+		}
+		if(phase_set.size() != 8) return 42;
+		Razor::PeerState paced_peer{};
+		if(s->syncDelay(paced_peer) != SYNC_DELAY) return 43;
+		paced_peer.ping = 2 * SYNC_REFERENCE_PING;
+		if(s->syncDelay(paced_peer) != 2 * SYNC_DELAY) return 44;
+		paced_peer.loss = 1.0f;
+		if(s->syncDelay(paced_peer) != SYNC_MAX_DELAY) return 45;
+		
+		// Join streams send a large state over several ticks and resume lost chunks
+		s->setInterestManagement(false);
+		s->setSyncBudget(0);
+		s->setJoinStream(true, 4096);
+		for(int i=0; i<20000; i++)
+			test_daemon_state.push_back((char)(i * 7));
+		test_slave_syncs = 0;
+		c->sendRequestFullSync();
+		for(int i=0; i<3; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		auto &joining_peer = s->peers[slave_address];
+		if(!joining_peer.joining || !c->join_receiving) return 46;
+		if(test_slave_syncs != 0) return 47;
+		// lose two queued chunks
+		joining_peer.join_queue.erase(joining_peer.join_queue.begin(), joining_peer.join_queue.begin() + 2);
+		for(int i=0; i<JOIN_STREAM_RESUME_TICKS + 20; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_syncs != 1) return 48;
+		if(test_slave_state != test_daemon_state) return 49;
+		if(joining_peer.joining || c->join_receiving) return 50;
+		
+		// a chunk announcing a state over JOIN_STREAM_MAX_STATE is dropped before allocating it
+		Razor::NetworkMessage forged_chunk;
+		BufferWriter<> forged(&forged_chunk.message);
+		forged.write((ticktype)(c->join_receive_tick + 1));
+		forged.write(0xFFFFFFFFU);
+		forged.write((unsigned short)0);
+		forged.finish();
+		c->receiveJoinStream(&forged_chunk);
+		if(c->join_receiving || c->join_buffer.size() != 0) return 51;
+		// and a daemon refuses to stream one rather than sending something slaves can't take
+		auto streamed_state = test_daemon_state;
+		test_daemon_state.assign(JOIN_STREAM_MAX_STATE + 1, 'x');
+		auto queued_bulk = s->send_queues[SEND_LANE_BULK].size();
+		s->startJoinStream(slave_address);
+		if(joining_peer.joining || s->send_queues[SEND_LANE_BULK].size() != queued_bulk) return 52;
+		test_daemon_state = streamed_state;
+		
+		// truncated messages throw for receiveMessages to drop rather than reading past the end
+		Razor::NetworkMessage truncated;
+		BufferWriter<> truncated_out(&truncated.message);
+		truncated_out.write((ticktype)s->merkle_tick);
+		truncated_out.finish();
+		bool dropped = false;
+		try {
+			s->receiveMerkleRequest(&truncated);
+		} catch(std::range_error &e) {
+			dropped = true;
+		}
+		if(!dropped) return 53;
+		
+		// With interest management, joining slaves are sent their nearest objects first
+		s->setInterestManagement(true, 10.0f);
+		for(unsigned int id=1; id<=200; id++)
+			s->interest.add(id, id * 5.0f, 0, 0);
+		s->interest.addGlobal(1000);
+		s->startJoinStream(slave_address);
+		if(!joining_peer.joining) return 54;
+		s->sendObjectSync(slave_address, 250);
+		if(joining_peer.join_unsent != std::unordered_set<unsigned int>({99, 101})) return 55;
+		s->sendObjectSync(slave_address, 250);
+		if(joining_peer.joining) return 56;
+		
+		// The daemon reports how early each command arrived, which steers the slave's lead
+		c->lead_controller.clear();
+		for(int i=0; i<LEAD_MIN_SAMPLES + COMMAND_DELAY * 2; i++, frame++) {
+			c->sendCommand("timed command");
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(s->tick_period == 0) return 57;
+		if(!c->lead_controller.ready()) return 58;
+		// commands were sent 20 ticks ahead, so the target lead is under the time of 20 ticks
+		if(c->lead_controller.target >= 20 * (nanotimediff)s->tick_period) return 59;
+		// margins are measured from the tick's scheduled start, finer than whole ticks
+		c->sendCommand("timed command");
+		c->next_command_time = 0;
+		c->tick(sbt+frame+20, nanoNow()+error);
+		sleep(5);
+		s->receiveMessages();
+		auto &timed_margins = s->peers[slave_address].command_margins;
+		if(timed_margins.empty() || std::all_of(timed_margins.begin(), timed_margins.end(),
+				[&](auto &margin) { return margin.second % (nanotimediff)s->tick_period == 0; })) return 60;
+		
+		// Entity sync sends each tick only what changed in the daemon's store
+		s->setInterestManagement(false);
+		s->setEntitySync();
+		c->setEntitySync();
+		for(auto r : {s, c}) {
+			r->entities.addField<Vector3>();
+			r->entities.addField<int>();
+		}
+		std::vector<entityhandle> entities;
+		for(int i=0; i<100; i++) {
+			entities.push_back(s->entities.create());
+			s->entities.set(entities.back(), 0, Vector3{(float)i, 0, 0});
+		}
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(c->entities.size() != 100 || c->entities.get<Vector3>(entities[42], 0).x != 42) return 61;
+		s->entities.set(entities[7], 1, 3);
+		s->entities.destroy(entities[8]);
+		c->entities.clearDirty();
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(c->entities.get<int>(entities[7], 1) != 3 || c->entities.alive(entities[8])) return 62;
+		if(c->entities.dirtyCount(0) != 0 || c->entities.dirtyCount(1) != 1 || s->entities.changed()) return 63;
+		
+		// changes arriving after newer ones have been applied are dropped
+		Razor::NetworkMessage late_changes;
+		BufferWriter<> late_out(&late_changes.message);
+		late_out.write((ticktype)(c->entity_tick - 1));
+		s->entities.set(entities[7], 1, 4);
+		s->entities.writeChanges(late_out);
+		s->entities.clearDirty();
+		late_out.finish();
+		s->entities.set(entities[7], 1, 3);
+		s->entities.clearDirty();
+		c->receiveEntityChanges(&late_changes);
+		if(c->entities.get<int>(entities[7], 1) != 3) return 64;
+		s->setEntitySync(false);
+		c->setEntitySync(false);
+		
+		// Compression is agreed in REQUEST_FULL, then large messages go compressed
+		std::string typical_state;
+		for(int i=0; i<20000; i++)
+			typical_state.push_back(i % 16 < 12 ? 0 : (char)(i / 64));
+		s->setCompression(true, typical_state.substr(0, 4096));
+		c->setCompression(true, typical_state.substr(0, 4096));
+		c->sendRequestFullSync();
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		auto &compressing_peer = s->peers[slave_address];
+		if(!compressing_peer.compression || !compressing_peer.compression_dictionary) return 65;
+		test_daemon_state = typical_state;
+		s->sendSync(slave_address);
+		auto compressed_sync = s->send_queues[SEND_LANE_BULK].back();
+		s->compressed_ready[0] = s->compressed_ready[1] = false;
+		if(!s->compressMessage(compressing_peer, &compressed_sync) ||
+				compressed_sync.message.size() * 4 > typical_state.size()) return 66;
+		for(int i=0; i<5; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		if(test_slave_state != test_daemon_state) return 67;
+		s->setCompression(false);
+		c->setCompression(false);
+		
+		// Registered commands go as an opcode and fields, and the daemon drops malformed ones
+		s->command_registry.add<TestSpawnCommand>("spawn");
+		c->command_registry.add<TestSpawnCommand>("spawn");
+		test_daemon_commands.clear();
+		c->command(TestSpawnCommand{7, {1, 2, 3}});
+		c->command(std::string("\0\x09", 2));
+		for(int i=0; i<30; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			c->tick(sbt+frame+20, nanoNow()+error);
+			sleep(5);
+		}
+		TestSpawnCommand spawn;
+		if(test_daemon_commands.size() != 1 || !s->command_registry.decode(test_daemon_commands[0], &spawn) ||
+				spawn.unit != 7 || spawn.position.z != 3) return 68;
+		
+		// Slaves that go quiet time out, and are forgotten by the daemon
+		s->registerCallbackPeerDisconnected(&testPeerDisconnected);
+		c->registerCallbackPeerDisconnected(&testPeerDisconnected);
+		auto &timed_peer = s->peers[slave_address];
+		if(timed_peer.id == 0 || !s->timers.pending(timed_peer.timeout_timer)) return 69;
+		if(!s->timers.pending(timed_peer.keepalive_timer)) return 70;
+		unsigned int timed_id = timed_peer.id;
+		s->setTimeouts(20 * NANOS_PER_MILLI, 100 * NANOS_PER_MILLI);
+		s->tick(sbt+frame, nanoNow());
+		for(int i=0; i<30; i++, frame++) {
+			s->tick(sbt+frame, nanoNow());
+			sleep(5);
+		}
+		if(s->peers.count(slave_address) != 0 || s->connection.channels.count(slave_address) != 0) return 71;
+		if(test_disconnected != std::vector<std::string>({slave_address})) return 72;
+		
+		// It rejoins when it speaks again, and a DISCONNECT ends its session on both sides
+		s->setTimeouts();
+		c->sendPing(c->daemon_host_and_port);
+		c->tick(sbt+frame+20, nanoNow()+error);
+		sleep(5);
+		s->tick(sbt+frame, nanoNow());
+		if(s->peers.count(slave_address) == 0 || s->peers[slave_address].id == timed_id) return 73;
+		c->disconnect();
+		if(c->slaved || c->daemon_host_and_port != "") return 74;
+		sleep(5);
+		s->tick(sbt+frame, nanoNow());
+		if(s->peers.count(slave_address) != 0 || test_disconnected.size() != 3) return 75;
+		
+		// A slave whose daemon stops answering reconnects
+		c->setDaemonAddress("127.0.0.1:12320");
+		c->setTimeouts(KEEPALIVE, 30 * NANOS_PER_MILLI);
+		c->tick(sbt+frame+22, nanoNow()+error);
+		sleep(50);
+		c->tick(sbt+frame+23, nanoNow()+error);
+		if(test_disconnected.size() != 4 || !c->slaved) return 76;
+		
+		// Slaves whose command types differ from the daemon's are refused
+		c->command_registry.clear();
+		c->sendRequestFullSync();
+		c->tick(sbt+frame+24, nanoNow()+error);
+		sleep(5);
+		s->tick(sbt+frame, nanoNow());
+		sleep(5);
+		c->tick(sbt+frame+25, nanoNow()+error);
+		if(s->peers.count(slave_address) != 0 || c->slaved) return 77;
 		
 		delete s;
 		delete c;
@@ -13,9 +13,15 @@ namespace razor {
 		return length;
 	}
 
-	unsigned int copyInString(void *data, unsigned int position, std::string* in) {
-		auto cstr = in->c_str();
-		return copyInCString(data, position, cstr);
+	// Copy in a string that may contain binary data (including nulls)
+	unsigned int copyInString(void *data, unsigned int position, const std::string* in) {
+		int length = 0;
+		int sl = in->size();
+		length += copyIn(data, position, sl);
+		if(sl!=0) {
+			length += copyInArray(data, position+length, in->c_str(), sl);
+		}
+		return length;
 	}
 
 	unsigned int copyInBV(void *data, unsigned int position, bool* in, unsigned char bool_num) {
@@ -32,7 +38,7 @@ namespace razor {
 		char packed_bools[8];
 		memset(packed_bools, 0, 8);
 		
-		int packed_bool_num = std::ceil(bool_num / 8.0f);
+		int packed_bool_num = (bool_num + 7) / 8;
 		int bool_i = 0;
 		for(int packed_i = 0; packed_i<packed_bool_num; packed_i++) {
 			for(int inner_i=0; inner_i<8 && bool_i<bool_num; inner_i++) {
@@ -87,7 +93,7 @@ namespace razor {
 		
 		char packed_bools[8];
 		memset(packed_bools, 0, 8);
-		int packed_bool_num = std::ceil(*bool_num / 8.0f);
+		int packed_bool_num = (*bool_num + 7) / 8;
 		
 		length += copyOutArray(packed_bools, data, position+length, packed_bool_num);
 		
@@ -105,6 +111,81 @@ namespace razor {
 		return length;
 	}
 
+	static constexpr unsigned long long HASH_PRIME_1 = 11400714785074694791ULL;
+	static constexpr unsigned long long HASH_PRIME_2 = 14029467366897019727ULL;
+	static constexpr unsigned long long HASH_PRIME_3 = 1609587929392839161ULL;
+	static constexpr unsigned long long HASH_PRIME_4 = 9650029242287828579ULL;
+	static constexpr unsigned long long HASH_PRIME_5 = 2870177450012600261ULL;
+	
+	static inline unsigned long long hashRotate(unsigned long long value, int bits) {
+		return (value << bits) | (value >> (64 - bits));
+	}
+	
+	static inline unsigned long long hashRound(unsigned long long accumulator, unsigned long long input) {
+		accumulator += input * HASH_PRIME_2;
+		accumulator = hashRotate(accumulator, 31);
+		return accumulator * HASH_PRIME_1;
+	}
+	
+	static inline unsigned long long hashMerge(unsigned long long accumulator, unsigned long long value) {
+		accumulator ^= hashRound(0, value);
+		return accumulator * HASH_PRIME_1 + HASH_PRIME_4;
+	}
+	
+	unsigned long long hashData(const void* data, unsigned int length, unsigned long long seed) {
+		auto p = (const uint8_t*)data;
+		auto end = p + length;
+		unsigned long long h;
+		
+		if(length >= 32) {
+			unsigned long long v1 = seed + HASH_PRIME_1 + HASH_PRIME_2;
+			unsigned long long v2 = seed + HASH_PRIME_2;
+			unsigned long long v3 = seed;
+			unsigned long long v4 = seed - HASH_PRIME_1;
+			unsigned long long lane;
+			for(; p + 32 <= end; p += 32) {
+				copyOut(&lane, (void*)p, 0); v1 = hashRound(v1, lane);
+				copyOut(&lane, (void*)p, 8); v2 = hashRound(v2, lane);
+				copyOut(&lane, (void*)p, 16); v3 = hashRound(v3, lane);
+				copyOut(&lane, (void*)p, 24); v4 = hashRound(v4, lane);
+			}
+			h = hashRotate(v1, 1) + hashRotate(v2, 7) + hashRotate(v3, 12) + hashRotate(v4, 18);
+			h = hashMerge(h, v1);
+			h = hashMerge(h, v2);
+			h = hashMerge(h, v3);
+			h = hashMerge(h, v4);
+		} else {
+			h = seed + HASH_PRIME_5;
+		}
+		
+		h += length;
+		
+		for(; p + 8 <= end; p += 8) {
+			unsigned long long lane;
+			copyOut(&lane, (void*)p, 0);
+			h ^= hashRound(0, lane);
+			h = hashRotate(h, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+		}
+		if(p + 4 <= end) {
+			unsigned int lane;
+			copyOut(&lane, (void*)p, 0);
+			h ^= (unsigned long long)lane * HASH_PRIME_1;
+			h = hashRotate(h, 23) * HASH_PRIME_2 + HASH_PRIME_3;
+			p += 4;
+		}
+		for(; p < end; p++) {
+			h ^= (*p) * HASH_PRIME_5;
+			h = hashRotate(h, 11) * HASH_PRIME_1;
+		}
+		
+		h ^= h >> 33;
+		h *= HASH_PRIME_2;
+		h ^= h >> 29;
+		h *= HASH_PRIME_3;
+		h ^= h >> 32;
+		return h;
+	}
+	
 	int serializationUnitTest() {
 		// Test serialization
 		bool bin = true;
@@ -233,6 +314,228 @@ produces no resultant pleasure?
 		
 		if(in_len != p) return 200;
 		
+		// Test hashing
+		if(hashData(data, 0) != 0xEF46DB3751D8E999ULL) return 300;
+		if(hashData(strin.c_str(), strin.size()) != hashData(strin.c_str(), strin.size())) return 301;
+		auto hash_before = hashData(strin.c_str(), strin.size());
+		strin[strin.size()/2] ^= 1;
+		if(hashData(strin.c_str(), strin.size()) == hash_before) return 302;
+		if(hashData(strin.c_str(), strin.size(), 1) == hashData(strin.c_str(), strin.size())) return 303;
+		if(hashData("abc", 3) != 0x44BC2CF5AD770999ULL) return 304;
+		
+		// Test stream writers and readers
+		std::string stream;
+		BufferWriter<> writer(&stream);
+		writer.write(llin);
+		writer.writeString(strin);
+		writer.writeArray(bvin, 9);
+		writer.finish();
+		if(stream.size() != 8 + 4 + strin.size() + 9) return 400;
+		
+		// the same layout as copyIn
+		long long llstream = 0;
+		std::string strstream;
+		p = copyOut(&llstream, stream.data(), 0);
+		copyOutString(&strstream, stream.data(), p);
+		if(llstream != llin || strstream != strin) return 401;
+		
+		BufferReader<> reader(stream);
+		if(reader.read<long long>() != llin) return 402;
+		auto strview = reader.readString();
+		if(strview != strin || strview.data() != stream.data() + 12) return 403;
+		reader.readArray(bvout, 9);
+		if(!bvout[0] || bvout[3] || !bvout[8] || reader.remaining() != 0) return 404;
+		
+		// fixed buffers and short or corrupt input fail cleanly
+		char small[10];
+		BufferWriter<> small_writer(small);
+		small_writer.write(llin);
+		try {
+			small_writer.write(iin);
+			return 405;
+		} catch(std::range_error &e) {}
+		if(small_writer.position != 8) return 406;
+		
+		BufferReader<> short_reader(std::string_view(stream.data(), 20));
+		short_reader.read<long long>();
+		try {
+			short_reader.readString();
+			return 407;
+		} catch(std::range_error &e) {}
+		
+		std::string corrupt = stream;
+		copyIn(corrupt.data(), 8, -5);
+		BufferReader<> corrupt_reader(corrupt);
+		corrupt_reader.read<long long>();
+		try {
+			corrupt_reader.readString();
+			return 408;
+		} catch(std::range_error &e) {}
+		
+		// unchecked writers rely on a single reserve up front
+		std::string reserved;
+		BufferWriter<false> unchecked_writer(&reserved);
+		unchecked_writer.reserve(12);
+		unchecked_writer.write(llin);
+		unchecked_writer.write(iin);
+		unchecked_writer.finish();
+		BufferReader<false> unchecked_reader(reserved);
+		if(unchecked_reader.read<long long>() != llin || unchecked_reader.read<int>() != iin) return 409;
+		
+		// Test bit packing
+		std::string bits;
+		BitWriter bit_writer(&bits);
+		bit_writer.writeBits(5, 3);
+		bit_writer.writeBools(bvin, 9);
+		bit_writer.writeRanged(-3, -10, 10); // 5 bits
+		bit_writer.writeBits(0x0123456789ABCDEFULL, 64);
+		bit_writer.writeRanged(1000, 1000, 1000); // no bits
+		bool many_bools[150];
+		for(int i=0; i<150; i++)
+			many_bools[i] = (i * 7) % 3 == 0;
+		bit_writer.writeBools(many_bools, 150);
+		bit_writer.writeBits(0x7FFF, 15);
+		if(bit_writer.bitsWritten() != 3 + 9 + 5 + 64 + 150 + 15) return 500;
+		bit_writer.finish();
+		if(bits.size() != (246 + 7) / 8) return 501;
+		
+		BitReader bit_reader(bits);
+		if(bit_reader.readBits(3) != 5) return 502;
+		bit_reader.readBools(bvout, 9);
+		for(int i=0; i<9; i++) {
+			if(bvout[i] != bvin[i]) return 503;
+		}
+		if(bit_reader.readRanged(-10, 10) != -3) return 504;
+		if(bit_reader.readBits(64) != 0x0123456789ABCDEFULL) return 505;
+		if(bit_reader.readRanged(1000, 1000) != 1000) return 506;
+		bool many_out[150];
+		bit_reader.readBools(many_out, 150);
+		if(!std::equal(many_bools, many_bools + 150, many_out)) return 507;
+		if(bit_reader.readBits(15) != 0x7FFF) return 508;
+		try {
+			bit_reader.readBits(16);
+			return 509;
+		} catch(std::range_error &e) {}
+		
+		// bools are laid out as copyInBV packs them
+		std::string bv_bits;
+		BitWriter bv_writer(&bv_bits);
+		bv_writer.writeBits(9, 8);
+		bv_writer.writeBools(bvin, 9);
+		bv_writer.finish();
+		copyInBV(data, 0, bvin, 9);
+		if(bv_bits.size() != 3 || std::memcmp(bv_bits.data(), data, 3) != 0) return 510;
+		
+		// an entity record of six ints and five bools, 29 bytes byte-aligned, packs into 53 bits
+		std::string packed;
+		BitWriter entity_writer(&packed);
+		for(int i=0; i<100; i++) {
+			entity_writer.writeRanged(i, 0, 1023); // id
+			entity_writer.writeRanged(100 - i, 0, 100); // health
+			entity_writer.writeRanged(i % 4, 0, 3); // team
+			entity_writer.writeBools(many_bools + i, 5); // flags
+			entity_writer.writeRanged(i * 3, -512, 511); // x
+			entity_writer.writeRanged(-i, -512, 511); // y
+			entity_writer.writeRanged(i * 7 % 360, 0, 359); // heading
+		}
+		entity_writer.finish();
+		if(packed.size() != (100 * 53 + 7) / 8) return 511;
+		BitReader entity_reader(packed);
+		for(int i=0; i<100; i++) {
+			if(entity_reader.readRanged(0, 1023) != i || entity_reader.readRanged(0, 100) != 100 - i) return 512;
+			if(entity_reader.readRanged(0, 3) != i % 4) return 513;
+			entity_reader.readBools(many_out, 5);
+			if(!std::equal(many_bools + i, many_bools + i + 5, many_out)) return 514;
+			if(entity_reader.readRanged(-512, 511) != i * 3 || entity_reader.readRanged(-512, 511) != -i) return 515;
+			if(entity_reader.readRanged(0, 359) != i * 7 % 360) return 516;
+		}
+		
+		try {
+			bit_writer.writeRanged(11, -10, 10);
+			return 517;
+		} catch(std::range_error &e) {}
+		
+		// arrays pack the same bits as writing each value, after any offset
+		unsigned int array_values[300];
+		for(int i=0; i<300; i++)
+			array_values[i] = i * 2654435761U;
+		for(unsigned int width : {1U, 13U, 29U, 32U}) {
+			std::string one_at_a_time, as_array;
+			BitWriter single_writer(&one_at_a_time), array_writer(&as_array);
+			single_writer.writeBits(5, 3);
+			array_writer.writeBits(5, 3);
+			for(int i=0; i<300; i++)
+				single_writer.writeBits(array_values[i], width);
+			array_writer.writeBitsArray(array_values, 300, width);
+			single_writer.writeBits(1, 1);
+			array_writer.writeBits(1, 1);
+			single_writer.finish();
+			array_writer.finish();
+			if(one_at_a_time != as_array) return 518;
+			BitReader array_reader(as_array);
+			array_reader.readBits(3);
+			unsigned int array_out[300];
+			array_reader.readBitsArray(array_out, 300, width);
+			for(int i=0; i<300; i++) {
+				if(array_out[i] != (array_values[i] & bitMask(width))) return 519;
+			}
+		}
+		
+		// Test varints
+		if(zigzagEncode(0) != 0U || zigzagEncode(-1) != 1U || zigzagEncode(1) != 2U || zigzagEncode(-2) != 3U) return 600;
+		if(zigzagDecode(zigzagEncode(-2147483647 - 1)) != -2147483647 - 1) return 601;
+		unsigned long long varint_values[] = {0, 127, 128, 16383, 16384, 1ULL << 35, ~0ULL};
+		unsigned int varint_sizes[] = {1, 1, 2, 2, 3, 6, 10};
+		for(int i=0; i<7; i++) {
+			unsigned long long value_out;
+			if(copyInVarint(data, 0, varint_values[i]) != varint_sizes[i]) return 602;
+			if(varintSize(varint_values[i]) != varint_sizes[i]) return 603;
+			if(copyOutVarint(&value_out, data, 0) != varint_sizes[i] || value_out != varint_values[i]) return 604;
+		}
+		long long signed_out;
+		if(copyInVarint(data, 0, -64LL) != 1 || copyInVarint(data, 0, -65LL) != 2) return 605;
+		copyInVarint(data, 0, (long long)(-9223372036854775807LL - 1));
+		copyOutVarint(&signed_out, data, 0);
+		if(signed_out != -9223372036854775807LL - 1) return 606;
+		
+		// deltas from a nearby reference are short whichever way they go
+		unsigned long long tick_out;
+		if(copyInVarintDelta(data, 0, (unsigned long long)1000000, (unsigned long long)1000003) != 1) return 607;
+		copyOutVarintDelta(&tick_out, data, 0, (unsigned long long)1000003);
+		if(tick_out != 1000000) return 608;
+		if(copyInVarintDelta(data, 0, (unsigned long long)0, ~(unsigned long long)0) != 1) return 609; // wraps around
+		
+		std::string varints;
+		BufferWriter<> varint_writer(&varints);
+		varint_writer.writeVarint(300U);
+		varint_writer.writeVarint((short)-3);
+		varint_writer.writeVarintDelta((unsigned long long)5005, (unsigned long long)5000);
+		varint_writer.writeVarintString(strin);
+		varint_writer.finish();
+		if(varints.size() != 2 + 1 + 1 + varintSize(strin.size()) + strin.size()) return 610;
+		BufferReader<> varint_reader(varints);
+		if(varint_reader.readVarint<unsigned int>() != 300 || varint_reader.readVarint<short>() != -3) return 611;
+		if(varint_reader.readVarintDelta((unsigned long long)5000) != 5005) return 612;
+		if(varint_reader.readVarintString() != strin || varint_reader.remaining() != 0) return 613;
+		
+		// truncated, overlong and oversized varints throw
+		BufferReader<> truncated_reader(std::string_view(varints.data(), 1));
+		try {
+			truncated_reader.readVarint<unsigned int>();
+			return 614;
+		} catch(std::range_error &e) {}
+		std::string overlong(11, (char)0x80);
+		BufferReader<> overlong_reader(overlong);
+		try {
+			overlong_reader.readVarint<unsigned long long>();
+			return 615;
+		} catch(std::range_error &e) {}
+		BufferReader<> oversized_reader(varints);
+		try {
+			oversized_reader.readVarint<unsigned char>(); // 300
+			return 616;
+		} catch(std::range_error &e) {}
+		
 		return 0;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,487 @@
+#include "simd.h"
+
+#include <bit>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RAZOR_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace razor {
+	static SimdLevel simd_level = detectSimdLevel();
+	
+	SimdLevel detectSimdLevel() {
+#ifdef RAZOR_SIMD_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2"))
+			return SIMD_AVX2;
+		if(__builtin_cpu_supports("sse4.1"))
+			return SIMD_SSE4;
+#endif
+		return SIMD_SCALAR;
+	}
+	
+	SimdLevel simdLevel() {
+		return simd_level;
+	}
+	
+	SimdLevel setSimdLevel(SimdLevel level) {
+		simd_level = std::min(level, detectSimdLevel());
+		return simd_level;
+	}
+	
+	// Scalar kernels, which the wide ones fall back to for their tails. Each does the same float
+	// operations in the same order as the wide kernels so that every level gives the same bits.
+	
+	static inline unsigned int quantizeFloat(float value, float min, float max, float scale) {
+		value = value > min ? value : min; // NaN clamps to min, as maxps does
+		value = value < max ? value : max;
+		return (unsigned int)((value - min) * scale + 0.5f);
+	}
+	
+	// steps per unit, for quantizeFloat
+	static inline float quantizationScale(const Quantization &quantization) {
+		float range = quantization.max - quantization.min;
+		return range > 0 ? (float)bitMask(quantization.bits) / range : 0;
+	}
+	
+	static void quantizeFloatsScalar(const float* values, size_t count, float min, float max, float scale,
+			unsigned int* out) {
+		for(size_t i=0; i<count; i++)
+			out[i] = quantizeFloat(values[i], min, max, scale);
+	}
+	
+	static void quantizeQuaternionsScalar(const Quaternion* values, size_t count, unsigned int bits,
+			unsigned int* out) {
+		const float range = (float)M_SQRT1_2;
+		const float scale = (float)bitMask(bits) / (2 * range);
+		for(size_t i=0; i<count; i++) {
+			float x = values[i].x, y = values[i].y, z = values[i].z, w = values[i].w;
+			float length = std::sqrt(x*x + y*y + z*z + w*w);
+			if(!(length > 0)) { // not a rotation, send the identity
+				w = 1;
+				length = 1;
+			}
+			unsigned int index = 0;
+			float largest = std::abs(x), largest_value = x;
+			if(std::abs(y) > largest) {
+				index = 1;
+				largest = std::abs(y);
+				largest_value = y;
+			}
+			if(std::abs(z) > largest) {
+				index = 2;
+				largest = std::abs(z);
+				largest_value = z;
+			}
+			if(std::abs(w) > largest) {
+				index = 3;
+				largest_value = w;
+			}
+			float s = (largest_value < 0 ? -1.0f : 1.0f) / length;
+			float a = index == 0 ? y : x;
+			float b = index <= 1 ? z : y;
+			float c = index <= 2 ? w : z;
+			out[i] = index |
+				quantizeFloat(a * s, -range, range, scale) << 2 |
+				quantizeFloat(b * s, -range, range, scale) << (2 + bits) |
+				quantizeFloat(c * s, -range, range, scale) << (2 + 2 * bits);
+		}
+	}
+	
+	static void xorBuffersScalar(const char* a, const char* b, char* out, size_t length) {
+		size_t i = 0;
+		for(; i + 8 <= length; i += 8) {
+			unsigned long long wa, wb;
+			std::memcpy(&wa, a + i, 8);
+			std::memcpy(&wb, b + i, 8);
+			wa ^= wb;
+			std::memcpy(out + i, &wa, 8);
+		}
+		for(; i<length; i++)
+			out[i] = a[i] ^ b[i];
+	}
+	
+	static size_t firstDifferenceScalar(const char* a, const char* b, size_t length) {
+		size_t i = 0;
+		for(; i + 8 <= length; i += 8) {
+			unsigned long long wa, wb;
+			std::memcpy(&wa, a + i, 8);
+			std::memcpy(&wb, b + i, 8);
+			if(wa != wb)
+				break;
+		}
+		for(; i<length; i++) {
+			if(a[i] != b[i])
+				return i;
+		}
+		return length;
+	}
+	
+	static size_t firstNonZeroScalar(const unsigned long long* words, size_t count) {
+		size_t i = 0;
+		for(; i<count; i++) {
+			if(words[i])
+				break;
+		}
+		return i;
+	}
+
+#ifdef RAZOR_SIMD_X86
+	__attribute__((target("sse4.1")))
+	static void quantizeFloatsSse4(const float* values, size_t count, float min, float max, float scale,
+			unsigned int* out) {
+		auto vmin = _mm_set1_ps(min), vmax = _mm_set1_ps(max), vscale = _mm_set1_ps(scale), half = _mm_set1_ps(0.5f);
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4) {
+			auto v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i), vmin), vmax);
+			v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, vmin), vscale), half);
+			_mm_storeu_si128((__m128i*)(out + i), _mm_cvttps_epi32(v));
+		}
+		quantizeFloatsScalar(values + i, count - i, min, max, scale, out + i);
+	}
+	
+	__attribute__((target("avx2")))
+	static void quantizeFloatsAvx2(const float* values, size_t count, float min, float max, float scale,
+			unsigned int* out) {
+		auto vmin = _mm256_set1_ps(min), vmax = _mm256_set1_ps(max);
+		auto vscale = _mm256_set1_ps(scale), half = _mm256_set1_ps(0.5f);
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8) {
+			auto v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(values + i), vmin), vmax);
+			v = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(v, vmin), vscale), half);
+			_mm256_storeu_si256((__m256i*)(out + i), _mm256_cvttps_epi32(v));
+		}
+		quantizeFloatsScalar(values + i, count - i, min, max, scale, out + i);
+	}
+	
+	__attribute__((target("sse4.1")))
+	static inline __m128i quantizeComponentsSse4(__m128 v, __m128 min, __m128 max, __m128 scale, __m128 half) {
+		v = _mm_min_ps(_mm_max_ps(v, min), max);
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, min), scale), half));
+	}
+	
+	__attribute__((target("avx2")))
+	static inline __m256i quantizeComponentsAvx2(__m256 v, __m256 min, __m256 max, __m256 scale, __m256 half) {
+		v = _mm256_min_ps(_mm256_max_ps(v, min), max);
+		return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(v, min), scale), half));
+	}
+	
+	// Four quaternions a pass, transposed so each register holds one component of all four
+	__attribute__((target("sse4.1")))
+	static void quantizeQuaternionsSse4(const Quaternion* values, size_t count, unsigned int bits,
+			unsigned int* out) {
+		const float range = (float)M_SQRT1_2;
+		auto vrange = _mm_set1_ps(range), vnegative = _mm_set1_ps(-range);
+		auto vscale = _mm_set1_ps((float)bitMask(bits) / (2 * range)), half = _mm_set1_ps(0.5f);
+		auto one = _mm_set1_ps(1), minus_one = _mm_set1_ps(-1), zero = _mm_setzero_ps();
+		auto sign = _mm_set1_ps(-0.0f);
+		auto shift_a = _mm_cvtsi32_si128(2), shift_b = _mm_cvtsi32_si128(2 + bits);
+		auto shift_c = _mm_cvtsi32_si128(2 + 2 * bits);
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4) {
+			const float* p = &values[i].x;
+			auto x = _mm_loadu_ps(p), y = _mm_loadu_ps(p + 4), z = _mm_loadu_ps(p + 8), w = _mm_loadu_ps(p + 12);
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+			auto length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+				_mm_mul_ps(z, z)), _mm_mul_ps(w, w)));
+			auto empty = _mm_cmpngt_ps(length, zero);
+			w = _mm_blendv_ps(w, one, empty);
+			length = _mm_blendv_ps(length, one, empty);
+			
+			auto index = _mm_setzero_ps(); // integer lanes, kept as floats for blendv
+			auto largest = _mm_andnot_ps(sign, x), largest_value = x;
+			auto ay = _mm_andnot_ps(sign, y), az = _mm_andnot_ps(sign, z), aw = _mm_andnot_ps(sign, w);
+			auto greater = _mm_cmpgt_ps(ay, largest);
+			index = _mm_blendv_ps(index, _mm_castsi128_ps(_mm_set1_epi32(1)), greater);
+			largest = _mm_blendv_ps(largest, ay, greater);
+			largest_value = _mm_blendv_ps(largest_value, y, greater);
+			greater = _mm_cmpgt_ps(az, largest);
+			index = _mm_blendv_ps(index, _mm_castsi128_ps(_mm_set1_epi32(2)), greater);
+			largest = _mm_blendv_ps(largest, az, greater);
+			largest_value = _mm_blendv_ps(largest_value, z, greater);
+			greater = _mm_cmpgt_ps(aw, largest);
+			index = _mm_blendv_ps(index, _mm_castsi128_ps(_mm_set1_epi32(3)), greater);
+			largest_value = _mm_blendv_ps(largest_value, w, greater);
+			
+			auto s = _mm_div_ps(_mm_blendv_ps(one, minus_one, _mm_cmplt_ps(largest_value, zero)), length);
+			auto indices = _mm_castps_si128(index);
+			auto a = _mm_blendv_ps(x, y, _mm_castsi128_ps(_mm_cmpeq_epi32(indices, _mm_setzero_si128())));
+			auto b = _mm_blendv_ps(y, z, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(2), indices)));
+			auto c = _mm_blendv_ps(z, w, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(3), indices)));
+			
+			auto qa = quantizeComponentsSse4(_mm_mul_ps(a, s), vnegative, vrange, vscale, half);
+			auto qb = quantizeComponentsSse4(_mm_mul_ps(b, s), vnegative, vrange, vscale, half);
+			auto qc = quantizeComponentsSse4(_mm_mul_ps(c, s), vnegative, vrange, vscale, half);
+			auto packed = _mm_or_si128(_mm_or_si128(indices, _mm_sll_epi32(qa, shift_a)),
+				_mm_or_si128(_mm_sll_epi32(qb, shift_b), _mm_sll_epi32(qc, shift_c)));
+			_mm_storeu_si128((__m128i*)(out + i), packed);
+		}
+		quantizeQuaternionsScalar(values + i, count - i, bits, out + i);
+	}
+	
+	// Eight quaternions a pass. The transpose leaves them in the order 0 2 4 6 1 3 5 7, which the
+	// final permute undoes.
+	__attribute__((target("avx2")))
+	static void quantizeQuaternionsAvx2(const Quaternion* values, size_t count, unsigned int bits,
+			unsigned int* out) {
+		const float range = (float)M_SQRT1_2;
+		auto vrange = _mm256_set1_ps(range), vnegative = _mm256_set1_ps(-range);
+		auto vscale = _mm256_set1_ps((float)bitMask(bits) / (2 * range)), half = _mm256_set1_ps(0.5f);
+		auto one = _mm256_set1_ps(1), minus_one = _mm256_set1_ps(-1), zero = _mm256_setzero_ps();
+		auto sign = _mm256_set1_ps(-0.0f);
+		auto shift_a = _mm_cvtsi32_si128(2), shift_b = _mm_cvtsi32_si128(2 + bits);
+		auto shift_c = _mm_cvtsi32_si128(2 + 2 * bits);
+		auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8) {
+			const float* p = &values[i].x;
+			auto r0 = _mm256_loadu_ps(p), r1 = _mm256_loadu_ps(p + 8);
+			auto r2 = _mm256_loadu_ps(p + 16), r3 = _mm256_loadu_ps(p + 24);
+			auto t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+			auto t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+			auto x = _mm256_shuffle_ps(t0, t2, 0x44), y = _mm256_shuffle_ps(t0, t2, 0xEE);
+			auto z = _mm256_shuffle_ps(t1, t3, 0x44), w = _mm256_shuffle_ps(t1, t3, 0xEE);
+			
+			auto length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x),
+				_mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)), _mm256_mul_ps(w, w)));
+			auto empty = _mm256_cmp_ps(length, zero, _CMP_NGT_UQ);
+			w = _mm256_blendv_ps(w, one, empty);
+			length = _mm256_blendv_ps(length, one, empty);
+			
+			auto index = _mm256_setzero_ps(); // integer lanes, kept as floats for blendv
+			auto largest = _mm256_andnot_ps(sign, x), largest_value = x;
+			auto ay = _mm256_andnot_ps(sign, y), az = _mm256_andnot_ps(sign, z), aw = _mm256_andnot_ps(sign, w);
+			auto greater = _mm256_cmp_ps(ay, largest, _CMP_GT_OQ);
+			index = _mm256_blendv_ps(index, _mm256_castsi256_ps(_mm256_set1_epi32(1)), greater);
+			largest = _mm256_blendv_ps(largest, ay, greater);
+			largest_value = _mm256_blendv_ps(largest_value, y, greater);
+			greater = _mm256_cmp_ps(az, largest, _CMP_GT_OQ);
+			index = _mm256_blendv_ps(index, _mm256_castsi256_ps(_mm256_set1_epi32(2)), greater);
+			largest = _mm256_blendv_ps(largest, az, greater);
+			largest_value = _mm256_blendv_ps(largest_value, z, greater);
+			greater = _mm256_cmp_ps(aw, largest, _CMP_GT_OQ);
+			index = _mm256_blendv_ps(index, _mm256_castsi256_ps(_mm256_set1_epi32(3)), greater);
+			largest_value = _mm256_blendv_ps(largest_value, w, greater);
+			
+			auto s = _mm256_div_ps(_mm256_blendv_ps(one, minus_one, _mm256_cmp_ps(largest_value, zero, _CMP_LT_OQ)),
+				length);
+			auto indices = _mm256_castps_si256(index);
+			auto a = _mm256_blendv_ps(x, y, _mm256_castsi256_ps(_mm256_cmpeq_epi32(indices, _mm256_setzero_si256())));
+			auto b = _mm256_blendv_ps(y, z, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(2), indices)));
+			auto c = _mm256_blendv_ps(z, w, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(3), indices)));
+			
+			auto qa = quantizeComponentsAvx2(_mm256_mul_ps(a, s), vnegative, vrange, vscale, half);
+			auto qb = quantizeComponentsAvx2(_mm256_mul_ps(b, s), vnegative, vrange, vscale, half);
+			auto qc = quantizeComponentsAvx2(_mm256_mul_ps(c, s), vnegative, vrange, vscale, half);
+			auto packed = _mm256_or_si256(_mm256_or_si256(indices, _mm256_sll_epi32(qa, shift_a)),
+				_mm256_or_si256(_mm256_sll_epi32(qb, shift_b), _mm256_sll_epi32(qc, shift_c)));
+			_mm256_storeu_si256((__m256i*)(out + i), _mm256_permutevar8x32_epi32(packed, order));
+		}
+		quantizeQuaternionsScalar(values + i, count - i, bits, out + i);
+	}
+	
+	__attribute__((target("sse4.1")))
+	static void xorBuffersSse4(const char* a, const char* b, char* out, size_t length) {
+		size_t i = 0;
+		for(; i + 16 <= length; i += 16) {
+			auto v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+			_mm_storeu_si128((__m128i*)(out + i), v);
+		}
+		xorBuffersScalar(a + i, b + i, out + i, length - i);
+	}
+	
+	__attribute__((target("avx2")))
+	static void xorBuffersAvx2(const char* a, const char* b, char* out, size_t length) {
+		size_t i = 0;
+		for(; i + 32 <= length; i += 32) {
+			auto v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+				_mm256_loadu_si256((const __m256i*)(b + i)));
+			_mm256_storeu_si256((__m256i*)(out + i), v);
+		}
+		xorBuffersScalar(a + i, b + i, out + i, length - i);
+	}
+	
+	__attribute__((target("sse4.1")))
+	static size_t firstDifferenceSse4(const char* a, const char* b, size_t length) {
+		size_t i = 0;
+		for(; i + 16 <= length; i += 16) {
+			auto equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+			unsigned int mask = _mm_movemask_epi8(equal);
+			if(mask != 0xFFFF)
+				return i + std::countr_zero(~mask);
+		}
+		return i + firstDifferenceScalar(a + i, b + i, length - i);
+	}
+	
+	__attribute__((target("avx2")))
+	static size_t firstDifferenceAvx2(const char* a, const char* b, size_t length) {
+		size_t i = 0;
+		for(; i + 32 <= length; i += 32) {
+			auto equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)),
+				_mm256_loadu_si256((const __m256i*)(b + i)));
+			unsigned int mask = _mm256_movemask_epi8(equal);
+			if(mask != 0xFFFFFFFF)
+				return i + std::countr_zero(~mask);
+		}
+		return i + firstDifferenceScalar(a + i, b + i, length - i);
+	}
+	
+	__attribute__((target("sse4.1")))
+	static size_t firstNonZeroSse4(const unsigned long long* words, size_t count) {
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4) {
+			auto v = _mm_or_si128(_mm_loadu_si128((const __m128i*)(words + i)), _mm_loadu_si128((const __m128i*)(words + i + 2)));
+			if(!_mm_testz_si128(v, v))
+				break;
+		}
+		return i + firstNonZeroScalar(words + i, count - i);
+	}
+	
+	__attribute__((target("avx2")))
+	static size_t firstNonZeroAvx2(const unsigned long long* words, size_t count) {
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8) {
+			auto v = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(words + i)),
+				_mm256_loadu_si256((const __m256i*)(words + i + 4)));
+			if(!_mm256_testz_si256(v, v))
+				break;
+		}
+		return i + firstNonZeroScalar(words + i, count - i);
+	}
+#endif
+	
+	void quantizeFloats(const float* values, size_t count, const Quantization &quantization, unsigned int* out) {
+		if(quantization.bits > 24) {
+			for(size_t i=0; i<count; i++)
+				out[i] = quantization.quantize(values[i]);
+			return;
+		}
+		float scale = quantizationScale(quantization);
+		switch(simd_level) {
+#ifdef RAZOR_SIMD_X86
+			case SIMD_AVX2:
+				return quantizeFloatsAvx2(values, count, quantization.min, quantization.max, scale, out);
+			case SIMD_SSE4:
+				return quantizeFloatsSse4(values, count, quantization.min, quantization.max, scale, out);
+#endif
+			default:
+				return quantizeFloatsScalar(values, count, quantization.min, quantization.max, scale, out);
+		}
+	}
+	
+	void quantizeQuaternions(const Quaternion* values, size_t count, unsigned int component_bits, unsigned int* out) {
+		switch(simd_level) {
+#ifdef RAZOR_SIMD_X86
+			case SIMD_AVX2:
+				return quantizeQuaternionsAvx2(values, count, component_bits, out);
+			case SIMD_SSE4:
+				return quantizeQuaternionsSse4(values, count, component_bits, out);
+#endif
+			default:
+				return quantizeQuaternionsScalar(values, count, component_bits, out);
+		}
+	}
+	
+	void xorBuffers(const char* a, const char* b, char* out, size_t length) {
+		switch(simd_level) {
+#ifdef RAZOR_SIMD_X86
+			case SIMD_AVX2:
+				return xorBuffersAvx2(a, b, out, length);
+			case SIMD_SSE4:
+				return xorBuffersSse4(a, b, out, length);
+#endif
+			default:
+				return xorBuffersScalar(a, b, out, length);
+		}
+	}
+	
+	size_t firstDifference(const char* a, const char* b, size_t length) {
+		switch(simd_level) {
+#ifdef RAZOR_SIMD_X86
+			case SIMD_AVX2:
+				return firstDifferenceAvx2(a, b, length);
+			case SIMD_SSE4:
+				return firstDifferenceSse4(a, b, length);
+#endif
+			default:
+				return firstDifferenceScalar(a, b, length);
+		}
+	}
+	
+	size_t firstNonZero(const unsigned long long* words, size_t count) {
+		switch(simd_level) {
+#ifdef RAZOR_SIMD_X86
+			case SIMD_AVX2:
+				return firstNonZeroAvx2(words, count);
+			case SIMD_SSE4:
+				return firstNonZeroSse4(words, count);
+#endif
+			default:
+				return firstNonZeroScalar(words, count);
+		}
+	}
+	
+	int simdUnitTest() {
+		auto detected = detectSimdLevel();
+		if(simdLevel() != detected || setSimdLevel(SIMD_AVX2) != detected) return 1;
+		
+		std::mt19937 random(45);
+		std::normal_distribution<float> normal;
+		std::vector<float> floats;
+		for(int i=0; i<1003; i++) // not a multiple of any width, to cover the tails
+			floats.push_back(normal(random) * 300);
+		std::vector<Quaternion> rotations = {{0, 0, 0, 0}, {0.5f, 0.5f, 0.5f, 0.5f}, {0, 0, -1, 0}, {0.1f, -0.9f, 0.2f, 0.3f}};
+		for(int i=0; i<997; i++)
+			rotations.push_back({normal(random), normal(random), normal(random), normal(random)});
+		std::vector<char> a(1000), b(1000);
+		for(int i=0; i<1000; i++)
+			a[i] = b[i] = random();
+		
+		auto quantization = quantizationFor(-512, 512, 1.0f / 64);
+		std::vector<unsigned int> scalar_floats(floats.size()), scalar_rotations(rotations.size());
+		setSimdLevel(SIMD_SCALAR);
+		quantizeFloats(floats.data(), floats.size(), quantization, scalar_floats.data());
+		quantizeQuaternions(rotations.data(), rotations.size(), 9, scalar_rotations.data());
+		for(size_t i=0; i<floats.size(); i++) {
+			if(std::abs((int)scalar_floats[i] - (int)quantization.quantize(floats[i])) > 1) return 2;
+		}
+		
+		// every level the CPU has gives the scalar kernels' results
+		for(int level=SIMD_SCALAR; level<=detected; level++) {
+			setSimdLevel((SimdLevel)level);
+			std::vector<unsigned int> quantized(floats.size()), packed(rotations.size());
+			quantizeFloats(floats.data(), floats.size(), quantization, quantized.data());
+			if(quantized != scalar_floats) return 3;
+			quantizeQuaternions(rotations.data(), rotations.size(), 9, packed.data());
+			if(packed != scalar_rotations) return 4;
+			
+			// from unaligned offsets and with short tails
+			std::vector<char> xored(1000);
+			xorBuffers(a.data() + 3, b.data() + 1, xored.data() + 3, 990);
+			for(int i=0; i<990; i++) {
+				if(xored[3 + i] != (char)(a[3 + i] ^ b[1 + i])) return 5;
+			}
+			if(firstDifference(a.data() + 1, b.data() + 1, 999) != 999) return 6;
+			for(size_t difference : {0, 7, 15, 16, 31, 32, 500, 998}) {
+				b[1 + difference] ^= 0x40;
+				if(firstDifference(a.data() + 1, b.data() + 1, 999) != difference) return 7;
+				b[1 + difference] ^= 0x40;
+			}
+			std::vector<unsigned long long> words(77);
+			if(firstNonZero(words.data() + 1, 76) != 76) return 8;
+			for(int set : {0, 3, 4, 7, 8, 75}) {
+				words[1 + set] = 1ULL << (set % 64);
+				if(firstNonZero(words.data() + 1, 76) != (size_t)set) return 9;
+				words[1 + set] = 0;
+			}
+		}
+		
+		// a zero quaternion goes as the identity, and ties go to the first largest
+		if((scalar_rotations[0] & 3) != 3 || (scalar_rotations[1] & 3) != 0 || (scalar_rotations[2] & 3) != 2) return 10;
+		
+		setSimdLevel(detected);
+		return 0;
+	}
+}
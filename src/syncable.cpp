@@ -0,0 +1,133 @@
+#include "syncable.h"
+
+namespace razor {
+	enum TestTeam : unsigned char {
+		TEAM_RED,
+		TEAM_BLUE
+	};
+	
+	template<> struct SyncableEnumRange<TestTeam> {
+		static constexpr TestTeam min = TEAM_RED, max = TEAM_BLUE;
+	};
+	
+	struct TestWeapon {
+		unsigned short ammo;
+		bool reloading;
+		static constexpr auto syncable_fields = std::make_tuple(&TestWeapon::ammo, &TestWeapon::reloading);
+	};
+	
+	struct TestPlayer {
+		int id;
+		float health;
+		TestTeam team;
+		Vector3 position;
+		Quaternion rotation;
+		std::array<TestWeapon, 2> weapons;
+		int not_synced;
+		static constexpr auto syncable_fields = std::make_tuple(&TestPlayer::id, &TestPlayer::health,
+			&TestPlayer::team, &TestPlayer::position, &TestPlayer::rotation, &TestPlayer::weapons);
+	};
+	
+	struct TestNamedPlayer {
+		TestPlayer player;
+		std::string name;
+		static constexpr auto syncable_fields = std::make_tuple(&TestNamedPlayer::player, &TestNamedPlayer::name);
+	};
+	
+	int syncableUnitTest() {
+		// sizes of all fixed fields are known at compile time
+		static_assert(syncableFixed<TestPlayer>() && !syncableFixed<TestNamedPlayer>());
+		static_assert(syncableSize<TestPlayer>() == 4 + 4 + 1 + 12 + 16 + 2 * 3);
+		static_assert(syncableFieldCount<TestNamedPlayer>() == 2);
+		
+		TestPlayer player = {7, 87.5f, TEAM_BLUE, {1, 2, 3}, {0, 0, 0, 1}, {{{30, false}, {5, true}}}, 99};
+		std::string stream;
+		BufferWriter<> out(&stream);
+		encode(player, out);
+		out.finish();
+		if(stream.size() != syncableSize<TestPlayer>() || encodedSize(player) != stream.size()) return 1;
+		
+		// the same bytes as the hand-written copyIn sequence
+		char manual[64];
+		unsigned int p = 0;
+		p += copyIn(manual, p, player.id);
+		p += copyIn(manual, p, player.health);
+		p += copyIn(manual, p, player.team);
+		p += copyIn(manual, p, player.position);
+		p += copyIn(manual, p, player.rotation);
+		for(auto &weapon : player.weapons) {
+			p += copyIn(manual, p, weapon.ammo);
+			p += copyIn(manual, p, weapon.reloading);
+		}
+		if(p != stream.size() || std::memcmp(manual, stream.data(), p) != 0) return 2;
+		
+		TestPlayer decoded = {};
+		BufferReader<> in(stream);
+		decode(&decoded, in);
+		if(decoded.id != 7 || decoded.health != 87.5f || decoded.team != TEAM_BLUE || decoded.position.z != 3 ||
+				decoded.weapons[1].ammo != 5 || !decoded.weapons[1].reloading || decoded.not_synced != 0) return 3;
+		if(diffFields(player, decoded) != 0 || hashSyncable(player) != hashSyncable(decoded)) return 4;
+		
+		// deltas carry only the changed fields
+		TestNamedPlayer named = {player, "Razor"};
+		TestNamedPlayer reference = named;
+		named.player.health = 50;
+		named.name = "Razor the second";
+		if(diffFields(named.player, reference.player) != 1 << 1 || diffFields(named, reference) != 3) return 5;
+		if(hashSyncable(named) == hashSyncable(reference)) return 6;
+		std::string delta;
+		BufferWriter<> delta_out(&delta);
+		named.player.health = 87.5f; // only the name differs now
+		encodeDelta(named, reference, delta_out);
+		delta_out.finish();
+		if(delta.size() != 1 + SyncableField<std::string>::encodedSize(named.name)) return 7;
+		TestNamedPlayer applied = reference;
+		BufferReader<> delta_in(delta);
+		if(decodeDelta(&applied, delta_in) != 1 << 1 || applied.name != named.name || diffFields(applied, named) != 0) return 8;
+		
+		// strings round trip, and short data throws
+		stream.clear();
+		BufferWriter<> named_out(&stream);
+		encode(named, named_out);
+		named_out.finish();
+		if(stream.size() != encodedSize(named)) return 9;
+		TestNamedPlayer named_decoded;
+		BufferReader<> named_in(stream);
+		decode(&named_decoded, named_in);
+		if(diffFields(named, named_decoded) != 0) return 10;
+		BufferReader<> short_in(std::string_view(stream.data(), syncableSize<TestPlayer>() - 1));
+		try {
+			decode(&named_decoded, short_in);
+			return 11;
+		} catch(std::range_error &e) {}
+		
+		// a delta naming fields the struct doesn't have is rejected
+		std::string bad_delta;
+		BufferWriter<> bad_out(&bad_delta);
+		bad_out.writeVarint(1ULL << 5);
+		bad_out.finish();
+		BufferReader<> bad_in(bad_delta);
+		try {
+			decodeDelta(&applied, bad_in);
+			return 12;
+		} catch(std::range_error &e) {}
+		
+		// bools other than 0 or 1, and enums outside their range, are rejected
+		std::string valid;
+		BufferWriter<> valid_out(&valid);
+		encode(player, valid_out);
+		valid_out.finish();
+		size_t team_offset = 4 + 4, reloading_offset = team_offset + 1 + 12 + 16 + 2;
+		for(size_t offset : {team_offset, reloading_offset}) {
+			std::string invalid = valid;
+			invalid[offset] = 2;
+			BufferReader<> invalid_in(invalid);
+			try {
+				decode(&decoded, invalid_in);
+				return 13;
+			} catch(std::range_error &e) {}
+		}
+		
+		return 0;
+	}
+}
@@ -0,0 +1,241 @@
+#include "timingwheel.h"
+
+namespace razor {
+	TimingWheel::TimingWheel(nanotime now, nanotime resolution) {
+		this->resolution = resolution;
+		this->clear(now);
+	}
+	
+	// Timers are kept, freed with their generations, so handles from before stay stale
+	void TimingWheel::clear(nanotime now) {
+		this->free_timers.clear();
+		for(int i=this->timers.size()-1; i>=0; i--) {
+			auto &t = this->timers[i];
+			if(t.slot != -1) {
+				t.slot = -1;
+				t.generation++;
+			}
+			this->free_timers.push_back(i);
+		}
+		this->slots.assign(TIMING_WHEEL_LEVELS * TIMING_WHEEL_SLOTS, -1);
+		this->current = now / this->resolution;
+		this->active = 0;
+		this->active_level0 = 0;
+	}
+	
+	// handles hold the timer's generation in the upper 32 bits, so stale handles are rejected
+	int TimingWheel::find(timerhandle handle) {
+		unsigned int index = handle & 0xFFFFFFFF;
+		if(index >= this->timers.size())
+			return -1;
+		auto &t = this->timers[index];
+		if(t.slot == -1 || t.generation != (handle >> 32))
+			return -1;
+		return index;
+	}
+	
+	void TimingWheel::link(int index) {
+		auto &t = this->timers[index];
+		if(t.expires < this->current)
+			t.expires = this->current;
+		
+		ticktype delta = t.expires - this->current;
+		int level = 0;
+		while(level < TIMING_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMING_WHEEL_BITS * (level + 1))))
+			level++;
+		// beyond the top level's span, wait in its furthest slot and be cascaded again from there
+		ticktype position = std::min(t.expires,
+			this->current + (1ULL << (TIMING_WHEEL_BITS * TIMING_WHEEL_LEVELS)) - 1);
+		t.slot = level * TIMING_WHEEL_SLOTS + ((position >> (TIMING_WHEEL_BITS * level)) & (TIMING_WHEEL_SLOTS - 1));
+		if(level == 0)
+			this->active_level0++;
+		
+		t.prev = -1;
+		t.next = this->slots[t.slot];
+		if(t.next != -1)
+			this->timers[t.next].prev = index;
+		this->slots[t.slot] = index;
+	}
+	
+	void TimingWheel::unlink(int index) {
+		auto &t = this->timers[index];
+		if(t.prev != -1) {
+			this->timers[t.prev].next = t.next;
+		} else {
+			this->slots[t.slot] = t.next;
+		}
+		if(t.next != -1)
+			this->timers[t.next].prev = t.prev;
+		if(t.slot < TIMING_WHEEL_SLOTS)
+			this->active_level0--;
+	}
+	
+	void TimingWheel::release(int index) {
+		auto &t = this->timers[index];
+		t.slot = -1;
+		t.generation++;
+		this->free_timers.push_back(index);
+		this->active--;
+	}
+	
+	timerhandle TimingWheel::schedule(nanotime when, unsigned long long data) {
+		int index;
+		if(this->free_timers.size() > 0) {
+			index = this->free_timers.back();
+			this->free_timers.pop_back();
+		} else {
+			index = this->timers.size();
+			this->timers.push_back({0, 0, 1, -1, -1, -1});
+		}
+		auto &t = this->timers[index];
+		t.data = data;
+		// the current step's slot has already fired
+		t.expires = std::max(when / this->resolution, this->current + 1);
+		this->link(index);
+		this->active++;
+		return ((timerhandle)t.generation << 32) | index;
+	}
+	
+	bool TimingWheel::reschedule(timerhandle handle, nanotime when) {
+		int index = this->find(handle);
+		if(index == -1)
+			return false;
+		this->unlink(index);
+		this->timers[index].expires = std::max(when / this->resolution, this->current + 1);
+		this->link(index);
+		return true;
+	}
+	
+	bool TimingWheel::cancel(timerhandle handle) {
+		int index = this->find(handle);
+		if(index == -1)
+			return false;
+		this->unlink(index);
+		this->release(index);
+		return true;
+	}
+	
+	bool TimingWheel::pending(timerhandle handle) {
+		return this->find(handle) != -1;
+	}
+	
+	unsigned int TimingWheel::size() {
+		return this->active;
+	}
+	
+	// re-links a higher level slot's timers, which now fall into lower levels
+	void TimingWheel::cascade(int level, unsigned int slot) {
+		int index = this->slots[level * TIMING_WHEEL_SLOTS + slot];
+		this->slots[level * TIMING_WHEEL_SLOTS + slot] = -1;
+		while(index != -1) {
+			int next = this->timers[index].next;
+			this->link(index);
+			index = next;
+		}
+	}
+	
+	void TimingWheel::advance(nanotime now, std::vector<unsigned long long>* expired) {
+		ticktype target = now / this->resolution;
+		while(this->current < target) {
+			// nothing to fire, so skip straight to now
+			if(this->active == 0) {
+				this->current = target;
+				break;
+			}
+			// with level 0 empty nothing fires before it next wraps
+			if(this->active_level0 == 0) {
+				this->current = std::min(target, this->current | (TIMING_WHEEL_SLOTS - 1));
+				if(this->current == target)
+					break;
+			}
+			
+			this->current++;
+			// a level cascades when every level below it has wrapped, highest first so its
+			// timers can fall through the lower levels' slots for this step
+			int top = 0;
+			while(top < TIMING_WHEEL_LEVELS - 1 &&
+					(this->current & ((1ULL << (TIMING_WHEEL_BITS * (top + 1))) - 1)) == 0)
+				top++;
+			for(int level=top; level>0; level--)
+				this->cascade(level, (this->current >> (TIMING_WHEEL_BITS * level)) & (TIMING_WHEEL_SLOTS - 1));
+			
+			unsigned int slot = this->current & (TIMING_WHEEL_SLOTS - 1);
+			int index = this->slots[slot];
+			this->slots[slot] = -1;
+			while(index != -1) {
+				int next = this->timers[index].next;
+				this->active_level0--;
+				expired->push_back(this->timers[index].data);
+				this->release(index);
+				index = next;
+			}
+		}
+	}
+	
+	int timingWheelUnitTest() {
+		const nanotime ms = NANOS_PER_MILLI;
+		nanotime start = 1'700'000'000ULL * NANOS_PER_SECOND;
+		TimingWheel wheel(start);
+		std::vector<unsigned long long> expired;
+		
+		// timers on every level fire at their time, in order
+		std::vector<nanotime> delays = {1, 5, 63, 64, 65, 1000, 4095, 4096, 5000, 300000, 20000000};
+		for(size_t i=0; i<delays.size(); i++)
+			wheel.schedule(start + delays[i] * ms, i);
+		if(wheel.size() != delays.size()) return 1;
+		for(size_t i=0; i<delays.size(); i++) {
+			wheel.advance(start + delays[i] * ms - 1, &expired);
+			if(expired.size() != i) return 2;
+			wheel.advance(start + delays[i] * ms, &expired);
+			if(expired.size() != i + 1 || expired.back() != i) return 3;
+		}
+		if(wheel.size() != 0) return 4;
+		
+		// cancelled and rescheduled timers
+		nanotime now = start + 20000000 * ms;
+		expired.clear();
+		auto a = wheel.schedule(now + 10 * ms, 1);
+		auto b = wheel.schedule(now + 10 * ms, 2);
+		auto c = wheel.schedule(now + 10 * ms, 3);
+		if(!wheel.cancel(b) || wheel.cancel(b) || wheel.pending(b)) return 5;
+		if(!wheel.reschedule(c, now + 5000 * ms)) return 6;
+		wheel.advance(now + 100 * ms, &expired);
+		if(expired != std::vector<unsigned long long>({1}) || wheel.pending(a)) return 7;
+		if(wheel.reschedule(a, now + 200 * ms)) return 8;
+		
+		// a freed timer's handle stays stale after its slot is reused
+		auto d = wheel.schedule(now + 200 * ms, 4);
+		if(wheel.pending(a) || !wheel.pending(d)) return 9;
+		
+		// timers scheduled in the past fire on the next advance
+		wheel.schedule(start, 5);
+		wheel.advance(now + 101 * ms, &expired);
+		if(expired.back() != 5) return 10;
+		
+		wheel.advance(now + 5000 * ms, &expired);
+		if(expired.size() != 4 || expired[2] != 4 || expired[3] != 3 || wheel.size() != 0) return 11;
+		
+		// thousands of timers, each firing exactly once
+		expired.clear();
+		for(unsigned int i=0; i<5000; i++)
+			wheel.schedule(now + 5000 * ms + (i * 7919 % 10000) * ms, i);
+		for(nanotime t=now+5000*ms; t<=now+16000*ms; t+=16*ms)
+			wheel.advance(t, &expired);
+		if(expired.size() != 5000) return 12;
+		std::vector<bool> seen(5000, false);
+		for(auto i : expired) {
+			if(seen[i]) return 13;
+			seen[i] = true;
+		}
+		
+		// handles from before a clear don't match timers scheduled after it
+		TimingWheel cleared_wheel(start);
+		auto cleared = cleared_wheel.schedule(start + 10 * ms, 6);
+		cleared_wheel.clear(start);
+		auto after = cleared_wheel.schedule(start + 10 * ms, 7);
+		if(cleared_wheel.pending(cleared) || cleared_wheel.cancel(cleared) || !cleared_wheel.pending(after) ||
+				cleared_wheel.size() != 1) return 14;
+		
+		return 0;
+	}
+}
@@ -1,9 +0,0 @@
-module;
-
-export module razor.datatypes;
-
-export namespace razor {
-	int datatypesUnitTest() {
-		return 0;
-	}
-}
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include <chrono>
+#include <random>
+
+#include "razor.h"
+
+// Times encoding entity transforms one at a time and in batches at each SIMD level the CPU has.
+// Build the library with `make release` first for meaningful numbers.
+
+static const int ENTITIES = 10000;
+static const int ROUNDS = 200;
+
+template<class F> double nanosPerEntity(F encode) {
+	encode(); // warm up
+	auto start = std::chrono::steady_clock::now();
+	for(int round=0; round<ROUNDS; round++)
+		encode();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / ROUNDS / ENTITIES;
+}
+
+int main(int argc, char *argv[])
+{
+	std::mt19937 random(1);
+	std::normal_distribution<float> normal;
+	std::vector<razor::Vector3> positions;
+	std::vector<razor::Quaternion> rotations;
+	for(int i=0; i<ENTITIES; i++) {
+		positions.push_back({normal(random) * 200, normal(random) * 200, normal(random) * 20});
+		rotations.push_back({normal(random), normal(random), normal(random), normal(random)});
+	}
+	auto quantization = razor::quantizationFor(-512, 512, 1.0f / 64);
+	std::string stream;
+	
+	const char* level_names[] = {"scalar", "SSE4", "AVX2"};
+	std::cout << "==Razor Benchmarks==" << std::endl;
+	std::cout << ENTITIES << " entities, position and rotation, " << ROUNDS << " rounds" << std::endl;
+	
+	auto single = nanosPerEntity([&]() {
+		stream.clear();
+		razor::BitWriter out(&stream);
+		for(int i=0; i<ENTITIES; i++) {
+			razor::writeVector3(out, positions[i], quantization);
+			razor::writeQuaternion(out, rotations[i]);
+		}
+		out.finish();
+	});
+	std::cout << "One at a time: " << single << " ns per entity" << std::endl;
+	
+	auto detected = razor::detectSimdLevel();
+	for(int level=razor::SIMD_SCALAR; level<=detected; level++) {
+		razor::setSimdLevel((razor::SimdLevel)level);
+		auto batch = nanosPerEntity([&]() {
+			stream.clear();
+			razor::BitWriter out(&stream);
+			razor::encodePositions(positions, quantization, out);
+			razor::encodeQuaternions(rotations, out);
+			out.finish();
+		});
+		std::cout << "Batch, " << level_names[level] << ": " << batch << " ns per entity" << std::endl;
+	}
+	
+	// XOR and compare of two 1 MB state buffers
+	std::string a(1024 * 1024, 'a'), b = a, xored(a.size(), 0);
+	for(int level=razor::SIMD_SCALAR; level<=detected; level++) {
+		razor::setSimdLevel((razor::SimdLevel)level);
+		auto start = std::chrono::steady_clock::now();
+		size_t same = 0;
+		for(int round=0; round<ROUNDS; round++) {
+			razor::xorBuffers(a.data(), b.data(), xored.data(), a.size());
+			same += razor::firstDifference(a.data(), b.data(), a.size());
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "XOR and compare, " << level_names[level] << ": "
+			<< 2.0 * a.size() * ROUNDS / elapsed.count() / 1e9 << " GB/s" << (same == 0 ? " ?" : "") << std::endl;
+	}
+	
+	// Delta of a 1 MB state with a changed byte every 4 KB, and applying it
+	for(size_t i=0; i<b.size(); i += 4096)
+		b[i] ^= 1;
+	std::string delta, patched;
+	for(int level=razor::SIMD_SCALAR; level<=detected; level++) {
+		razor::setSimdLevel((razor::SimdLevel)level);
+		auto start = std::chrono::steady_clock::now();
+		for(int round=0; round<ROUNDS; round++)
+			razor::diffState(a, b, &delta);
+		auto middle = std::chrono::steady_clock::now();
+		for(int round=0; round<ROUNDS; round++)
+			razor::patchState(a, delta, &patched);
+		std::chrono::duration<double> diff = middle - start, patch = std::chrono::steady_clock::now() - middle;
+		std::cout << "Delta diff and patch, " << level_names[level] << ": "
+			<< 1.0 * a.size() * ROUNDS / diff.count() / 1e9 << " and "
+			<< 1.0 * a.size() * ROUNDS / patch.count() / 1e9 << " GB/s, " << delta.size() << " bytes"
+			<< (patched != b ? " ?" : "") << std::endl;
+	}
+	
+	// Compression of 100 KB of entity records, mostly zeroes, repeated floats and small ints
+	std::string state, compressed, decompressed;
+	razor::BufferWriter<> state_out(&state);
+	for(int i=0; state.size() < 100 * 1024; i++) {
+		state_out.write(i);
+		state_out.write(i % 4 == 0 ? normal(random) * 100 : 0.0f);
+		state_out.write(1.0f);
+		state_out.write((unsigned short)(i % 8));
+		state_out.write(0ULL);
+		state_out.finish();
+	}
+	auto start = std::chrono::steady_clock::now();
+	for(int round=0; round<ROUNDS; round++)
+		razor::compress(state, &compressed);
+	auto middle = std::chrono::steady_clock::now();
+	for(int round=0; round<ROUNDS; round++)
+		razor::decompress(compressed, state.size(), &decompressed);
+	std::chrono::duration<double, std::micro> compress_time = middle - start,
+		decompress_time = std::chrono::steady_clock::now() - middle;
+	std::cout << "Compress 100 KB: " << compress_time.count() / ROUNDS << " us, "
+		<< (double)state.size() / compressed.size() << "x. Decompress: " << decompress_time.count() / ROUNDS << " us"
+		<< (decompressed != state ? " ?" : "") << std::endl;
+	
+	return 0;
+}
@@ -12,6 +12,48 @@ int main(int argc, char *argv[])
 			std::string("Failed ").append(std::to_string(result))
 		) << std::endl;
 
+	result = razor::datatypesUnitTest();
+	std::cout << "Datatypes: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+
+	result = razor::simdUnitTest();
+	std::cout << "SIMD: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+
+	result = razor::syncableUnitTest();
+	std::cout << "Syncable: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+
+	result = razor::compressionUnitTest();
+	std::cout << "Compression: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+
+	result = razor::deltaUnitTest();
+	std::cout << "Delta: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+
+	result = razor::entityStoreUnitTest();
+	std::cout << "Entity store: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+
 	result = razor::networkingUnitTest();
 	std::cout << "Networking: " << (
 			result==0 ? 
@@ -19,6 +61,55 @@ int main(int argc, char *argv[])
 			std::string("Failed ").append(std::to_string(result))
 		) << std::endl;
 	
+	result = razor::commandsUnitTest();
+	std::cout << "Commands: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+	
+	result = razor::merkleUnitTest();
+	std::cout << "Merkle: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+	
+	result = razor::interestUnitTest();
+	std::cout << "Interest: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+	
+	result = razor::clockSyncUnitTest();
+	std::cout << "Clock sync: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+	
+	result = razor::timingWheelUnitTest();
+	std::cout << "Timing wheel: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+	
+	result = razor::historyUnitTest();
+	std::cout << "History: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+	
+	result = razor::interpolationUnitTest();
+	std::cout << "Interpolation: " << (
+			result==0 ? 
+			"Passed" : 
+			std::string("Failed ").append(std::to_string(result))
+		) << std::endl;
+	
 	result = razor::razorUnitTest();
 	std::cout << "Razor: " << (
 			result==0 ? 